@@ -0,0 +1,117 @@
+#!/bin/bash
+# Benchmark type-ahead queries: prefix queries vs prefix indexes vs edge n-grams
+#
+# Usage: ./scripts/benchmark_autocomplete.sh [library] [documents]
+#
+# Indexes the same generated corpus three times:
+#   prefix-scan   tokenize='<name>', keystrokes queried as MATCH 'ab*'
+#   prefix-index  tokenize='<name>' prefix='2 3 4 5', queried as MATCH 'ab*'
+#   edge-ngram    tokenize='<name> edge_ngram_max 5', queried as MATCH 'ab'
+# and replays the keystrokes of typing the first five characters of sampled
+# words, reporting build time, index size and the average query latency.
+
+LIBRARY="${1:-./build/libfts5_icu.so}"
+DOCUMENTS="${2:-50000}"
+SQLITE3="${SQLITE3:-sqlite3}"
+
+if [ ! -f "$LIBRARY" ]; then
+    echo "Error: $LIBRARY not found. Build the project first."
+    exit 1
+fi
+
+if ! command -v "$SQLITE3" &> /dev/null; then
+    echo "Error: sqlite3 is not installed"
+    exit 1
+fi
+
+# Tokenizer name registered by the library: libfts5_icu_ru.so -> icu_ru
+TOKENIZER="$(basename "$LIBRARY" .so)"
+TOKENIZER="icu${TOKENIZER#libfts5_icu}"
+
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# Build the corpus once: every document is twelve of 100000 words assembled
+# from Latin, accented and Cyrillic syllables, and every keystroke query is a
+# prefix of one of the words
+"$SQLITE3" "$WORK_DIR/corpus.db" <<EOF
+CREATE TABLE syllables(id INTEGER PRIMARY KEY, body TEXT);
+INSERT INTO syllables(body) VALUES
+  ('ka'), ('lo'), ('mi'), ('ne'), ('ra'), ('su'), ('te'), ('vo'),
+  ('bri'), ('dan'), ('fel'), ('gor'), ('hum'), ('jas'), ('pel'), ('tor'),
+  ('Кра'), ('Мо'), ('Пе'), ('Сви'), ('Ша'), ('Éco'), ('Über'), ('Ñan');
+CREATE TABLE words(id INTEGER PRIMARY KEY, body TEXT);
+INSERT INTO words(id, body)
+  SELECT g.value, a.body || b.body || c.body || d.body
+    FROM generate_series(0, 99999) AS g
+    JOIN syllables AS a ON a.id = 1 + g.value % 24
+    JOIN syllables AS b ON b.id = 1 + (g.value / 24) % 24
+    JOIN syllables AS c ON c.id = 1 + (g.value / 576) % 24
+    JOIN syllables AS d ON d.id = 1 + (g.value / 13824) % 24;
+CREATE TABLE corpus(id INTEGER PRIMARY KEY, body TEXT);
+INSERT INTO corpus(id, body)
+  SELECT g.value, group_concat(w.body, ' ')
+    FROM generate_series(1, $DOCUMENTS) AS g
+    JOIN generate_series(1, 12) AS n
+    JOIN words AS w ON w.id = (g.value * 7919 + n.value * 104729) % 100000
+   GROUP BY g.value;
+CREATE TABLE keystrokes(id INTEGER PRIMARY KEY, prefix TEXT);
+INSERT INTO keystrokes(prefix)
+  SELECT substr(w.body, 1, n.value)
+    FROM words AS w JOIN generate_series(2, 5) AS n
+   WHERE w.id % 500 = 0;
+EOF
+
+QUERIES=$("$SQLITE3" "$WORK_DIR/corpus.db" "SELECT count(*) FROM keystrokes")
+echo "Tokenizer: $TOKENIZER ($LIBRARY)"
+echo "Corpus:    $DOCUMENTS documents, $QUERIES keystroke queries"
+echo ""
+printf "%-14s %10s %14s %10s %10s %12s\n" "mode" "build s" "index bytes" "query s" "us/query" \
+    "matches"
+
+for MODE in prefix-scan prefix-index edge-ngram; do
+    case "$MODE" in
+        prefix-scan)
+            OPTIONS="tokenize='$TOKENIZER'"
+            QUERY="k.prefix || '*'" ;;
+        prefix-index)
+            OPTIONS="tokenize='$TOKENIZER', prefix='2 3 4 5'"
+            QUERY="k.prefix || '*'" ;;
+        edge-ngram)
+            OPTIONS="tokenize='$TOKENIZER edge_ngram_max 5'"
+            QUERY="k.prefix" ;;
+    esac
+
+    DB="$WORK_DIR/$MODE.db"
+    cp "$WORK_DIR/corpus.db" "$DB"
+
+    START=$(date +%s.%N)
+    "$SQLITE3" "$DB" <<EOF
+.load $LIBRARY
+CREATE VIRTUAL TABLE documents USING fts5(body, content='corpus', content_rowid='id', $OPTIONS);
+INSERT INTO documents(documents) VALUES ('rebuild');
+EOF
+    END=$(date +%s.%N)
+
+    INDEX_BYTES=$("$SQLITE3" "$DB" "SELECT sum(length(block)) FROM documents_data")
+
+    # Every keystroke fetches the first ten matches, as an autocomplete box
+    # would; the total number of rows returned must agree between the modes
+    QUERY_START=$(date +%s.%N)
+    MATCHES=$("$SQLITE3" "$DB" <<EOF
+.load $LIBRARY
+SELECT sum((SELECT count(*) FROM (SELECT rowid FROM documents
+                                   WHERE documents MATCH $QUERY LIMIT 10)))
+  FROM keystrokes AS k;
+EOF
+)
+    QUERY_END=$(date +%s.%N)
+
+    awk -v mode="$MODE" -v start="$START" -v end="$END" -v qstart="$QUERY_START" \
+        -v qend="$QUERY_END" -v queries="$QUERIES" -v bytes="$INDEX_BYTES" \
+        -v matches="$MATCHES" 'BEGIN {
+        seconds = qend - qstart
+        printf "%-14s %10.2f %14d %10.2f %10.0f %12d\n", mode, end - start, bytes, seconds,
+               seconds * 1000000 / queries, matches
+    }'
+done
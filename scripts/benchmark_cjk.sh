@@ -0,0 +1,84 @@
+#!/bin/bash
+# Benchmark CJK segmentation: ICU dictionary breaking vs overlapping bigrams
+#
+# Usage: ./scripts/benchmark_cjk.sh [library] [documents]
+#
+# Indexes the same generated Chinese/Japanese corpus once with
+# tokenize='<name> cjk dictionary' and once with tokenize='<name> cjk bigram'
+# and reports indexing time, throughput, distinct terms and index size.
+
+LIBRARY="${1:-./build/libfts5_icu.so}"
+DOCUMENTS="${2:-20000}"
+SQLITE3="${SQLITE3:-sqlite3}"
+
+if [ ! -f "$LIBRARY" ]; then
+    echo "Error: $LIBRARY not found. Build the project first."
+    exit 1
+fi
+
+if ! command -v "$SQLITE3" &> /dev/null; then
+    echo "Error: sqlite3 is not installed"
+    exit 1
+fi
+
+# Tokenizer name registered by the library: libfts5_icu_zh.so -> icu_zh
+TOKENIZER="$(basename "$LIBRARY" .so)"
+TOKENIZER="icu${TOKENIZER#libfts5_icu}"
+
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# Build the corpus once: every document is a different window over a mix of
+# Chinese and Japanese sentences, with a product name that is unlikely to be
+# in any dictionary
+"$SQLITE3" "$WORK_DIR/corpus.db" <<EOF
+CREATE TABLE sentences(id INTEGER PRIMARY KEY, body TEXT);
+INSERT INTO sentences(body) VALUES
+  ('今天天气很好，我们去公园散步吧。'),
+  ('全文检索系统需要高效的分词算法来处理中文文本。'),
+  ('数据库索引的大小直接影响查询性能和存储成本。'),
+  ('这个新产品在市场上获得了很大的成功。'),
+  ('東京で新しいスマートフォンが発売されました。'),
+  ('日本語の形態素解析は辞書に依存しています。'),
+  ('検索エンジンの性能を改善するために様々な手法を試しました。'),
+  ('明日の会議は午後三時から始まる予定です。');
+CREATE TABLE corpus(id INTEGER PRIMARY KEY, body TEXT);
+INSERT INTO corpus(id, body)
+  SELECT g.value, group_concat(s.body, '') || '型号X' || (g.value % 997) || 'プロ'
+    FROM generate_series(1, $DOCUMENTS) AS g
+    JOIN sentences AS s ON (s.id * 7 + g.value) % 8 < 4 + g.value % 5
+   GROUP BY g.value;
+EOF
+
+echo "Tokenizer: $TOKENIZER ($LIBRARY)"
+echo "Corpus:    $DOCUMENTS documents, $("$SQLITE3" "$WORK_DIR/corpus.db" \
+    "SELECT sum(length(CAST(body AS BLOB))) FROM corpus") bytes"
+echo ""
+printf "%-12s %10s %14s %12s %14s\n" "mode" "seconds" "docs/second" "terms" "index bytes"
+
+for MODE in dictionary bigram; do
+    DB="$WORK_DIR/$MODE.db"
+    cp "$WORK_DIR/corpus.db" "$DB"
+
+    START=$(date +%s.%N)
+    "$SQLITE3" "$DB" <<EOF
+.load $LIBRARY
+CREATE VIRTUAL TABLE documents USING fts5(body, content='corpus', content_rowid='id',
+                                          tokenize='$TOKENIZER cjk $MODE');
+INSERT INTO documents(documents) VALUES ('rebuild');
+EOF
+    END=$(date +%s.%N)
+
+    read -r TERMS INDEX_BYTES < <("$SQLITE3" -separator ' ' "$DB" <<EOF
+.load $LIBRARY
+CREATE VIRTUAL TABLE temp.vocab USING fts5vocab(main, documents, 'row');
+SELECT (SELECT count(*) FROM vocab), (SELECT sum(length(block)) FROM documents_data);
+EOF
+)
+
+    awk -v mode="$MODE" -v start="$START" -v end="$END" -v docs="$DOCUMENTS" \
+        -v terms="$TERMS" -v bytes="$INDEX_BYTES" 'BEGIN {
+        seconds = end - start
+        printf "%-12s %10.2f %14.0f %12d %14d\n", mode, seconds, docs / seconds, terms, bytes
+    }'
+done
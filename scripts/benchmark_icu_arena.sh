@@ -0,0 +1,106 @@
+#!/bin/bash
+# Benchmark ICU's internal allocations: default memory functions vs per-call arenas
+#
+# Usage: ./scripts/benchmark_icu_arena.sh [library] [arena library] [documents] [threads]
+#
+# The arena library is a build of the same locale configured with
+# -DFTS5_ICU_ARENA=ON, e.g.
+#   cmake -S . -B build-arena -DFTS5_ICU_ARENA=ON && cmake --build build-arena
+# Rebuilds the same generated corpus with both libraries, serially and with
+# icu_parallel_rebuild(), and reports the build times and how many of ICU's
+# allocations reached the system allocator.
+
+LIBRARY="${1:-./build/libfts5_icu.so}"
+ARENA_LIBRARY="${2:-./build-arena/libfts5_icu.so}"
+DOCUMENTS="${3:-50000}"
+THREADS="${4:-4}"
+SQLITE3="${SQLITE3:-sqlite3}"
+
+for LIB in "$LIBRARY" "$ARENA_LIBRARY"; do
+    if [ ! -f "$LIB" ]; then
+        echo "Error: $LIB not found. Build the project first."
+        exit 1
+    fi
+done
+
+if ! command -v "$SQLITE3" &> /dev/null; then
+    echo "Error: sqlite3 is not installed"
+    exit 1
+fi
+
+# Tokenizer name registered by the library: libfts5_icu_ru.so -> icu_ru
+TOKENIZER="$(basename "$LIBRARY" .so)"
+TOKENIZER="icu${TOKENIZER#libfts5_icu}"
+
+WORK_DIR="$(mktemp -d)"
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+# Build the corpus once: every document is twelve words assembled from
+# Latin, accented, Cyrillic and Greek syllables plus a CJK phrase
+"$SQLITE3" "$WORK_DIR/corpus.db" <<EOF
+CREATE TABLE syllables(id INTEGER PRIMARY KEY, body TEXT);
+INSERT INTO syllables(body) VALUES
+  ('ka'), ('lo'), ('mi'), ('ne'), ('ra'), ('su'), ('te'), ('vo'),
+  ('bri'), ('dan'), ('fel'), ('gor'), ('hum'), ('jas'), ('pel'), ('tor'),
+  ('Кра'), ('Мо'), ('Пе'), ('Сви'), ('Ша'), ('Éco'), ('Über'), ('Ñan');
+CREATE TABLE words(id INTEGER PRIMARY KEY, body TEXT);
+INSERT INTO words(id, body)
+  SELECT g.value, a.body || b.body || c.body
+    FROM generate_series(0, 13823) AS g
+    JOIN syllables AS a ON a.id = 1 + g.value % 24
+    JOIN syllables AS b ON b.id = 1 + (g.value / 24) % 24
+    JOIN syllables AS c ON c.id = 1 + (g.value / 576) % 24;
+CREATE TABLE corpus(id INTEGER PRIMARY KEY, body TEXT);
+INSERT INTO corpus(id, body)
+  SELECT g.value, group_concat(w.body, ' ') || ' 東京タワーの夜景 Ελληνικά'
+    FROM generate_series(1, $DOCUMENTS) AS g
+    JOIN generate_series(1, 12) AS n
+    JOIN words AS w ON w.id = (g.value * 7919 + n.value * 104729) % 13824
+   GROUP BY g.value;
+EOF
+
+echo "Tokenizer: $TOKENIZER"
+echo "Corpus:    $DOCUMENTS documents, $THREADS threads for the parallel rebuild"
+echo ""
+printf "%-10s %-10s %10s %16s %16s\n" "library" "rebuild" "seconds" "ICU allocations" "system allocs"
+
+for VARIANT in default arena; do
+    LIB="$LIBRARY"
+    [ "$VARIANT" = arena ] && LIB="$ARENA_LIBRARY"
+
+    for MODE in serial parallel; do
+        case "$MODE" in
+            serial)   REBUILD="INSERT INTO documents(documents) VALUES ('rebuild');" ;;
+            parallel) REBUILD="SELECT icu_parallel_rebuild('documents', $THREADS);" ;;
+        esac
+
+        DB="$WORK_DIR/$VARIANT-$MODE.db"
+        cp "$WORK_DIR/corpus.db" "$DB"
+
+        # Counters are read after the rebuild in the same process; the
+        # default build reports NULL since ICU allocates through malloc()
+        START=$(date +%s.%N)
+        STATS=$("$SQLITE3" "$DB" <<EOF
+.load $LIB
+CREATE VIRTUAL TABLE documents USING fts5(body, content='corpus', content_rowid='id',
+    tokenize='$TOKENIZER');
+$REBUILD
+SELECT coalesce(icu_arena_stats() ->> 'icu_allocations', '-') || ' ' ||
+       coalesce(icu_arena_stats() ->> 'heap_allocations', '-');
+EOF
+)
+        END=$(date +%s.%N)
+        STATS="$(echo "$STATS" | tail -n 1)"
+
+        awk -v variant="$VARIANT" -v mode="$MODE" -v start="$START" -v end="$END" \
+            -v stats="$STATS" 'BEGIN {
+            split(stats, counts, " ")
+            printf "%-10s %-10s %10.2f %16s %16s\n", variant, mode, end - start, counts[1],
+                   counts[2]
+        }'
+    done
+done
+
+echo ""
+echo "Without arenas every ICU allocation is a system allocator call; the arena"
+echo "build's ICU allocation count is therefore also the default build's count."
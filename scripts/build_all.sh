@@ -18,8 +18,9 @@ echo "Cleaning previous build artifacts..."
 make clean >/dev/null 2>&1
 rm -f libfts5_icu*.so
 
-# List of all supported locales (standard ICU codes)
-LOCALES=("ar" "el" "he" "ja" "ko" "ru" "th" "zh")
+# List of all supported locales (standard ICU codes); "all" builds
+# libfts5_icu_all.so, which registers every tokenizer from one init call
+LOCALES=("ar" "el" "he" "ja" "ko" "ru" "th" "zh" "all")
 
 # Array to store built libraries
 BUILT_LIBRARIES=()
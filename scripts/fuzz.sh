@@ -0,0 +1,58 @@
+#!/bin/bash
+# Fuzz icuTokenize() for slow and memory-hungry inputs
+#
+# Usage: ./scripts/fuzz.sh [locale] [seconds] [jobs]
+#
+# Builds icu_tokenize_fuzz with clang, libFuzzer and AddressSanitizer for the
+# given locale (default: the universal tokenizer) in build-fuzz[-locale]/ and
+# runs it for the given time (default 600 seconds), starting from the seed
+# corpus and the regression inputs in tests/fuzz/. New coverage is kept in
+# build-fuzz[-locale]/corpus; failing inputs are written there as crash-* or
+# slow-unit-* files and minimized into minimized-* files. A minimized input
+# that shows a real problem belongs in tests/fuzz/regressions, where
+# scripts/test_all.sh replays it on every run.
+#
+# The per-byte limits are read from FTS5_ICU_FUZZ_NS_PER_BYTE and
+# FTS5_ICU_FUZZ_BYTES_PER_BYTE (see src/icu_tokenize_fuzz.c).
+
+LOCALE="${1:-}"
+SECONDS_TO_RUN="${2:-600}"
+JOBS="${3:-1}"
+
+if ! command -v clang &> /dev/null; then
+    echo "Error: clang is required for libFuzzer"
+    exit 1
+fi
+
+BUILD_DIR="build-fuzz${LOCALE:+-$LOCALE}"
+CMAKE_ARGS=(-DFTS5_ICU_FUZZ=ON -DCMAKE_BUILD_TYPE=RelWithDebInfo)
+if [ -n "$LOCALE" ]; then
+    CMAKE_ARGS+=(-DLOCALE="$LOCALE")
+fi
+
+echo "Building icu_tokenize_fuzz in $BUILD_DIR..."
+CC=clang cmake -S . -B "$BUILD_DIR" "${CMAKE_ARGS[@]}" > /dev/null || exit 1
+cmake --build "$BUILD_DIR" --target icu_tokenize_fuzz -j"$(nproc)" || exit 1
+
+mkdir -p "$BUILD_DIR/corpus"
+cd "$BUILD_DIR" || exit 1
+
+# Inputs over 64 KiB only repeat what smaller ones find, more slowly; the
+# libFuzzer timeout catches hangs that the per-byte time limit cannot see
+echo "Fuzzing for $SECONDS_TO_RUN seconds with $JOBS job(s)..."
+./icu_tokenize_fuzz -max_total_time="$SECONDS_TO_RUN" -max_len=65536 -timeout=10 \
+    -rss_limit_mb=2048 -jobs="$JOBS" -workers="$JOBS" -artifact_prefix=./ \
+    corpus ../tests/fuzz/corpus ../tests/fuzz/regressions
+STATUS=$?
+
+for artifact in crash-* slow-unit-* oom-* timeout-*; do
+    [ -f "$artifact" ] || continue
+    echo "Minimizing $artifact..."
+    ./icu_tokenize_fuzz -minimize_crash=1 -max_total_time=60 \
+        -exact_artifact_path="minimized-$artifact" "$artifact" > /dev/null 2>&1
+done
+
+if [ "$STATUS" -ne 0 ]; then
+    echo "Failing inputs are in $BUILD_DIR"
+fi
+exit "$STATUS"
@@ -0,0 +1,69 @@
+#!/bin/bash
+# Measure multi-connection scaling and profile one phase with perf
+#
+# Usage: ./scripts/profile_concurrency.sh [library] [threads] [phase] [tokenizer options]
+#
+# Runs icu_concurrency_bench for 1, 2, 4, ... threads up to the given count
+# and writes the scaling curve to concurrency.csv. If perf is installed, it
+# then records the given phase (create, insert or match; default insert) at the
+# highest thread count and writes:
+#   concurrency.perf.txt     flat profile by symbol, lock and allocator
+#                            functions included
+#   concurrency.perf.stacks  "perf script" output for flame graph tools
+# Build with -DCMAKE_BUILD_TYPE=RelWithDebInfo for symbolized line numbers.
+
+LIBRARY="${1:-./build/libfts5_icu.so}"
+THREADS="${2:-$(nproc)}"
+PHASE="${3:-insert}"
+OPTIONS="$4"
+BENCH="${BENCH:-./build/icu_concurrency_bench}"
+
+if [ ! -f "$LIBRARY" ]; then
+    echo "Error: $LIBRARY not found. Build the project first."
+    exit 1
+fi
+
+if [ ! -x "$BENCH" ]; then
+    echo "Error: $BENCH not found. Build the project first or set BENCH."
+    exit 1
+fi
+
+COUNTS="1"
+COUNT=2
+while [ "$COUNT" -le "$THREADS" ]; do
+    COUNTS="$COUNTS,$COUNT"
+    COUNT=$((COUNT * 2))
+done
+if [ "${COUNTS##*,}" != "$THREADS" ] && [ "$THREADS" -gt 1 ]; then
+    COUNTS="$COUNTS,$THREADS"
+fi
+
+BENCH_ARGS=()
+if [ -n "$OPTIONS" ]; then
+    BENCH_ARGS+=(-o "$OPTIONS")
+fi
+
+echo "Scaling curve ($COUNTS threads):"
+"$BENCH" -t "$COUNTS" "${BENCH_ARGS[@]}" "$LIBRARY" || exit 1
+"$BENCH" -r -t "$COUNTS" "${BENCH_ARGS[@]}" "$LIBRARY" > concurrency.csv || exit 1
+echo ""
+echo "Wrote concurrency.csv"
+
+if ! command -v perf &> /dev/null; then
+    echo "perf is not installed; skipping the profile"
+    exit 0
+fi
+
+# DWARF unwinding works even where the library was built without frame
+# pointers; the thread name (comm) tells the benchmark threads apart
+echo "Profiling the $PHASE phase with $THREADS threads..."
+perf record --call-graph dwarf -o concurrency.perf.data -- \
+    "$BENCH" -p "$PHASE" -t "$THREADS" "${BENCH_ARGS[@]}" "$LIBRARY" > /dev/null || exit 1
+perf report -i concurrency.perf.data --no-children --sort dso,symbol --stdio \
+    > concurrency.perf.txt 2> /dev/null
+perf script -i concurrency.perf.data > concurrency.perf.stacks 2> /dev/null
+
+echo "Wrote concurrency.perf.txt and concurrency.perf.stacks"
+echo ""
+echo "Top symbols:"
+grep -v '^#' concurrency.perf.txt | grep -v '^$' | head -n 20
@@ -27,6 +27,73 @@ else
     echo "WARNING: Universal tokenizer library not found"
 fi
 
+# Test the extension features using the universal tokenizer
+echo ""
+echo "=================================================="
+echo "Testing extension features"
+echo "=================================================="
+
+# Define feature test cases: description, test script file
+FEATURE_TESTS=(
+    "icu_parallel_rebuild():tests/test_parallel_rebuild.sql"
+    "icu_tokenize_blob() and icu_replay:tests/test_token_blob.sql"
+    "icu_tokens():tests/test_icu_tokens.sql"
+    "object pool:tests/test_object_pool.sql"
+    "memory budget:tests/test_memory_budget.sql"
+    "CJK bigram mode:tests/test_cjk_bigram.sql"
+    "user dictionary:tests/test_user_dictionary.sql"
+    "trigram mode:tests/test_trigram.sql"
+    "edge n-grams:tests/test_edge_ngrams.sql"
+    "fuzzy matching:tests/test_fuzzy.sql"
+    "normalization cache:tests/test_normalization_cache.sql"
+    "slow document log:tests/test_slow_documents.sql"
+    "latency budget:tests/test_latency_budget.sql"
+    "custom rules:tests/test_custom_rules.sql"
+    "native forms:tests/test_native_forms.sql"
+    "canonical numbers:tests/test_canonical_numbers.sql"
+    "hashed terms:tests/test_hashed_terms.sql"
+    "sharded build:tests/test_sharded_build.sql"
+    "specialized tokenize:tests/test_specialized_tokenize.sql"
+)
+
+# The user dictionary test loads a dictionary compiled from its word list
+if [ -x "./build/icu_dict_build" ]; then
+    ./build/icu_dict_build tests/user_dictionary.txt ./build/test_user_dictionary.dict > /dev/null
+fi
+
+# The sharded build test queries shards built from a small JSONL corpus
+if [ -x "./build/icu_shard_build" ]; then
+    ./build/icu_shard_build -s 3 -i id -c body -j tests/shard_corpus.jsonl \
+        ./build/libfts5_icu.so ./build/test_shards > /dev/null
+fi
+
+for test_case in "${FEATURE_TESTS[@]}"; do
+    feature="${test_case%%:*}"
+    test_script="${test_case#*:}"
+
+    if [ -f "./build/libfts5_icu.so" ]; then
+        sqlite3 < ./$test_script
+        if [ $? -ne 0 ]; then
+            echo "ERROR: Test failed for $feature"
+        else
+            echo "SUCCESS: $feature test completed"
+        fi
+    else
+        echo "WARNING: Universal tokenizer library not found"
+    fi
+done
+
+# Replay the fuzzing seed corpus and the saved slow inputs; any input over
+# the time or memory limit per byte fails
+if [ -x "./build/icu_tokenize_fuzz" ]; then
+    ./build/icu_tokenize_fuzz tests/fuzz/corpus tests/fuzz/regressions > /dev/null
+    if [ $? -ne 0 ]; then
+        echo "ERROR: Test failed for fuzz regression inputs"
+    else
+        echo "SUCCESS: fuzz regression inputs test completed"
+    fi
+fi
+
 # Test locale-specific tokenizers
 echo ""
 echo "=================================================="
@@ -43,6 +110,7 @@ TEST_CASES=(
     "ru:tests/test_ru_tokenizer.sql"
     "th:tests/test_th_tokenizer.sql"
     "zh:tests/test_zh_tokenizer.sql"
+    "all:tests/test_all_tokenizer.sql"
 )
 
 # Test each locale
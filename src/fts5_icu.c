@@ -12,10 +12,12 @@
  *   -DTOKENIZER_LOCALE="ja"   (or "zh", "th", etc.)
  *
  * All other settings (TOKENIZER_NAME, INIT_LOCALE_SUFFIX, ICU rules)
- * are derived automatically at compile time.
+ * are derived automatically at compile time. A LOCALE=all build registers
+ * the tokenizers of every locale from one init function instead.
  */
 
 #include "fts5_icu.h"
+#include "fts5_icu_probes.h"
 
 // Define the fts5_api pointer before use - this must come after sqlite3ext.h is
 // included
@@ -33,95 +35,798 @@ static fts5_api* fts5_api_from_db(sqlite3* db) {
     return pApi;
 }
 
-// Forward declarations for v2 API
-static int icuCreate(void*, const char**, int, Fts5Tokenizer**);
-static void icuDelete(Fts5Tokenizer*);
-static int icuTokenize(Fts5Tokenizer*, void*, int, const char*, int, const char*, int,
-                       int (*)(void*, int, const char*, int, int, int));
+// ========================================================================
+// === LOCALE DESCRIPTORS =================================================
+// ========================================================================
+
+/**
+ * Tokenizers registered by the init function; the first is the default.
+ * Every built-in rule chain maps a word of ASCII letters, digits and
+ * underscores to its ASCII lowercase form, which fold_ascii_token() relies
+ * on; a chain without that property must not be added here.
+ */
+const IcuLocaleDescriptor icu_locale_descriptors[] = {
+#ifdef TOKENIZER_LOCALE_ALL
+  {"icu", "", ICU_RULE_DEFAULT},
+  {"icu_ja", "ja", ICU_RULE_JA},
+  {"icu_zh", "zh", ICU_RULE_ZH},
+  {"icu_th", "th", ICU_RULE_TH},
+  {"icu_ko", "ko", ICU_RULE_KO},
+  {"icu_ar", "ar", ICU_RULE_AR},
+  {"icu_ru", "ru", ICU_RULE_RU},
+  {"icu_he", "he", ICU_RULE_HE},
+  {"icu_el", "el", ICU_RULE_EL},
+#else
+  {TOKENIZER_NAME, TOKENIZER_LOCALE, ICU_TOKENIZER_RULES},
+#endif
+};
+
+const int icu_locale_descriptor_count =
+  (int)(sizeof(icu_locale_descriptors) / sizeof(icu_locale_descriptors[0]));
+
+/**
+ * @brief Prototype ICU objects of one descriptor
+ *
+ * Compiling the transliterator rule chain is the most expensive part of
+ * creating a tokenizer. The objects of a descriptor are therefore opened once,
+ * on the first create, and every later instance clones them. Prototypes are
+ * never used to tokenize and live as long as the process, like ICU's own data
+ * caches. All access is under the SQLITE_MUTEX_STATIC_APP2 mutex, not APP1,
+ * because object pools are created with the APP1 mutex held.
+ */
+typedef struct IcuPrototype {
+    UBreakIterator* pBreakIterator;   /**< Prototype break iterator, or NULL */
+    UTransliterator* pTransliterator; /**< Prototype transliterator, or NULL */
+} IcuPrototype;
+
+static IcuPrototype icu_prototypes[sizeof(icu_locale_descriptors) /
+                                   sizeof(icu_locale_descriptors[0])];
 
-// Main tokenizer struct for v2 API
-typedef struct IcuTokenizerV2 {
-    fts5_tokenizer_v2 fts_tokenizer_v2;  // Must be first member for v2 API
-    UBreakIterator* pBreakIterator;
-    UTransliterator* pTransliterator;
-} IcuTokenizerV2;
+/**
+ * @brief Rule chain of the native-script forms indexed with "native 1"
+ *
+ * The base normalization of every locale without any script conversion, so
+ * that a word keeps the script it was written in.
+ */
+static const char icu_native_rules[] = "NFKD; Lower; NFKC";
 
 // ========================================================================
-// === FTS5 TOKENIZER CREATION CALLBACK (xCreate) =========================
+// === TOKENIZER CONFIGURATION ============================================
 // ========================================================================
 
-static int icuCreate(void* pCtx, const char** azArg, int nArg, Fts5Tokenizer** ppOut) {
-    UNUSED_PARAMETER(pCtx);
-    UNUSED_PARAMETER(azArg);
-    UNUSED_PARAMETER(nArg);
+/**
+ * @brief Parses a boolean tokenizer option value ("0" or "1")
+ *
+ * @param value The option value
+ * @param[out] pResult Receives the parsed value
+ * @return SQLITE_OK on success, SQLITE_ERROR for any other value
+ */
+static int parse_boolean_option(const char* value, int* pResult) {
+    if (value[0] == '0' || value[0] == '1') {
+        if (value[1] == '\0') {
+            *pResult = value[0] - '0';
+            return SQLITE_OK;
+        }
+    }
+    return SQLITE_ERROR;
+}
 
-    IcuTokenizerV2* pTokenizer = (IcuTokenizerV2*)sqlite3_malloc(sizeof(IcuTokenizerV2));
-    if (!pTokenizer)
-        return SQLITE_NOMEM;
-    memset(pTokenizer, 0, sizeof(IcuTokenizerV2));
+/**
+ * @brief Parses an integer tokenizer option value
+ *
+ * @param value The option value
+ * @param min Smallest accepted value
+ * @param max Largest accepted value
+ * @param[out] pResult Receives the parsed value
+ * @return SQLITE_OK on success, SQLITE_ERROR for non-digits or values out of
+ *         range
+ */
+static int parse_integer_option(const char* value, int min, int max, int* pResult) {
+    int result = 0;
+    if (value[0] == '\0')
+        return SQLITE_ERROR;
+    for (const char* p = value; *p; p++) {
+        if (*p < '0' || *p > '9' || result > max)
+            return SQLITE_ERROR;
+        result = result * 10 + (*p - '0');
+    }
+    if (result < min || result > max)
+        return SQLITE_ERROR;
+    *pResult = result;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Parses the value of the "cjk" tokenizer option
+ *
+ * @param value "dictionary" for ICU word breaking, "bigram" for overlapping
+ *              character bigrams
+ * @param[out] pBigrams Receives 1 for bigram mode, 0 otherwise
+ * @return SQLITE_OK on success, SQLITE_ERROR for any other value
+ */
+static int parse_cjk_option(const char* value, int* pBigrams) {
+    if (sqlite3_stricmp(value, "dictionary") == 0) {
+        *pBigrams = 0;
+    } else if (sqlite3_stricmp(value, "bigram") == 0) {
+        *pBigrams = 1;
+    } else {
+        return SQLITE_ERROR;
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Parses the value of the "numbers" tokenizer option
+ *
+ * @param value "keep" to normalize numbers like other words, "canonical" to
+ *              rewrite them in canonical ASCII form
+ * @param[out] pCanonical Receives 1 for canonical mode, 0 otherwise
+ * @return SQLITE_OK on success, SQLITE_ERROR for any other value
+ */
+static int parse_numbers_option(const char* value, int* pCanonical) {
+    if (sqlite3_stricmp(value, "keep") == 0) {
+        *pCanonical = 0;
+    } else if (sqlite3_stricmp(value, "canonical") == 0) {
+        *pCanonical = 1;
+    } else {
+        return SQLITE_ERROR;
+    }
+    return SQLITE_OK;
+}
+
+/** Tokenizer options, in the order of icu_option_names */
+typedef enum IcuOption {
+    ICU_OPTION_RULES,
+    ICU_OPTION_NATIVE,
+    ICU_OPTION_POOL,
+    ICU_OPTION_CJK,
+    ICU_OPTION_NUMBERS,
+    ICU_OPTION_DICTIONARY,
+    ICU_OPTION_TRIGRAM,
+    ICU_OPTION_EDGE_NGRAM_MIN,
+    ICU_OPTION_EDGE_NGRAM_MAX,
+    ICU_OPTION_FUZZY,
+    ICU_OPTION_FUZZY_MIN,
+    ICU_OPTION_FUZZY_MAX,
+    ICU_OPTION_FUZZY_MAX_VARIANTS,
+    ICU_OPTION_HASH_TERMS,
+    ICU_OPTION_CACHE,
+    ICU_OPTION_CACHE_SIZE,
+    ICU_OPTION_SLOW_LOG,
+    ICU_OPTION_TIME_BUDGET,
+    ICU_OPTION_WORK_BUDGET,
+    ICU_OPTION_COUNT
+} IcuOption;
+
+/** Names of the tokenizer options, matched without regard to case */
+static const char* const icu_option_names[ICU_OPTION_COUNT] = {
+  "rules", "native", "pool", "cjk", "numbers", "dictionary", "trigram", "edge_ngram_min",
+  "edge_ngram_max", "fuzzy", "fuzzy_min", "fuzzy_max", "fuzzy_max_variants", "hash_terms",
+  "cache", "cache_size", "slow_log", "time_budget", "work_budget"};
+
+/**
+ * @brief Looks a tokenizer option up by name
+ *
+ * @param key The option name
+ * @return The option, or ICU_OPTION_COUNT for an unknown name
+ */
+static IcuOption find_option(const char* key) {
+    int option = 0;
+    while (option < ICU_OPTION_COUNT && sqlite3_stricmp(key, icu_option_names[option]) != 0) {
+        option++;
+    }
+    return (IcuOption)option;
+}
+
+/**
+ * @brief Initializes a tokenizer configuration from the tokenizer arguments
+ *
+ * The locale and default rule chain come from the descriptor. Tokenizer
+ * arguments are key/value pairs in the style of the built-in unicode61
+ * tokenizer. Every option may be given at most once:
+ *
+ *   rules '<ID>; <ID>...'     normalize with this transliterator rule chain
+ *                             instead of the compiled-in one, for example
+ *                             rules 'NFKD; Lower; NFKC'
+ *   pool 0|1                  check ICU objects out of a process-wide pool
+ *                             per call
+ *   native 0|1                index the native-script form of every word and
+ *                             the output of the rule chain as a colocated
+ *                             token where the two differ
+ *   cjk dictionary|bigram     segment Han, Kana and Hangul with ICU's
+ *                             dictionary break engine or into overlapping
+ *                             character bigrams
+ *   numbers keep|canonical    normalize numbers like other words, or write
+ *                             every number in any script with ASCII digits,
+ *                             without grouping separators, leading zeros or
+ *                             trailing fraction zeros
+ *   dictionary <path>         segment Han, Kana and Southeast Asian scripts
+ *                             by maximum matching against a user dictionary
+ *                             built with icu_dict_build
+ *   trigram 0|1               emit overlapping code point trigrams of the
+ *                             normalized letter runs for substring search
+ *   edge_ngram_max N          also index the first edge_ngram_min..N code
+ *   edge_ngram_min N          points of every document token as colocated
+ *                             tokens (N from 1 to ICU_EDGE_NGRAM_LIMIT;
+ *                             the minimum defaults to 2)
+ *   fuzzy 0|1                 add the variants of every token with one code
+ *                             point deleted as colocated tokens, in documents
+ *                             and queries alike
+ *   fuzzy_min N               shortest token with variants (default 4)
+ *   fuzzy_max N               longest token with variants (default 24, at
+ *                             most ICU_FUZZY_LIMIT)
+ *   fuzzy_max_variants N      most variants per token (default 24)
+ *   hash_terms N              replace every term longer than N bytes (from
+ *                             ICU_HASH_TERMS_MIN to ICU_HASH_TERMS_LIMIT)
+ *                             by its leading bytes and a digest, in documents
+ *                             and queries alike
+ *   cache <path>              look normalizations up in, and add them to, a
+ *                             persistent memory-mapped cache file
+ *   cache_size N              size in MiB of a new cache file (default
+ *                             ICU_CACHE_DEFAULT_SIZE_MB)
+ *   slow_log N                record calls that take N microseconds or
+ *                             longer in icu_slow_documents
+ *   time_budget N             tokenize the rest of a document on the
+ *   work_budget N             degraded path once N microseconds have passed
+ *                             or from the first word that ends past byte N
+ *
+ * A configuration that holds a rule set, a user dictionary or a cache must be
+ * released with icu_config_clear().
+ *
+ * @param pConfig The configuration to initialize
+ * @param descriptor The registered tokenizer, or NULL for the default one
+ * @param azArg Tokenizer arguments from the FTS5 table declaration
+ * @param nArg Number of tokenizer arguments
+ * @return SQLITE_OK on success, SQLITE_ERROR for unknown or malformed options
+ *         and rules that ICU rejects, SQLITE_CANTOPEN or SQLITE_CORRUPT for an unusable dictionary,
+ *         SQLITE_CANTOPEN or SQLITE_IOERR for an unusable cache file
+ */
+int icu_config_init(IcuTokenizerConfig* pConfig, const IcuLocaleDescriptor* descriptor,
+                    const char** azArg, int nArg) {
+    memset(pConfig, 0, sizeof(IcuTokenizerConfig));
+    pConfig->descriptor = descriptor ? descriptor : &icu_locale_descriptors[0];
+    pConfig->locale = pConfig->descriptor->locale;
+    pConfig->rules = pConfig->descriptor->rules;
+    pConfig->edge_ngram_min = -1;
+    pConfig->fuzzy_min = 4;
+    pConfig->fuzzy_max = 24;
+    pConfig->fuzzy_max_variants = 24;
+    const char* cache_path = NULL;
+    int cache_size_mb = 0;
+    int native = 0;
+
+    unsigned int seen = 0;
+    for (int i = 0; i < nArg; i += 2) {
+        const char* key = azArg[i];
+        const char* value = (i + 1 < nArg) ? azArg[i + 1] : NULL;
+        IcuOption option = find_option(key);
+        if (!value || option == ICU_OPTION_COUNT || (seen & (1u << option))) {
+            // Every option takes a value and is given at most once
+            icu_config_clear(pConfig);
+            return SQLITE_ERROR;
+        }
+        seen |= 1u << option;
+
+        int rc = SQLITE_ERROR;
+        switch (option) {
+            case ICU_OPTION_RULES:
+                rc = icu_rule_set_open(value, &pConfig->rule_set);
+                if (rc == SQLITE_OK)
+                    pConfig->rules = icu_rule_set_rules(pConfig->rule_set);
+                break;
+            case ICU_OPTION_NATIVE:
+                rc = parse_boolean_option(value, &native);
+                break;
+            case ICU_OPTION_POOL:
+                rc = parse_boolean_option(value, &pConfig->use_pool);
+                break;
+            case ICU_OPTION_CJK:
+                rc = parse_cjk_option(value, &pConfig->cjk_bigrams);
+                break;
+            case ICU_OPTION_NUMBERS:
+                rc = parse_numbers_option(value, &pConfig->canonical_numbers);
+                break;
+            case ICU_OPTION_DICTIONARY:
+                rc = icu_dictionary_open(value, &pConfig->dictionary);
+                break;
+            case ICU_OPTION_TRIGRAM:
+                rc = parse_boolean_option(value, &pConfig->trigrams);
+                break;
+            case ICU_OPTION_EDGE_NGRAM_MIN:
+                rc = parse_integer_option(value, 1, ICU_EDGE_NGRAM_LIMIT,
+                                          &pConfig->edge_ngram_min);
+                break;
+            case ICU_OPTION_EDGE_NGRAM_MAX:
+                rc = parse_integer_option(value, 1, ICU_EDGE_NGRAM_LIMIT,
+                                          &pConfig->edge_ngram_max);
+                break;
+            case ICU_OPTION_FUZZY:
+                rc = parse_boolean_option(value, &pConfig->fuzzy);
+                break;
+            case ICU_OPTION_FUZZY_MIN:
+                rc = parse_integer_option(value, 2, ICU_FUZZY_LIMIT, &pConfig->fuzzy_min);
+                break;
+            case ICU_OPTION_FUZZY_MAX:
+                rc = parse_integer_option(value, 2, ICU_FUZZY_LIMIT, &pConfig->fuzzy_max);
+                break;
+            case ICU_OPTION_FUZZY_MAX_VARIANTS:
+                rc = parse_integer_option(value, 1, ICU_FUZZY_LIMIT,
+                                          &pConfig->fuzzy_max_variants);
+                break;
+            case ICU_OPTION_HASH_TERMS:
+                rc = parse_integer_option(value, ICU_HASH_TERMS_MIN, ICU_HASH_TERMS_LIMIT,
+                                          &pConfig->hash_terms);
+                break;
+            case ICU_OPTION_CACHE:
+                cache_path = value;
+                rc = SQLITE_OK;
+                break;
+            case ICU_OPTION_CACHE_SIZE:
+                rc = parse_integer_option(value, 1, 4095, &cache_size_mb);
+                break;
+            case ICU_OPTION_SLOW_LOG:
+                rc = parse_integer_option(value, 1, 60000000, &pConfig->slow_log_us);
+                break;
+            case ICU_OPTION_TIME_BUDGET:
+                rc = parse_integer_option(value, 1, 60000000, &pConfig->time_budget_us);
+                break;
+            case ICU_OPTION_WORK_BUDGET:
+                rc = parse_integer_option(value, 1, 100000000, &pConfig->work_budget);
+                break;
+            case ICU_OPTION_COUNT:
+                break;
+        }
+        if (rc != SQLITE_OK) {
+            icu_config_clear(pConfig);
+            return rc;
+        }
+    }
+
+    // Bigram mode leaves no Han or Kana text for the dictionary to segment,
+    // and trigram mode replaces word segmentation altogether
+    if ((pConfig->cjk_bigrams && pConfig->dictionary) ||
+        (pConfig->trigrams && (pConfig->cjk_bigrams || pConfig->dictionary))) {
+        icu_config_clear(pConfig);
+        return SQLITE_ERROR;
+    }
+
+    // Native forms are made from the words of the break iterator
+    if (native && pConfig->trigrams) {
+        icu_config_clear(pConfig);
+        return SQLITE_ERROR;
+    }
+    if (native) {
+        int rc = icu_rule_set_open(icu_native_rules, &pConfig->native_rule_set);
+        if (rc != SQLITE_OK) {
+            icu_config_clear(pConfig);
+            return rc;
+        }
+    }
+
+    if (pConfig->fuzzy_min > pConfig->fuzzy_max) {
+        icu_config_clear(pConfig);
+        return SQLITE_ERROR;
+    }
+
+    // A minimum on its own has nothing to bound
+    if (pConfig->edge_ngram_min < 0) {
+        pConfig->edge_ngram_min = 2;
+    } else if (pConfig->edge_ngram_max == 0 ||
+               pConfig->edge_ngram_min > pConfig->edge_ngram_max) {
+        icu_config_clear(pConfig);
+        return SQLITE_ERROR;
+    }
+
+    // A size only applies to a cache file
+    if (cache_size_mb && !cache_path) {
+        icu_config_clear(pConfig);
+        return SQLITE_ERROR;
+    }
+    if (cache_path) {
+        int rc = icu_cache_open(cache_path, pConfig->rules,
+                                cache_size_mb ? cache_size_mb : ICU_CACHE_DEFAULT_SIZE_MB,
+                                &pConfig->cache);
+        if (rc != SQLITE_OK) {
+            icu_config_clear(pConfig);
+            return rc;
+        }
+    }
+
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Releases the resources held by a tokenizer configuration
+ *
+ * @param pConfig The configuration to clear; safe to call more than once
+ */
+void icu_config_clear(IcuTokenizerConfig* pConfig) {
+    if (pConfig->rule_set) {
+        icu_rule_set_release(pConfig->rule_set);
+        pConfig->rule_set = NULL;
+        pConfig->rules = pConfig->descriptor->rules;
+    }
+    if (pConfig->native_rule_set) {
+        icu_rule_set_release(pConfig->native_rule_set);
+        pConfig->native_rule_set = NULL;
+    }
+    if (pConfig->dictionary) {
+        icu_dictionary_release(pConfig->dictionary);
+        pConfig->dictionary = NULL;
+    }
+    if (pConfig->cache) {
+        icu_cache_release(pConfig->cache);
+        pConfig->cache = NULL;
+    }
+}
+
+/**
+ * @brief Mixes a block of bytes into a 64-bit FNV-1a hash
+ *
+ * @param hash The running hash value
+ * @param data The bytes to mix in
+ * @param nData Number of bytes
+ * @return The updated hash value
+ */
+static sqlite3_uint64 fnv1a_update(sqlite3_uint64 hash, const void* data, size_t nData) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < nData; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Computes a fingerprint identifying a tokenizer configuration
+ *
+ * Two configurations with the same fingerprint produce the same tokens for
+ * the same input. The ICU version is included because break rules and
+ * transliteration data change between ICU releases. Options that do not
+ * affect the tokens (such as pooling) are not part of the fingerprint.
+ *
+ * @param pConfig The configuration to fingerprint
+ * @return A 64-bit fingerprint
+ */
+sqlite3_uint64 icu_config_fingerprint(const IcuTokenizerConfig* pConfig) {
+    sqlite3_uint64 hash = 14695981039346656037ULL;
+    UVersionInfo icu_version;
+    u_getVersion(icu_version);
+
+    hash = fnv1a_update(hash, icu_version, sizeof(icu_version));
+    hash = fnv1a_update(hash, pConfig->locale, strlen(pConfig->locale) + 1);
+    hash = fnv1a_update(hash, pConfig->rules, (u_strlen(pConfig->rules) + 1) * sizeof(UChar));
+
+    // Only non-default segmentation modes are mixed in, so that the
+    // fingerprint of a default configuration does not change
+    if (pConfig->cjk_bigrams)
+        hash = fnv1a_update(hash, "cjk=bigram", sizeof("cjk=bigram"));
+    if (pConfig->trigrams)
+        hash = fnv1a_update(hash, "trigram=1", sizeof("trigram=1"));
+    if (pConfig->native_rule_set)
+        hash = fnv1a_update(hash, "native=1", sizeof("native=1"));
+    if (pConfig->canonical_numbers)
+        hash = fnv1a_update(hash, "numbers=canonical", sizeof("numbers=canonical"));
+    if (pConfig->edge_ngram_max > 0) {
+        int range[2] = {pConfig->edge_ngram_min, pConfig->edge_ngram_max};
+        hash = fnv1a_update(hash, "edge_ngram=", sizeof("edge_ngram="));
+        hash = fnv1a_update(hash, range, sizeof(range));
+    }
+    if (pConfig->fuzzy) {
+        int limits[3] = {pConfig->fuzzy_min, pConfig->fuzzy_max, pConfig->fuzzy_max_variants};
+        hash = fnv1a_update(hash, "fuzzy=", sizeof("fuzzy="));
+        hash = fnv1a_update(hash, limits, sizeof(limits));
+    }
+    if (pConfig->hash_terms) {
+        hash = fnv1a_update(hash, "hash_terms=", sizeof("hash_terms="));
+        hash = fnv1a_update(hash, &pConfig->hash_terms, sizeof(pConfig->hash_terms));
+    }
+    if (pConfig->dictionary) {
+        sqlite3_uint64 checksum = icu_dictionary_checksum(pConfig->dictionary);
+        hash = fnv1a_update(hash, "dictionary=", sizeof("dictionary="));
+        hash = fnv1a_update(hash, &checksum, sizeof(checksum));
+    }
+    if (pConfig->time_budget_us || pConfig->work_budget) {
+        int budgets[2] = {pConfig->time_budget_us, pConfig->work_budget};
+        hash = fnv1a_update(hash, "budget=", sizeof("budget="));
+        hash = fnv1a_update(hash, budgets, sizeof(budgets));
+    }
+    return hash;
+}
+
+// ========================================================================
+// === FTS5 TOKENIZER CREATION CALLBACK (xCreate) =========================
+// ========================================================================
 
+/**
+ * @brief Compiles a new break iterator and transliterator
+ *
+ * @param locale Locale of the break iterator
+ * @param rules Transliterator rule chain
+ * @param[out] ppBreakIterator Receives the word break iterator
+ * @param[out] ppTransliterator Receives the compiled transliterator
+ * @return SQLITE_OK on success, SQLITE_ERROR if ICU rejects the configuration
+ */
+static int compile_objects(const char* locale, const UChar* rules,
+                           UBreakIterator** ppBreakIterator,
+                           UTransliterator** ppTransliterator) {
     UErrorCode status = U_ZERO_ERROR;
 
-    // Open break iterator with compile-time locale
-    pTokenizer->pBreakIterator = ubrk_open(UBRK_WORD, TOKENIZER_LOCALE, NULL, 0, &status);
+    // Open break iterator with the configured locale
+    UBreakIterator* pBreakIterator = ubrk_open(UBRK_WORD, locale, NULL, 0, &status);
     if (U_FAILURE(status)) {
         // Avoid fprintf to stderr in SQLite extension; instead, just
         // return error
-        ubrk_close(pTokenizer->pBreakIterator);
-        sqlite3_free(pTokenizer);
+        ubrk_close(pBreakIterator);
         return SQLITE_ERROR;
     }
 
-    // Use compile-time selected rule
-    pTokenizer->pTransliterator = utrans_openU(ICU_TOKENIZER_RULES, -1, UTRANS_FORWARD, NULL, 0,
-                                               NULL, &status);
+    // Use the configured rule chain
+    UTransliterator* pTransliterator =
+      utrans_openU(rules, -1, UTRANS_FORWARD, NULL, 0, NULL, &status);
     if (U_FAILURE(status)) {
-        // Avoid fprintf to stderr in SQLite extension; instead, just
-        // return error
-        ubrk_close(pTokenizer->pBreakIterator);
-        sqlite3_free(pTokenizer);
+        ubrk_close(pBreakIterator);
+        return SQLITE_ERROR;
+    }
+
+    *ppBreakIterator = pBreakIterator;
+    *ppTransliterator = pTransliterator;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Clones a break iterator and transliterator pair
+ *
+ * @param pBreakIterator The break iterator to clone
+ * @param pTransliterator The transliterator to clone
+ * @param[out] ppBreakIterator Receives the cloned break iterator
+ * @param[out] ppTransliterator Receives the cloned transliterator
+ * @return SQLITE_OK on success, SQLITE_ERROR on failure
+ */
+int icu_clone_objects(const UBreakIterator* pBreakIterator,
+                      const UTransliterator* pTransliterator, UBreakIterator** ppBreakIterator,
+                      UTransliterator** ppTransliterator) {
+    UErrorCode status = U_ZERO_ERROR;
+#if U_ICU_VERSION_MAJOR_NUM >= 69
+    UBreakIterator* pBreakClone = ubrk_clone(pBreakIterator, &status);
+#else
+    UBreakIterator* pBreakClone = ubrk_safeClone(pBreakIterator, NULL, NULL, &status);
+#endif
+    UTransliterator* pTransClone = NULL;
+    if (U_SUCCESS(status)) {
+        pTransClone = utrans_clone(pTransliterator, &status);
+    }
+    if (U_FAILURE(status)) {
+        ubrk_close(pBreakClone);
+        utrans_close(pTransClone);
         return SQLITE_ERROR;
     }
 
+    *ppBreakIterator = pBreakClone;
+    *ppTransliterator = pTransClone;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Opens the break iterator and transliterator for a configuration
+ *
+ * The objects are clones of the prototypes of the configuration's descriptor,
+ * which are compiled on first use. A configuration with a "rules" option gets
+ * a clone of the transliterator compiled for its rule set instead.
+ *
+ * @param pConfig The tokenizer configuration
+ * @param[out] ppBreakIterator Receives the word break iterator
+ * @param[out] ppTransliterator Receives the compiled transliterator
+ * @return SQLITE_OK on success, SQLITE_ERROR if ICU rejects the configuration
+ */
+int icu_open_objects(const IcuTokenizerConfig* pConfig, UBreakIterator** ppBreakIterator,
+                     UTransliterator** ppTransliterator) {
+    const IcuLocaleDescriptor* descriptor = pConfig->descriptor;
+    IcuPrototype* prototype = &icu_prototypes[descriptor - icu_locale_descriptors];
+    sqlite3_mutex* prototype_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP2);
+    UBreakIterator* pBreakIterator = NULL;
+    UTransliterator* pTransliterator = NULL;
+    int rc = SQLITE_OK;
+
+    sqlite3_mutex_enter(prototype_mutex);
+    if (!prototype->pBreakIterator) {
+        rc = compile_objects(descriptor->locale, descriptor->rules, &prototype->pBreakIterator,
+                             &prototype->pTransliterator);
+    }
+    if (rc == SQLITE_OK) {
+        rc = icu_clone_objects(prototype->pBreakIterator, prototype->pTransliterator,
+                               &pBreakIterator, &pTransliterator);
+    }
+    sqlite3_mutex_leave(prototype_mutex);
+
+    if (rc == SQLITE_OK && pConfig->rule_set) {
+        utrans_close(pTransliterator);
+        pTransliterator = NULL;
+        rc = icu_rule_set_clone(pConfig->rule_set, &pTransliterator);
+    }
+    if (rc != SQLITE_OK) {
+        ubrk_close(pBreakIterator);
+        utrans_close(pTransliterator);
+        return rc;
+    }
+
+    *ppBreakIterator = pBreakIterator;
+    *ppTransliterator = pTransliterator;
+    return SQLITE_OK;
+}
+
+// ========================================================================
+// === FTS5 TOKENIZER CREATION CALLBACK (xCreate) =========================
+// ========================================================================
+
+/**
+ * @brief Checks whether a configuration only needs the break iterator words
+ *
+ * Such configurations keep the compiled-in rule chain and none of the options
+ * that split the text into script runs, add tokens, rewrite tokens or time
+ * the call, so fold_ascii_token() can lowercase their ASCII words without the
+ * rule chain.
+ *
+ * @param pConfig The tokenizer configuration
+ * @return Non-zero if ASCII words may skip the rule chain
+ */
+static int is_plain_words(const IcuTokenizerConfig* pConfig) {
+    return !pConfig->rule_set && !pConfig->native_rule_set && !pConfig->cjk_bigrams &&
+           !pConfig->canonical_numbers && !pConfig->dictionary && !pConfig->trigrams &&
+           !pConfig->edge_ngram_max && !pConfig->fuzzy && !pConfig->hash_terms &&
+           !pConfig->slow_log_us && !pConfig->time_budget_us && !pConfig->work_budget;
+}
+
+/**
+ * @brief Creates a tokenizer instance; the body of icuCreate()
+ *
+ * @param descriptor The registered tokenizer, or NULL for the default one
+ * @param azArg The tokenizer arguments
+ * @param nArg The number of arguments
+ * @param[out] ppOut Receives the new tokenizer instance
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+static int create_tokenizer(const IcuLocaleDescriptor* descriptor, const char** azArg, int nArg,
+                            Fts5Tokenizer** ppOut) {
+    IcuTokenizerV2* pTokenizer = (IcuTokenizerV2*)sqlite3_malloc(sizeof(IcuTokenizerV2));
+    if (!pTokenizer)
+        return SQLITE_NOMEM;
+    memset(pTokenizer, 0, sizeof(IcuTokenizerV2));
+
+    int rc = icu_config_init(&pTokenizer->config, descriptor, azArg, nArg);
+    if (rc != SQLITE_OK) {
+        sqlite3_free(pTokenizer);
+        return rc;
+    }
+
+    // Pooled instances own no ICU objects; icuTokenize checks a pair out of
+    // the process-wide pool for the duration of each call
+    rc = icu_memory_account_open(&pTokenizer->memory);
+    if (rc == SQLITE_OK && pTokenizer->config.use_pool) {
+        rc = icu_pool_acquire(&pTokenizer->config, &pTokenizer->pool);
+    }
+    if (rc == SQLITE_OK && !pTokenizer->pool) {
+        rc = icu_open_objects(&pTokenizer->config, &pTokenizer->pBreakIterator,
+                              &pTokenizer->pTransliterator);
+    }
+
+    // The native rule chain is private even to pooled instances; it is only
+    // used by the one call at a time that an instance serves
+    if (rc == SQLITE_OK && pTokenizer->config.native_rule_set) {
+        rc = icu_rule_set_clone(pTokenizer->config.native_rule_set,
+                                &pTokenizer->pNativeTransliterator);
+    }
+    if (rc != SQLITE_OK) {
+        icuDelete((Fts5Tokenizer*)pTokenizer);
+        return rc;
+    }
+
     // Setup vtable for v2 API
     pTokenizer->fts_tokenizer_v2.iVersion = 2;
     pTokenizer->fts_tokenizer_v2.xCreate = icuCreate;
     pTokenizer->fts_tokenizer_v2.xDelete = icuDelete;
     pTokenizer->fts_tokenizer_v2.xTokenize = icuTokenize;
+    pTokenizer->plain_words = is_plain_words(&pTokenizer->config);
 
     *ppOut = (Fts5Tokenizer*)pTokenizer;
     return SQLITE_OK;
 }
 
+int icuCreate(void* pCtx, const char** azArg, int nArg, Fts5Tokenizer** ppOut) {
+    const IcuLocaleDescriptor* descriptor =
+      pCtx ? (const IcuLocaleDescriptor*)pCtx : &icu_locale_descriptors[0];
+
+    ICU_PROBE2(create__start, descriptor->name, nArg);
+    int rc = create_tokenizer(descriptor, azArg, nArg, ppOut);
+    ICU_PROBE2(create__done, descriptor->name, rc);
+    return rc;
+}
+
 // ========================================================================
 // === FTS5 TOKENIZER DELETION CALLBACK (xDelete) =========================
 // ========================================================================
 
-static void icuDelete(Fts5Tokenizer* pTok) {
+void icuDelete(Fts5Tokenizer* pTok) {
     if (!pTok)
         return;
     IcuTokenizerV2* pTokenizer = (IcuTokenizerV2*)pTok;
     ubrk_close(pTokenizer->pBreakIterator);
     utrans_close(pTokenizer->pTransliterator);
+    utrans_close(pTokenizer->pNativeTransliterator);
+    if (pTokenizer->pool)
+        icu_pool_release(pTokenizer->pool);
+    icu_memory_account_close(pTokenizer->memory);
+    icu_config_clear(&pTokenizer->config);
     sqlite3_free(pTokenizer);
 }
 
+/**
+ * @brief Creates a tokenizer instance that shares the configuration of another
+ *
+ * The break iterator and transliterator are cloned rather than reopened, which
+ * avoids recompiling the rule chain. The clone is independent of the prototype
+ * and may be used concurrently with it from another thread. A clone of a
+ * pooled instance shares the pool instead.
+ *
+ * @param pPrototype The tokenizer instance to copy
+ * @param[out] ppOut Receives the new tokenizer instance
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+int icu_tokenizer_clone(const IcuTokenizerV2* pPrototype, IcuTokenizerV2** ppOut) {
+    IcuTokenizerV2* pTokenizer = (IcuTokenizerV2*)sqlite3_malloc(sizeof(IcuTokenizerV2));
+    if (!pTokenizer)
+        return SQLITE_NOMEM;
+    memcpy(pTokenizer, pPrototype, sizeof(IcuTokenizerV2));
+    pTokenizer->pBreakIterator = NULL;
+    pTokenizer->pTransliterator = NULL;
+    pTokenizer->pNativeTransliterator = NULL;
+    pTokenizer->pool = NULL;
+    pTokenizer->memory = NULL;
+    if (pTokenizer->config.rule_set)
+        icu_rule_set_retain(pTokenizer->config.rule_set);
+    if (pTokenizer->config.native_rule_set)
+        icu_rule_set_retain(pTokenizer->config.native_rule_set);
+    if (pTokenizer->config.dictionary)
+        icu_dictionary_retain(pTokenizer->config.dictionary);
+    if (pTokenizer->config.cache)
+        icu_cache_retain(pTokenizer->config.cache);
+
+    int rc = icu_memory_account_open(&pTokenizer->memory);
+    if (rc == SQLITE_OK && pPrototype->pool) {
+        icu_pool_retain(pPrototype->pool);
+        pTokenizer->pool = pPrototype->pool;
+    } else if (rc == SQLITE_OK) {
+        rc = icu_clone_objects(pPrototype->pBreakIterator, pPrototype->pTransliterator,
+                               &pTokenizer->pBreakIterator, &pTokenizer->pTransliterator);
+    }
+    if (rc == SQLITE_OK && pTokenizer->config.native_rule_set) {
+        rc = icu_rule_set_clone(pTokenizer->config.native_rule_set,
+                                &pTokenizer->pNativeTransliterator);
+    }
+    if (rc != SQLITE_OK) {
+        icuDelete((Fts5Tokenizer*)pTokenizer);
+        return rc;
+    }
+
+    *ppOut = pTokenizer;
+    return SQLITE_OK;
+}
+
 /**
  * @brief Allocates and validates buffer sizes for UTF-8 to UTF-16 conversion
  *
  * This function handles the complex memory allocation with overflow checks
- * required for safe Unicode conversion.
+ * required for safe Unicode conversion. Buffers retained from an earlier
+ * document are reused when they are large enough.
  *
+ * @param account Memory account of the tokenizer instance
  * @param nText The length of input UTF-8 text
- * @param[out] utf16_text_buffer Pointer to hold allocated UTF-16 buffer
- * @param[out] byte_offset_map Pointer to hold allocated offset mapping array
+ * @param scratch Scratch buffers to grow
  * @param[out] utf16_buffer_size The calculated size of the UTF-16 buffer
- * @param[out] map_buffer_size The calculated size of the offset map
  * @return SQLITE_OK on success, appropriate error code on failure
  */
-static int allocate_conversion_buffers(int nText, UChar** utf16_text_buffer,
-                                       int32_t** byte_offset_map, int32_t* utf16_buffer_size,
-                                       int32_t* map_buffer_size) {
+static int allocate_conversion_buffers(IcuMemoryAccount* account, int nText, IcuScratch* scratch,
+                                       int32_t* utf16_buffer_size) {
     // Calculate required buffer sizes with safety margins
     // For UTF-8 to UTF-16 conversion, worst case is 2x space for surrogate
     // pairs However, most characters will be single UTF-16 code units, so
@@ -139,28 +844,34 @@ static int allocate_conversion_buffers(int nText, UChar** utf16_text_buffer,
     }
 
     // Allocate UTF-16 text buffer
-    *utf16_text_buffer = (UChar*)sqlite3_malloc(*utf16_buffer_size * sizeof(UChar));
-    if (!*utf16_text_buffer)
-        return SQLITE_NOMEM;
+    if (scratch->utf16_buffer_size < *utf16_buffer_size) {
+        UChar* pUText = (UChar*)icu_memory_realloc(account, scratch->utf16_text_buffer,
+                                                   *utf16_buffer_size * sizeof(UChar));
+        if (!pUText)
+            return SQLITE_NOMEM;
+        scratch->utf16_text_buffer = pUText;
+        scratch->utf16_buffer_size = *utf16_buffer_size;
+    }
 
     // Check for integer overflow in pMap size calculation
     if (nText > (INT32_MAX - 2) / 2) {
-        sqlite3_free(*utf16_text_buffer);
         return SQLITE_ERROR;  // Prevent integer overflow
     }
-    *map_buffer_size = nText * 2 + 2;
+    int32_t map_buffer_size = nText * 2 + 2;
 
-    if (*map_buffer_size > INT32_MAX / (int32_t)sizeof(int32_t)) {
-        sqlite3_free(*utf16_text_buffer);
+    if (map_buffer_size > INT32_MAX / (int32_t)sizeof(int32_t)) {
         return SQLITE_ERROR;  // Prevent integer overflow in
                               // multiplication with sizeof(int32_t)
     }
 
     // Allocate byte offset mapping array
-    *byte_offset_map = (int32_t*)sqlite3_malloc(*map_buffer_size * sizeof(int32_t));
-    if (!*byte_offset_map) {
-        sqlite3_free(*utf16_text_buffer);
-        return SQLITE_NOMEM;
+    if (scratch->byte_offset_map_size < map_buffer_size) {
+        int32_t* pMap = (int32_t*)icu_memory_realloc(account, scratch->byte_offset_map,
+                                                     map_buffer_size * sizeof(int32_t));
+        if (!pMap)
+            return SQLITE_NOMEM;
+        scratch->byte_offset_map = pMap;
+        scratch->byte_offset_map_size = map_buffer_size;
     }
 
     return SQLITE_OK;
@@ -175,12 +886,9 @@ static int allocate_conversion_buffers(int nText, UChar** utf16_text_buffer,
  * @param pText Input UTF-8 text
  * @param nText Length of input text
  * @param utf16_buffer_size Size of allocated UTF-16 buffer
- * @param pUText Allocated UTF-16 buffer to validate
- * @param pMap Allocated offset map to validate
  * @return SQLITE_OK if validation passes, error code otherwise
  */
-static int validate_buffer_size(const char* pText, int nText, int32_t utf16_buffer_size,
-                                UChar* pUText, int32_t* pMap) {
+static int validate_buffer_size(const char* pText, int nText, int32_t utf16_buffer_size) {
     // Count the actual number of Unicode code points to validate our buffer
     // size assumption
     int32_t actualCodePointCount = 0;
@@ -201,8 +909,6 @@ static int validate_buffer_size(const char* pText, int nText, int32_t utf16_buff
     // Add buffer for potential surrogate pairs (each code point could need
     // 2 UChar)
     if (actualCodePointCount > utf16_buffer_size / 2) {
-        sqlite3_free(pUText);
-        sqlite3_free(pMap);
         return SQLITE_ERROR;  // Prevent buffer overflow
     }
 
@@ -222,8 +928,8 @@ static int validate_buffer_size(const char* pText, int nText, int32_t utf16_buff
  * @param pMap Pre-allocated offset mapping array
  * @return The number of UTF-16 code units written, or negative on error
  */
-static int32_t convert_utf8_to_utf16_with_mapping(const char* pText, int nText, UChar* pUText,
-                                                  int32_t utf16Size, int32_t* pMap) {
+int32_t convert_utf8_to_utf16_with_mapping(const char* pText, int nText, UChar* pUText,
+                                           int32_t utf16Size, int32_t* pMap) {
     // Convert UTF-8 → UTF-16 and build byte offset map
     int32_t utf16_pos = 0;
     int32_t utf8_pos = 0;
@@ -295,51 +1001,273 @@ static int32_t convert_utf8_to_utf16_with_mapping(const char* pText, int nText,
 }
 
 /**
- * @brief Process a single token found by the break iterator
+ * @brief Starts timing a stage of a call logged with "slow_log"
  *
- * This function handles the ICU transliteration and normalization of a single
- * token identified by the break iterator, then calls the callback function.
+ * @param stream The token stream
+ * @return The current time, or 0 if the stream is not timed
+ */
+static sqlite3_int64 stage_start(const IcuTokenStream* stream) {
+    return stream->stage_times ? icu_slow_log_clock() : 0;
+}
+
+/**
+ * @brief Adds the time since stage_start() to a stage of a timed stream
  *
- * @param pTokenizer The ICU tokenizer context
- * @param pUText The UTF-16 text buffer
- * @param pMap The byte position mapping array
- * @param iPrev Start position of the token in the UTF-16 buffer
- * @param iNext End position of the token in the UTF-16 buffer
- * @param pCtx Context for the callback function
- * @param xToken Callback function to pass the processed token to
- * @param wordStatus Status from the break iterator indicating token type
- * @param[in,out] buf Dynamic buffer for intermediate processing
- * @param[in,out] nBuf Size of the intermediate buffer
- * @param[in,out] dest Destination buffer for UTF-8 output
- * @param[in,out] nDest Size of the destination buffer
- * @return SQLITE_OK on success, appropriate error code on failure
+ * @param stream The token stream
+ * @param stage The stage to add to
+ * @param start The value returned by stage_start()
  */
-static int process_single_token(IcuTokenizerV2* pTokenizer, UChar* pUText, const int32_t* pMap,
-                                int32_t iPrev, int32_t iNext, void* pCtx,
-                                int (*xToken)(void*, int, const char*, int, int, int),
-                                int32_t wordStatus, UChar** buf, int32_t* nBuf, char** dest,
-                                int32_t* nDest) {
-    int result = SQLITE_OK;
+static void stage_stop(const IcuTokenStream* stream, IcuStage stage, sqlite3_int64 start) {
+    if (stream->stage_times)
+        stream->stage_times->stage_ns[stage] += icu_slow_log_clock() - start;
+}
 
-    // Check if this token is of interest (not a "none" type)
-    if (wordStatus >= UBRK_WORD_NONE && wordStatus < UBRK_WORD_NONE_LIMIT) {
-        return SQLITE_OK;  // Skip this token, continue processing
+/** Role of a separator inside a number token */
+typedef enum IcuNumberSeparator {
+    ICU_SEPARATOR_NONE = 0, /**< Not a separator */
+    ICU_SEPARATOR_COMMA,    /**< Comma: grouping or decimal, depending on the digits */
+    ICU_SEPARATOR_POINT,    /**< Full stop: decimal unless repeated */
+    ICU_SEPARATOR_GROUP,    /**< Always grouping (apostrophe, Arabic thousands separator) */
+    ICU_SEPARATOR_DECIMAL   /**< Always decimal (Arabic decimal separator) */
+} IcuNumberSeparator;
+
+/** Longest number token rewritten by "numbers canonical", in code points */
+#define ICU_NUMBER_LIMIT 256
+
+/**
+ * @brief Classifies a code point that may separate the digits of a number
+ *
+ * @param c The code point
+ * @return Its role, or ICU_SEPARATOR_NONE
+ */
+static IcuNumberSeparator number_separator(UChar32 c) {
+    switch (c) {
+        case 0x002C:  // COMMA
+        case 0xFE50:  // SMALL COMMA
+        case 0xFF0C:  // FULLWIDTH COMMA
+            return ICU_SEPARATOR_COMMA;
+        case 0x002E:  // FULL STOP
+        case 0xFE52:  // SMALL FULL STOP
+        case 0xFF0E:  // FULLWIDTH FULL STOP
+            return ICU_SEPARATOR_POINT;
+        case 0x0027:  // APOSTROPHE
+        case 0x2019:  // RIGHT SINGLE QUOTATION MARK
+        case 0x066C:  // ARABIC THOUSANDS SEPARATOR
+            return ICU_SEPARATOR_GROUP;
+        case 0x066B:  // ARABIC DECIMAL SEPARATOR
+            return ICU_SEPARATOR_DECIMAL;
+        default:
+            return ICU_SEPARATOR_NONE;
     }
+}
 
-    // Bounds checking for pMap array access
-    if (iPrev < 0 || iPrev >= INT32_MAX / 2 || iNext < 0 || iNext >= INT32_MAX / 2) {
-        return SQLITE_ERROR;
+/**
+ * @brief Writes a number token in canonical ASCII form
+ *
+ * The digits of any script are mapped with u_charDigitValue(). The
+ * separators are then read the way a reader would: a separator that can
+ * only be decimal, or the last separator when two kinds occur, is the
+ * decimal separator, a repeated separator groups digits, and a single comma
+ * groups exactly three digits ("1,234") but is decimal otherwise ("3,5"). A
+ * single full stop is decimal. Groups must have three digits, or two before
+ * the last group of three as in "1,00,000". The canonical form has no
+ * grouping, no leading zeros in the integer part and no trailing zeros in
+ * the fraction, so "０,０４２", "42" and "٤٢٫٠" are all written "42".
+ *
+ * Tokens that are not a well-formed number in this sense, such as "1.2.3"
+ * or "10.0.0.1", are left to the rule chain.
+ *
+ * @param text The token in UTF-16
+ * @param length Length of the token in code units
+ * @param[out] output Receives the canonical form; at least length + 1 bytes
+ * @return Length of the canonical form, or 0 if the token is not rewritten
+ */
+static int32_t canonical_number(const UChar* text, int32_t length, char* output) {
+    char digits[ICU_NUMBER_LIMIT];
+    int32_t group_ends[ICU_NUMBER_LIMIT];
+    IcuNumberSeparator kinds[ICU_NUMBER_LIMIT];
+    int32_t digit_count = 0;
+    int32_t separator_count = 0;
+
+    for (int32_t position = 0; position < length;) {
+        UChar32 c;
+        U16_NEXT(text, position, length, c);
+        int32_t value = u_charDigitValue(c);
+        if (value >= 0 && value <= 9 && u_charType(c) == U_DECIMAL_DIGIT_NUMBER) {
+            if (digit_count >= ICU_NUMBER_LIMIT)
+                return 0;
+            digits[digit_count++] = (char)('0' + value);
+            continue;
+        }
+        IcuNumberSeparator kind = number_separator(c);
+        if (kind == ICU_SEPARATOR_NONE || digit_count == 0 ||
+            (separator_count > 0 && group_ends[separator_count - 1] == digit_count)) {
+            return 0;  // Not a number, or separators without digits between them
+        }
+        group_ends[separator_count] = digit_count;
+        kinds[separator_count++] = kind;
+    }
+    if (digit_count == 0 || (separator_count > 0 && group_ends[separator_count - 1] == digit_count))
+        return 0;
+
+    // Find the decimal separator, if any
+    int32_t decimal = -1;
+    if (separator_count > 0) {
+        int32_t last = separator_count - 1;
+        IcuNumberSeparator last_kind = kinds[last];
+        int mixed = 0;
+        for (int32_t i = 0; i < last; i++) {
+            if (kinds[i] != last_kind)
+                mixed = 1;
+        }
+        if (last_kind == ICU_SEPARATOR_DECIMAL || (mixed && last_kind != ICU_SEPARATOR_GROUP)) {
+            decimal = last;
+        } else if (separator_count == 1 && last_kind == ICU_SEPARATOR_POINT) {
+            decimal = last;
+        } else if (separator_count == 1 && last_kind == ICU_SEPARATOR_COMMA &&
+                   digit_count - group_ends[last] != 3) {
+            decimal = last;
+        }
     }
 
-    int32_t iStartByte = pMap[iPrev];
-    int32_t iEndByte = pMap[iNext];
-    int nTokenByte = iEndByte - iStartByte;
-    if (nTokenByte <= 0) {
-        return SQLITE_OK;  // Skip empty tokens
+    // The remaining separators must all be of one kind and group the digits
+    int32_t grouping_count = decimal >= 0 ? decimal : separator_count;
+    int32_t integer_end = decimal >= 0 ? group_ends[decimal] : digit_count;
+    for (int32_t i = 0; i < grouping_count; i++) {
+        if (kinds[i] != kinds[0] || kinds[i] == ICU_SEPARATOR_DECIMAL)
+            return 0;
+        int32_t group_start = i > 0 ? group_ends[i - 1] : 0;
+        int32_t group_length = group_ends[i] - group_start;
+        int32_t next_end = i + 1 < grouping_count ? group_ends[i + 1] : integer_end;
+        int32_t next_length = next_end - group_ends[i];
+        if ((i == 0 && group_length > 3) || (i + 1 == grouping_count && next_length != 3) ||
+            (i + 1 < grouping_count && next_length != 2 && next_length != 3) ||
+            (i > 0 && group_length != group_ends[1] - group_ends[0])) {
+            return 0;
+        }
     }
 
-    // Process the token
-    int32_t nSrc = iNext - iPrev;
+    // Integer part without leading zeros, fraction without trailing zeros
+    int32_t start = 0;
+    while (start + 1 < integer_end && digits[start] == '0') {
+        start++;
+    }
+    int32_t fraction_end = digit_count;
+    while (fraction_end > integer_end && digits[fraction_end - 1] == '0') {
+        fraction_end--;
+    }
+    int32_t written = integer_end - start;
+    memcpy(output, digits + start, written);
+    if (fraction_end > integer_end) {
+        output[written++] = '.';
+        memcpy(output + written, digits + integer_end, fraction_end - integer_end);
+        written += fraction_end - integer_end;
+    }
+    return written;
+}
+
+/**
+ * @brief Makes the canonical form of a number token the current token
+ *
+ * @param stream The token stream holding the conversion and scratch buffers
+ * @param iPrev Start position of the token in the UTF-16 buffer
+ * @param iNext End position of the token in the UTF-16 buffer
+ * @param wordStatus Status from the break iterator indicating token type
+ * @param[out] pRewritten Set to 1 if the token was rewritten, 0 if it is not
+ *             a well-formed number
+ * @return SQLITE_OK on success, SQLITE_NOMEM
+ */
+static int set_canonical_number(IcuTokenStream* stream, int32_t iPrev, int32_t iNext,
+                                int32_t wordStatus, int* pRewritten) {
+    IcuScratch* scratch = &stream->scratch;
+    int32_t length = iNext - iPrev;
+    *pRewritten = 0;
+    if (length <= 0 || length > ICU_NUMBER_LIMIT * 2)
+        return SQLITE_OK;
+
+    if (scratch->transliterated_utf8_buffer_size < length + 1) {
+        char* buffer = (char*)icu_memory_realloc(stream->tokenizer->memory,
+                                                 scratch->transliterated_utf8_buffer,
+                                                 length + 1);
+        if (!buffer)
+            return SQLITE_NOMEM;
+        scratch->transliterated_utf8_buffer = buffer;
+        scratch->transliterated_utf8_buffer_size = length + 1;
+    }
+
+    int32_t written = canonical_number(scratch->utf16_text_buffer + iPrev, length,
+                                       scratch->transliterated_utf8_buffer);
+    if (written > 0) {
+        stream->token = scratch->transliterated_utf8_buffer;
+        stream->token_length = written;
+        stream->token_start_byte = scratch->byte_offset_map[iPrev];
+        stream->token_end_byte = scratch->byte_offset_map[iNext];
+        stream->token_rule_status = wordStatus;
+        *pRewritten = 1;
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Normalizes a single token found by the break iterator
+ *
+ * This function handles the ICU transliteration and normalization of a single
+ * token identified by the break iterator and stores the result as the current
+ * token of the stream. The current token is left empty for tokens that are
+ * skipped (spaces, punctuation and empty results).
+ *
+ * @param stream The token stream holding the conversion and scratch buffers
+ * @param iPrev Start position of the token in the UTF-16 buffer
+ * @param iNext End position of the token in the UTF-16 buffer
+ * @param wordStatus Status from the break iterator indicating token type
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+static int normalize_single_token(IcuTokenStream* stream, int32_t iPrev, int32_t iNext,
+                                  int32_t wordStatus) {
+    IcuTokenizerV2* pTokenizer = stream->tokenizer;
+    const UChar* pUText = stream->scratch.utf16_text_buffer;
+    const int32_t* pMap = stream->scratch.byte_offset_map;
+    UChar** buf = &stream->scratch.transliteration_buffer;
+    int32_t* nBuf = &stream->scratch.transliteration_buffer_size;
+    char** dest = &stream->scratch.transliterated_utf8_buffer;
+    int32_t* nDest = &stream->scratch.transliterated_utf8_buffer_size;
+    int result = SQLITE_OK;
+
+    // Check if this token is of interest (not a "none" type)
+    if (wordStatus >= UBRK_WORD_NONE && wordStatus < UBRK_WORD_NONE_LIMIT) {
+        return SQLITE_OK;  // Skip this token, continue processing
+    }
+
+    // Bounds checking for pMap array access
+    if (iPrev < 0 || iPrev >= INT32_MAX / 2 || iNext < 0 || iNext >= INT32_MAX / 2) {
+        return SQLITE_ERROR;
+    }
+
+    int32_t iStartByte = pMap[iPrev];
+    int32_t iEndByte = pMap[iNext];
+    int nTokenByte = iEndByte - iStartByte;
+    if (nTokenByte <= 0) {
+        return SQLITE_OK;  // Skip empty tokens
+    }
+
+    // Process the token
+    int32_t nSrc = iNext - iPrev;
+
+    // A persistent cache hit skips the transliterator; the cached token stays
+    // mapped for as long as the configuration holds the cache
+    IcuNormalizationCache* cache = pTokenizer->config.cache;
+    const char* cached = NULL;
+    int32_t cachedLength = 0;
+    if (cache && icu_cache_lookup(cache, pUText + iPrev, nSrc, &cached, &cachedLength)) {
+        if (cachedLength > 0) {
+            stream->token = cached;
+            stream->token_length = cachedLength;
+            stream->token_start_byte = iStartByte;
+            stream->token_end_byte = iEndByte;
+            stream->token_rule_status = wordStatus;
+        }
+        return SQLITE_OK;
+    }
 
     // Grow buffer if needed for transliteration
     // Use a more conservative estimate for buffer size to handle complex
@@ -356,7 +1284,8 @@ static int process_single_token(IcuTokenizerV2* pTokenizer, UChar* pUText, const
         if (requiredBufSize > (INT32_MAX / sizeof(UChar))) {
             return SQLITE_ERROR;  // Prevent integer overflow
         }
-        UChar* newBuf = (UChar*)sqlite3_realloc(*buf, requiredBufSize * sizeof(UChar));
+        UChar* newBuf = (UChar*)icu_memory_realloc(pTokenizer->memory, *buf,
+                                                   requiredBufSize * sizeof(UChar));
         if (!newBuf) {
             return SQLITE_NOMEM;
         }
@@ -377,7 +1306,11 @@ static int process_single_token(IcuTokenizerV2* pTokenizer, UChar* pUText, const
 
     UErrorCode status = U_ZERO_ERROR;
     int32_t limit = copyLen;
+    ICU_PROBE1(translit__start, copyLen);
+    sqlite3_int64 translit_start = stage_start(stream);
     utrans_transUChars(pTokenizer->pTransliterator, *buf, &copyLen, *nBuf, 0, &limit, &status);
+    stage_stop(stream, ICU_STAGE_TRANSLITERATE, translit_start);
+    ICU_PROBE2(translit__done, srcLength, copyLen);
     if (U_FAILURE(status)) {
         return SQLITE_ERROR;
     }
@@ -399,7 +1332,7 @@ static int process_single_token(IcuTokenizerV2* pTokenizer, UChar* pUText, const
     requiredDestSize = (copyLen * 8) + 4096;  // Increased multiplier to handle all possible
                                               // expansions
     if (*nDest < requiredDestSize) {
-        char* newDest = (char*)sqlite3_realloc(*dest, requiredDestSize);
+        char* newDest = (char*)icu_memory_realloc(pTokenizer->memory, *dest, requiredDestSize);
         if (!newDest) {
             return SQLITE_NOMEM;
         }
@@ -427,141 +1360,1480 @@ static int process_single_token(IcuTokenizerV2* pTokenizer, UChar* pUText, const
         return SQLITE_ERROR;
     }
 
+    if (cache && utf8Len <= *nDest)
+        icu_cache_insert(cache, pUText + iPrev, nSrc, *dest, utf8Len);
+
     // Ensure we don't pass invalid parameters to xToken
     if (*dest && utf8Len > 0) {
         // Handle case where utf8Len might exceed buffer but ICU
         // truncated the output
-        int safeLen = (utf8Len <= *nDest) ? utf8Len : *nDest;
-        if (xToken(pCtx, 0, *dest, safeLen, iStartByte, iEndByte) != SQLITE_OK) {
-            return SQLITE_ERROR;
+        stream->token = *dest;
+        stream->token_length = (utf8Len <= *nDest) ? utf8Len : *nDest;
+        stream->token_start_byte = iStartByte;
+        stream->token_end_byte = iEndByte;
+        stream->token_rule_status = wordStatus;
+    }
+
+    return result;
+}
+
+/**
+ * @brief Adds the native-script form of the current token
+ *
+ * The source of the token is run through the native rule chain. If the
+ * result differs from the normalized token, it becomes the current token and
+ * the normalized token its colocated alternate, or replaces the normalized
+ * token altogether for queries.
+ *
+ * @param stream The token stream positioned on a token
+ * @param iPrev Start position of the token in the UTF-16 buffer
+ * @param iNext End position of the token in the UTF-16 buffer
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+static int add_native_form(IcuTokenStream* stream, int32_t iPrev, int32_t iNext) {
+    IcuScratch* scratch = &stream->scratch;
+    IcuMemoryAccount* memory = stream->tokenizer->memory;
+    int32_t nSrc = iNext - iPrev;
+
+    // Lower and NFKC can expand a code unit to a few; the fallback copes
+    // with anything longer
+    if (nSrc > (INT32_MAX / (int32_t)sizeof(UChar) - 2048) / 6) {
+        return SQLITE_TOOBIG;
+    }
+    int32_t required_size = nSrc * 6 + 2048;
+    if (scratch->transliteration_buffer_size < required_size) {
+        UChar* buffer = (UChar*)icu_memory_realloc(memory, scratch->transliteration_buffer,
+                                                   required_size * sizeof(UChar));
+        if (!buffer)
+            return SQLITE_NOMEM;
+        scratch->transliteration_buffer = buffer;
+        scratch->transliteration_buffer_size = required_size;
+    }
+
+    u_memcpy(scratch->transliteration_buffer, scratch->utf16_text_buffer + iPrev, nSrc);
+    int32_t length = nSrc;
+    int32_t limit = nSrc;
+    UErrorCode status = U_ZERO_ERROR;
+    sqlite3_int64 translit_start = stage_start(stream);
+    utrans_transUChars(stream->tokenizer->pNativeTransliterator, scratch->transliteration_buffer,
+                       &length, scratch->transliteration_buffer_size, 0, &limit, &status);
+    stage_stop(stream, ICU_STAGE_TRANSLITERATE, translit_start);
+    if (U_FAILURE(status) || length > scratch->transliteration_buffer_size) {
+        return SQLITE_ERROR;
+    }
+
+    // A UTF-16 code unit never needs more than 3 UTF-8 bytes
+    int32_t utf8_size = length * 3 + 1;
+    if (scratch->native_utf8_buffer_size < utf8_size) {
+        char* buffer = (char*)icu_memory_realloc(memory, scratch->native_utf8_buffer, utf8_size);
+        if (!buffer)
+            return SQLITE_NOMEM;
+        scratch->native_utf8_buffer = buffer;
+        scratch->native_utf8_buffer_size = utf8_size;
+    }
+    int32_t utf8_length = 0;
+    status = U_ZERO_ERROR;
+    u_strToUTF8WithSub(scratch->native_utf8_buffer, scratch->native_utf8_buffer_size,
+                       &utf8_length, scratch->transliteration_buffer, length, 0xFFFD, NULL,
+                       &status);
+    if (U_FAILURE(status) || utf8_length > scratch->native_utf8_buffer_size) {
+        return SQLITE_ERROR;
+    }
+
+    if (utf8_length == 0 || (utf8_length == stream->token_length &&
+                             memcmp(scratch->native_utf8_buffer, stream->token, utf8_length) == 0)) {
+        return SQLITE_OK;  // Nothing to add
+    }
+    if (!stream->native_only) {
+        stream->alternate_token = stream->token;
+        stream->alternate_length = stream->token_length;
+    }
+    stream->token = scratch->native_utf8_buffer;
+    stream->token_length = utf8_length;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Lowercases an ASCII word without the rule chain
+ *
+ * Every built-in rule chain maps a word of ASCII letters, digits and
+ * underscores to its ASCII lowercase form. For tokenizers with a plain
+ * configuration (see is_plain_words()), such a word is copied in lowercase
+ * into a buffer of exactly its length, skipping the transliterator and the
+ * conversion back to UTF-8. A word is ASCII if it is as long in UTF-16 as in
+ * UTF-8.
+ *
+ * @param stream The token stream
+ * @param iPrev Start position of the token in the UTF-16 buffer
+ * @param iNext End position of the token in the UTF-16 buffer
+ * @param wordStatus Status from the break iterator indicating token type
+ * @param[out] pFolded Set to 1 if the word was folded and is the current token
+ * @return SQLITE_OK, or SQLITE_NOMEM
+ */
+static int fold_ascii_token(IcuTokenStream* stream, int32_t iPrev, int32_t iNext,
+                            int32_t wordStatus, int* pFolded) {
+    if (wordStatus >= UBRK_WORD_NONE && wordStatus < UBRK_WORD_NONE_LIMIT)
+        return SQLITE_OK;
+
+    IcuScratch* scratch = &stream->scratch;
+    int32_t iStartByte = scratch->byte_offset_map[iPrev];
+    int nTokenByte = scratch->byte_offset_map[iNext] - iStartByte;
+    if (nTokenByte != iNext - iPrev || nTokenByte <= 0)
+        return SQLITE_OK;
+
+    if (scratch->transliterated_utf8_buffer_size < nTokenByte) {
+        char* buffer = (char*)icu_memory_realloc(stream->tokenizer->memory,
+                                                 scratch->transliterated_utf8_buffer, nTokenByte);
+        if (!buffer)
+            return SQLITE_NOMEM;
+        scratch->transliterated_utf8_buffer = buffer;
+        scratch->transliterated_utf8_buffer_size = nTokenByte;
+    }
+    const char* text = stream->text + iStartByte;
+    char* output = scratch->transliterated_utf8_buffer;
+    for (int i = 0; i < nTokenByte; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if ((unsigned char)(c - 'A') < 26) {
+            c += 'a' - 'A';
+        } else if ((unsigned char)(c - 'a') >= 26 && (unsigned char)(c - '0') >= 10 && c != '_') {
+            return SQLITE_OK;
         }
+        output[i] = (char)c;
     }
 
+    stream->token = output;
+    stream->token_length = nTokenByte;
+    stream->token_start_byte = iStartByte;
+    stream->token_end_byte = iStartByte + nTokenByte;
+    stream->token_rule_status = wordStatus;
+    *pFolded = 1;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Process a single token found by the break iterator
+ *
+ * Stores the normalized token as the current token of the stream, or leaves
+ * the current token unchanged for skipped tokens (see
+ * normalize_single_token()). With "numbers canonical", well-formed numbers
+ * bypass the rule chain (see canonical_number()). With "native 1", words and
+ * dictionary segments also get their native-script form (see
+ * add_native_form()).
+ *
+ * @param stream The token stream holding the conversion and scratch buffers
+ * @param iPrev Start position of the token in the UTF-16 buffer
+ * @param iNext End position of the token in the UTF-16 buffer
+ * @param wordStatus Status from the break iterator indicating token type
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+static int process_single_token(IcuTokenStream* stream, int32_t iPrev, int32_t iNext,
+                                int32_t wordStatus) {
+    ICU_PROBE1(token__start, iNext - iPrev);
+    if (stream->tokenizer->plain_words) {
+        int folded = 0;
+        int result = fold_ascii_token(stream, iPrev, iNext, wordStatus, &folded);
+        if (result != SQLITE_OK || folded) {
+            ICU_PROBE3(token__done, iNext - iPrev, stream->token_length, result);
+            return result;
+        }
+    }
+    if (stream->tokenizer->config.canonical_numbers && wordStatus >= UBRK_WORD_NUMBER &&
+        wordStatus < UBRK_WORD_NUMBER_LIMIT) {
+        int rewritten = 0;
+        int result = set_canonical_number(stream, iPrev, iNext, wordStatus, &rewritten);
+        if (result != SQLITE_OK || rewritten) {
+            ICU_PROBE3(token__done, iNext - iPrev, stream->token_length, result);
+            return result;
+        }
+    }
+    int result = normalize_single_token(stream, iPrev, iNext, wordStatus);
+    if (result == SQLITE_OK && stream->token_length > 0 &&
+        stream->tokenizer->pNativeTransliterator && stream->run_kind != ICU_RUN_BIGRAMS) {
+        result = add_native_form(stream, iPrev, iNext);
+    }
+    ICU_PROBE3(token__done, iNext - iPrev, stream->token_length, result);
     return result;
 }
 
 // ========================================================================
-// === CORE TOKENIZATION FUNCTION (xTokenize) =============================
+// === TOKEN STREAM =======================================================
 // ========================================================================
 
-static int icuTokenize(Fts5Tokenizer* pTok, void* pCtx, int flags, const char* pText, int nText,
-                       const char* pLocale, int nLocale,
-                       int (*xToken)(void* pCtx, int tflags, const char* pToken, int nToken,
-                                     int iStart, int iEnd)) {
-    UNUSED_PARAMETER(flags);
-    UNUSED_PARAMETER(pLocale);
-    UNUSED_PARAMETER(nLocale);
+/** Longest word of the full path in code points; longer words are cut into pieces */
+#define ICU_WORD_LIMIT 256
 
-    IcuTokenizerV2* pTokenizer = (IcuTokenizerV2*)pTok;
+/**
+ * @brief Checks whether a configuration splits documents into script runs
+ *
+ * @param pConfig The tokenizer configuration
+ * @return Non-zero if some text bypasses the break iterator
+ */
+static int is_segmented_by_script(const IcuTokenizerConfig* pConfig) {
+    return pConfig->cjk_bigrams || pConfig->dictionary || pConfig->trigrams;
+}
+
+/**
+ * @brief Points the break iterator at a range of the converted text
+ *
+ * @param stream The token stream
+ * @param start Start of the range in the UTF-16 text
+ * @param end End of the range in the UTF-16 text
+ * @return SQLITE_OK on success, SQLITE_ERROR if ICU fails
+ */
+static int set_break_text(IcuTokenStream* stream, int32_t start, int32_t end) {
+    UBreakIterator* pBreakIterator = stream->tokenizer->pBreakIterator;
     UErrorCode status = U_ZERO_ERROR;
+    ubrk_setText(pBreakIterator, stream->scratch.utf16_text_buffer + start, end - start, &status);
+    if (U_FAILURE(status)) {
+        return SQLITE_ERROR;
+    }
+    stream->break_offset = start;
+    stream->break_position = ubrk_first(pBreakIterator);
+    return SQLITE_OK;
+}
 
-    if (!pText || nText <= 0)
+/**
+ * @brief Opens a token stream over a document
+ *
+ * Converts the document to UTF-16 and attaches it to the tokenizer's break
+ * iterator. The stream must be released with icu_token_stream_close() even if
+ * this function fails.
+ *
+ * @param stream The stream to initialize
+ * @param pTokenizer The tokenizer whose ICU objects are used
+ * @param pText Input UTF-8 text; must stay valid until the stream is closed
+ * @param nText Length of input text
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+int icu_token_stream_open(IcuTokenStream* stream, IcuTokenizerV2* pTokenizer, const char* pText,
+                          int nText) {
+    memset(stream, 0, sizeof(IcuTokenStream));
+    stream->tokenizer = pTokenizer;
+    stream->text = pText;
+    stream->text_length = nText;
+
+    if (!pText || nText <= 0) {
+        stream->finished = 1;
         return SQLITE_OK;
+    }
 
     // Step 1: Allocate buffers for UTF-8 to UTF-16 conversion and byte
-    // offset mapping
-    UChar* utf16_text_buffer = NULL;
-    int32_t* byte_offset_map = NULL;
-    int32_t utf16_buffer_size, map_buffer_size;
+    // offset mapping, reusing the buffers retained by the tokenizer
+    icu_scratch_acquire(pTokenizer->memory, &stream->scratch);
+    int32_t utf16_buffer_size;
 
-    int result = allocate_conversion_buffers(nText, &utf16_text_buffer, &byte_offset_map,
-                                             &utf16_buffer_size, &map_buffer_size);
+    int result =
+      allocate_conversion_buffers(pTokenizer->memory, nText, &stream->scratch, &utf16_buffer_size);
     if (result != SQLITE_OK) {
-        return result;  // Error already handled in the allocation
-                        // function
+        return result;
     }
 
     // Step 2: Validate buffer size against actual code point count
-    result = validate_buffer_size(pText, nText, utf16_buffer_size, utf16_text_buffer,
-                                  byte_offset_map);
+    result = validate_buffer_size(pText, nText, utf16_buffer_size);
     if (result != SQLITE_OK) {
-        return result;  // Error already handled in the validation
-                        // function
+        return result;
     }
+    UChar* utf16_text_buffer = stream->scratch.utf16_text_buffer;
 
     // Step 3: Convert UTF-8 to UTF-16 with position mapping
-    int32_t utf16_text_length = convert_utf8_to_utf16_with_mapping(
-      pText, nText, utf16_text_buffer, utf16_buffer_size, byte_offset_map);
+    stream->utf16_text_length = convert_utf8_to_utf16_with_mapping(
+      pText, nText, utf16_text_buffer, utf16_buffer_size, stream->scratch.byte_offset_map);
+
+    if (stream->utf16_text_length < 0) {
+        return SQLITE_ERROR;  // Error occurred in conversion
+    }
 
-    if (utf16_text_length < 0) {
-        // Error occurred in conversion
-        sqlite3_free(utf16_text_buffer);
-        sqlite3_free(byte_offset_map);
+    // Step 4: With bigrams or a user dictionary the text is split into
+    // script runs as it is consumed; the first call opens the first run
+    if (is_segmented_by_script(&pTokenizer->config)) {
+        stream->run_kind = ICU_RUN_NONE;
+        return SQLITE_OK;
+    }
+
+    // Otherwise the whole text is a single run for the break iterator
+    stream->run_kind = ICU_RUN_WORDS;
+    stream->run_end = stream->utf16_text_length;
+    return set_break_text(stream, 0, stream->utf16_text_length);
+}
+
+/**
+ * @brief Returns the script of a code point for run classification
+ *
+ * The prolonged sound mark and the iteration marks are Common script but
+ * belong to the surrounding Kana or Han word, so they are reported as Han.
+ *
+ * @param c The code point
+ * @return The script code, or USCRIPT_INVALID_CODE on failure
+ */
+static UScriptCode run_script(UChar32 c) {
+    if (c == 0x30FC || c == 0x3005 || c == 0x309D || c == 0x309E || c == 0x30FD || c == 0x30FE)
+        return USCRIPT_HAN;
+
+    UErrorCode status = U_ZERO_ERROR;
+    UScriptCode script = uscript_getScript(c, &status);
+    return U_FAILURE(status) ? USCRIPT_INVALID_CODE : script;
+}
+
+/**
+ * @brief Decides how the run containing a code point is segmented
+ *
+ * @param pConfig The tokenizer configuration
+ * @param c The code point
+ * @return ICU_RUN_TRIGRAMS for letters, marks and digits and ICU_RUN_NONE
+ *         for everything else in trigram mode, ICU_RUN_BIGRAMS for Han, Kana
+ *         and Hangul in bigram mode, ICU_RUN_DICTIONARY for Han, Kana and
+ *         Southeast Asian scripts with a user dictionary, ICU_RUN_WORDS
+ *         otherwise
+ */
+static IcuRunKind classify_code_point(const IcuTokenizerConfig* pConfig, UChar32 c) {
+    // Trigram mode indexes letters, marks and digits and skips the rest
+    if (pConfig->trigrams) {
+        return (U_GET_GC_MASK(c) & (U_GC_L_MASK | U_GC_M_MASK | U_GC_N_MASK)) ? ICU_RUN_TRIGRAMS
+                                                                              : ICU_RUN_NONE;
+    }
+
+    UScriptCode script = run_script(c);
+    switch (script) {
+        case USCRIPT_HAN:
+        case USCRIPT_HIRAGANA:
+        case USCRIPT_KATAKANA:
+            if (pConfig->cjk_bigrams)
+                return ICU_RUN_BIGRAMS;
+            return pConfig->dictionary ? ICU_RUN_DICTIONARY : ICU_RUN_WORDS;
+        case USCRIPT_HANGUL:
+            return pConfig->cjk_bigrams ? ICU_RUN_BIGRAMS : ICU_RUN_WORDS;
+        case USCRIPT_THAI:
+        case USCRIPT_LAO:
+        case USCRIPT_KHMER:
+        case USCRIPT_MYANMAR:
+            return pConfig->dictionary ? ICU_RUN_DICTIONARY : ICU_RUN_WORDS;
+        default:
+            return ICU_RUN_WORDS;
+    }
+}
+
+/**
+ * @brief Runs the rule chain over the whole current run into run_buffer
+ *
+ * @param stream The token stream positioned on a run
+ * @param[out] pNormalizedLength Receives the length of the normalized run
+ * @return SQLITE_OK on success, SQLITE_TOOBIG if the run is too long to
+ *         normalize in one piece, or another error code
+ */
+static int transliterate_run(IcuTokenStream* stream, int32_t* pNormalizedLength) {
+    IcuScratch* scratch = &stream->scratch;
+    const UChar* run = scratch->utf16_text_buffer + stream->run_start;
+    int32_t run_length = stream->run_end - stream->run_start;
+
+    if (run_length > (INT32_MAX / (int32_t)sizeof(UChar) - 2048) / 6) {
+        return SQLITE_TOOBIG;
+    }
+    int32_t required_size = run_length * 6 + 2048;
+    if (scratch->run_buffer_size < required_size) {
+        UChar* run_buffer = (UChar*)icu_memory_realloc(stream->tokenizer->memory,
+                                                       scratch->run_buffer,
+                                                       required_size * sizeof(UChar));
+        if (!run_buffer)
+            return SQLITE_NOMEM;
+        scratch->run_buffer = run_buffer;
+        scratch->run_buffer_size = required_size;
+    }
+
+    u_memcpy(scratch->run_buffer, run, run_length);
+    int32_t normalized_length = run_length;
+    int32_t limit = run_length;
+    UErrorCode status = U_ZERO_ERROR;
+    ICU_PROBE1(translit__start, run_length);
+    sqlite3_int64 translit_start = stage_start(stream);
+    utrans_transUChars(stream->tokenizer->pTransliterator, scratch->run_buffer, &normalized_length,
+                       scratch->run_buffer_size, 0, &limit, &status);
+    stage_stop(stream, ICU_STAGE_TRANSLITERATE, translit_start);
+    ICU_PROBE2(translit__done, run_length, normalized_length);
+    if (U_FAILURE(status) || normalized_length > scratch->run_buffer_size) {
         return SQLITE_ERROR;
     }
 
-    // Step 4: Set text for break iterator
-    ubrk_setText(pTokenizer->pBreakIterator, utf16_text_buffer, utf16_text_length, &status);
-    if (U_FAILURE(status)) {
-        sqlite3_free(utf16_text_buffer);
-        sqlite3_free(byte_offset_map);
+    *pNormalizedLength = normalized_length;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Runs the rule chain over a whole CJK run
+ *
+ * Transliterating the run once is much cheaper than transliterating every
+ * bigram, which would process each code point twice. The normalized run can
+ * only be sliced into bigrams if the rule chain mapped it code point for
+ * code point (as with Traditional-Simplified or Katakana-Hiragana); otherwise
+ * run_normalized_length is set to -1 and each bigram is normalized on its
+ * own.
+ *
+ * @param stream The token stream positioned on a CJK run
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+static int normalize_cjk_run(IcuTokenStream* stream) {
+    const UChar* run = stream->scratch.utf16_text_buffer + stream->run_start;
+    int32_t run_length = stream->run_end - stream->run_start;
+
+    stream->run_normalized_length = -1;
+    stream->run_normalized_position = 0;
+    int32_t normalized_length = 0;
+    int result = transliterate_run(stream, &normalized_length);
+    if (result == SQLITE_TOOBIG) {
+        return SQLITE_OK;  // Too long to normalize in one piece
+    }
+    if (result != SQLITE_OK) {
+        return result;
+    }
+
+    if (u_countChar32(stream->scratch.run_buffer, normalized_length) ==
+        u_countChar32(run, run_length)) {
+        stream->run_normalized_length = normalized_length;
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Runs the rule chain over a whole trigram run
+ *
+ * Trigrams are taken from the normalized run, so the rule chain runs once
+ * per run however many trigrams it yields.
+ *
+ * @param stream The token stream positioned on a trigram run
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+static int normalize_trigram_run(IcuTokenStream* stream) {
+    const UChar* run = stream->scratch.utf16_text_buffer + stream->run_start;
+    int32_t run_length = stream->run_end - stream->run_start;
+
+    int32_t normalized_length = 0;
+    int result = transliterate_run(stream, &normalized_length);
+    if (result != SQLITE_OK) {
+        return result;
+    }
+
+    stream->run_normalized_length = normalized_length;
+    stream->run_normalized_position = 0;
+    stream->run_code_points = u_countChar32(run, run_length);
+    stream->normalized_code_points = u_countChar32(stream->scratch.run_buffer, normalized_length);
+    stream->trigram_index = 0;
+    stream->origin_start = stream->run_start;
+    stream->origin_start_index = 0;
+    stream->origin_end = stream->run_start;
+    stream->origin_end_index = 0;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Sets the current token to a slice of the normalized run
+ *
+ * @param stream The token stream
+ * @param normalized_start Start of the slice in run_buffer
+ * @param normalized_end End of the slice in run_buffer
+ * @param token_start Start of the token in the UTF-16 text
+ * @param token_end End of the token in the UTF-16 text
+ * @param rule_status Rule status reported for the token
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+static int set_normalized_token(IcuTokenStream* stream, int32_t normalized_start,
+                                int32_t normalized_end, int32_t token_start, int32_t token_end,
+                                int32_t rule_status) {
+    IcuScratch* scratch = &stream->scratch;
+    int32_t length = normalized_end - normalized_start;
+
+    // A UTF-16 code unit never needs more than 3 UTF-8 bytes
+    int32_t required_size = length * 3 + 1;
+    if (scratch->transliterated_utf8_buffer_size < required_size) {
+        char* utf8_buffer = (char*)icu_memory_realloc(
+          stream->tokenizer->memory, scratch->transliterated_utf8_buffer, required_size);
+        if (!utf8_buffer)
+            return SQLITE_NOMEM;
+        scratch->transliterated_utf8_buffer = utf8_buffer;
+        scratch->transliterated_utf8_buffer_size = required_size;
+    }
+
+    int32_t utf8_length = 0;
+    UErrorCode status = U_ZERO_ERROR;
+    u_strToUTF8WithSub(scratch->transliterated_utf8_buffer,
+                       scratch->transliterated_utf8_buffer_size, &utf8_length,
+                       scratch->run_buffer + normalized_start, length, 0xFFFD, NULL, &status);
+    if (U_FAILURE(status) || utf8_length > scratch->transliterated_utf8_buffer_size) {
         return SQLITE_ERROR;
     }
 
-    // Step 5: Initialize dynamic buffers for normalized text
-    UChar* transliteration_buffer = NULL;
-    char* transliterated_utf8_buffer = NULL;
-    int32_t transliteration_buffer_size = 0;
-    int32_t transliterated_utf8_buffer_size = 0;
+    stream->token = scratch->transliterated_utf8_buffer;
+    stream->token_length = utf8_length;
+    stream->token_start_byte = scratch->byte_offset_map[token_start];
+    stream->token_end_byte = scratch->byte_offset_map[token_end];
+    stream->token_rule_status = rule_status;
+    return SQLITE_OK;
+}
 
-    // Step 6: Process tokens identified by the break iterator
-    int32_t token_start = ubrk_first(pTokenizer->pBreakIterator);
-    int32_t token_end;
+/**
+ * @brief Segments a dictionary run with the user dictionary
+ *
+ * @param stream The token stream positioned on a dictionary run
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+static int segment_dictionary_run(IcuTokenStream* stream) {
+    IcuScratch* scratch = &stream->scratch;
+    int32_t run_length = stream->run_end - stream->run_start;
+    if (run_length > INT32_MAX / 2 / (int32_t)sizeof(int32_t)) {
+        return SQLITE_ERROR;  // Prevent integer overflow
+    }
+
+    int32_t required_size = run_length * 2;
+    if (scratch->segment_buffer_size < required_size) {
+        int32_t* segment_buffer = (int32_t*)icu_memory_realloc(
+          stream->tokenizer->memory, scratch->segment_buffer, required_size * sizeof(int32_t));
+        if (!segment_buffer)
+            return SQLITE_NOMEM;
+        scratch->segment_buffer = segment_buffer;
+        scratch->segment_buffer_size = required_size;
+    }
+
+    stream->segment_count =
+      icu_dictionary_segment(stream->tokenizer->config.dictionary, scratch->utf16_text_buffer,
+                             stream->run_start, stream->run_end, scratch->segment_buffer);
+    stream->segment_index = 0;
+    stream->segment_start = stream->run_start;
+    stream->in_gap = 0;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Switches the rest of a stream to the degraded path
+ *
+ * Called before the full path would exceed the time or work budget of the
+ * call. Tokenization resumes where the full path stopped, so no text is
+ * tokenized twice or skipped.
+ *
+ * @param stream The token stream
+ * @param position Text position where the degraded path starts
+ */
+static void degrade_stream(IcuTokenStream* stream, int32_t position) {
+    stream->degraded = 1;
+    stream->degraded_start = position;
+    stream->degraded_position = position;
+}
+
+/**
+ * @brief Checks whether the next piece of work would exceed the budget
+ *
+ * Called before a token or run is broken, segmented or transliterated, so a
+ * single huge word and text without any token are bounded as well.
+ *
+ * @param stream The token stream
+ * @param end Text position where the piece of work ends
+ * @return Non-zero if the piece ends past the work budget or the time
+ *         budget is spent
+ */
+static int over_budget(const IcuTokenStream* stream, int32_t end) {
+    if (stream->work_budget && stream->scratch.byte_offset_map[end] > stream->work_budget)
+        return 1;
+    return stream->deadline_ns && icu_slow_log_clock() >= stream->deadline_ns;
+}
 
-    while ((token_end = ubrk_next(pTokenizer->pBreakIterator)) != UBRK_DONE) {
-        // Bounds checking for array access - ensure positions are
-        // within our UTF-16 buffer
-        if (token_start < 0 || token_end < 0 || token_start > utf16_buffer_size ||
-            token_end > utf16_buffer_size) {
-            result = SQLITE_ERROR;
+/**
+ * @brief Advances a script-segmented stream to the next script run
+ *
+ * A run is a maximal sequence of code points that are segmented the same
+ * way (see classify_code_point()). Runs for the break iterator are handed to
+ * it on their own, so ICU's dictionary engine never sees the text that is
+ * segmented into bigrams or with the user dictionary.
+ *
+ * @param stream The token stream; the previous run must be exhausted
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+static int open_next_run(IcuTokenStream* stream) {
+    const IcuTokenizerConfig* pConfig = &stream->tokenizer->config;
+    const UChar* text = stream->scratch.utf16_text_buffer;
+    int32_t length = stream->utf16_text_length;
+    int32_t position = stream->run_end;
+
+    UChar32 c;
+    U16_NEXT(text, position, length, c);
+    IcuRunKind run_kind = classify_code_point(pConfig, c);
+    int32_t run_end = position;
+    while (run_end < length) {
+        U16_NEXT(text, position, length, c);
+        if (classify_code_point(pConfig, c) != run_kind)
             break;
+        run_end = position;
+    }
+
+    stream->run_start = stream->run_end;
+    stream->run_end = run_end;
+    stream->run_kind = run_kind;
+
+    // Bigram, trigram and dictionary runs are processed as a whole when
+    // they are opened
+    if (run_kind != ICU_RUN_WORDS && run_kind != ICU_RUN_NONE && over_budget(stream, run_end)) {
+        degrade_stream(stream, stream->run_start);
+        return SQLITE_OK;
+    }
+    switch (run_kind) {
+        case ICU_RUN_BIGRAMS:
+            stream->cjk_position = stream->run_start;
+            return normalize_cjk_run(stream);
+        case ICU_RUN_DICTIONARY:
+            return segment_dictionary_run(stream);
+        case ICU_RUN_TRIGRAMS:
+            return normalize_trigram_run(stream);
+        case ICU_RUN_NONE:
+            return SQLITE_OK;  // Separators produce no tokens
+        default:
+            return set_break_text(stream, stream->run_start, run_end);
+    }
+}
+
+/**
+ * @brief Produces the next bigram of a CJK run
+ *
+ * Each code point starts a bigram with its successor, so a run of n code
+ * points yields n - 1 overlapping bigrams. A run of a single code point
+ * yields that code point.
+ *
+ * @param stream The token stream
+ * @return SQLITE_ROW if a token is available, SQLITE_DONE at the end of the
+ *         run, or an error code
+ */
+static int next_bigram_in_run(IcuTokenStream* stream) {
+    const UChar* text = stream->scratch.utf16_text_buffer;
+
+    while (stream->cjk_position < stream->run_end) {
+        int32_t token_start = stream->cjk_position;
+        int32_t second = token_start;
+        U16_FWD_1(text, second, stream->run_end);
+        int32_t token_end = second;
+        if (second < stream->run_end) {
+            U16_FWD_1(text, token_end, stream->run_end);
+        } else if (token_start != stream->run_start) {
+            break;  // The last code point is already part of a bigram
+        }
+        stream->cjk_position = second;
+
+        stream->token_length = 0;
+        int result;
+        if (stream->run_normalized_length >= 0) {
+            // Slice the bigram out of the normalized run
+            const UChar* normalized = stream->scratch.run_buffer;
+            int32_t length = stream->run_normalized_length;
+            int32_t normalized_start = stream->run_normalized_position;
+            int32_t normalized_second = normalized_start;
+            U16_FWD_1(normalized, normalized_second, length);
+            int32_t normalized_end = normalized_second;
+            if (token_end != second) {
+                U16_FWD_1(normalized, normalized_end, length);
+            }
+            stream->run_normalized_position = normalized_second;
+            result = set_normalized_token(stream, normalized_start, normalized_end, token_start,
+                                          token_end, UBRK_WORD_IDEO);
+        } else {
+            result = process_single_token(stream, token_start, token_end, UBRK_WORD_IDEO);
+        }
+        if (result != SQLITE_OK) {
+            return result;
         }
+        if (stream->token_length > 0) {
+            return SQLITE_ROW;
+        }
+    }
+    return SQLITE_DONE;
+}
 
-        int32_t word_status = ubrk_getRuleStatus(pTokenizer->pBreakIterator);
+/**
+ * @brief Moves a position in the current run forward to a code point index
+ *
+ * @param stream The token stream
+ * @param[in,out] pPosition Text position of code point *pIndex of the run
+ * @param[in,out] pIndex Code point index within the run
+ * @param target Code point index to move to; never before *pIndex
+ */
+static void advance_in_run(IcuTokenStream* stream, int32_t* pPosition, int32_t* pIndex,
+                           int32_t target) {
+    const UChar* text = stream->scratch.utf16_text_buffer;
+    while (*pIndex < target && *pPosition < stream->run_end) {
+        U16_FWD_1(text, *pPosition, stream->run_end);
+        (*pIndex)++;
+    }
+}
+
+/**
+ * @brief Produces the next trigram of a trigram run
+ *
+ * Trigrams are cut from the normalized run. Their offsets are those of the
+ * original code points they came from when the rule chain maps the run code
+ * point for code point. When it does not (transliteration to Latin, for
+ * example), normalized code points are mapped onto the original run in
+ * proportion, which keeps offsets inside the run and in document order. A
+ * run that normalizes to fewer than three code points is a single token.
+ *
+ * @param stream The token stream
+ * @return SQLITE_ROW if a token is available, SQLITE_DONE at the end of the
+ *         run, or an error code
+ */
+static int next_trigram_in_run(IcuTokenStream* stream) {
+    int32_t normalized_count = stream->normalized_code_points;
+    int32_t index = stream->trigram_index;
+    if (normalized_count == 0 || index > (normalized_count < 3 ? 0 : normalized_count - 3)) {
+        return SQLITE_DONE;
+    }
+    stream->trigram_index = index + 1;
+
+    // Slice the trigram out of the normalized run
+    const UChar* normalized = stream->scratch.run_buffer;
+    int32_t length = stream->run_normalized_length;
+    int32_t normalized_start = stream->run_normalized_position;
+    int32_t normalized_end = normalized_start;
+    U16_FWD_1(normalized, stream->run_normalized_position, length);
+    U16_FWD_N(normalized, normalized_end, length, 3);
+
+    // Map the normalized code points back onto the original run
+    sqlite3_int64 run_count = stream->run_code_points;
+    int32_t end_index = index + 3 < normalized_count ? index + 3 : normalized_count;
+    int32_t origin_start_index = index;
+    int32_t origin_end_index = end_index;
+    if (normalized_count != run_count) {
+        origin_start_index = (int32_t)(index * run_count / normalized_count);
+        origin_end_index =
+          (int32_t)((end_index * run_count + normalized_count - 1) / normalized_count);
+    }
+    if (normalized_count < 3) {
+        origin_end_index = (int32_t)run_count;
+    }
+    advance_in_run(stream, &stream->origin_start, &stream->origin_start_index, origin_start_index);
+    advance_in_run(stream, &stream->origin_end, &stream->origin_end_index, origin_end_index);
+
+    int result = set_normalized_token(stream, normalized_start, normalized_end,
+                                      stream->origin_start, stream->origin_end, UBRK_WORD_LETTER);
+    return result == SQLITE_OK ? SQLITE_ROW : result;
+}
+
+/**
+ * @brief Produces the next word from the break iterator
+ *
+ * Words longer than ICU_WORD_LIMIT code points are cut into pieces of that
+ * length, so that one token never costs more than a bounded amount of
+ * transliteration. When the budget of the call would be exceeded by the
+ * next word, the stream degrades at its start and SQLITE_DONE is returned.
+ *
+ * @param stream The token stream
+ * @return SQLITE_ROW if a token is available, SQLITE_DONE once the text
+ *         given to the break iterator is exhausted, or an error code
+ */
+static int next_word_in_run(IcuTokenStream* stream) {
+    UBreakIterator* pBreakIterator = stream->tokenizer->pBreakIterator;
+    const UChar* text = stream->scratch.utf16_text_buffer;
+
+    for (;;) {
+        int32_t token_start;
+        int32_t token_end;
+        int32_t word_status;
+        if (stream->piece_start < stream->piece_end) {
+            // The rest of a cut word
+            token_start = stream->piece_start;
+            token_end = stream->piece_end;
+            word_status = stream->piece_rule_status;
+            stream->piece_start = stream->piece_end;
+        } else {
+            token_start = stream->break_position;
+            ICU_PROBE1(break__start, token_start);
+            sqlite3_int64 break_start = stage_start(stream);
+            token_end = ubrk_next(pBreakIterator);
+            stage_stop(stream, ICU_STAGE_BREAK, break_start);
+            ICU_PROBE2(break__done, token_start, token_end);
+            if (token_end == UBRK_DONE) {
+                return SQLITE_DONE;
+            }
+            stream->break_position = token_end;
+
+            // Break positions are relative to the text given to the iterator
+            token_start += stream->break_offset;
+            token_end += stream->break_offset;
+
+            // Bounds checking for array access - ensure positions are
+            // within our UTF-16 buffer
+            if (token_start < 0 || token_end < 0 ||
+                token_start > stream->scratch.utf16_buffer_size ||
+                token_end > stream->scratch.utf16_buffer_size) {
+                return SQLITE_ERROR;
+            }
+            word_status = ubrk_getRuleStatus(pBreakIterator);
+        }
+
+        if (token_end - token_start > ICU_WORD_LIMIT) {
+            int32_t cut = token_start;
+            U16_FWD_N(text, cut, token_end, ICU_WORD_LIMIT);
+            if (cut < token_end) {
+                stream->piece_start = cut;
+                stream->piece_end = token_end;
+                stream->piece_rule_status = word_status;
+                token_end = cut;
+            }
+        }
+
+        if ((stream->work_budget || stream->deadline_ns) && over_budget(stream, token_end)) {
+            degrade_stream(stream, token_start);
+            return SQLITE_DONE;
+        }
 
         // Process the current token
-        result = process_single_token(pTokenizer, utf16_text_buffer, byte_offset_map, token_start,
-                                      token_end, pCtx, xToken, word_status, &transliteration_buffer,
-                                      &transliteration_buffer_size, &transliterated_utf8_buffer,
-                                      &transliterated_utf8_buffer_size);
+        stream->token_length = 0;
+        int result = process_single_token(stream, token_start, token_end, word_status);
+        if (result != SQLITE_OK) {
+            return result;  // Error in processing this token
+        }
+        if (stream->token_length > 0) {
+            return SQLITE_ROW;
+        }
+    }
+}
 
+/**
+ * @brief Returns the rule status reported for a dictionary word
+ *
+ * Mirrors the status ICU's own dictionary engine reports for the script.
+ *
+ * @param c The first code point of the word
+ * @return UBRK_WORD_IDEO for Han, UBRK_WORD_KANA for Kana, UBRK_WORD_LETTER
+ *         otherwise
+ */
+static int32_t dictionary_word_status(UChar32 c) {
+    switch (run_script(c)) {
+        case USCRIPT_HAN:
+            return UBRK_WORD_IDEO;
+        case USCRIPT_HIRAGANA:
+        case USCRIPT_KATAKANA:
+            return UBRK_WORD_KANA;
+        default:
+            return UBRK_WORD_LETTER;
+    }
+}
+
+/**
+ * @brief Produces the next token of a dictionary run
+ *
+ * Dictionary words become tokens as they are; the text between them is
+ * broken by the break iterator.
+ *
+ * @param stream The token stream
+ * @return SQLITE_ROW if a token is available, SQLITE_DONE at the end of the
+ *         run, or an error code
+ */
+static int next_in_dictionary_run(IcuTokenStream* stream) {
+    const UChar* text = stream->scratch.utf16_text_buffer;
+
+    for (;;) {
+        if (stream->in_gap) {
+            int result = next_word_in_run(stream);
+            if (result != SQLITE_DONE || stream->degraded)
+                return result;
+            stream->in_gap = 0;
+        }
+        if (stream->segment_index >= stream->segment_count)
+            return SQLITE_DONE;
+
+        int32_t segment = stream->scratch.segment_buffer[stream->segment_index++];
+        int32_t token_start = stream->segment_start;
+        if (segment < 0) {
+            stream->segment_start = ICU_DICT_GAP_END(segment);
+            int result = set_break_text(stream, token_start, stream->segment_start);
+            if (result != SQLITE_OK)
+                return result;
+            stream->in_gap = 1;
+            continue;
+        }
+        stream->segment_start = segment;
+        if (stream->deadline_ns && over_budget(stream, segment)) {
+            degrade_stream(stream, token_start);
+            return SQLITE_DONE;
+        }
+
+        UChar32 first;
+        U16_GET(text, 0, token_start, segment, first);
+        stream->token_length = 0;
+        int result =
+          process_single_token(stream, token_start, segment, dictionary_word_status(first));
         if (result != SQLITE_OK) {
-            break;  // Error in processing this token
+            return result;
         }
+        if (stream->token_length > 0) {
+            return SQLITE_ROW;
+        }
+    }
+}
+
+// ========================================================================
+// === DEGRADED PATH ======================================================
+// ========================================================================
+
+/** Longest token of the degraded path in code points */
+#define ICU_DEGRADED_TOKEN_LIMIT 64
+
+/** Code point classes of the degraded path */
+typedef enum IcuDegradedClass {
+    ICU_DEGRADED_SEPARATOR = 0, /**< Not part of any token */
+    ICU_DEGRADED_WORD,          /**< Joined with neighbours of the same script */
+    ICU_DEGRADED_IDEOGRAPH      /**< A token of its own */
+} IcuDegradedClass;
 
-        token_start = token_end;
+/**
+ * @brief Classifies a code point for the degraded path
+ *
+ * @param c The code point
+ * @param[out] pScript Receives the script, USCRIPT_COMMON for digits and
+ *             marks, which join the word they are in
+ * @return The class of the code point
+ */
+static IcuDegradedClass degraded_class(UChar32 c, UScriptCode* pScript) {
+    *pScript = USCRIPT_COMMON;
+    if (U_GET_GC_MASK(c) & U_GC_M_MASK)
+        return ICU_DEGRADED_WORD;
+    if (!u_isalnum(c))
+        return ICU_DEGRADED_SEPARATOR;
+    if (u_isdigit(c))
+        return ICU_DEGRADED_WORD;
+
+    *pScript = run_script(c);
+    if (*pScript == USCRIPT_HAN || *pScript == USCRIPT_HIRAGANA || *pScript == USCRIPT_KATAKANA)
+        return ICU_DEGRADED_IDEOGRAPH;
+    return ICU_DEGRADED_WORD;
+}
+
+/**
+ * @brief Case folds a range of the text and stores it as the current token
+ *
+ * @param stream The token stream
+ * @param start Start of the token in the UTF-16 text
+ * @param end End of the token in the UTF-16 text
+ * @param rule_status Rule status reported for the token
+ * @return SQLITE_OK on success, SQLITE_NOMEM or SQLITE_ERROR on failure
+ */
+static int set_folded_token(IcuTokenStream* stream, int32_t start, int32_t end,
+                            int32_t rule_status) {
+    IcuScratch* scratch = &stream->scratch;
+    IcuMemoryAccount* memory = stream->tokenizer->memory;
+
+    // Full case folding expands a code unit to at most 3, and a UTF-16 code
+    // unit never needs more than 3 UTF-8 bytes
+    int32_t folded_size = (end - start) * 3 + 1;
+    if (scratch->transliteration_buffer_size < folded_size) {
+        UChar* buffer = (UChar*)icu_memory_realloc(memory, scratch->transliteration_buffer,
+                                                   folded_size * sizeof(UChar));
+        if (!buffer)
+            return SQLITE_NOMEM;
+        scratch->transliteration_buffer = buffer;
+        scratch->transliteration_buffer_size = folded_size;
+    }
+    int32_t utf8_size = folded_size * 3;
+    if (scratch->transliterated_utf8_buffer_size < utf8_size) {
+        char* buffer =
+          (char*)icu_memory_realloc(memory, scratch->transliterated_utf8_buffer, utf8_size);
+        if (!buffer)
+            return SQLITE_NOMEM;
+        scratch->transliterated_utf8_buffer = buffer;
+        scratch->transliterated_utf8_buffer_size = utf8_size;
     }
 
-    // Step 7: Cleanup allocated memory
-    if (transliteration_buffer)
-        sqlite3_free(transliteration_buffer);
-    if (transliterated_utf8_buffer)
-        sqlite3_free(transliterated_utf8_buffer);
-    if (utf16_text_buffer)
-        sqlite3_free(utf16_text_buffer);
-    if (byte_offset_map)
-        sqlite3_free(byte_offset_map);
+    UErrorCode status = U_ZERO_ERROR;
+    int32_t folded_length = u_strFoldCase(
+      scratch->transliteration_buffer, scratch->transliteration_buffer_size,
+      scratch->utf16_text_buffer + start, end - start, U_FOLD_CASE_DEFAULT, &status);
+    int32_t utf8_length = 0;
+    u_strToUTF8WithSub(scratch->transliterated_utf8_buffer,
+                       scratch->transliterated_utf8_buffer_size, &utf8_length,
+                       scratch->transliteration_buffer, folded_length, 0xFFFD, NULL, &status);
+    if (U_FAILURE(status) || utf8_length > scratch->transliterated_utf8_buffer_size) {
+        return SQLITE_ERROR;
+    }
 
-    return result;
+    stream->token = scratch->transliterated_utf8_buffer;
+    stream->token_length = utf8_length;
+    stream->token_start_byte = scratch->byte_offset_map[start];
+    stream->token_end_byte = scratch->byte_offset_map[end];
+    stream->token_rule_status = rule_status;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Produces the next token of the degraded path
+ *
+ * Words are runs of letters, digits and marks of one script, cut after
+ * ICU_DEGRADED_TOKEN_LIMIT code points; Han and Kana code points are tokens
+ * of their own. Tokens are case folded but not transliterated, so the cost is
+ * linear in the length of the text.
+ *
+ * @param stream The token stream
+ * @return SQLITE_ROW if a token is available, SQLITE_DONE at the end of the
+ *         text, or an error code
+ */
+static int next_degraded_token(IcuTokenStream* stream) {
+    const UChar* text = stream->scratch.utf16_text_buffer;
+    int32_t length = stream->utf16_text_length;
+    int32_t position = stream->degraded_position;
+
+    UChar32 c;
+    UScriptCode script;
+    IcuDegradedClass first_class = ICU_DEGRADED_SEPARATOR;
+    int32_t start = position;
+    while (position < length) {
+        start = position;
+        U16_NEXT(text, position, length, c);
+        first_class = degraded_class(c, &script);
+        if (first_class != ICU_DEGRADED_SEPARATOR)
+            break;
+    }
+    if (first_class == ICU_DEGRADED_SEPARATOR) {
+        stream->degraded_position = length;
+        return SQLITE_DONE;
+    }
+
+    int32_t rule_status = UBRK_WORD_IDEO;
+    if (first_class == ICU_DEGRADED_WORD) {
+        UScriptCode word_script = script;
+        int32_t code_points = 1;
+        rule_status = UBRK_WORD_LETTER;
+        while (position < length && code_points < ICU_DEGRADED_TOKEN_LIMIT) {
+            int32_t next = position;
+            U16_NEXT(text, next, length, c);
+            if (degraded_class(c, &script) != ICU_DEGRADED_WORD ||
+                (script != USCRIPT_COMMON && word_script != USCRIPT_COMMON &&
+                 script != word_script)) {
+                break;
+            }
+            if (word_script == USCRIPT_COMMON)
+                word_script = script;
+            position = next;
+            code_points++;
+        }
+    }
+
+    stream->degraded_position = position;
+    int result = set_folded_token(stream, start, position, rule_status);
+    return result == SQLITE_OK ? SQLITE_ROW : result;
+}
+
+/**
+ * @brief Advances a token stream to the next normalized token
+ *
+ * On SQLITE_ROW the token, its byte offsets and its rule status are available
+ * in the stream until the next call.
+ *
+ * @param stream The token stream
+ * @return SQLITE_ROW if a token is available, SQLITE_DONE at the end of the
+ *         document, or an error code
+ */
+int icu_token_stream_next(IcuTokenStream* stream) {
+    stream->alternate_length = 0;
+    if (stream->degraded)
+        return next_degraded_token(stream);
+
+    while (!stream->finished) {
+        int result;
+        switch (stream->run_kind) {
+            case ICU_RUN_WORDS:
+                result = next_word_in_run(stream);
+                break;
+            case ICU_RUN_BIGRAMS:
+                result = next_bigram_in_run(stream);
+                break;
+            case ICU_RUN_DICTIONARY:
+                result = next_in_dictionary_run(stream);
+                break;
+            case ICU_RUN_TRIGRAMS:
+                result = next_trigram_in_run(stream);
+                break;
+            default:
+                result = SQLITE_DONE;
+                break;
+        }
+        if (result != SQLITE_DONE) {
+            return result;
+        }
+        if (stream->degraded)
+            return next_degraded_token(stream);
+
+        // The current run is exhausted; only script-segmented streams have
+        // further runs
+        if (!is_segmented_by_script(&stream->tokenizer->config) ||
+            stream->run_end >= stream->utf16_text_length) {
+            stream->finished = 1;
+            break;
+        }
+        result = open_next_run(stream);
+        if (result != SQLITE_OK) {
+            return result;
+        }
+        if (stream->degraded)
+            return next_degraded_token(stream);
+    }
+    return SQLITE_DONE;
+}
+
+/**
+ * @brief Hands the buffers of a token stream back to its tokenizer
+ *
+ * @param stream The token stream
+ */
+void icu_token_stream_close(IcuTokenStream* stream) {
+    if (stream->tokenizer)
+        icu_scratch_release(stream->tokenizer->memory, &stream->scratch);
+    memset(stream, 0, sizeof(IcuTokenStream));
 }
 
 // ========================================================================
-// === MODULE INITIALIZATION ==============================================
+// === CORE TOKENIZATION FUNCTION (xTokenize) =============================
 // ========================================================================
 
-#define PASTE_IMPL(a, b, c) a##b##c
-#define PASTE(a, b, c) PASTE_IMPL(a, b, c)
+/**
+ * @brief Passes the leading code points of the current token to FTS5
+ *
+ * Each prefix of min_length to max_length code points that is shorter than
+ * the token is reported as a colocated token with the offsets of the whole
+ * token, so a query for the prefix is a lookup of a single term.
+ *
+ * @param stream The token stream positioned on a token
+ * @param min_length Shortest prefix in code points
+ * @param max_length Longest prefix in code points
+ * @param pCtx Context passed to xToken
+ * @param xToken FTS5 token callback
+ * @return SQLITE_OK on success, or the first error returned by xToken
+ */
+static int emit_edge_ngrams(const IcuTokenStream* stream, int min_length, int max_length,
+                            void* pCtx, IcuTokenCallback xToken) {
+    const uint8_t* token = (const uint8_t*)stream->token;
+    int32_t length = stream->token_length;
+    int32_t prefix_end = 0;
+
+    for (int code_points = 1; code_points <= max_length; code_points++) {
+        U8_FWD_1(token, prefix_end, length);
+        if (prefix_end >= length)
+            break;  // The whole token has already been reported
+        if (code_points < min_length)
+            continue;
+        int rc = xToken(pCtx, FTS5_TOKEN_COLOCATED, stream->token, prefix_end,
+                        stream->token_start_byte, stream->token_end_byte);
+        if (rc != SQLITE_OK)
+            return rc;
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Passes the variants of the current token with one code point
+ *        deleted to FTS5
+ *
+ * Variants are reported as colocated tokens with the offsets of the whole
+ * token. When both documents and queries carry their deletion variants, a
+ * query term and a document word share a term whenever they are at most one
+ * insertion, deletion or substitution apart (and sometimes when they are
+ * two apart), so fuzzy matching becomes a handful of exact term lookups.
+ * Deleting any code point of a run of equal code points gives the same
+ * variant, which is reported once.
+ *
+ * @param stream The token stream positioned on a token
+ * @param pConfig The tokenizer configuration with the length limits
+ * @param pCtx Context passed to xToken
+ * @param xToken FTS5 token callback
+ * @return SQLITE_OK on success, or the first error returned by xToken
+ */
+static int emit_deletion_variants(const IcuTokenStream* stream, const IcuTokenizerConfig* pConfig,
+                                  void* pCtx, IcuTokenCallback xToken) {
+    const uint8_t* token = (const uint8_t*)stream->token;
+    int32_t length = stream->token_length;
+    if (length > ICU_FUZZY_LIMIT * U8_MAX_LENGTH)
+        return SQLITE_OK;
+
+    // Find the code point boundaries once and check the length limits
+    int32_t boundaries[ICU_FUZZY_LIMIT + 1];
+    int32_t code_points = 0;
+    int32_t position = 0;
+    while (position < length) {
+        if (code_points >= pConfig->fuzzy_max)
+            return SQLITE_OK;
+        boundaries[code_points++] = position;
+        U8_FWD_1(token, position, length);
+    }
+    boundaries[code_points] = length;
+    if (code_points < pConfig->fuzzy_min)
+        return SQLITE_OK;
+
+    char variant[ICU_FUZZY_LIMIT * U8_MAX_LENGTH];
+    int variants = 0;
+    for (int32_t i = 0; i < code_points && variants < pConfig->fuzzy_max_variants; i++) {
+        int32_t start = boundaries[i];
+        int32_t end = boundaries[i + 1];
+        if (i > 0 && end - start == start - boundaries[i - 1] &&
+            memcmp(token + boundaries[i - 1], token + start, end - start) == 0) {
+            continue;  // Same variant as deleting the previous code point
+        }
+
+        memcpy(variant, token, start);
+        memcpy(variant + start, token + end, length - end);
+        int rc = xToken(pCtx, FTS5_TOKEN_COLOCATED, variant, length - (end - start),
+                        stream->token_start_byte, stream->token_end_byte);
+        if (rc != SQLITE_OK)
+            return rc;
+        variants++;
+    }
+    return SQLITE_OK;
+}
+
+/** Separates the kept leading bytes of a hashed term from its digest */
+#define ICU_HASHED_TERM_MARKER '\x1f'
+
+/** Length of the digest of a hashed term in base32 characters (99 bits) */
+#define ICU_HASHED_TERM_DIGEST_LENGTH 20
+
+/** Forwards tokens to FTS5 with long terms hashed ("hash_terms N") */
+typedef struct IcuHashedTerms {
+    void* pCtx;              /**< Context of the FTS5 callback */
+    IcuTokenCallback xToken; /**< FTS5 callback */
+    int max_length;          /**< Longest term passed on unchanged, in bytes */
+} IcuHashedTerms;
+
+/**
+ * @brief Scrambles the bits of a 64-bit hash (the SplitMix64 finalizer)
+ *
+ * @param x The value to scramble
+ * @return The scrambled value
+ */
+static sqlite3_uint64 mix_hash(sqlite3_uint64 x) {
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief Replaces a long term by its leading bytes and a digest
+ *
+ * The result is max_length bytes long for ASCII terms: the leading code
+ * points of the term that fit, ICU_HASHED_TERM_MARKER, and a digest of the
+ * whole term. The digest combines two 64-bit FNV-1a hashes, one over the
+ * bytes in order and one in reverse order with another seed, of which 99
+ * bits are written in base32. The marker is a control character that no
+ * word contains, so a hashed term never equals a term that was not hashed.
+ *
+ * @param term The term as UTF-8
+ * @param length Length of the term in bytes, more than max_length
+ * @param max_length Length limit of the result in bytes
+ * @param output Receives the hashed term; at least max_length bytes
+ * @return Length of the hashed term in bytes
+ */
+static int hash_term(const char* term, int length, int max_length, char* output) {
+    static const char digits[] = "0123456789abcdefghijklmnopqrstuv";
+    const uint8_t* bytes = (const uint8_t*)term;
+
+    int32_t kept = 0;
+    int32_t kept_limit = max_length - 1 - ICU_HASHED_TERM_DIGEST_LENGTH;
+    while (kept < length) {
+        int32_t next = kept;
+        U8_FWD_1(bytes, next, length);
+        if (next > kept_limit)
+            break;
+        kept = next;
+    }
+    memcpy(output, term, kept);
+    output[kept] = ICU_HASHED_TERM_MARKER;
+
+    sqlite3_uint64 forward = mix_hash(fnv1a_update(14695981039346656037ULL, term, length));
+    sqlite3_uint64 backward = 0x9E3779B97F4A7C15ULL;
+    for (int i = length - 1; i >= 0; i--) {
+        backward ^= bytes[i];
+        backward *= 1099511628211ULL;
+    }
+    backward = mix_hash(backward + (sqlite3_uint64)length);
+
+    char* digest = output + kept + 1;
+    for (int i = 0; i < 13; i++, forward >>= 5)
+        digest[i] = digits[forward & 31];
+    for (int i = 13; i < ICU_HASHED_TERM_DIGEST_LENGTH; i++, backward >>= 5)
+        digest[i] = digits[backward & 31];
+    return kept + 1 + ICU_HASHED_TERM_DIGEST_LENGTH;
+}
+
+/**
+ * @brief xToken callback that hashes long terms before passing them on
+ *
+ * @param pCtx The IcuHashedTerms of the call
+ * @param tflags FTS5_TOKEN_* flags
+ * @param pToken The term
+ * @param nToken Length of the term in bytes
+ * @param iStart Byte offset of the token in the text
+ * @param iEnd Byte offset just past the token
+ * @return The result of the FTS5 callback
+ */
+static int forward_hashed_term(void* pCtx, int tflags, const char* pToken, int nToken,
+                               int iStart, int iEnd) {
+    const IcuHashedTerms* hashed = (const IcuHashedTerms*)pCtx;
+    if (nToken <= hashed->max_length)
+        return hashed->xToken(hashed->pCtx, tflags, pToken, nToken, iStart, iEnd);
+
+    char term[ICU_HASH_TERMS_LIMIT];
+    int length = hash_term(pToken, nToken, hashed->max_length, term);
+    return hashed->xToken(hashed->pCtx, tflags, term, length, iStart, iEnd);
+}
+
+/**
+ * @brief Tokenizes a document or query; the body of icuTokenize()
+ *
+ * @param pTokenizer The tokenizer instance
+ * @param pCtx Context passed to the callback
+ * @param flags FTS5_TOKENIZE_* flags
+ * @param pText The text to tokenize
+ * @param nText Length of the text in bytes
+ * @param pLocale Locale passed by FTS5, used to match a precomputed stream
+ * @param nLocale Length of the locale in bytes
+ * @param xToken Callback receiving the tokens
+ * @param[out] pTokenCount Incremented for each token that is not colocated
+ * @return SQLITE_OK on success, or the first error from ICU or the callback
+ */
+static int tokenize_text(IcuTokenizerV2* pTokenizer, void* pCtx, int flags, const char* pText,
+                         int nText, const char* pLocale, int nLocale, IcuTokenCallback xToken,
+                         int* pTokenCount) {
+    if (!pText || nText <= 0)
+        return SQLITE_OK;
+
+    // Replay a token stream precomputed by icu_parallel_rebuild()
+    int replay_result = SQLITE_OK;
+    if (icu_rebuild_try_replay(pTokenizer, flags, pText, nText, pLocale, nLocale, pCtx, xToken,
+                               &replay_result)) {
+        return replay_result;
+    }
+
+    // Long terms of "hash_terms" tables are hashed on their way to FTS5,
+    // after replay because recorded streams hold the hashed terms. Prefix
+    // query terms are passed on unchanged: a prefix of a hashed word cannot
+    // be matched, but shorter words still can.
+    const IcuTokenizerConfig* pConfig = &pTokenizer->config;
+    IcuHashedTerms hashed;
+    if (pConfig->hash_terms && !(flags & FTS5_TOKENIZE_PREFIX)) {
+        hashed.pCtx = pCtx;
+        hashed.xToken = xToken;
+        hashed.max_length = pConfig->hash_terms;
+        pCtx = &hashed;
+        xToken = forward_hashed_term;
+    }
+
+    // Calls of tables with "slow_log" or "time_budget" are timed from here
+    // on; only the slow log needs the time of each stage
+    sqlite3_int64 start_ns = 0;
+    if (pConfig->slow_log_us || pConfig->time_budget_us)
+        start_ns = icu_slow_log_clock();
+    IcuStageTimes stage_times;
+    memset(&stage_times, 0, sizeof(stage_times));
+
+    // Borrow ICU objects from the process-wide pool for this call
+    IcuPoolLease lease;
+    if (pTokenizer->pool) {
+        int rc = icu_pool_checkout(pTokenizer->pool, &lease);
+        if (rc != SQLITE_OK)
+            return rc;
+        pTokenizer->pBreakIterator = lease.pBreakIterator;
+        pTokenizer->pTransliterator = lease.pTransliterator;
+    }
+
+    // Edge n-grams are only added to documents, so that a query term matches
+    // every document word it is a prefix of
+    int edge_ngram_max = (flags & FTS5_TOKENIZE_QUERY) ? 0 : pConfig->edge_ngram_max;
+
+    // Deletion variants are added on both sides, where FTS5 treats colocated
+    // query tokens as alternatives; prefix queries are left as they are
+    int fuzzy = pConfig->fuzzy && !(flags & FTS5_TOKENIZE_PREFIX);
+
+    // ICU's own allocations during the call come from a per-thread arena in
+    // builds with FTS5_ICU_ARENA
+    icu_arena_begin();
+
+    IcuTokenStream stream;
+    sqlite3_int64 convert_start = pConfig->slow_log_us ? icu_slow_log_clock() : 0;
+    int result = icu_token_stream_open(&stream, pTokenizer, pText, nText);
+    if (pConfig->slow_log_us) {
+        stage_times.stage_ns[ICU_STAGE_CONVERT] = icu_slow_log_clock() - convert_start;
+        stream.stage_times = &stage_times;
+    }
+    // The stream checks the budget before each word or run, and takes the
+    // degraded path for the rest of the document once it would be exceeded
+    stream.work_budget = pConfig->work_budget;
+    if (pConfig->time_budget_us)
+        stream.deadline_ns = start_ns + (sqlite3_int64)pConfig->time_budget_us * 1000;
+    int longest_token = 0;
+    // Queries of "native 1" tables are matched in the script they are
+    // written in; a Latin query term still finds the colocated forms
+    stream.native_only = (flags & FTS5_TOKENIZE_QUERY) != 0;
+    while (result == SQLITE_OK && (result = icu_token_stream_next(&stream)) == SQLITE_ROW) {
+        // Abandon tokenization and return the callback's result on failure
+        result = xToken(pCtx, 0, stream.token, stream.token_length, stream.token_start_byte,
+                        stream.token_end_byte);
+        (*pTokenCount)++;
+        if (result == SQLITE_OK && stream.alternate_length > 0) {
+            result = xToken(pCtx, FTS5_TOKEN_COLOCATED, stream.alternate_token,
+                            stream.alternate_length, stream.token_start_byte,
+                            stream.token_end_byte);
+        }
+        if (stream.token_length > longest_token)
+            longest_token = stream.token_length;
+        if (result == SQLITE_OK && edge_ngram_max > 0) {
+            result =
+              emit_edge_ngrams(&stream, pConfig->edge_ngram_min, edge_ngram_max, pCtx, xToken);
+        }
+        if (result == SQLITE_OK && fuzzy) {
+            result = emit_deletion_variants(&stream, pConfig, pCtx, xToken);
+        }
+    }
+    int degraded_bytes =
+      stream.degraded ? nText - stream.scratch.byte_offset_map[stream.degraded_start] : 0;
+    if (degraded_bytes > 0)
+        icu_slow_log_note_degraded(degraded_bytes);
+    if (pConfig->slow_log_us) {
+        sqlite3_int64 total_ns = icu_slow_log_clock() - start_ns;
+        if (total_ns >= (sqlite3_int64)pConfig->slow_log_us * 1000) {
+            icu_slow_log_record(&stream, flags, *pTokenCount, longest_token, total_ns,
+                                &stage_times);
+        }
+    }
+    icu_token_stream_close(&stream);
+    icu_arena_end();
+
+    if (pTokenizer->pool) {
+        pTokenizer->pBreakIterator = NULL;
+        pTokenizer->pTransliterator = NULL;
+        icu_pool_checkin(pTokenizer->pool, &lease);
+    }
+
+    return result == SQLITE_DONE ? SQLITE_OK : result;
+}
+
+int icuTokenize(Fts5Tokenizer* pTok, void* pCtx, int flags, const char* pText, int nText,
+                const char* pLocale, int nLocale, IcuTokenCallback xToken) {
+    IcuTokenizerV2* pTokenizer = (IcuTokenizerV2*)pTok;
+
+    int token_count = 0;
+    ICU_PROBE3(tokenize__start, pTokenizer->config.locale, nText, flags);
+    int rc = tokenize_text(pTokenizer, pCtx, flags, pText, nText, pLocale, nLocale, xToken,
+                           &token_count);
+    ICU_PROBE4(tokenize__done, pTokenizer->config.locale, nText, token_count, rc);
+    return rc;
+}
+
+// ========================================================================
+// === MODULE INITIALIZATION ==============================================
+// ========================================================================
 
-#ifdef _WIN32
-__declspec(dllexport)
-#endif
 // cppcheck-suppress unusedFunction
-int PASTE(sqlite3_ftsicu, INIT_LOCALE_SUFFIX_FOR_FUNCTION, _init)(
+FTS5_ICU_EXPORT int PASTE(sqlite3_ftsicu, INIT_LOCALE_SUFFIX_FOR_FUNCTION, _init)(
   sqlite3 *db,
   char **pzErrMsg,
   const sqlite3_api_routines *pApi
 ){
     SQLITE_EXTENSION_INIT2(pApi);
+
+    // ICU memory functions can only be replaced before ICU allocates anything
+    if (icu_arena_install() != SQLITE_OK) {
+        *pzErrMsg = sqlite3_mprintf("Failed to install ICU memory functions");
+        return SQLITE_ERROR;
+    }
+
     fts5_api* pFts5Api = fts5_api_from_db(db);
     if (!pFts5Api) {
         *pzErrMsg = sqlite3_mprintf("Failed to get FTS5 API");
@@ -577,9 +2849,58 @@ int PASTE(sqlite3_ftsicu, INIT_LOCALE_SUFFIX_FOR_FUNCTION, _init)(
     fts5_tokenizer_v2 tokenizer = {
       .iVersion = 2, .xCreate = icuCreate, .xDelete = icuDelete, .xTokenize = icuTokenize};
 
-    int rc = pFts5Api->xCreateTokenizer_v2(pFts5Api, TOKENIZER_NAME, NULL, &tokenizer, NULL);
+    // Registration only records the descriptor; ICU objects are compiled when
+    // a table first creates one of the tokenizers
+    int rc = SQLITE_OK;
+    for (int i = 0; i < icu_locale_descriptor_count; i++) {
+        const IcuLocaleDescriptor* descriptor = &icu_locale_descriptors[i];
+        rc = pFts5Api->xCreateTokenizer_v2(pFts5Api, descriptor->name, (void*)descriptor,
+                                           &tokenizer, NULL);
+        if (rc != SQLITE_OK) {
+            *pzErrMsg = sqlite3_mprintf("Failed to register ICU tokenizer %s: %s",
+                                        descriptor->name, sqlite3_errstr(rc));
+            return rc;
+        }
+    }
+
+    rc = icu_register_blob_functions(db, pFts5Api);
+    if (rc != SQLITE_OK) {
+        *pzErrMsg = sqlite3_mprintf("Failed to register ICU replay tokenizer: %s",
+                                    sqlite3_errstr(rc));
+        return rc;
+    }
+
+    rc = icu_register_tokens_module(db);
+    if (rc != SQLITE_OK) {
+        *pzErrMsg = sqlite3_mprintf("Failed to register icu_tokens: %s", sqlite3_errstr(rc));
+        return rc;
+    }
+
+    rc = icu_register_slow_log_module(db);
+    if (rc != SQLITE_OK) {
+        *pzErrMsg =
+          sqlite3_mprintf("Failed to register icu_slow_documents: %s", sqlite3_errstr(rc));
+        return rc;
+    }
+
+    rc = icu_register_rebuild_function(db);
+    if (rc != SQLITE_OK) {
+        *pzErrMsg = sqlite3_mprintf("Failed to register icu_parallel_rebuild: %s",
+                                    sqlite3_errstr(rc));
+        return rc;
+    }
+
+    rc = icu_register_memory_functions(db);
+    if (rc != SQLITE_OK) {
+        *pzErrMsg = sqlite3_mprintf("Failed to register memory functions: %s",
+                                    sqlite3_errstr(rc));
+        return rc;
+    }
+
+    rc = icu_register_arena_functions(db);
     if (rc != SQLITE_OK) {
-        *pzErrMsg = sqlite3_mprintf("Failed to register ICU tokenizer: %s", sqlite3_errstr(rc));
+        *pzErrMsg = sqlite3_mprintf("Failed to register icu_arena_stats: %s",
+                                    sqlite3_errstr(rc));
     }
     return rc;
 }
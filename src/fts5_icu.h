@@ -11,6 +11,7 @@
 #define FTS5_ICU_H
 
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -22,6 +23,7 @@
 // ICU headers
 #include <unicode/ubrk.h>
 #include <unicode/uchar.h>
+#include <unicode/uscript.h>
 #include <unicode/ustring.h>
 #include <unicode/utrans.h>
 #include <unicode/utypes.h>
@@ -162,6 +164,13 @@
 #define TOKENIZER_NAME "icu_el"
 #define ICU_TOKENIZER_RULES ICU_RULE_EL
 
+#elif defined(TOKENIZER_LOCALE_ALL)
+// Every locale in one library (see icu_locale_descriptors); the universal
+// tokenizer is the default for the helper functions
+#define INIT_LOCALE_SUFFIX _all
+#define TOKENIZER_NAME "icu"
+#define ICU_TOKENIZER_RULES ICU_RULE_DEFAULT
+
 #else
 // Default/fallback: generic tokenizer
 #define INIT_LOCALE_SUFFIX
@@ -181,6 +190,331 @@ typedef struct IcuTokenizer {
     UTransliterator* pTransliterator; /**< ICU transliterator for text normalization */
 } IcuTokenizer;
 
+/** Memory-mapped user dictionary (fts5_icu_dict.c) */
+typedef struct IcuUserDictionary IcuUserDictionary;
+
+/** Transliterator compiled from a "rules" option (fts5_icu_rules.c) */
+typedef struct IcuRuleSet IcuRuleSet;
+
+/** Persistent memory-mapped normalization cache (fts5_icu_cache.c) */
+typedef struct IcuNormalizationCache IcuNormalizationCache;
+
+/** Size in MiB of a cache file created without a "cache_size" option */
+#define ICU_CACHE_DEFAULT_SIZE_MB 16
+
+/** Encodes the end of a segment that is not a dictionary word */
+#define ICU_DICT_GAP(end) (-(end)-1)
+
+/** Decodes a segment end stored with ICU_DICT_GAP() */
+#define ICU_DICT_GAP_END(value) (-(value)-1)
+
+/** Longest edge n-gram accepted by the "edge_ngram_max" option */
+#define ICU_EDGE_NGRAM_LIMIT 64
+
+/** Longest token accepted by the "fuzzy_max" option, in code points */
+#define ICU_FUZZY_LIMIT 64
+
+/** Shortest and longest term length accepted by the "hash_terms" option, in bytes */
+#define ICU_HASH_TERMS_MIN 24
+#define ICU_HASH_TERMS_LIMIT 255
+
+/** Signature of the FTS5 token callback passed to xTokenize */
+typedef int (*IcuTokenCallback)(void* pCtx, int tflags, const char* pToken, int nToken,
+                                int iStart, int iEnd);
+
+/**
+ * @brief A tokenizer registered by the library
+ *
+ * Locale builds register the one tokenizer they were configured for; builds
+ * with LOCALE=all register every supported locale from a single init call.
+ * The descriptor is the pCtx of the registered xCreate, and icuCreate() with
+ * a NULL pCtx uses the first descriptor.
+ */
+typedef struct IcuLocaleDescriptor {
+    const char* name;   /**< FTS5 tokenizer name, e.g. "icu_ja" */
+    const char* locale; /**< Locale passed to the break iterator */
+    const UChar* rules; /**< Transliterator rule chain */
+} IcuLocaleDescriptor;
+
+/**
+ * @brief Configuration shared by every tokenizer instance of one kind
+ *
+ * Everything that influences the tokens produced for a given input is held
+ * here, so that icu_config_fingerprint() can identify the configuration
+ * without opening any ICU objects.
+ */
+typedef struct IcuTokenizerConfig {
+    const IcuLocaleDescriptor* descriptor; /**< Registered tokenizer */
+    const char* locale; /**< Locale passed to the break iterator */
+    const UChar* rules; /**< Transliterator rule chain */
+    IcuRuleSet* rule_set; /**< Compiled "rules" option replacing the rule chain, or NULL */
+    IcuRuleSet* native_rule_set; /**< Native-script rule chain with "native 1", or NULL */
+    int use_pool;       /**< Borrow ICU objects from the process-wide pool */
+    int cjk_bigrams;    /**< Emit overlapping bigrams for Han, Kana and Hangul runs */
+    int canonical_numbers; /**< Rewrite number tokens in canonical ASCII form */
+    IcuUserDictionary* dictionary; /**< User dictionary for Han, Kana and Thai runs, or NULL */
+    int trigrams;       /**< Emit code point trigrams of normalized letter runs */
+    int edge_ngram_min; /**< Shortest edge n-gram in code points */
+    int edge_ngram_max; /**< Longest edge n-gram in code points, 0 to disable */
+    int fuzzy;          /**< Emit deletion variants of tokens in documents and queries */
+    int fuzzy_min;      /**< Shortest token in code points that gets deletion variants */
+    int fuzzy_max;      /**< Longest token in code points that gets deletion variants */
+    int fuzzy_max_variants; /**< Most deletion variants emitted per token */
+    int hash_terms;     /**< Replace terms longer than this many bytes by a digest, 0 to disable */
+    IcuNormalizationCache* cache; /**< Persistent normalization cache, or NULL */
+    int slow_log_us;    /**< Log calls taking this many microseconds, 0 to disable */
+    int time_budget_us; /**< Degrade calls after this many microseconds, 0 to disable */
+    int work_budget;    /**< Degrade calls after this many bytes of text, 0 to disable */
+} IcuTokenizerConfig;
+
+/** Process-wide pool of ICU objects for one configuration (fts5_icu_pool.c) */
+typedef struct IcuObjectPool IcuObjectPool;
+
+/** ICU objects checked out of an IcuObjectPool for the duration of one call */
+typedef struct IcuPoolLease {
+    UBreakIterator* pBreakIterator;   /**< Borrowed break iterator */
+    UTransliterator* pTransliterator; /**< Borrowed transliterator */
+    uint32_t slot;                    /**< Pool slot, or ICU_POOL_NO_SLOT for overflow objects */
+} IcuPoolLease;
+
+/** Slot number of a lease whose objects are not owned by the pool */
+#define ICU_POOL_NO_SLOT UINT32_MAX
+
+/** Memory accounting for one tokenizer instance (fts5_icu_memory.c) */
+typedef struct IcuMemoryAccount IcuMemoryAccount;
+
+/**
+ * @brief Scratch buffers used while tokenizing a document
+ *
+ * A token stream takes the buffers its tokenizer retained from the previous
+ * call and hands them back when it is closed, so that documents of similar
+ * size do not allocate at all. Retained buffers are released under memory
+ * pressure (see fts5_icu_memory.c).
+ */
+typedef struct IcuScratch {
+    UChar* utf16_text_buffer;                /**< Source text converted to UTF-16 */
+    int32_t utf16_buffer_size;               /**< Allocated size of utf16_text_buffer */
+    int32_t* byte_offset_map;                /**< UTF-16 index to UTF-8 byte offset */
+    int32_t byte_offset_map_size;            /**< Allocated entries in byte_offset_map */
+    UChar* transliteration_buffer;           /**< Scratch buffer for transliteration */
+    int32_t transliteration_buffer_size;     /**< Size of transliteration_buffer */
+    char* transliterated_utf8_buffer;        /**< Normalized token as UTF-8 */
+    int32_t transliterated_utf8_buffer_size; /**< Size of transliterated_utf8_buffer */
+    char* native_utf8_buffer;                /**< Native-script form of the token as UTF-8 */
+    int32_t native_utf8_buffer_size;         /**< Size of native_utf8_buffer */
+    UChar* run_buffer;                       /**< Normalized text of a CJK run */
+    int32_t run_buffer_size;                 /**< Size of run_buffer */
+    int32_t* segment_buffer;                 /**< Segment ends of a dictionary run */
+    int32_t segment_buffer_size;             /**< Allocated entries in segment_buffer */
+} IcuScratch;
+
+/** How the current script run of a token stream is segmented */
+typedef enum IcuRunKind {
+    ICU_RUN_NONE = 0,   /**< No run opened yet, or a run without tokens */
+    ICU_RUN_WORDS,      /**< ICU break iterator */
+    ICU_RUN_BIGRAMS,    /**< Overlapping bigrams ("cjk bigram") */
+    ICU_RUN_DICTIONARY, /**< User dictionary ("dictionary <path>") */
+    ICU_RUN_TRIGRAMS    /**< Code point trigrams ("trigram 1") */
+} IcuRunKind;
+
+/** Stages timed for the slow document log ("slow_log N") */
+typedef enum IcuStage {
+    ICU_STAGE_CONVERT = 0,   /**< UTF-8 to UTF-16 conversion when the stream is opened */
+    ICU_STAGE_BREAK,         /**< ubrk_next() calls */
+    ICU_STAGE_TRANSLITERATE, /**< utrans_transUChars() calls */
+    ICU_STAGE_COUNT
+} IcuStage;
+
+/** Time spent in each stage of one call, in nanoseconds */
+typedef struct IcuStageTimes {
+    sqlite3_int64 stage_ns[ICU_STAGE_COUNT]; /**< Indexed by IcuStage */
+} IcuStageTimes;
+
+/**
+ * @brief Tokenizer instance used by the FTS5 v2 implementation
+ *
+ * The fts5_tokenizer_v2 vtable must be the first member so that the instance
+ * can be handed to FTS5 as an opaque Fts5Tokenizer pointer.
+ */
+typedef struct IcuTokenizerV2 {
+    fts5_tokenizer_v2 fts_tokenizer_v2;     /**< Must be first member for v2 API */
+    UBreakIterator* pBreakIterator;         /**< ICU break iterator for word segmentation */
+    UTransliterator* pTransliterator;       /**< ICU transliterator for text normalization */
+    UTransliterator* pNativeTransliterator; /**< Native-script rule chain with "native 1" */
+    IcuTokenizerConfig config;              /**< Configuration this instance was created with */
+    IcuObjectPool* pool;                    /**< Object pool when config.use_pool is set */
+    IcuMemoryAccount* memory;               /**< Memory accounting and retained scratch */
+    int plain_words;                        /**< ASCII words are folded without the rules */
+} IcuTokenizerV2;
+
+/**
+ * @brief Incremental tokenization state for one document
+ *
+ * icuTokenize() drives a token stream to completion; callers that want one
+ * token at a time (such as the icu_tokens table-valued function) step it with
+ * icu_token_stream_next() instead. A stream uses the break iterator of its
+ * tokenizer, so only one stream per tokenizer instance may be open at a time.
+ */
+typedef struct IcuTokenStream {
+    IcuTokenizerV2* tokenizer;                 /**< Tokenizer that owns the break iterator */
+    const char* text;                          /**< Source UTF-8 text */
+    int text_length;                           /**< Length of the source text in bytes */
+    IcuScratch scratch;                        /**< Conversion and normalization buffers */
+    int32_t utf16_text_length;                 /**< UTF-16 code units in the converted text */
+    int32_t run_start;                         /**< Start of the current script run (UTF-16) */
+    int32_t run_end;                           /**< End of the current script run (UTF-16) */
+    IcuRunKind run_kind;                       /**< How the current run is segmented */
+    int32_t cjk_position;                      /**< Start of the next bigram in a CJK run */
+    int32_t run_normalized_length;             /**< Length in run_buffer, -1 if not aligned */
+    int32_t run_normalized_position;           /**< Position in run_buffer of cjk_position */
+    int32_t segment_count;                     /**< Segments of a dictionary run */
+    int32_t segment_index;                     /**< Next segment of a dictionary run */
+    int32_t segment_start;                     /**< Start of the next dictionary segment */
+    int in_gap;                                /**< Set while breaking a dictionary gap */
+    int32_t run_code_points;                   /**< Code points of a trigram run */
+    int32_t normalized_code_points;            /**< Code points of a normalized trigram run */
+    int32_t trigram_index;                     /**< Next trigram of a trigram run */
+    int32_t origin_start;                      /**< Text position of origin_start_index */
+    int32_t origin_start_index;                /**< Run code point where the last trigram began */
+    int32_t origin_end;                        /**< Text position of origin_end_index */
+    int32_t origin_end_index;                  /**< Run code point where the last trigram ended */
+    int32_t break_offset;                      /**< Text position of break iterator offset 0 */
+    int32_t break_position;                    /**< Break iterator position */
+    int32_t piece_start;                       /**< Rest of a word cut after ICU_WORD_LIMIT */
+    int32_t piece_end;                         /**< End of the word piece_start is in */
+    int32_t piece_rule_status;                 /**< Rule status of that word */
+    int finished;                              /**< Set once the break iterator is exhausted */
+    const char* token;                         /**< Current normalized token */
+    int token_length;                          /**< Length of the current token in bytes */
+    int token_start_byte;                      /**< Start byte offset of the current token */
+    int token_end_byte;                        /**< End byte offset of the current token */
+    int32_t token_rule_status;                 /**< Break iterator rule status of the token */
+    const char* alternate_token;               /**< Colocated form of the token, or NULL */
+    int alternate_length;                      /**< Length of the colocated form in bytes */
+    int native_only;                           /**< Report native forms without alternates */
+    IcuStageTimes* stage_times;                /**< Stage times to add to, or NULL */
+    int work_budget;                           /**< Bytes of the full path, 0 for no limit */
+    sqlite3_int64 deadline_ns;                 /**< End of the time budget, 0 for no limit */
+    int degraded;                              /**< Set once the budget of the call is spent */
+    int32_t degraded_start;                    /**< Text position where degradation began */
+    int32_t degraded_position;                 /**< Next text position of the degraded path */
+} IcuTokenStream;
+
+/**
+ * @brief Symbol visibility for the extension entry points
+ *
+ * The library is built with hidden visibility so that the internal functions
+ * shared between translation units do not clash when several locale builds
+ * are loaded into the same process. Only the init functions are exported.
+ */
+#if defined(_WIN32)
+#define FTS5_ICU_EXPORT __declspec(dllexport)
+#elif defined(__GNUC__)
+#define FTS5_ICU_EXPORT __attribute__((visibility("default")))
+#else
+#define FTS5_ICU_EXPORT
+#endif
+
+// ========================================================================
+// === INTERNAL INTERFACE =================================================
+// ========================================================================
+// Functions shared between the translation units of the extension.
+
+/* fts5_icu.c */
+extern const IcuLocaleDescriptor icu_locale_descriptors[];
+extern const int icu_locale_descriptor_count;
+int icuCreate(void* pCtx, const char** azArg, int nArg, Fts5Tokenizer** ppOut);
+void icuDelete(Fts5Tokenizer* pTok);
+int icuTokenize(Fts5Tokenizer* pTok, void* pCtx, int flags, const char* pText, int nText,
+                const char* pLocale, int nLocale, IcuTokenCallback xToken);
+int icu_tokenizer_clone(const IcuTokenizerV2* pPrototype, IcuTokenizerV2** ppOut);
+int icu_token_stream_open(IcuTokenStream* stream, IcuTokenizerV2* pTokenizer, const char* pText,
+                          int nText);
+int icu_token_stream_next(IcuTokenStream* stream);
+void icu_token_stream_close(IcuTokenStream* stream);
+int icu_config_init(IcuTokenizerConfig* pConfig, const IcuLocaleDescriptor* descriptor,
+                    const char** azArg, int nArg);
+void icu_config_clear(IcuTokenizerConfig* pConfig);
+sqlite3_uint64 icu_config_fingerprint(const IcuTokenizerConfig* pConfig);
+int icu_open_objects(const IcuTokenizerConfig* pConfig, UBreakIterator** ppBreakIterator,
+                     UTransliterator** ppTransliterator);
+int icu_clone_objects(const UBreakIterator* pBreakIterator,
+                      const UTransliterator* pTransliterator, UBreakIterator** ppBreakIterator,
+                      UTransliterator** ppTransliterator);
+int32_t convert_utf8_to_utf16_with_mapping(const char* pText, int nText, UChar* pUText,
+                                           int32_t utf16Size, int32_t* pMap);
+
+/* fts5_icu_arena.c */
+int icu_arena_install(void);
+void icu_arena_begin(void);
+void icu_arena_end(void);
+int icu_register_arena_functions(sqlite3* db);
+
+/* fts5_icu_blob.c */
+int icu_register_blob_functions(sqlite3* db, fts5_api* pFts5Api);
+
+/* fts5_icu_tokens.c */
+int icu_register_tokens_module(sqlite3* db);
+
+/* fts5_icu_slowlog.c */
+sqlite3_int64 icu_slow_log_clock(void);
+void icu_slow_log_record(const IcuTokenStream* stream, int flags, int token_count,
+                         int longest_token, sqlite3_int64 total_ns,
+                         const IcuStageTimes* stage_times);
+void icu_slow_log_note_degraded(int bytes);
+int icu_register_slow_log_module(sqlite3* db);
+
+/* fts5_icu_cache.c */
+int icu_cache_open(const char* path, const UChar* rules, int size_mb,
+                   IcuNormalizationCache** ppCache);
+void icu_cache_retain(IcuNormalizationCache* cache);
+void icu_cache_release(IcuNormalizationCache* cache);
+int icu_cache_lookup(const IcuNormalizationCache* cache, const UChar* key, int32_t key_length,
+                     const char** pValue, int32_t* pValueLength);
+void icu_cache_insert(IcuNormalizationCache* cache, const UChar* key, int32_t key_length,
+                      const char* value, int32_t value_length);
+
+/* fts5_icu_dict.c */
+int icu_dictionary_open(const char* path, IcuUserDictionary** ppDictionary);
+void icu_dictionary_retain(IcuUserDictionary* dictionary);
+void icu_dictionary_release(IcuUserDictionary* dictionary);
+sqlite3_uint64 icu_dictionary_checksum(const IcuUserDictionary* dictionary);
+int32_t icu_dictionary_segment(const IcuUserDictionary* dictionary, const UChar* text,
+                               int32_t start, int32_t end, int32_t* segments);
+
+/* fts5_icu_rules.c */
+int icu_rule_set_open(const char* rules, IcuRuleSet** ppRuleSet);
+void icu_rule_set_retain(IcuRuleSet* rule_set);
+void icu_rule_set_release(IcuRuleSet* rule_set);
+void icu_rule_set_release_idle(void);
+const UChar* icu_rule_set_rules(const IcuRuleSet* rule_set);
+int icu_rule_set_clone(IcuRuleSet* rule_set, UTransliterator** ppTransliterator);
+
+/* fts5_icu_memory.c */
+int icu_memory_account_open(IcuMemoryAccount** ppAccount);
+void icu_memory_account_close(IcuMemoryAccount* account);
+void* icu_memory_realloc(IcuMemoryAccount* account, void* p, sqlite3_int64 n);
+void icu_memory_free(IcuMemoryAccount* account, void* p);
+void icu_scratch_acquire(IcuMemoryAccount* account, IcuScratch* scratch);
+void icu_scratch_release(IcuMemoryAccount* account, IcuScratch* scratch);
+sqlite3_int64 icu_memory_release(sqlite3_int64 n);
+int icu_register_memory_functions(sqlite3* db);
+
+/* fts5_icu_pool.c */
+int icu_online_cpu_count(void);
+int icu_pool_acquire(const IcuTokenizerConfig* pConfig, IcuObjectPool** ppPool);
+void icu_pool_retain(IcuObjectPool* pool);
+void icu_pool_release(IcuObjectPool* pool);
+int icu_pool_checkout(IcuObjectPool* pool, IcuPoolLease* lease);
+void icu_pool_checkin(IcuObjectPool* pool, IcuPoolLease* lease);
+void icu_pool_release_idle(void);
+
+/* fts5_icu_rebuild.c */
+int icu_rebuild_try_replay(IcuTokenizerV2* pTokenizer, int flags, const char* pText, int nText,
+                           const char* pLocale, int nLocale, void* pCtx, IcuTokenCallback xToken,
+                           int* pRc);
+int icu_register_rebuild_function(sqlite3* db);
+
 /**
  * @brief Macro for module initialization function name construction
  *
@@ -0,0 +1,415 @@
+/**
+ * @file fts5_icu_arena.c
+ * @brief Per-call bump arenas for ICU's internal allocations
+ *
+ * Our own buffers are reused across calls, but utrans_transUChars() and the
+ * break engines still make many small heap allocations per token for
+ * replaceable strings and rule-matching state. Under multi-threaded load
+ * these calls contend in the system allocator. Libraries built with
+ * -DFTS5_ICU_ARENA=ON install ICU memory functions (u_setMemoryFunctions())
+ * when the extension is first initialized. During icuTokenize() the
+ * functions hand out memory from a thread-local bump arena.
+ *
+ * ICU may keep some of the memory it allocates during a call, for example
+ * lazily loaded dictionaries, caches and buffers that its objects grow
+ * once. Every block therefore starts with a header naming its arena chunk,
+ * and each chunk counts its live blocks, plus one reference held by the
+ * owning thread. At the end of a call a chunk whose blocks were all freed is
+ * rewound for the next call. A chunk with surviving blocks is retired
+ * instead, and the last free() of one of its blocks, from whichever thread,
+ * releases it. Allocations outside icuTokenize(), and large ones, go to the
+ * system allocator behind the same header.
+ *
+ * ICU memory functions are process-wide and must be installed before ICU
+ * allocates anything, because memory allocated earlier could not be told
+ * apart from ours. Load an arena build before any other ICU user in the
+ * process. Once installed, the functions stay in ICU for the life of the
+ * process, so the library pins itself in memory: closing the last connection
+ * that loaded it must not unmap code that ICU and exiting threads still call.
+ * icu_arena_stats() reports the allocation counts used to compare builds.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // dladdr()
+#endif
+
+#include "fts5_icu.h"
+
+SQLITE_EXTENSION_INIT3
+
+#if defined(FTS5_ICU_ARENA) && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unicode/uclean.h>
+#ifdef FTS5_ICU_HAVE_PTHREADS
+#include <pthread.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+#define FTS5_ICU_HAVE_ARENA 1
+#endif
+
+#ifdef FTS5_ICU_HAVE_ARENA
+
+/** Size of an arena chunk including its header */
+#define ICU_ARENA_CHUNK_SIZE (64 * 1024)
+
+/** Largest allocation served from an arena; larger ones use the heap */
+#define ICU_ARENA_MAX_ALLOCATION 4096
+
+/** Alignment of every block handed to ICU */
+#define ICU_ARENA_ALIGNMENT 16
+
+typedef struct IcuArenaChunk IcuArenaChunk;
+
+/** Header in front of every block; a multiple of ICU_ARENA_ALIGNMENT */
+typedef struct IcuArenaBlock {
+    IcuArenaChunk* chunk; /**< Chunk holding the block, NULL for heap blocks */
+    size_t size;          /**< Usable size of the block */
+} IcuArenaBlock;
+
+struct IcuArenaChunk {
+    _Atomic sqlite3_int64 live; /**< Live blocks, plus one while owned by a thread */
+    size_t used;                /**< Bytes handed out; only the owner touches it */
+    _Alignas(ICU_ARENA_ALIGNMENT) unsigned char data[]; /**< Block storage */
+};
+
+/** Bytes of block storage in a chunk */
+#define ICU_ARENA_CHUNK_CAPACITY (ICU_ARENA_CHUNK_SIZE - offsetof(IcuArenaChunk, data))
+
+/** Allocation counters reported by icu_arena_stats() */
+static _Atomic sqlite3_int64 arena_icu_allocations = 0;
+static _Atomic sqlite3_int64 arena_arena_allocations = 0;
+static _Atomic sqlite3_int64 arena_heap_allocations = 0;
+static _Atomic sqlite3_int64 arena_chunks_created = 0;
+static _Atomic sqlite3_int64 arena_chunks_retired = 0;
+
+/** Set once the memory functions are installed; protected by SQLITE_MUTEX_STATIC_APP3 */
+static int arena_installed = 0;
+
+/** Chunk owned by the calling thread, or NULL */
+static _Thread_local IcuArenaChunk* thread_chunk = NULL;
+
+/** Nesting depth of icu_arena_begin() on the calling thread */
+static _Thread_local int thread_depth = 0;
+
+static void counter_increment(_Atomic sqlite3_int64* counter) {
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+// ========================================================================
+// === CHUNKS =============================================================
+// ========================================================================
+
+/**
+ * @brief Drops a reference to a chunk, freeing it with the last one
+ *
+ * @param chunk The chunk
+ */
+static void chunk_release(IcuArenaChunk* chunk) {
+    if (atomic_fetch_sub_explicit(&chunk->live, 1, memory_order_acq_rel) == 1)
+        free(chunk);
+}
+
+#ifdef FTS5_ICU_HAVE_PTHREADS
+
+static pthread_key_t chunk_key;
+static pthread_once_t chunk_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Releases the chunk of an exiting thread
+ *
+ * @param value The chunk registered for the thread
+ */
+static void chunk_thread_exit(void* value) {
+    chunk_release((IcuArenaChunk*)value);
+}
+
+static void chunk_key_create(void) {
+    pthread_key_create(&chunk_key, chunk_thread_exit);
+}
+
+#endif
+
+/**
+ * @brief Gives up the calling thread's chunk, leaving it to its live blocks
+ */
+static void chunk_retire(void) {
+    IcuArenaChunk* chunk = thread_chunk;
+    thread_chunk = NULL;
+    if (chunk) {
+#ifdef FTS5_ICU_HAVE_PTHREADS
+        pthread_setspecific(chunk_key, NULL);
+#endif
+        counter_increment(&arena_chunks_retired);
+        chunk_release(chunk);
+    }
+}
+
+/**
+ * @brief Returns the calling thread's chunk, creating one if necessary
+ *
+ * @return The chunk, or NULL if it cannot be allocated
+ */
+static IcuArenaChunk* chunk_for_thread(void) {
+    if (thread_chunk)
+        return thread_chunk;
+    IcuArenaChunk* chunk = (IcuArenaChunk*)malloc(ICU_ARENA_CHUNK_SIZE);
+    if (!chunk)
+        return NULL;
+    atomic_init(&chunk->live, 1);  // The owner's reference
+    chunk->used = 0;
+    thread_chunk = chunk;
+    counter_increment(&arena_chunks_created);
+#ifdef FTS5_ICU_HAVE_PTHREADS
+    pthread_once(&chunk_key_once, chunk_key_create);
+    pthread_setspecific(chunk_key, chunk);
+#endif
+    return chunk;
+}
+
+// ========================================================================
+// === ICU MEMORY FUNCTIONS ===============================================
+// ========================================================================
+
+/**
+ * @brief Allocates a block from the system allocator
+ *
+ * @param size Usable size of the block
+ * @return The block, or NULL
+ */
+static void* heap_allocate(size_t size) {
+    IcuArenaBlock* block = (IcuArenaBlock*)malloc(sizeof(IcuArenaBlock) + size);
+    if (!block)
+        return NULL;
+    counter_increment(&arena_heap_allocations);
+    block->chunk = NULL;
+    block->size = size;
+    return block + 1;
+}
+
+/**
+ * @brief Allocates a block, from the thread's arena during icuTokenize()
+ *
+ * @param context Unused
+ * @param size Requested size
+ * @return The block, or NULL
+ */
+static void* U_CALLCONV arena_alloc(const void* context, size_t size) {
+    UNUSED_PARAMETER(context);
+    counter_increment(&arena_icu_allocations);
+    if (thread_depth == 0 || size > ICU_ARENA_MAX_ALLOCATION)
+        return heap_allocate(size);
+
+    size_t needed = sizeof(IcuArenaBlock) +
+                    ((size + ICU_ARENA_ALIGNMENT - 1) & ~(size_t)(ICU_ARENA_ALIGNMENT - 1));
+    IcuArenaChunk* chunk = chunk_for_thread();
+    if (chunk && chunk->used + needed > ICU_ARENA_CHUNK_CAPACITY) {
+        chunk_retire();
+        chunk = chunk_for_thread();
+    }
+    if (!chunk)
+        return heap_allocate(size);
+
+    IcuArenaBlock* block = (IcuArenaBlock*)(chunk->data + chunk->used);
+    chunk->used += needed;
+    atomic_fetch_add_explicit(&chunk->live, 1, memory_order_relaxed);
+    counter_increment(&arena_arena_allocations);
+    block->chunk = chunk;
+    block->size = size;
+    return block + 1;
+}
+
+/**
+ * @brief Frees a block of either kind
+ *
+ * @param context Unused
+ * @param mem The block, or NULL
+ */
+static void U_CALLCONV arena_free(const void* context, void* mem) {
+    UNUSED_PARAMETER(context);
+    if (!mem)
+        return;
+    IcuArenaBlock* block = (IcuArenaBlock*)mem - 1;
+    if (block->chunk)
+        chunk_release(block->chunk);
+    else
+        free(block);
+}
+
+/**
+ * @brief Resizes a block; arena blocks move when they grow
+ *
+ * @param context Unused
+ * @param mem The block, or NULL
+ * @param size New size
+ * @return The resized block, or NULL
+ */
+static void* U_CALLCONV arena_realloc(const void* context, void* mem, size_t size) {
+    if (!mem)
+        return arena_alloc(context, size);
+    IcuArenaBlock* block = (IcuArenaBlock*)mem - 1;
+    if (!block->chunk) {
+        counter_increment(&arena_icu_allocations);
+        IcuArenaBlock* resized = (IcuArenaBlock*)realloc(block, sizeof(IcuArenaBlock) + size);
+        if (!resized)
+            return NULL;
+        counter_increment(&arena_heap_allocations);
+        resized->size = size;
+        return resized + 1;
+    }
+    if (size <= block->size)
+        return mem;
+    void* moved = arena_alloc(context, size);
+    if (moved) {
+        memcpy(moved, mem, block->size);
+        arena_free(context, mem);
+    }
+    return moved;
+}
+
+// ========================================================================
+// === PUBLIC INTERFACE ===================================================
+// ========================================================================
+
+/**
+ * @brief Keeps the library mapped until the process exits
+ *
+ * sqlite3_close() unloads the extensions a connection loaded. ICU's memory
+ * functions and the destructor of chunk_key point into this library, so it
+ * takes a reference that is never dropped.
+ *
+ * @return SQLITE_OK on success, SQLITE_ERROR if the library cannot be pinned
+ */
+static int pin_library(void) {
+#ifdef _WIN32
+    HMODULE module = NULL;
+    if (!GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_PIN,
+                            (LPCSTR)(void*)&arena_installed, &module)) {
+        return SQLITE_ERROR;
+    }
+    return SQLITE_OK;
+#else
+    Dl_info info;
+    if (!dladdr((void*)&arena_installed, &info) || !info.dli_fname)
+        return SQLITE_ERROR;
+    void* handle = dlopen(info.dli_fname, RTLD_NOW | RTLD_NOLOAD | RTLD_NODELETE);
+    return handle ? SQLITE_OK : SQLITE_ERROR;
+#endif
+}
+
+/**
+ * @brief Installs the arena-backed ICU memory functions once per process
+ *
+ * Called from the extension entry point, before the tokenizer opens any
+ * ICU object. The check and the installation are done under the
+ * SQLITE_MUTEX_STATIC_APP3 mutex, so a concurrent caller returns only once
+ * the functions are in place, and a failed installation can be retried.
+ *
+ * @return SQLITE_OK on success, SQLITE_ERROR if the library cannot be pinned
+ *         or ICU refuses the functions
+ */
+int icu_arena_install(void) {
+    sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP3);
+    sqlite3_mutex_enter(mutex);
+    int rc = SQLITE_OK;
+    if (!arena_installed) {
+        rc = pin_library();
+        if (rc == SQLITE_OK) {
+            UErrorCode status = U_ZERO_ERROR;
+            u_setMemoryFunctions(NULL, arena_alloc, arena_realloc, arena_free, &status);
+            if (U_SUCCESS(status))
+                arena_installed = 1;
+            else
+                rc = SQLITE_ERROR;
+        }
+    }
+    sqlite3_mutex_leave(mutex);
+    return rc;
+}
+
+/**
+ * @brief Starts serving ICU allocations of the calling thread from its arena
+ */
+void icu_arena_begin(void) {
+    thread_depth++;
+}
+
+/**
+ * @brief Ends an icu_arena_begin() section and recycles the arena
+ *
+ * The chunk is rewound if every block allocated from it was freed, and
+ * retired otherwise.
+ */
+void icu_arena_end(void) {
+    if (--thread_depth > 0)
+        return;
+    IcuArenaChunk* chunk = thread_chunk;
+    if (!chunk)
+        return;
+    if (atomic_load_explicit(&chunk->live, memory_order_acquire) == 1)
+        chunk->used = 0;
+    else
+        chunk_retire();
+}
+
+/**
+ * @brief SQL function returning the ICU allocation counters as JSON
+ *
+ * icu_arena_stats() counts the allocations requested by ICU, those served
+ * from arenas and those that reached the system allocator, and the arena
+ * chunks created and retired. Returns NULL when the library was built
+ * without FTS5_ICU_ARENA.
+ */
+static void icu_arena_stats_func(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    UNUSED_PARAMETER(argc);
+    UNUSED_PARAMETER(argv);
+    char* json = sqlite3_mprintf(
+      "{\"icu_allocations\":%lld,\"arena_allocations\":%lld,\"heap_allocations\":%lld,"
+      "\"chunks_created\":%lld,\"chunks_retired\":%lld}",
+      atomic_load(&arena_icu_allocations), atomic_load(&arena_arena_allocations),
+      atomic_load(&arena_heap_allocations), atomic_load(&arena_chunks_created),
+      atomic_load(&arena_chunks_retired));
+    if (!json) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    sqlite3_result_text(context, json, -1, sqlite3_free);
+}
+
+#else  // !FTS5_ICU_HAVE_ARENA
+
+// Without FTS5_ICU_ARENA (or without C11 atomics) ICU keeps its default
+// memory functions.
+
+int icu_arena_install(void) {
+    return SQLITE_OK;
+}
+
+void icu_arena_begin(void) {
+}
+
+void icu_arena_end(void) {
+}
+
+static void icu_arena_stats_func(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    UNUSED_PARAMETER(argc);
+    UNUSED_PARAMETER(argv);
+    sqlite3_result_null(context);
+}
+
+#endif  // FTS5_ICU_HAVE_ARENA
+
+/**
+ * @brief Registers icu_arena_stats() with a database connection
+ *
+ * @param db The database connection
+ * @return SQLITE_OK on success, error code from sqlite3_create_function()
+ */
+int icu_register_arena_functions(sqlite3* db) {
+    return sqlite3_create_function(db, "icu_arena_stats", 0, SQLITE_UTF8, NULL,
+                                   icu_arena_stats_func, NULL, NULL);
+}
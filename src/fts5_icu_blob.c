@@ -0,0 +1,581 @@
+/**
+ * @file fts5_icu_blob.c
+ * @brief Pre-tokenized token-stream blobs and the replay tokenizer
+ *
+ * icu_tokenize_blob(text [, tokenizer]) runs an ICU tokenizer over a document
+ * and serializes the resulting tokens into a compact blob, so that the ICU
+ * work can be done in an offline batch pipeline. The optional second argument
+ * names a registered tokenizer and its arguments the way a tokenize directive
+ * does, e.g. 'icu_th' or 'icu cjk bigram'; by default the first registered
+ * tokenizer is used without arguments. The companion replay
+ * tokenizers ("<tokenizer name>_replay", e.g. "icu_replay") decode such blobs
+ * in xTokenize without any ICU calls. Query text is not a blob, so queries
+ * are tokenized with a regular ICU tokenizer created on first use.
+ *
+ * Blob layout (all integers are unsigned LEB128 varints unless noted):
+ *
+ *   magic        4 bytes  "ICUT"
+ *   version      1 byte   ICU_BLOB_FORMAT_VERSION
+ *   fingerprint  8 bytes  big-endian icu_config_fingerprint() of the producer
+ *   then, for each token until the end of the blob:
+ *     tflags
+ *     start delta   zigzag-encoded difference to the previous token's start
+ *     length        iEnd - iStart
+ *     token size    followed by that many bytes of UTF-8 token text
+ *
+ * Blobs produced with a different format version, rule chain, locale or ICU
+ * version are rejected with SQLITE_ERROR.
+ */
+
+#include "fts5_icu.h"
+
+SQLITE_EXTENSION_INIT3
+
+/** Magic bytes at the start of every token-stream blob */
+#define ICU_BLOB_MAGIC "ICUT"
+
+/** Length of the magic bytes */
+#define ICU_BLOB_MAGIC_SIZE 4
+
+/** Current blob format version; bump on any incompatible change */
+#define ICU_BLOB_FORMAT_VERSION 1
+
+/** Size of the fixed blob header */
+#define ICU_BLOB_HEADER_SIZE (ICU_BLOB_MAGIC_SIZE + 1 + 8)
+
+/** Maximum encoded size of a 64-bit varint */
+#define ICU_VARINT_MAX_SIZE 10
+
+// ========================================================================
+// === VARINT ENCODING ====================================================
+// ========================================================================
+
+/**
+ * @brief Writes an unsigned LEB128 varint
+ *
+ * @param out Destination buffer with room for ICU_VARINT_MAX_SIZE bytes
+ * @param value The value to encode
+ * @return Number of bytes written
+ */
+static int put_varint(unsigned char* out, sqlite3_uint64 value) {
+    int n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+/**
+ * @brief Reads an unsigned LEB128 varint with bounds checking
+ *
+ * @param data Start of the encoded data
+ * @param nData Number of bytes available
+ * @param[out] pValue Receives the decoded value
+ * @return Number of bytes consumed, or 0 if the varint is truncated or too long
+ */
+static int get_varint(const unsigned char* data, int nData, sqlite3_uint64* pValue) {
+    sqlite3_uint64 value = 0;
+    for (int i = 0; i < nData && i < ICU_VARINT_MAX_SIZE; i++) {
+        value |= (sqlite3_uint64)(data[i] & 0x7F) << (7 * i);
+        if (!(data[i] & 0x80)) {
+            *pValue = value;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+/** Maps a signed value onto an unsigned one so small magnitudes stay short */
+static sqlite3_uint64 zigzag_encode(sqlite3_int64 value) {
+    return ((sqlite3_uint64)value << 1) ^ (sqlite3_uint64)(value >> 63);
+}
+
+/** Inverse of zigzag_encode() */
+static sqlite3_int64 zigzag_decode(sqlite3_uint64 value) {
+    return (sqlite3_int64)(value >> 1) ^ -(sqlite3_int64)(value & 1);
+}
+
+// ========================================================================
+// === BLOB WRITER ========================================================
+// ========================================================================
+
+/** Growable output buffer used while serializing tokens */
+typedef struct IcuBlobWriter {
+    unsigned char* data; /**< Encoded blob */
+    int used;            /**< Bytes written */
+    int capacity;        /**< Allocated size of data */
+    int previous_start;  /**< Start offset of the previous token */
+} IcuBlobWriter;
+
+/**
+ * @brief Makes room for at least nExtra more bytes in the writer
+ *
+ * @param writer The blob writer
+ * @param nExtra Number of bytes about to be written
+ * @return SQLITE_OK on success, SQLITE_NOMEM or SQLITE_TOOBIG on failure
+ */
+static int blob_writer_reserve(IcuBlobWriter* writer, int nExtra) {
+    if (nExtra > INT_MAX - writer->used)
+        return SQLITE_TOOBIG;
+    if (writer->used + nExtra <= writer->capacity)
+        return SQLITE_OK;
+
+    int64_t new_capacity = writer->capacity ? writer->capacity : 256;
+    while (new_capacity < (int64_t)writer->used + nExtra) {
+        new_capacity *= 2;
+    }
+    if (new_capacity > INT_MAX)
+        return SQLITE_TOOBIG;
+
+    unsigned char* new_data = (unsigned char*)sqlite3_realloc(writer->data, (int)new_capacity);
+    if (!new_data)
+        return SQLITE_NOMEM;
+    writer->data = new_data;
+    writer->capacity = (int)new_capacity;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief xToken callback that appends one token to the blob
+ *
+ * @param pCtx The IcuBlobWriter
+ * @param tflags FTS5_TOKEN_* flags
+ * @param pToken Token text
+ * @param nToken Length of the token text in bytes
+ * @param iStart Start byte offset in the source text
+ * @param iEnd End byte offset in the source text
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+static int blob_write_token(void* pCtx, int tflags, const char* pToken, int nToken, int iStart,
+                            int iEnd) {
+    IcuBlobWriter* writer = (IcuBlobWriter*)pCtx;
+    if (nToken < 0 || iEnd < iStart)
+        return SQLITE_ERROR;
+
+    int rc = blob_writer_reserve(writer, 4 * ICU_VARINT_MAX_SIZE);
+    if (rc == SQLITE_OK) {
+        unsigned char* out = writer->data + writer->used;
+        int n = put_varint(out, (sqlite3_uint64)tflags);
+        n += put_varint(out + n, zigzag_encode((sqlite3_int64)iStart - writer->previous_start));
+        n += put_varint(out + n, (sqlite3_uint64)(iEnd - iStart));
+        n += put_varint(out + n, (sqlite3_uint64)nToken);
+        writer->used += n;
+        rc = blob_writer_reserve(writer, nToken);
+    }
+    if (rc == SQLITE_OK) {
+        memcpy(writer->data + writer->used, pToken, nToken);
+        writer->used += nToken;
+        writer->previous_start = iStart;
+    }
+    return rc;
+}
+
+/**
+ * @brief Writes the fixed blob header
+ *
+ * @param writer The blob writer
+ * @param fingerprint Fingerprint of the producing tokenizer configuration
+ * @return SQLITE_OK on success, SQLITE_NOMEM on failure
+ */
+static int blob_write_header(IcuBlobWriter* writer, sqlite3_uint64 fingerprint) {
+    int rc = blob_writer_reserve(writer, ICU_BLOB_HEADER_SIZE);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    unsigned char* out = writer->data;
+    memcpy(out, ICU_BLOB_MAGIC, ICU_BLOB_MAGIC_SIZE);
+    out[ICU_BLOB_MAGIC_SIZE] = ICU_BLOB_FORMAT_VERSION;
+    for (int i = 0; i < 8; i++) {
+        out[ICU_BLOB_MAGIC_SIZE + 1 + i] = (unsigned char)(fingerprint >> (56 - 8 * i));
+    }
+    writer->used = ICU_BLOB_HEADER_SIZE;
+    return SQLITE_OK;
+}
+
+// ========================================================================
+// === SQL FUNCTION: icu_tokenize_blob(text [, tokenizer]) ================
+// ========================================================================
+
+/** Per-connection state of icu_tokenize_blob() */
+typedef struct IcuBlobFunction {
+    IcuTokenizerV2* tokenizer; /**< Created on first call and when the spec changes */
+    char* spec;                /**< Tokenizer spec the tokenizer was created from */
+} IcuBlobFunction;
+
+/**
+ * @brief Splits a tokenizer spec into the tokenizer name and its arguments
+ *
+ * Words are separated by whitespace. As in a tokenize directive, a word may
+ * be quoted with single or double quotes, with the quote doubled inside.
+ *
+ * @param spec The tokenizer spec, e.g. "icu rules 'NFKD; Lower; NFKC'"
+ * @param[out] pazWord Receives the words; one allocation, free with sqlite3_free()
+ * @param[out] pnWord Receives the number of words
+ * @return SQLITE_OK on success, SQLITE_ERROR for an unterminated quote,
+ *         SQLITE_NOMEM
+ */
+static int split_tokenizer_spec(const char* spec, char*** pazWord, int* pnWord) {
+    size_t length = strlen(spec);
+    size_t max_words = length / 2 + 1;
+    char** azWord = (char**)sqlite3_malloc64(max_words * sizeof(char*) + length + 1);
+    if (!azWord)
+        return SQLITE_NOMEM;
+    char* out = (char*)(azWord + max_words);
+
+    int nWord = 0;
+    const char* in = spec;
+    for (;;) {
+        while (*in == ' ' || *in == '\t' || *in == '\n' || *in == '\r')
+            in++;
+        if (!*in)
+            break;
+        azWord[nWord++] = out;
+        if (*in == '\'' || *in == '"') {
+            char quote = *in++;
+            for (;;) {
+                if (!*in) {
+                    sqlite3_free(azWord);
+                    return SQLITE_ERROR;
+                }
+                if (*in == quote) {
+                    if (in[1] != quote)
+                        break;
+                    in++;
+                }
+                *out++ = *in++;
+            }
+            in++;
+        } else {
+            while (*in && *in != ' ' && *in != '\t' && *in != '\n' && *in != '\r')
+                *out++ = *in++;
+        }
+        *out++ = 0;
+    }
+    *pazWord = azWord;
+    *pnWord = nWord;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Creates the tokenizer named by a tokenizer spec
+ *
+ * @param spec The tokenizer spec, or NULL for the first registered tokenizer
+ * @param[out] ppTokenizer Receives the tokenizer
+ * @param[out] pzError Receives an error message (free with sqlite3_free())
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+static int create_spec_tokenizer(const char* spec, IcuTokenizerV2** ppTokenizer,
+                                 char** pzError) {
+    Fts5Tokenizer* tokenizer = NULL;
+    if (!spec) {
+        int rc = icuCreate(NULL, NULL, 0, &tokenizer);
+        *ppTokenizer = (IcuTokenizerV2*)tokenizer;
+        return rc;
+    }
+
+    char** azWord = NULL;
+    int nWord = 0;
+    int rc = split_tokenizer_spec(spec, &azWord, &nWord);
+    if (rc == SQLITE_OK && nWord == 0)
+        rc = SQLITE_ERROR;
+    if (rc != SQLITE_OK) {
+        if (rc == SQLITE_ERROR)
+            *pzError = sqlite3_mprintf("icu_tokenize_blob: malformed tokenizer '%s'", spec);
+        sqlite3_free(azWord);
+        return rc;
+    }
+
+    const IcuLocaleDescriptor* descriptor = NULL;
+    for (int i = 0; i < icu_locale_descriptor_count; i++) {
+        if (sqlite3_stricmp(azWord[0], icu_locale_descriptors[i].name) == 0)
+            descriptor = &icu_locale_descriptors[i];
+    }
+    if (!descriptor) {
+        *pzError = sqlite3_mprintf("icu_tokenize_blob: no such tokenizer: %s", azWord[0]);
+        rc = SQLITE_ERROR;
+    } else {
+        rc = icuCreate((void*)descriptor, (const char**)azWord + 1, nWord - 1, &tokenizer);
+        if (rc == SQLITE_ERROR)
+            *pzError = sqlite3_mprintf("icu_tokenize_blob: bad arguments for %s", azWord[0]);
+    }
+    sqlite3_free(azWord);
+    *ppTokenizer = (IcuTokenizerV2*)tokenizer;
+    return rc;
+}
+
+/**
+ * @brief Destructor for the icu_tokenize_blob() user data
+ *
+ * @param pArg The IcuBlobFunction to free
+ */
+static void blob_function_destroy(void* pArg) {
+    IcuBlobFunction* function = (IcuBlobFunction*)pArg;
+    if (function->tokenizer)
+        icuDelete((Fts5Tokenizer*)function->tokenizer);
+    sqlite3_free(function->spec);
+    sqlite3_free(function);
+}
+
+/**
+ * @brief Implementation of icu_tokenize_blob()
+ *
+ * Returns NULL for a NULL document, otherwise a token-stream blob. The
+ * tokenizer is kept for later calls with the same spec, which is the usual
+ * case of one spec for every row of a batch.
+ *
+ * @param context SQL function context
+ * @param argc Number of arguments (1 or 2)
+ * @param argv Document text and optional tokenizer spec
+ */
+static void icu_tokenize_blob_func(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    IcuBlobFunction* function = (IcuBlobFunction*)sqlite3_user_data(context);
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
+        return;
+
+    const char* spec = argc > 1 ? (const char*)sqlite3_value_text(argv[1]) : NULL;
+    if (argc > 1 && !spec) {
+        sqlite3_result_error(context, "icu_tokenize_blob: the tokenizer must be text", -1);
+        return;
+    }
+    if (function->tokenizer && spec && strcmp(spec, function->spec) != 0) {
+        icuDelete((Fts5Tokenizer*)function->tokenizer);
+        function->tokenizer = NULL;
+        sqlite3_free(function->spec);
+        function->spec = NULL;
+    }
+    if (!function->tokenizer) {
+        char* spec_copy = spec ? sqlite3_mprintf("%s", spec) : NULL;
+        if (spec && !spec_copy) {
+            sqlite3_result_error_nomem(context);
+            return;
+        }
+        char* zError = NULL;
+        IcuTokenizerV2* tokenizer = NULL;
+        int rc = create_spec_tokenizer(spec, &tokenizer, &zError);
+        if (rc != SQLITE_OK) {
+            sqlite3_free(spec_copy);
+            if (zError) {
+                sqlite3_result_error(context, zError, -1);
+                sqlite3_free(zError);
+            } else {
+                sqlite3_result_error_code(context, rc);
+            }
+            return;
+        }
+        function->tokenizer = tokenizer;
+        function->spec = spec_copy;
+    }
+
+    const char* text = (const char*)sqlite3_value_text(argv[0]);
+    int text_length = sqlite3_value_bytes(argv[0]);
+
+    IcuBlobWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    int rc = blob_write_header(&writer, icu_config_fingerprint(&function->tokenizer->config));
+    if (rc == SQLITE_OK) {
+        rc = icuTokenize((Fts5Tokenizer*)function->tokenizer, &writer, FTS5_TOKENIZE_DOCUMENT,
+                         text, text_length, NULL, 0, blob_write_token);
+    }
+
+    if (rc == SQLITE_OK) {
+        sqlite3_result_blob(context, writer.data, writer.used, sqlite3_free);
+    } else {
+        sqlite3_free(writer.data);
+        sqlite3_result_error_code(context, rc);
+    }
+}
+
+// ========================================================================
+// === REPLAY TOKENIZER ===================================================
+// ========================================================================
+
+/** Replay tokenizer instance */
+typedef struct IcuReplayTokenizer {
+    const IcuLocaleDescriptor* descriptor; /**< Tokenizer whose blobs are replayed */
+    sqlite3_uint64 fingerprint; /**< Expected fingerprint of document blobs */
+    IcuTokenizerV2* query_tokenizer; /**< ICU tokenizer for query text, created on first use */
+    char** azArg;               /**< Copy of the tokenizer arguments */
+    int nArg;                   /**< Number of tokenizer arguments */
+} IcuReplayTokenizer;
+
+/**
+ * @brief Releases a replay tokenizer instance
+ *
+ * @param pTok The IcuReplayTokenizer to free
+ */
+static void replayDelete(Fts5Tokenizer* pTok) {
+    if (!pTok)
+        return;
+    IcuReplayTokenizer* replay = (IcuReplayTokenizer*)pTok;
+    if (replay->query_tokenizer)
+        icuDelete((Fts5Tokenizer*)replay->query_tokenizer);
+    for (int i = 0; i < replay->nArg; i++) {
+        sqlite3_free(replay->azArg[i]);
+    }
+    sqlite3_free(replay->azArg);
+    sqlite3_free(replay);
+}
+
+/**
+ * @brief xCreate for the replay tokenizer
+ *
+ * No ICU objects are opened here; the tokenizer arguments are kept so that
+ * the query tokenizer can be created with the same configuration later.
+ */
+static int replayCreate(void* pCtx, const char** azArg, int nArg, Fts5Tokenizer** ppOut) {
+    const IcuLocaleDescriptor* descriptor = (const IcuLocaleDescriptor*)pCtx;
+
+    IcuTokenizerConfig config;
+    if (icu_config_init(&config, descriptor, azArg, nArg) != SQLITE_OK)
+        return SQLITE_ERROR;
+    sqlite3_uint64 fingerprint = icu_config_fingerprint(&config);
+    icu_config_clear(&config);
+
+    IcuReplayTokenizer* replay = (IcuReplayTokenizer*)sqlite3_malloc(sizeof(IcuReplayTokenizer));
+    if (!replay)
+        return SQLITE_NOMEM;
+    memset(replay, 0, sizeof(IcuReplayTokenizer));
+    replay->descriptor = descriptor;
+    replay->fingerprint = fingerprint;
+
+    if (nArg > 0) {
+        replay->azArg = (char**)sqlite3_malloc(nArg * (int)sizeof(char*));
+        if (!replay->azArg) {
+            replayDelete((Fts5Tokenizer*)replay);
+            return SQLITE_NOMEM;
+        }
+        for (int i = 0; i < nArg; i++) {
+            replay->azArg[i] = sqlite3_mprintf("%s", azArg[i]);
+            if (!replay->azArg[i]) {
+                replayDelete((Fts5Tokenizer*)replay);
+                return SQLITE_NOMEM;
+            }
+            replay->nArg++;
+        }
+    }
+
+    *ppOut = (Fts5Tokenizer*)replay;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Decodes a token-stream blob and passes its tokens to xToken
+ *
+ * @param replay The replay tokenizer instance
+ * @param blob The blob bytes
+ * @param nBlob Length of the blob
+ * @param pCtx Context for the callback function
+ * @param xToken Callback function to pass the tokens to
+ * @return SQLITE_OK on success, SQLITE_ERROR for stale or malformed blobs
+ */
+static int replay_blob(const IcuReplayTokenizer* replay, const unsigned char* blob, int nBlob,
+                       void* pCtx, IcuTokenCallback xToken) {
+    if (nBlob < ICU_BLOB_HEADER_SIZE || memcmp(blob, ICU_BLOB_MAGIC, ICU_BLOB_MAGIC_SIZE) != 0 ||
+        blob[ICU_BLOB_MAGIC_SIZE] != ICU_BLOB_FORMAT_VERSION) {
+        return SQLITE_ERROR;
+    }
+    sqlite3_uint64 fingerprint = 0;
+    for (int i = 0; i < 8; i++) {
+        fingerprint = (fingerprint << 8) | blob[ICU_BLOB_MAGIC_SIZE + 1 + i];
+    }
+    if (fingerprint != replay->fingerprint)
+        return SQLITE_ERROR;  // Produced by a different rule set or ICU version
+
+    int position = ICU_BLOB_HEADER_SIZE;
+    sqlite3_int64 previous_start = 0;
+    while (position < nBlob) {
+        sqlite3_uint64 fields[4];
+        for (int i = 0; i < 4; i++) {
+            int n = get_varint(blob + position, nBlob - position, &fields[i]);
+            if (n == 0)
+                return SQLITE_ERROR;
+            position += n;
+        }
+
+        sqlite3_int64 start = previous_start + zigzag_decode(fields[1]);
+        sqlite3_int64 end = start + (sqlite3_int64)fields[2];
+        if (fields[0] > INT_MAX || start < 0 || end > INT_MAX ||
+            fields[3] > (sqlite3_uint64)(nBlob - position)) {
+            return SQLITE_ERROR;
+        }
+
+        int rc = xToken(pCtx, (int)fields[0], (const char*)blob + position, (int)fields[3],
+                        (int)start, (int)end);
+        if (rc != SQLITE_OK)
+            return rc;
+        position += (int)fields[3];
+        previous_start = start;
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * @brief xTokenize for the replay tokenizer
+ *
+ * Documents are decoded from blobs; queries are tokenized with ICU.
+ */
+static int replayTokenize(Fts5Tokenizer* pTok, void* pCtx, int flags, const char* pText, int nText,
+                          const char* pLocale, int nLocale, IcuTokenCallback xToken) {
+    IcuReplayTokenizer* replay = (IcuReplayTokenizer*)pTok;
+    if (!pText || nText <= 0)
+        return SQLITE_OK;
+
+    if (!(flags & FTS5_TOKENIZE_QUERY)) {
+        return replay_blob(replay, (const unsigned char*)pText, nText, pCtx, xToken);
+    }
+
+    if (!replay->query_tokenizer) {
+        Fts5Tokenizer* tokenizer = NULL;
+        int rc = icuCreate((void*)replay->descriptor, (const char**)replay->azArg, replay->nArg,
+                           &tokenizer);
+        if (rc != SQLITE_OK)
+            return rc;
+        replay->query_tokenizer = (IcuTokenizerV2*)tokenizer;
+    }
+    return icuTokenize((Fts5Tokenizer*)replay->query_tokenizer, pCtx, flags, pText, nText, pLocale,
+                       nLocale, xToken);
+}
+
+// ========================================================================
+// === REGISTRATION =======================================================
+// ========================================================================
+
+/**
+ * @brief Registers icu_tokenize_blob() and a replay tokenizer for every
+ *        registered ICU tokenizer
+ *
+ * @param db The database connection
+ * @param pFts5Api The FTS5 API of the connection
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+int icu_register_blob_functions(sqlite3* db, fts5_api* pFts5Api) {
+    fts5_tokenizer_v2 replay_tokenizer = {
+      .iVersion = 2, .xCreate = replayCreate, .xDelete = replayDelete,
+      .xTokenize = replayTokenize};
+    int rc = SQLITE_OK;
+    for (int i = 0; i < icu_locale_descriptor_count && rc == SQLITE_OK; i++) {
+        const IcuLocaleDescriptor* descriptor = &icu_locale_descriptors[i];
+        char* name = sqlite3_mprintf("%s_replay", descriptor->name);
+        if (!name)
+            return SQLITE_NOMEM;
+        rc = pFts5Api->xCreateTokenizer_v2(pFts5Api, name, (void*)descriptor, &replay_tokenizer,
+                                           NULL);
+        sqlite3_free(name);
+    }
+    if (rc != SQLITE_OK)
+        return rc;
+
+    // Each arity owns its own state; sqlite3_create_function_v2() invokes the
+    // destructor itself if registration fails.
+    for (int nArg = 1; nArg <= 2 && rc == SQLITE_OK; nArg++) {
+        IcuBlobFunction* function = (IcuBlobFunction*)sqlite3_malloc(sizeof(IcuBlobFunction));
+        if (!function)
+            return SQLITE_NOMEM;
+        memset(function, 0, sizeof(IcuBlobFunction));
+        rc = sqlite3_create_function_v2(db, "icu_tokenize_blob", nArg, SQLITE_UTF8, function,
+                                        icu_tokenize_blob_func, NULL, NULL, blob_function_destroy);
+    }
+    return rc;
+}
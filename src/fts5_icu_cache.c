@@ -0,0 +1,623 @@
+/**
+ * @file fts5_icu_cache.c
+ * @brief Persistent memory-mapped cache of token normalizations
+ *
+ * Transliteration dominates tokenization time, and the same words are
+ * normalized over and over again. Tables created with the "cache <path>"
+ * option look tokens up in a hash table stored in a file before running the
+ * rule chain, and add the normalizations they compute. The file is mapped
+ * shared, so every connection and every process that uses it, including
+ * processes started later, benefits from the work of the others.
+ *
+ * File layout:
+ *   IcuCacheHeader
+ *   uint64_t slots[header.slot_count]   open addressing, linear probing
+ *   heap[header.heap_size]               append-only entry records
+ *
+ * A slot is 0 while empty; otherwise its high 32 bits are the high bits of
+ * the key hash and its low 32 bits the heap offset of the entry. Entries are
+ * never modified or removed once published, so readers need no locks: the
+ * writer fills the record, then publishes the slot with a release store that
+ * readers pair with an acquire load. There is one writer at a time, chosen
+ * by a mutex within the process and an advisory file lock between
+ * processes. A writer that finds the lock taken skips the insertion instead
+ * of waiting. When the heap or the probe window is full, new
+ * normalizations are simply not cached.
+ *
+ * The header records a key derived from the ICU version and the rule chain.
+ * A file with another key was written by a different library or
+ * configuration, and is replaced by a fresh file with an atomic rename, so
+ * that processes still using the old file are not disturbed.
+ *
+ * The cache needs C11 atomics and POSIX file mapping. On other platforms
+ * the option is accepted and tokens are always normalized by ICU.
+ */
+
+#include "fts5_icu.h"
+
+SQLITE_EXTENSION_INIT3
+
+#if !defined(__STDC_NO_ATOMICS__) && !defined(_WIN32)
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FTS5_ICU_HAVE_CACHE 1
+#endif
+
+#ifdef FTS5_ICU_HAVE_CACHE
+
+/** Magic bytes at the start of every cache file */
+#define ICU_CACHE_MAGIC "ICUC"
+
+/** Current file format version */
+#define ICU_CACHE_VERSION 1
+
+/** Written in host byte order to detect files from a different host */
+#define ICU_CACHE_BYTE_ORDER 0x01020304u
+
+/** Longest token cached, in UTF-16 code units */
+#define ICU_CACHE_MAX_KEY 64
+
+/** Slots probed before a lookup or insertion gives up */
+#define ICU_CACHE_MAX_PROBES 32
+
+/** Average heap bytes per slot; keeps the table at most half full */
+#define ICU_CACHE_HEAP_PER_SLOT 64
+
+/** Fixed-size file header */
+typedef struct IcuCacheHeader {
+    char magic[4];                /**< ICU_CACHE_MAGIC */
+    uint32_t version;             /**< ICU_CACHE_VERSION */
+    uint32_t byte_order;          /**< ICU_CACHE_BYTE_ORDER in the byte order of the file */
+    uint32_t slot_count;          /**< Number of slots, a power of two */
+    uint64_t key;                 /**< Hash of the ICU version and the rule chain */
+    uint64_t heap_size;           /**< Size of the heap in bytes */
+    _Atomic uint64_t heap_used;   /**< Bytes of the heap in use */
+    _Atomic uint64_t entry_count; /**< Number of published entries */
+} IcuCacheHeader;
+
+/** Entry record in the heap, followed by the key and the value */
+typedef struct IcuCacheEntry {
+    uint16_t key_length;   /**< Raw token length in UTF-16 code units */
+    uint16_t value_length; /**< Normalized token length in UTF-8 bytes */
+} IcuCacheEntry;
+
+struct IcuNormalizationCache {
+    IcuNormalizationCache* next_cache; /**< Next cache in the registry */
+    int reference_count;               /**< Configurations using the cache */
+    char* path;                        /**< Canonical path of the file */
+    int fd;                            /**< Open file, used for the writer lock */
+    void* mapping;                     /**< Start of the mapped file */
+    size_t mapping_size;               /**< Size of the mapped file */
+    IcuCacheHeader* header;            /**< File header */
+    _Atomic uint64_t* slots;           /**< Slot array */
+    unsigned char* heap;               /**< Entry heap */
+    sqlite3_mutex* writer_mutex;       /**< Serializes writers within the process */
+};
+
+/** All open caches; protected by the SQLITE_MUTEX_STATIC_APP1 mutex */
+static IcuNormalizationCache* cache_registry = NULL;
+
+/**
+ * Serializes icu_cache_open() calls, so that one file is created or mapped
+ * at a time without holding the APP1 mutex over file locks and writes.
+ * Allocated under the APP1 mutex and never freed.
+ */
+static sqlite3_mutex* cache_open_mutex = NULL;
+
+// ========================================================================
+// === FILE ===============================================================
+// ========================================================================
+
+/**
+ * @brief Computes the key that ties a cache file to a rule chain
+ *
+ * @param rules The transliterator rule chain
+ * @return Hash of the ICU version and the rules
+ */
+static uint64_t cache_key(const UChar* rules) {
+    uint64_t hash = 14695981039346656037ULL;
+    UVersionInfo icu_version;
+    u_getVersion(icu_version);
+    for (size_t i = 0; i < sizeof(icu_version); i++) {
+        hash = (hash ^ icu_version[i]) * 1099511628211ULL;
+    }
+    for (const UChar* p = rules; *p; p++) {
+        hash = (hash ^ (*p & 0xFF)) * 1099511628211ULL;
+        hash = (hash ^ (*p >> 8)) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Computes the layout of a cache file of a given size
+ *
+ * @param size_mb Requested size in MiB
+ * @param[out] pSlotCount Receives the number of slots
+ * @param[out] pHeapSize Receives the heap size in bytes
+ * @return The file size in bytes
+ */
+static size_t cache_layout(int size_mb, uint32_t* pSlotCount, uint64_t* pHeapSize) {
+    uint64_t total = (uint64_t)size_mb << 20;
+    uint32_t slot_count = 1024;
+    while ((uint64_t)slot_count * 2 * (sizeof(uint64_t) + ICU_CACHE_HEAP_PER_SLOT) <= total) {
+        slot_count *= 2;
+    }
+    *pSlotCount = slot_count;
+    *pHeapSize = total - sizeof(IcuCacheHeader) - (uint64_t)slot_count * sizeof(uint64_t);
+    return (size_t)total;
+}
+
+/**
+ * @brief Checks whether an open file is a usable cache for a key
+ *
+ * @param fd The open file
+ * @param key The expected key
+ * @return Non-zero if the header and size match
+ */
+static int cache_file_matches(int fd, uint64_t key) {
+    IcuCacheHeader header;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != sizeof(header))
+        return 0;
+    if (memcmp(header.magic, ICU_CACHE_MAGIC, 4) != 0 || header.version != ICU_CACHE_VERSION ||
+        header.byte_order != ICU_CACHE_BYTE_ORDER || header.key != key) {
+        return 0;
+    }
+    uint64_t slot_count = header.slot_count;
+    if (slot_count == 0 || (slot_count & (slot_count - 1)) != 0)
+        return 0;
+    return sizeof(IcuCacheHeader) + slot_count * sizeof(uint64_t) + header.heap_size ==
+           (uint64_t)st.st_size;
+}
+
+/**
+ * @brief Writes an empty cache into a new file
+ *
+ * @param fd The open, empty file
+ * @param key Key of the cache
+ * @param size_mb Size of the file in MiB
+ * @return SQLITE_OK on success, SQLITE_IOERR on failure
+ */
+static int cache_file_initialize(int fd, uint64_t key, int size_mb) {
+    IcuCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ICU_CACHE_MAGIC, 4);
+    header.version = ICU_CACHE_VERSION;
+    header.byte_order = ICU_CACHE_BYTE_ORDER;
+    header.key = key;
+    size_t file_size = cache_layout(size_mb, &header.slot_count, &header.heap_size);
+    atomic_init(&header.heap_used, 8);  // Offset 0 marks an empty slot
+    atomic_init(&header.entry_count, 0);
+
+    // The file is sparse; slots and heap read as zero until written
+    if (ftruncate(fd, (off_t)file_size) != 0 ||
+        pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        return SQLITE_IOERR;
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Prepares an open cache file, initializing or replacing it if it does not match
+ *
+ * @param path Path of the cache file
+ * @param key Key of the cache
+ * @param size_mb Size of a new file in MiB
+ * @param[in,out] pFd The open file; receives the replacement file if the
+ *                file is replaced. Closed on failure.
+ * @return SQLITE_OK on success, SQLITE_CANTOPEN or SQLITE_IOERR on failure
+ */
+static int cache_file_prepare(const char* path, uint64_t key, int size_mb, int* pFd) {
+    int fd = *pFd;
+
+    // Creation and replacement happen under the writer lock, so concurrent
+    // openers agree on one file
+    flock(fd, LOCK_EX);
+    int rc = SQLITE_OK;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        rc = SQLITE_IOERR;
+    } else if (st.st_size == 0) {
+        rc = cache_file_initialize(fd, key, size_mb);
+    } else if (!cache_file_matches(fd, key)) {
+        // Written by another ICU version or rule chain: build a new file next
+        // to it and rename it into place
+        char* temp_path = sqlite3_mprintf("%s.XXXXXX", path);
+        int temp_fd = temp_path ? mkstemp(temp_path) : -1;
+        if (temp_fd < 0) {
+            rc = temp_path ? SQLITE_CANTOPEN : SQLITE_NOMEM;
+        } else {
+            rc = cache_file_initialize(temp_fd, key, size_mb);
+            if (rc == SQLITE_OK && fchmod(temp_fd, st.st_mode & 0777) != 0)
+                rc = SQLITE_IOERR;
+            if (rc == SQLITE_OK && rename(temp_path, path) != 0)
+                rc = SQLITE_IOERR;
+            if (rc != SQLITE_OK) {
+                unlink(temp_path);
+                close(temp_fd);
+            } else {
+                flock(fd, LOCK_UN);
+                close(fd);
+                fd = temp_fd;
+                flock(fd, LOCK_EX);
+            }
+        }
+        sqlite3_free(temp_path);
+    }
+    flock(fd, LOCK_UN);
+
+    if (rc != SQLITE_OK) {
+        close(fd);
+        *pFd = -1;
+        return rc;
+    }
+    *pFd = fd;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Unmaps a cache and frees it
+ *
+ * @param cache The cache
+ */
+static void cache_free(IcuNormalizationCache* cache) {
+    if (cache->mapping)
+        munmap(cache->mapping, cache->mapping_size);
+    if (cache->fd >= 0)
+        close(cache->fd);
+    sqlite3_mutex_free(cache->writer_mutex);
+    sqlite3_free(cache->path);
+    sqlite3_free(cache);
+}
+
+/**
+ * @brief Maps an open cache file and locates its sections
+ *
+ * @param cache The cache whose file is open
+ * @return SQLITE_OK on success, SQLITE_CANTOPEN if the file cannot be mapped
+ */
+static int cache_map(IcuNormalizationCache* cache) {
+    struct stat st;
+    if (fstat(cache->fd, &st) != 0 || st.st_size <= (off_t)sizeof(IcuCacheHeader))
+        return SQLITE_CANTOPEN;
+    void* mapping =
+      mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    if (mapping == MAP_FAILED)
+        return SQLITE_CANTOPEN;
+
+    cache->mapping = mapping;
+    cache->mapping_size = (size_t)st.st_size;
+    cache->header = (IcuCacheHeader*)mapping;
+    cache->slots = (_Atomic uint64_t*)(cache->header + 1);
+    cache->heap = (unsigned char*)(cache->slots + cache->header->slot_count);
+    return SQLITE_OK;
+}
+
+// ========================================================================
+// === REGISTRY ===========================================================
+// ========================================================================
+
+/**
+ * @brief Opens a normalization cache, sharing an existing mapping if possible
+ *
+ * @param path Path of the cache file; created if it does not exist
+ * @param rules The rule chain whose normalizations are cached
+ * @param size_mb Size of the file in MiB if it has to be created
+ * @param[out] ppCache Receives the cache
+ * @return SQLITE_OK on success, SQLITE_CANTOPEN or SQLITE_IOERR if the file
+ *         cannot be used, SQLITE_ERROR if the file is already open for
+ *         another rule chain, SQLITE_NOMEM
+ */
+int icu_cache_open(const char* path, const UChar* rules, int size_mb,
+                   IcuNormalizationCache** ppCache) {
+    *ppCache = NULL;
+    uint64_t key = cache_key(rules);
+
+    // Opening never changes an existing file, so it is safe before the path
+    // is compared with the caches already mapped
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return SQLITE_CANTOPEN;
+    char* real = realpath(path, NULL);
+    char* resolved = real ? sqlite3_mprintf("%s", real) : NULL;
+    free(real);
+    if (!resolved) {
+        close(fd);
+        return real ? SQLITE_NOMEM : SQLITE_CANTOPEN;
+    }
+
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+    sqlite3_mutex_enter(registry_mutex);
+    if (!cache_open_mutex)
+        cache_open_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+    sqlite3_mutex* open_mutex = cache_open_mutex;
+    sqlite3_mutex_leave(registry_mutex);
+    if (!open_mutex && sqlite3_threadsafe()) {
+        close(fd);
+        sqlite3_free(resolved);
+        return SQLITE_NOMEM;
+    }
+
+    // The file lock and the initialization of a new file can take long, so
+    // they run under open_mutex only; APP1 is held just to read and link the
+    // registry, which also guards the pool and dictionary registries
+    sqlite3_mutex_enter(open_mutex);
+    int rc = SQLITE_OK;
+    sqlite3_mutex_enter(registry_mutex);
+    IcuNormalizationCache* cache = cache_registry;
+    while (cache && strcmp(cache->path, resolved) != 0) {
+        cache = cache->next_cache;
+    }
+    if (cache) {
+        // Already mapped in this process; the file is left as it is
+        if (cache->header->key == key) {
+            cache->reference_count++;
+        } else {
+            rc = SQLITE_ERROR;  // One file per rule chain
+            cache = NULL;
+        }
+    }
+    sqlite3_mutex_leave(registry_mutex);
+
+    if (cache || rc != SQLITE_OK) {
+        close(fd);
+        sqlite3_free(resolved);
+    } else {
+        rc = cache_file_prepare(resolved, key, size_mb, &fd);
+        if (rc == SQLITE_OK)
+            cache = (IcuNormalizationCache*)sqlite3_malloc(sizeof(IcuNormalizationCache));
+        if (!cache) {
+            if (fd >= 0)
+                close(fd);
+            sqlite3_free(resolved);
+            if (rc == SQLITE_OK)
+                rc = SQLITE_NOMEM;
+        } else {
+            memset(cache, 0, sizeof(IcuNormalizationCache));
+            cache->path = resolved;
+            cache->fd = fd;
+            cache->reference_count = 1;
+            cache->writer_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+            rc = (cache->writer_mutex || !sqlite3_threadsafe()) ? cache_map(cache) : SQLITE_NOMEM;
+            if (rc == SQLITE_OK) {
+                sqlite3_mutex_enter(registry_mutex);
+                cache->next_cache = cache_registry;
+                cache_registry = cache;
+                sqlite3_mutex_leave(registry_mutex);
+            } else {
+                cache_free(cache);
+                cache = NULL;
+            }
+        }
+    }
+    sqlite3_mutex_leave(open_mutex);
+
+    *ppCache = cache;
+    return rc;
+}
+
+/**
+ * @brief Takes an additional reference to a cache
+ *
+ * @param cache The cache
+ */
+void icu_cache_retain(IcuNormalizationCache* cache) {
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+    sqlite3_mutex_enter(registry_mutex);
+    cache->reference_count++;
+    sqlite3_mutex_leave(registry_mutex);
+}
+
+/**
+ * @brief Drops a reference to a cache, unmapping it with the last one
+ *
+ * @param cache The cache
+ */
+void icu_cache_release(IcuNormalizationCache* cache) {
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+    sqlite3_mutex_enter(registry_mutex);
+    int last_reference = (--cache->reference_count == 0);
+    if (last_reference) {
+        IcuNormalizationCache** link = &cache_registry;
+        while (*link != cache) {
+            link = &(*link)->next_cache;
+        }
+        *link = cache->next_cache;
+    }
+    sqlite3_mutex_leave(registry_mutex);
+
+    if (last_reference)
+        cache_free(cache);
+}
+
+// ========================================================================
+// === LOOKUP AND INSERTION ===============================================
+// ========================================================================
+
+/**
+ * @brief Hashes a raw token
+ *
+ * @param key The token in UTF-16
+ * @param key_length Length in code units
+ * @return 64-bit FNV-1a hash
+ */
+static uint64_t cache_hash(const UChar* key, int32_t key_length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int32_t i = 0; i < key_length; i++) {
+        hash = (hash ^ key[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Returns the entry a published slot points to if it holds a key
+ *
+ * @param cache The cache
+ * @param slot The slot value
+ * @param hash Hash of the key
+ * @param key The key
+ * @param key_length Length of the key in code units
+ * @return The entry, or NULL if the slot holds another key
+ */
+static const IcuCacheEntry* cache_entry_for(const IcuNormalizationCache* cache, uint64_t slot,
+                                            uint64_t hash, const UChar* key, int32_t key_length) {
+    if ((slot >> 32) != (hash >> 32))
+        return NULL;
+    uint64_t offset = slot & 0xFFFFFFFFu;
+    if (offset + sizeof(IcuCacheEntry) > cache->header->heap_size)
+        return NULL;
+    const IcuCacheEntry* entry = (const IcuCacheEntry*)(cache->heap + offset);
+    uint64_t record_size =
+      sizeof(IcuCacheEntry) + entry->key_length * sizeof(UChar) + entry->value_length;
+    if (entry->key_length != key_length || offset + record_size > cache->header->heap_size)
+        return NULL;
+    if (memcmp(entry + 1, key, key_length * sizeof(UChar)) != 0)
+        return NULL;
+    return entry;
+}
+
+/**
+ * @brief Looks up the normalized form of a raw token
+ *
+ * Lock-free; safe to call while other threads and processes insert.
+ *
+ * @param cache The cache
+ * @param key The raw token in UTF-16
+ * @param key_length Length of the raw token in code units
+ * @param[out] pValue Receives the normalized token in UTF-8; it points into
+ *             the mapping and stays valid while the cache is open
+ * @param[out] pValueLength Receives the length of the normalized token
+ * @return Non-zero if the token was found
+ */
+int icu_cache_lookup(const IcuNormalizationCache* cache, const UChar* key, int32_t key_length,
+                     const char** pValue, int32_t* pValueLength) {
+    if (key_length <= 0 || key_length > ICU_CACHE_MAX_KEY)
+        return 0;
+    uint64_t hash = cache_hash(key, key_length);
+    uint32_t mask = cache->header->slot_count - 1;
+    uint32_t index = (uint32_t)hash & mask;
+    for (int probe = 0; probe < ICU_CACHE_MAX_PROBES; probe++) {
+        uint64_t slot = atomic_load_explicit(&cache->slots[index], memory_order_acquire);
+        if (slot == 0)
+            return 0;
+        const IcuCacheEntry* entry = cache_entry_for(cache, slot, hash, key, key_length);
+        if (entry) {
+            *pValue = (const char*)(entry + 1) + entry->key_length * sizeof(UChar);
+            *pValueLength = entry->value_length;
+            return 1;
+        }
+        index = (index + 1) & mask;
+    }
+    return 0;
+}
+
+/**
+ * @brief Adds the normalized form of a raw token
+ *
+ * Does nothing if the token is too long, the cache is full, or another
+ * process holds the writer lock.
+ *
+ * @param cache The cache
+ * @param key The raw token in UTF-16
+ * @param key_length Length of the raw token in code units
+ * @param value The normalized token in UTF-8
+ * @param value_length Length of the normalized token in bytes
+ */
+void icu_cache_insert(IcuNormalizationCache* cache, const UChar* key, int32_t key_length,
+                      const char* value, int32_t value_length) {
+    if (key_length <= 0 || key_length > ICU_CACHE_MAX_KEY || value_length < 0 ||
+        value_length > UINT16_MAX) {
+        return;
+    }
+    uint64_t hash = cache_hash(key, key_length);
+    uint64_t record_size = sizeof(IcuCacheEntry) + key_length * sizeof(UChar) + value_length;
+    record_size = (record_size + 7) & ~(uint64_t)7;
+
+    sqlite3_mutex_enter(cache->writer_mutex);
+    if (flock(cache->fd, LOCK_EX | LOCK_NB) != 0) {
+        sqlite3_mutex_leave(cache->writer_mutex);
+        return;  // Another process is writing; the token is cached next time
+    }
+
+    // Find a free slot; another writer may have added the token meanwhile
+    uint32_t mask = cache->header->slot_count - 1;
+    uint32_t index = (uint32_t)hash & mask;
+    int found_free = 0;
+    for (int probe = 0; probe < ICU_CACHE_MAX_PROBES; probe++) {
+        uint64_t slot = atomic_load_explicit(&cache->slots[index], memory_order_acquire);
+        if (slot == 0) {
+            found_free = 1;
+            break;
+        }
+        if (cache_entry_for(cache, slot, hash, key, key_length))
+            break;
+        index = (index + 1) & mask;
+    }
+
+    uint64_t heap_used = atomic_load_explicit(&cache->header->heap_used, memory_order_acquire);
+    if (found_free && heap_used + record_size <= cache->header->heap_size &&
+        heap_used <= 0xFFFFFFFFu) {
+        IcuCacheEntry* entry = (IcuCacheEntry*)(cache->heap + heap_used);
+        entry->key_length = (uint16_t)key_length;
+        entry->value_length = (uint16_t)value_length;
+        memcpy(entry + 1, key, key_length * sizeof(UChar));
+        memcpy((char*)(entry + 1) + key_length * sizeof(UChar), value, value_length);
+        atomic_store_explicit(&cache->header->heap_used, heap_used + record_size,
+                              memory_order_release);
+
+        // Publishing the slot makes the entry visible to readers
+        atomic_store_explicit(&cache->slots[index], (hash & 0xFFFFFFFF00000000ULL) | heap_used,
+                              memory_order_release);
+        atomic_fetch_add_explicit(&cache->header->entry_count, 1, memory_order_relaxed);
+    }
+
+    flock(cache->fd, LOCK_UN);
+    sqlite3_mutex_leave(cache->writer_mutex);
+}
+
+#else  // !FTS5_ICU_HAVE_CACHE
+
+// Without C11 atomics or POSIX file mapping the "cache" option is accepted
+// but every token is normalized by ICU.
+
+int icu_cache_open(const char* path, const UChar* rules, int size_mb,
+                   IcuNormalizationCache** ppCache) {
+    UNUSED_PARAMETER(path);
+    UNUSED_PARAMETER(rules);
+    UNUSED_PARAMETER(size_mb);
+    *ppCache = NULL;
+    return SQLITE_OK;
+}
+
+void icu_cache_retain(IcuNormalizationCache* cache) {
+    UNUSED_PARAMETER(cache);
+}
+
+void icu_cache_release(IcuNormalizationCache* cache) {
+    UNUSED_PARAMETER(cache);
+}
+
+int icu_cache_lookup(const IcuNormalizationCache* cache, const UChar* key, int32_t key_length,
+                     const char** pValue, int32_t* pValueLength) {
+    UNUSED_PARAMETER(cache);
+    UNUSED_PARAMETER(key);
+    UNUSED_PARAMETER(key_length);
+    UNUSED_PARAMETER(pValue);
+    UNUSED_PARAMETER(pValueLength);
+    return 0;
+}
+
+void icu_cache_insert(IcuNormalizationCache* cache, const UChar* key, int32_t key_length,
+                      const char* value, int32_t value_length) {
+    UNUSED_PARAMETER(cache);
+    UNUSED_PARAMETER(key);
+    UNUSED_PARAMETER(key_length);
+    UNUSED_PARAMETER(value);
+    UNUSED_PARAMETER(value_length);
+}
+
+#endif  // FTS5_ICU_HAVE_CACHE
@@ -0,0 +1,450 @@
+/**
+ * @file fts5_icu_dict.c
+ * @brief Memory-mapped user dictionaries and maximum-matching segmentation
+ *
+ * ICU's dictionary break engine cannot be extended at runtime. Tables
+ * created with the "dictionary <path>" option therefore segment runs of
+ * Han, Kana and Southeast Asian scripts with a user dictionary built by
+ * icu_dict_build (see fts5_icu_dict_format.h), and leave text between
+ * dictionary words to the break iterator.
+ *
+ * A dictionary file is mapped read-only and used in place, so opening it
+ * takes constant time and its pages are shared by every process on the host
+ * through the page cache. Within a process, all tokenizer instances that
+ * name the same file share one mapping, found by canonical path in a
+ * registry protected by the SQLITE_MUTEX_STATIC_APP1 mutex (shared with the
+ * object pool registry).
+ *
+ * Runs are segmented by both forward and backward maximum matching. The
+ * segmentation that leaves fewer code points unmatched wins; on a tie, the
+ * one with fewer segments wins, and backward matching wins a complete tie
+ * because it resolves overlapping ambiguities better for Chinese.
+ */
+
+#include "fts5_icu.h"
+#include "fts5_icu_dict_format.h"
+
+SQLITE_EXTENSION_INIT3
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct IcuUserDictionary {
+    IcuUserDictionary* next_dictionary; /**< Next dictionary in the registry */
+    int reference_count;                /**< Configurations using the dictionary */
+    char* path;                         /**< Canonical path of the file */
+    void* mapping;                      /**< Start of the mapped file */
+    size_t mapping_size;                /**< Size of the mapped file */
+    const IcuDictHeader* header;        /**< File header */
+    const IcuDictUnit* forward;         /**< Forward trie */
+    const IcuDictUnit* backward;        /**< Backward trie */
+#ifdef _WIN32
+    HANDLE file_mapping; /**< File mapping object */
+#endif
+};
+
+/** All open dictionaries; protected by the SQLITE_MUTEX_STATIC_APP1 mutex */
+static IcuUserDictionary* dictionary_registry = NULL;
+
+// ========================================================================
+// === MAPPING ============================================================
+// ========================================================================
+
+/**
+ * @brief Returns the canonical form of a path
+ *
+ * @param path The path as given in the table declaration
+ * @return The canonical path (free with sqlite3_free()), or NULL if the file
+ *         does not exist or memory is exhausted
+ */
+static char* canonical_path(const char* path) {
+#ifdef _WIN32
+    char buffer[MAX_PATH];
+    if (!_fullpath(buffer, path, sizeof(buffer)))
+        return NULL;
+    return sqlite3_mprintf("%s", buffer);
+#else
+    char* resolved = realpath(path, NULL);
+    if (!resolved)
+        return NULL;
+    char* copy = sqlite3_mprintf("%s", resolved);
+    free(resolved);
+    return copy;
+#endif
+}
+
+/**
+ * @brief Unmaps the file of a dictionary and frees it
+ *
+ * @param dictionary The dictionary
+ */
+static void dictionary_free(IcuUserDictionary* dictionary) {
+#ifdef _WIN32
+    if (dictionary->mapping)
+        UnmapViewOfFile(dictionary->mapping);
+    if (dictionary->file_mapping)
+        CloseHandle(dictionary->file_mapping);
+#else
+    if (dictionary->mapping)
+        munmap(dictionary->mapping, dictionary->mapping_size);
+#endif
+    sqlite3_free(dictionary->path);
+    sqlite3_free(dictionary);
+}
+
+/**
+ * @brief Maps a dictionary file read-only
+ *
+ * @param dictionary The dictionary whose path is set
+ * @return SQLITE_OK on success, SQLITE_CANTOPEN if the file cannot be mapped
+ */
+static int dictionary_map(IcuUserDictionary* dictionary) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(dictionary->path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return SQLITE_CANTOPEN;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart <= 0) {
+        CloseHandle(file);
+        return SQLITE_CANTOPEN;
+    }
+    dictionary->file_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!dictionary->file_mapping)
+        return SQLITE_CANTOPEN;
+    dictionary->mapping = MapViewOfFile(dictionary->file_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!dictionary->mapping)
+        return SQLITE_CANTOPEN;
+    dictionary->mapping_size = (size_t)size.QuadPart;
+#else
+    int fd = open(dictionary->path, O_RDONLY);
+    if (fd < 0)
+        return SQLITE_CANTOPEN;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return SQLITE_CANTOPEN;
+    }
+    void* mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return SQLITE_CANTOPEN;
+    dictionary->mapping = mapping;
+    dictionary->mapping_size = (size_t)st.st_size;
+#endif
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Validates the header of a mapped dictionary and locates the tries
+ *
+ * @param dictionary The mapped dictionary
+ * @return SQLITE_OK on success, SQLITE_CORRUPT if the file is not a usable
+ *         dictionary
+ */
+static int dictionary_validate(IcuUserDictionary* dictionary) {
+    if (dictionary->mapping_size < sizeof(IcuDictHeader))
+        return SQLITE_CORRUPT;
+    const IcuDictHeader* header = (const IcuDictHeader*)dictionary->mapping;
+    if (memcmp(header->magic, ICU_DICT_MAGIC, 4) != 0 || header->version != ICU_DICT_VERSION ||
+        header->byte_order != ICU_DICT_BYTE_ORDER) {
+        return SQLITE_CORRUPT;
+    }
+    if (header->forward_units == 0 || header->backward_units == 0 ||
+        header->forward_units > INT32_MAX || header->backward_units > INT32_MAX) {
+        return SQLITE_CORRUPT;
+    }
+    sqlite3_uint64 expected_size =
+      sizeof(IcuDictHeader) +
+      ((sqlite3_uint64)header->forward_units + header->backward_units) * sizeof(IcuDictUnit);
+    if (expected_size != dictionary->mapping_size)
+        return SQLITE_CORRUPT;
+
+    dictionary->header = header;
+    dictionary->forward = (const IcuDictUnit*)(header + 1);
+    dictionary->backward = dictionary->forward + header->forward_units;
+    return SQLITE_OK;
+}
+
+// ========================================================================
+// === REGISTRY ===========================================================
+// ========================================================================
+
+/**
+ * @brief Opens a user dictionary, sharing an existing mapping if possible
+ *
+ * @param path Path of a file built by icu_dict_build
+ * @param[out] ppDictionary Receives the dictionary
+ * @return SQLITE_OK on success, SQLITE_CANTOPEN if the file cannot be read,
+ *         SQLITE_CORRUPT if it is not a valid dictionary, SQLITE_NOMEM
+ */
+int icu_dictionary_open(const char* path, IcuUserDictionary** ppDictionary) {
+    *ppDictionary = NULL;
+    char* resolved = canonical_path(path);
+    if (!resolved)
+        return SQLITE_CANTOPEN;
+
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+    sqlite3_mutex_enter(registry_mutex);
+    IcuUserDictionary* dictionary = dictionary_registry;
+    while (dictionary && strcmp(dictionary->path, resolved) != 0) {
+        dictionary = dictionary->next_dictionary;
+    }
+
+    int rc = SQLITE_OK;
+    if (dictionary) {
+        dictionary->reference_count++;
+        sqlite3_free(resolved);
+    } else {
+        dictionary = (IcuUserDictionary*)sqlite3_malloc(sizeof(IcuUserDictionary));
+        if (!dictionary) {
+            sqlite3_free(resolved);
+            rc = SQLITE_NOMEM;
+        } else {
+            memset(dictionary, 0, sizeof(IcuUserDictionary));
+            dictionary->path = resolved;
+            dictionary->reference_count = 1;
+            rc = dictionary_map(dictionary);
+            if (rc == SQLITE_OK)
+                rc = dictionary_validate(dictionary);
+            if (rc == SQLITE_OK) {
+                dictionary->next_dictionary = dictionary_registry;
+                dictionary_registry = dictionary;
+            } else {
+                dictionary_free(dictionary);
+                dictionary = NULL;
+            }
+        }
+    }
+    sqlite3_mutex_leave(registry_mutex);
+
+    *ppDictionary = dictionary;
+    return rc;
+}
+
+/**
+ * @brief Takes an additional reference to a dictionary
+ *
+ * @param dictionary The dictionary
+ */
+void icu_dictionary_retain(IcuUserDictionary* dictionary) {
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+    sqlite3_mutex_enter(registry_mutex);
+    dictionary->reference_count++;
+    sqlite3_mutex_leave(registry_mutex);
+}
+
+/**
+ * @brief Drops a reference to a dictionary, unmapping it with the last one
+ *
+ * @param dictionary The dictionary
+ */
+void icu_dictionary_release(IcuUserDictionary* dictionary) {
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+    sqlite3_mutex_enter(registry_mutex);
+    int last_reference = (--dictionary->reference_count == 0);
+    if (last_reference) {
+        IcuUserDictionary** link = &dictionary_registry;
+        while (*link != dictionary) {
+            link = &(*link)->next_dictionary;
+        }
+        *link = dictionary->next_dictionary;
+    }
+    sqlite3_mutex_leave(registry_mutex);
+
+    if (last_reference)
+        dictionary_free(dictionary);
+}
+
+/**
+ * @brief Returns the checksum of the word list a dictionary was built from
+ *
+ * @param dictionary The dictionary
+ * @return The checksum stored in the file header
+ */
+sqlite3_uint64 icu_dictionary_checksum(const IcuUserDictionary* dictionary) {
+    return dictionary->header->checksum;
+}
+
+// ========================================================================
+// === MATCHING ===========================================================
+// ========================================================================
+
+/**
+ * @brief Follows one transition in a double-array trie
+ *
+ * @param units The trie
+ * @param unit_count Number of units in the trie
+ * @param state The current state
+ * @param label The transition label
+ * @return The next state, or -1 if there is no such transition
+ */
+static int32_t trie_transition(const IcuDictUnit* units, uint32_t unit_count, int32_t state,
+                               int label) {
+    int64_t next = (int64_t)units[state].base + label;
+    if (next < 1 || next >= unit_count || units[next].check != state)
+        return -1;
+    return (int32_t)next;
+}
+
+/**
+ * @brief Feeds the UTF-8 bytes of a code point into a trie
+ *
+ * @param units The trie
+ * @param unit_count Number of units in the trie
+ * @param state The current state
+ * @param c The code point
+ * @return The state after the code point, or -1 if there is no such path
+ */
+static int32_t trie_feed_code_point(const IcuDictUnit* units, uint32_t unit_count, int32_t state,
+                                    UChar32 c) {
+    uint8_t bytes[U8_MAX_LENGTH];
+    int32_t length = 0;
+    UBool is_error = false;
+    U8_APPEND(bytes, length, U8_MAX_LENGTH, c, is_error);
+    if (is_error)
+        return -1;
+    for (int32_t i = 0; i < length && state >= 0; i++) {
+        state = trie_transition(units, unit_count, state, bytes[i] + 1);
+    }
+    return state;
+}
+
+/**
+ * @brief Finds the longest dictionary word starting at a position
+ *
+ * @param dictionary The dictionary
+ * @param text UTF-16 text
+ * @param start Start of the match
+ * @param limit End of the searchable range
+ * @return End of the longest word, or -1 if no word starts at start
+ */
+static int32_t match_forward(const IcuUserDictionary* dictionary, const UChar* text, int32_t start,
+                             int32_t limit) {
+    const IcuDictUnit* units = dictionary->forward;
+    uint32_t unit_count = dictionary->header->forward_units;
+    int32_t state = 0;
+    int32_t longest = -1;
+    int32_t position = start;
+    while (position < limit) {
+        UChar32 c;
+        U16_NEXT(text, position, limit, c);
+        state = trie_feed_code_point(units, unit_count, state, c);
+        if (state < 0)
+            break;
+        if (trie_transition(units, unit_count, state, ICU_DICT_END_LABEL) >= 0)
+            longest = position;
+    }
+    return longest;
+}
+
+/**
+ * @brief Finds the longest dictionary word ending at a position
+ *
+ * @param dictionary The dictionary
+ * @param text UTF-16 text
+ * @param limit Start of the searchable range
+ * @param end End of the match
+ * @return Start of the longest word, or -1 if no word ends at end
+ */
+static int32_t match_backward(const IcuUserDictionary* dictionary, const UChar* text,
+                              int32_t limit, int32_t end) {
+    const IcuDictUnit* units = dictionary->backward;
+    uint32_t unit_count = dictionary->header->backward_units;
+    int32_t state = 0;
+    int32_t longest = -1;
+    int32_t position = end;
+    while (position > limit) {
+        UChar32 c;
+        U16_PREV(text, limit, position, c);
+        state = trie_feed_code_point(units, unit_count, state, c);
+        if (state < 0)
+            break;
+        if (trie_transition(units, unit_count, state, ICU_DICT_END_LABEL) >= 0)
+            longest = position;
+    }
+    return longest;
+}
+
+// ========================================================================
+// === SEGMENTATION =======================================================
+// ========================================================================
+
+/**
+ * @brief Segments a run of text by forward and backward maximum matching
+ *
+ * The result is a list of segment end positions in text order. Segments
+ * that are not dictionary words (maximal stretches of unmatched code points)
+ * are stored as ICU_DICT_GAP(end).
+ *
+ * @param dictionary The dictionary
+ * @param text UTF-16 text
+ * @param start Start of the run
+ * @param end End of the run
+ * @param segments Output array with room for 2 * (end - start) entries
+ * @return Number of segments written to the start of segments
+ */
+int32_t icu_dictionary_segment(const IcuUserDictionary* dictionary, const UChar* text,
+                               int32_t start, int32_t end, int32_t* segments) {
+    int32_t run_length = end - start;
+    int32_t* forward = segments;
+    int32_t* backward = segments + run_length;
+
+    // Forward maximum matching, merging unmatched code points into gaps
+    int32_t forward_count = 0, forward_unmatched = 0;
+    int last_was_gap = 0;
+    for (int32_t position = start; position < end;) {
+        int32_t match_end = match_forward(dictionary, text, position, end);
+        if (match_end > position) {
+            forward[forward_count++] = match_end;
+            position = match_end;
+            last_was_gap = 0;
+        } else {
+            U16_FWD_1(text, position, end);
+            forward_unmatched++;
+            if (last_was_gap)
+                forward[forward_count - 1] = ICU_DICT_GAP(position);
+            else
+                forward[forward_count++] = ICU_DICT_GAP(position);
+            last_was_gap = 1;
+        }
+    }
+
+    // Backward maximum matching; a gap keeps its end as it grows leftwards,
+    // and the segment ends are collected from the back
+    int32_t backward_count = 0, backward_unmatched = 0;
+    last_was_gap = 0;
+    for (int32_t position = end; position > start;) {
+        int32_t match_start = match_backward(dictionary, text, start, position);
+        if (match_start >= 0 && match_start < position) {
+            backward[backward_count++] = position;
+            position = match_start;
+            last_was_gap = 0;
+        } else {
+            if (!last_was_gap)
+                backward[backward_count++] = ICU_DICT_GAP(position);
+            U16_BACK_1(text, start, position);
+            backward_unmatched++;
+            last_was_gap = 1;
+        }
+    }
+
+    int use_backward = backward_unmatched < forward_unmatched ||
+                       (backward_unmatched == forward_unmatched && backward_count <= forward_count);
+    if (!use_backward)
+        return forward_count;
+
+    // The backward pass wrote the segments in reverse order behind the
+    // forward result, which is no longer needed
+    for (int32_t i = 0; i < backward_count; i++) {
+        segments[i] = backward[backward_count - 1 - i];
+    }
+    return backward_count;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file fts5_icu_dict_format.h
+ * @brief On-disk format of the user dictionaries built by icu_dict_build
+ *
+ * A dictionary file holds two double-array tries over the UTF-8 bytes of the
+ * dictionary words: a forward trie of the words as written and a backward
+ * trie of the words with their code points in reverse order. The loader maps
+ * the file read-only and uses the arrays in place, so the file is written in
+ * the byte order of the host that builds it and records that byte order.
+ *
+ * Layout:
+ *   IcuDictHeader
+ *   IcuDictUnit forward[header.forward_units]
+ *   IcuDictUnit backward[header.backward_units]
+ *
+ * State 0 is the root of each trie. The transition from state s on label l
+ * leads to t = units[s].base + l and exists only if units[t].check == s.
+ * Byte b is encoded as label b + 1; label 0 (ICU_DICT_END_LABEL) marks the
+ * end of a word.
+ */
+
+#ifndef FTS5_ICU_DICT_FORMAT_H
+#define FTS5_ICU_DICT_FORMAT_H
+
+#include <stdint.h>
+
+/** Magic bytes at the start of every dictionary file */
+#define ICU_DICT_MAGIC "ICUD"
+
+/** Current format version */
+#define ICU_DICT_VERSION 1
+
+/** Written in host byte order to detect files built on a different host */
+#define ICU_DICT_BYTE_ORDER 0x01020304u
+
+/** Transition label marking the end of a word */
+#define ICU_DICT_END_LABEL 0
+
+/** Fixed-size file header (32 bytes) */
+typedef struct IcuDictHeader {
+    char magic[4];           /**< ICU_DICT_MAGIC */
+    uint32_t version;        /**< ICU_DICT_VERSION */
+    uint32_t byte_order;     /**< ICU_DICT_BYTE_ORDER in the byte order of the file */
+    uint32_t word_count;     /**< Number of distinct words */
+    uint64_t checksum;       /**< FNV-1a hash of the sorted word list */
+    uint32_t forward_units;  /**< Number of units in the forward trie */
+    uint32_t backward_units; /**< Number of units in the backward trie */
+} IcuDictHeader;
+
+/** One double-array unit */
+typedef struct IcuDictUnit {
+    int32_t base;  /**< Offset of the children of this state, -1 for none */
+    int32_t check; /**< Parent state, -1 for a free unit */
+} IcuDictUnit;
+
+#endif /* FTS5_ICU_DICT_FORMAT_H */
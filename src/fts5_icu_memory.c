@@ -0,0 +1,473 @@
+/**
+ * @file fts5_icu_memory.c
+ * @brief Memory accounting, budget and release hooks for the ICU tokenizer
+ *
+ * Every buffer the tokenizer allocates goes through icu_memory_realloc() and
+ * icu_memory_free(). The calls count the bytes against the tokenizer instance
+ * and against a process-wide total. Token streams take their scratch buffers
+ * from the tokenizer instance and give them back when they are closed, so
+ * the buffers can be reused for the next document.
+ *
+ * The memory can be limited with a process-wide budget. An allocation that
+ * would exceed the budget first releases retained scratch buffers and idle
+ * pooled ICU objects. If the budget is still exceeded after that, the
+ * allocation fails with SQLITE_NOMEM. The same release happens whenever a
+ * stream is closed while SQLite's soft heap limit is exceeded.
+ *
+ * SQLite offers no callback for sqlite3_release_memory(), so the release
+ * hook is exposed as the icu_release_memory() SQL function for applications
+ * that shed memory on demand. icu_memory_used(), icu_memory_highwater() and
+ * icu_memory_budget() mirror the corresponding SQLite C interfaces.
+ */
+
+#include "fts5_icu.h"
+
+SQLITE_EXTENSION_INIT3
+
+/** Scratch buffers larger than this are freed instead of retained */
+#define ICU_SCRATCH_RETAIN_LIMIT (256 * 1024)
+
+/** Process-wide budget in bytes at load time; 0 means unlimited */
+#ifndef FTS5_ICU_DEFAULT_MEMORY_BUDGET
+#define FTS5_ICU_DEFAULT_MEMORY_BUDGET 0
+#endif
+
+// ========================================================================
+// === COUNTERS ===========================================================
+// ========================================================================
+
+#if !defined(__STDC_NO_ATOMICS__)
+
+#include <stdatomic.h>
+
+typedef _Atomic sqlite3_int64 IcuMemoryCounter;
+
+static sqlite3_int64 counter_load(IcuMemoryCounter* counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static void counter_store(IcuMemoryCounter* counter, sqlite3_int64 value) {
+    atomic_store_explicit(counter, value, memory_order_relaxed);
+}
+
+static sqlite3_int64 counter_add(IcuMemoryCounter* counter, sqlite3_int64 delta) {
+    return atomic_fetch_add_explicit(counter, delta, memory_order_relaxed) + delta;
+}
+
+static void counter_raise(IcuMemoryCounter* counter, sqlite3_int64 value) {
+    sqlite3_int64 current = atomic_load_explicit(counter, memory_order_relaxed);
+    while (current < value && !atomic_compare_exchange_weak_explicit(
+                                counter, &current, value, memory_order_relaxed,
+                                memory_order_relaxed)) {
+    }
+}
+
+#else  // __STDC_NO_ATOMICS__
+
+typedef sqlite3_int64 IcuMemoryCounter;
+
+static sqlite3_int64 counter_load(IcuMemoryCounter* counter) {
+    sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP3);
+    sqlite3_mutex_enter(mutex);
+    sqlite3_int64 value = *counter;
+    sqlite3_mutex_leave(mutex);
+    return value;
+}
+
+static void counter_store(IcuMemoryCounter* counter, sqlite3_int64 value) {
+    sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP3);
+    sqlite3_mutex_enter(mutex);
+    *counter = value;
+    sqlite3_mutex_leave(mutex);
+}
+
+static sqlite3_int64 counter_add(IcuMemoryCounter* counter, sqlite3_int64 delta) {
+    sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP3);
+    sqlite3_mutex_enter(mutex);
+    sqlite3_int64 value = (*counter += delta);
+    sqlite3_mutex_leave(mutex);
+    return value;
+}
+
+static void counter_raise(IcuMemoryCounter* counter, sqlite3_int64 value) {
+    sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP3);
+    sqlite3_mutex_enter(mutex);
+    if (*counter < value)
+        *counter = value;
+    sqlite3_mutex_leave(mutex);
+}
+
+#endif  // __STDC_NO_ATOMICS__
+
+/** Bytes currently allocated by all tokenizer instances */
+static IcuMemoryCounter memory_used = 0;
+
+/** Highest value of memory_used since load or the last reset */
+static IcuMemoryCounter memory_highwater = 0;
+
+/** Bytes held in retained scratch buffers */
+static IcuMemoryCounter memory_retained = 0;
+
+/** Process-wide budget in bytes; 0 means unlimited */
+static IcuMemoryCounter memory_budget = FTS5_ICU_DEFAULT_MEMORY_BUDGET;
+
+// ========================================================================
+// === ACCOUNTS ===========================================================
+// ========================================================================
+
+struct IcuMemoryAccount {
+    IcuMemoryAccount* next_account; /**< Next account in the registry */
+    IcuMemoryAccount* prev_account; /**< Previous account in the registry */
+    sqlite3_mutex* mutex;           /**< Guards retained and retained_bytes */
+    IcuScratch retained;            /**< Scratch buffers kept between calls */
+    sqlite3_int64 retained_bytes;   /**< Allocated size of the retained buffers */
+    IcuMemoryCounter used;          /**< Bytes currently allocated by the instance */
+    IcuMemoryCounter highwater;     /**< Highest value of used */
+};
+
+/**
+ * All open accounts; protected by the SQLITE_MUTEX_STATIC_APP2 mutex, which
+ * also guards the prototype ICU objects in fts5_icu.c
+ */
+static IcuMemoryAccount* account_registry = NULL;
+
+/**
+ * @brief Adds a size change to an account and to the process-wide totals
+ *
+ * @param account The account, or NULL for memory not owned by an instance
+ * @param delta Change in bytes
+ */
+static void account_add(IcuMemoryAccount* account, sqlite3_int64 delta) {
+    counter_raise(&memory_highwater, counter_add(&memory_used, delta));
+    if (account)
+        counter_raise(&account->highwater, counter_add(&account->used, delta));
+}
+
+/**
+ * @brief Checks whether memory should be given back rather than retained
+ *
+ * @return Non-zero if the soft heap limit or the budget is exceeded
+ */
+static int memory_under_pressure(void) {
+    sqlite3_int64 soft_limit = sqlite3_soft_heap_limit64(-1);
+    if (soft_limit > 0 && sqlite3_memory_used() > soft_limit)
+        return 1;
+    sqlite3_int64 budget = counter_load(&memory_budget);
+    return budget > 0 && counter_load(&memory_used) > budget;
+}
+
+/**
+ * @brief Creates the memory account of a tokenizer instance
+ *
+ * @param[out] ppAccount Receives the new account
+ * @return SQLITE_OK on success, SQLITE_NOMEM on allocation failure
+ */
+int icu_memory_account_open(IcuMemoryAccount** ppAccount) {
+    IcuMemoryAccount* account = (IcuMemoryAccount*)sqlite3_malloc(sizeof(IcuMemoryAccount));
+    if (!account)
+        return SQLITE_NOMEM;
+    memset(account, 0, sizeof(IcuMemoryAccount));
+    account->mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+    if (!account->mutex && sqlite3_threadsafe()) {
+        sqlite3_free(account);
+        return SQLITE_NOMEM;
+    }
+
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP2);
+    sqlite3_mutex_enter(registry_mutex);
+    account->next_account = account_registry;
+    if (account_registry)
+        account_registry->prev_account = account;
+    account_registry = account;
+    sqlite3_mutex_leave(registry_mutex);
+
+    *ppAccount = account;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Releases the buffers of a scratch set
+ *
+ * @param account The account the buffers are charged to
+ * @param scratch The scratch buffers; cleared on return
+ */
+static void scratch_free(IcuMemoryAccount* account, IcuScratch* scratch) {
+    icu_memory_free(account, scratch->utf16_text_buffer);
+    icu_memory_free(account, scratch->byte_offset_map);
+    icu_memory_free(account, scratch->transliteration_buffer);
+    icu_memory_free(account, scratch->transliterated_utf8_buffer);
+    icu_memory_free(account, scratch->native_utf8_buffer);
+    icu_memory_free(account, scratch->run_buffer);
+    icu_memory_free(account, scratch->segment_buffer);
+    memset(scratch, 0, sizeof(IcuScratch));
+}
+
+/**
+ * @brief Takes the retained scratch buffers out of an account
+ *
+ * @param account The account
+ * @param[out] scratch Receives the buffers
+ * @return Allocated size of the buffers in bytes
+ */
+static sqlite3_int64 account_take_retained(IcuMemoryAccount* account, IcuScratch* scratch) {
+    sqlite3_mutex_enter(account->mutex);
+    *scratch = account->retained;
+    sqlite3_int64 bytes = account->retained_bytes;
+    memset(&account->retained, 0, sizeof(IcuScratch));
+    account->retained_bytes = 0;
+    sqlite3_mutex_leave(account->mutex);
+
+    counter_add(&memory_retained, -bytes);
+    return bytes;
+}
+
+/**
+ * @brief Deletes the memory account of a tokenizer instance
+ *
+ * @param account The account, or NULL
+ */
+void icu_memory_account_close(IcuMemoryAccount* account) {
+    if (!account)
+        return;
+
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP2);
+    sqlite3_mutex_enter(registry_mutex);
+    if (account->prev_account)
+        account->prev_account->next_account = account->next_account;
+    else
+        account_registry = account->next_account;
+    if (account->next_account)
+        account->next_account->prev_account = account->prev_account;
+    sqlite3_mutex_leave(registry_mutex);
+
+    IcuScratch scratch;
+    account_take_retained(account, &scratch);
+    scratch_free(account, &scratch);
+    sqlite3_mutex_free(account->mutex);
+    sqlite3_free(account);
+}
+
+// ========================================================================
+// === ALLOCATION =========================================================
+// ========================================================================
+
+/**
+ * @brief Resizes an accounted allocation, like sqlite3_realloc64()
+ *
+ * If the allocation would exceed the budget, retained memory is released
+ * first and the allocation fails if that is not enough.
+ *
+ * @param account The account to charge, or NULL for memory not owned by an
+ *                instance
+ * @param p The allocation to resize, or NULL
+ * @param n The new size in bytes
+ * @return The new allocation, or NULL on failure (p remains valid)
+ */
+void* icu_memory_realloc(IcuMemoryAccount* account, void* p, sqlite3_int64 n) {
+    sqlite3_int64 old_size = p ? (sqlite3_int64)sqlite3_msize(p) : 0;
+
+    sqlite3_int64 budget = counter_load(&memory_budget);
+    if (budget > 0) {
+        sqlite3_int64 excess = counter_load(&memory_used) - old_size + n - budget;
+        if (excess > 0 && icu_memory_release(excess) < excess)
+            return NULL;
+    }
+
+    void* resized = sqlite3_realloc64(p, (sqlite3_uint64)n);
+    if (!resized)
+        return NULL;
+    account_add(account, (sqlite3_int64)sqlite3_msize(resized) - old_size);
+    return resized;
+}
+
+/**
+ * @brief Frees an allocation made with icu_memory_realloc()
+ *
+ * @param account The account the allocation is charged to
+ * @param p The allocation, or NULL
+ */
+void icu_memory_free(IcuMemoryAccount* account, void* p) {
+    if (!p)
+        return;
+    sqlite3_int64 size = (sqlite3_int64)sqlite3_msize(p);
+    sqlite3_free(p);
+    account_add(account, -size);
+}
+
+// ========================================================================
+// === SCRATCH RETENTION ==================================================
+// ========================================================================
+
+/**
+ * @brief Moves the scratch buffers retained by an instance into a stream
+ *
+ * @param account The account of the tokenizer instance
+ * @param[out] scratch Receives the buffers; empty if nothing was retained
+ */
+void icu_scratch_acquire(IcuMemoryAccount* account, IcuScratch* scratch) {
+    account_take_retained(account, scratch);
+}
+
+/**
+ * @brief Hands the scratch buffers of a stream back to its instance
+ *
+ * The buffers are kept for the next document unless they are larger than
+ * ICU_SCRATCH_RETAIN_LIMIT or memory is under pressure, in which case they
+ * are freed and retained memory is released process-wide.
+ *
+ * @param account The account of the tokenizer instance
+ * @param scratch The buffers; cleared on return
+ */
+void icu_scratch_release(IcuMemoryAccount* account, IcuScratch* scratch) {
+    sqlite3_int64 bytes = 0;
+    if (scratch->utf16_text_buffer)
+        bytes += (sqlite3_int64)sqlite3_msize(scratch->utf16_text_buffer);
+    if (scratch->byte_offset_map)
+        bytes += (sqlite3_int64)sqlite3_msize(scratch->byte_offset_map);
+    if (scratch->transliteration_buffer)
+        bytes += (sqlite3_int64)sqlite3_msize(scratch->transliteration_buffer);
+    if (scratch->transliterated_utf8_buffer)
+        bytes += (sqlite3_int64)sqlite3_msize(scratch->transliterated_utf8_buffer);
+    if (scratch->native_utf8_buffer)
+        bytes += (sqlite3_int64)sqlite3_msize(scratch->native_utf8_buffer);
+    if (scratch->run_buffer)
+        bytes += (sqlite3_int64)sqlite3_msize(scratch->run_buffer);
+    if (scratch->segment_buffer)
+        bytes += (sqlite3_int64)sqlite3_msize(scratch->segment_buffer);
+    if (bytes == 0)
+        return;
+
+    int pressure = memory_under_pressure();
+    int retained = 0;
+    if (!pressure && bytes <= ICU_SCRATCH_RETAIN_LIMIT) {
+        sqlite3_mutex_enter(account->mutex);
+        if (account->retained_bytes == 0) {
+            account->retained = *scratch;
+            account->retained_bytes = bytes;
+            retained = 1;
+        }
+        sqlite3_mutex_leave(account->mutex);
+    }
+
+    if (retained) {
+        counter_add(&memory_retained, bytes);
+        memset(scratch, 0, sizeof(IcuScratch));
+    } else {
+        scratch_free(account, scratch);
+    }
+    if (pressure)
+        icu_memory_release(-1);
+}
+
+/**
+ * @brief Releases retained tokenizer memory, like sqlite3_release_memory()
+ *
+ * Frees the retained scratch buffers of idle instances until at least n
+ * bytes have been freed. If that is not enough, the idle objects of all
+ * object pools and the rule sets that no table uses are closed as well.
+ * These ICU objects are allocated by ICU and are not included in the
+ * returned count.
+ *
+ * @param n Number of bytes to free, or a negative value to free everything
+ * @return Number of bytes freed
+ */
+sqlite3_int64 icu_memory_release(sqlite3_int64 n) {
+    sqlite3_int64 freed = 0;
+
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP2);
+    sqlite3_mutex_enter(registry_mutex);
+    for (IcuMemoryAccount* account = account_registry; account && (n < 0 || freed < n);
+         account = account->next_account) {
+        IcuScratch scratch;
+        freed += account_take_retained(account, &scratch);
+        scratch_free(account, &scratch);
+    }
+    sqlite3_mutex_leave(registry_mutex);
+
+    if (n < 0 || freed < n) {
+        icu_pool_release_idle();
+        icu_rule_set_release_idle();
+    }
+    return freed;
+}
+
+// ========================================================================
+// === SQL FUNCTIONS ======================================================
+// ========================================================================
+
+/**
+ * @brief SQL function icu_memory_used(): bytes currently allocated
+ */
+static void icu_memory_used_func(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    UNUSED_PARAMETER(argc);
+    UNUSED_PARAMETER(argv);
+    sqlite3_result_int64(context, counter_load(&memory_used));
+}
+
+/**
+ * @brief SQL function icu_memory_highwater([reset]): peak allocated bytes
+ *
+ * With a true argument the high-water mark is reset to the current usage
+ * after it has been read, as with sqlite3_memory_highwater().
+ */
+static void icu_memory_highwater_func(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    sqlite3_result_int64(context, counter_load(&memory_highwater));
+    if (argc > 0 && sqlite3_value_int(argv[0]))
+        counter_store(&memory_highwater, counter_load(&memory_used));
+}
+
+/**
+ * @brief SQL function icu_memory_budget([bytes]): query or set the budget
+ *
+ * Returns the budget in effect before the call. A non-negative argument sets
+ * a new budget, where 0 removes the limit.
+ */
+static void icu_memory_budget_func(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    sqlite3_result_int64(context, counter_load(&memory_budget));
+    if (argc > 0 && sqlite3_value_int64(argv[0]) >= 0) {
+        counter_store(&memory_budget, sqlite3_value_int64(argv[0]));
+        if (memory_under_pressure())
+            icu_memory_release(-1);
+    }
+}
+
+/**
+ * @brief SQL function icu_release_memory([bytes]): release retained memory
+ *
+ * Without an argument everything that can be released is released. Returns
+ * the number of bytes freed.
+ */
+static void icu_release_memory_func(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    sqlite3_int64 n = argc > 0 ? sqlite3_value_int64(argv[0]) : -1;
+    sqlite3_result_int64(context, icu_memory_release(n));
+}
+
+/**
+ * @brief Registers the memory SQL functions on a database connection
+ *
+ * @param db The database connection
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+int icu_register_memory_functions(sqlite3* db) {
+    static const struct {
+        const char* name;
+        int nArg;
+        void (*xFunc)(sqlite3_context*, int, sqlite3_value**);
+    } functions[] = {
+        {"icu_memory_used", 0, icu_memory_used_func},
+        {"icu_memory_highwater", 0, icu_memory_highwater_func},
+        {"icu_memory_highwater", 1, icu_memory_highwater_func},
+        {"icu_memory_budget", 0, icu_memory_budget_func},
+        {"icu_memory_budget", 1, icu_memory_budget_func},
+        {"icu_release_memory", 0, icu_release_memory_func},
+        {"icu_release_memory", 1, icu_release_memory_func},
+    };
+
+    int rc = SQLITE_OK;
+    for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]) && rc == SQLITE_OK; i++) {
+        rc = sqlite3_create_function(db, functions[i].name, functions[i].nArg,
+                                     SQLITE_UTF8 | SQLITE_DIRECTONLY, NULL, functions[i].xFunc,
+                                     NULL, NULL);
+    }
+    return rc;
+}
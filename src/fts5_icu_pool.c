@@ -0,0 +1,447 @@
+/**
+ * @file fts5_icu_pool.c
+ * @brief Process-wide pool of ICU break iterators and transliterators
+ *
+ * Without pooling every FTS5 table on every connection owns a private break
+ * iterator and compiled transliterator, which sit idle most of the time but
+ * cost hundreds of kilobytes each. Tables created with the "pool 1" option
+ * instead share one pool per configuration for the whole process, and
+ * icuTokenize() checks a break iterator/transliterator pair out of it for the
+ * duration of a single call.
+ *
+ * The number of pairs a pool creates therefore tracks the peak number of
+ * threads tokenizing at the same time, not the number of connections. Pairs
+ * are cloned from the pool's prototype on demand, up to a fixed capacity of
+ * ICU_POOL_SLOTS_PER_CPU slots per online CPU; beyond that a temporary pair is
+ * cloned and closed again on checkin.
+ *
+ * Checkout and checkin use a lock-free stack (Treiber stack) over the fixed
+ * slot array. The head stores the index of the top slot in its low 32 bits
+ * and a modification counter in its high 32 bits to rule out ABA problems.
+ * Pools are found by configuration fingerprint under a mutex at xCreate time
+ * and freed when the last tokenizer instance using them is deleted.
+ */
+
+#include "fts5_icu.h"
+
+SQLITE_EXTENSION_INIT3
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#if !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+#define FTS5_ICU_HAVE_POOL 1
+#endif
+
+/** Number of pool slots per online CPU */
+#define ICU_POOL_SLOTS_PER_CPU 2
+
+/** Minimum number of pool slots */
+#define ICU_POOL_MIN_SLOTS 4
+
+/**
+ * @brief Returns the number of online CPUs
+ *
+ * @return The number of CPUs, at least 1
+ */
+int icu_online_cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO system_info;
+    GetSystemInfo(&system_info);
+    return system_info.dwNumberOfProcessors > 0 ? (int)system_info.dwNumberOfProcessors : 1;
+#else
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (int)online : 1;
+#endif
+}
+
+#ifdef FTS5_ICU_HAVE_POOL
+
+/** A pool slot; the objects stay in place while the slot is checked out */
+typedef struct IcuPoolSlot {
+    UBreakIterator* pBreakIterator;   /**< Pooled break iterator */
+    UTransliterator* pTransliterator; /**< Pooled transliterator */
+    _Atomic uint32_t next;            /**< Next free slot index + 1, 0 at the bottom */
+} IcuPoolSlot;
+
+struct IcuObjectPool {
+    IcuObjectPool* next_pool;          /**< Next pool in the registry */
+    int reference_count;               /**< Tokenizer instances using the pool */
+    sqlite3_uint64 fingerprint;        /**< Fingerprint of the configuration */
+    char* locale;                      /**< Copy of the configured locale */
+    UChar* rules;                      /**< Copy of the configured rule chain */
+    UBreakIterator* pBreakIterator;    /**< Prototype break iterator */
+    UTransliterator* pTransliterator;  /**< Prototype transliterator */
+    sqlite3_mutex* clone_mutex;        /**< Serializes cloning from the prototypes */
+    uint32_t capacity;                 /**< Number of slots */
+    _Atomic uint32_t created;          /**< Number of slots holding objects */
+    _Atomic uint64_t free_head;        /**< Tag << 32 | (top slot index + 1) */
+    IcuPoolSlot* slots;                /**< Fixed slot array */
+};
+
+/** All live pools; protected by the SQLITE_MUTEX_STATIC_APP1 mutex */
+static IcuObjectPool* pool_registry = NULL;
+
+// ========================================================================
+// === LOCK-FREE FREELIST =================================================
+// ========================================================================
+
+/**
+ * @brief Pushes a slot onto the pool's free stack
+ *
+ * @param pool The object pool
+ * @param slot_index Index of the slot being returned
+ */
+static void pool_push_free(IcuObjectPool* pool, uint32_t slot_index) {
+    uint64_t old_head = atomic_load_explicit(&pool->free_head, memory_order_relaxed);
+    uint64_t new_head;
+    do {
+        atomic_store_explicit(&pool->slots[slot_index].next, (uint32_t)old_head,
+                              memory_order_relaxed);
+        new_head = (((old_head >> 32) + 1) << 32) | (uint64_t)(slot_index + 1);
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_head, &old_head, new_head,
+                                                    memory_order_release,
+                                                    memory_order_relaxed));
+}
+
+/**
+ * @brief Pops a slot from the pool's free stack
+ *
+ * @param pool The object pool
+ * @param[out] pSlotIndex Receives the index of the slot
+ * @return Non-zero if a slot was popped, zero if the stack is empty
+ */
+static int pool_pop_free(IcuObjectPool* pool, uint32_t* pSlotIndex) {
+    uint64_t old_head = atomic_load_explicit(&pool->free_head, memory_order_acquire);
+    uint64_t new_head;
+    do {
+        uint32_t top = (uint32_t)old_head;
+        if (top == 0)
+            return 0;
+        uint32_t next = atomic_load_explicit(&pool->slots[top - 1].next, memory_order_relaxed);
+        new_head = (((old_head >> 32) + 1) << 32) | next;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_head, &old_head, new_head,
+                                                    memory_order_acquire,
+                                                    memory_order_acquire));
+    *pSlotIndex = (uint32_t)old_head - 1;
+    return 1;
+}
+
+// ========================================================================
+// === CHECKOUT AND CHECKIN ===============================================
+// ========================================================================
+
+/**
+ * @brief Clones a new object pair from the pool prototypes
+ *
+ * @param pool The object pool
+ * @param[out] ppBreakIterator Receives the break iterator
+ * @param[out] ppTransliterator Receives the transliterator
+ * @return SQLITE_OK on success, SQLITE_ERROR on failure
+ */
+static int pool_clone_prototypes(IcuObjectPool* pool, UBreakIterator** ppBreakIterator,
+                                 UTransliterator** ppTransliterator) {
+    sqlite3_mutex_enter(pool->clone_mutex);
+    int rc = icu_clone_objects(pool->pBreakIterator, pool->pTransliterator, ppBreakIterator,
+                               ppTransliterator);
+    sqlite3_mutex_leave(pool->clone_mutex);
+    return rc;
+}
+
+/**
+ * @brief Checks a break iterator/transliterator pair out of a pool
+ *
+ * @param pool The object pool
+ * @param[out] lease Receives the borrowed objects
+ * @return SQLITE_OK on success, SQLITE_ERROR if no objects could be created
+ */
+int icu_pool_checkout(IcuObjectPool* pool, IcuPoolLease* lease) {
+    uint32_t slot_index;
+    if (pool_pop_free(pool, &slot_index)) {
+        IcuPoolSlot* slot = &pool->slots[slot_index];
+        if (!slot->pBreakIterator &&
+            pool_clone_prototypes(pool, &slot->pBreakIterator, &slot->pTransliterator) !=
+                SQLITE_OK) {
+            slot->pBreakIterator = NULL;
+            slot->pTransliterator = NULL;
+            pool_push_free(pool, slot_index);
+            return SQLITE_ERROR;
+        }
+        lease->slot = slot_index;
+        lease->pBreakIterator = slot->pBreakIterator;
+        lease->pTransliterator = slot->pTransliterator;
+        return SQLITE_OK;
+    }
+
+    // No free pair: populate a new slot while there is capacity left
+    slot_index = atomic_fetch_add(&pool->created, 1);
+    if (slot_index < pool->capacity) {
+        IcuPoolSlot* slot = &pool->slots[slot_index];
+        if (pool_clone_prototypes(pool, &slot->pBreakIterator, &slot->pTransliterator) !=
+            SQLITE_OK) {
+            // Leave the slot empty but usable: it is filled on its next checkout
+            slot->pBreakIterator = NULL;
+            slot->pTransliterator = NULL;
+            pool_push_free(pool, slot_index);
+            return SQLITE_ERROR;
+        }
+        lease->slot = slot_index;
+        lease->pBreakIterator = slot->pBreakIterator;
+        lease->pTransliterator = slot->pTransliterator;
+        return SQLITE_OK;
+    }
+    atomic_fetch_sub(&pool->created, 1);
+
+    // Pool exhausted: use a temporary pair
+    lease->slot = ICU_POOL_NO_SLOT;
+    return pool_clone_prototypes(pool, &lease->pBreakIterator, &lease->pTransliterator);
+}
+
+/**
+ * @brief Returns a pair obtained from icu_pool_checkout()
+ *
+ * @param pool The object pool
+ * @param lease The lease to return
+ */
+void icu_pool_checkin(IcuObjectPool* pool, IcuPoolLease* lease) {
+    if (lease->slot == ICU_POOL_NO_SLOT) {
+        ubrk_close(lease->pBreakIterator);
+        utrans_close(lease->pTransliterator);
+    } else {
+        pool_push_free(pool, lease->slot);
+    }
+    lease->pBreakIterator = NULL;
+    lease->pTransliterator = NULL;
+}
+
+/**
+ * @brief Drains the free stack of a pool and closes the objects of its slots
+ *
+ * The drained slots are pushed back empty; pool_clone_prototypes() refills a
+ * slot the next time it is checked out.
+ *
+ * @param pool The object pool
+ */
+static void pool_close_idle_slots(IcuObjectPool* pool) {
+    uint32_t drained = 0;
+    uint32_t slot_index;
+    while (pool_pop_free(pool, &slot_index)) {
+        IcuPoolSlot* slot = &pool->slots[slot_index];
+        ubrk_close(slot->pBreakIterator);
+        utrans_close(slot->pTransliterator);
+        slot->pBreakIterator = NULL;
+        slot->pTransliterator = NULL;
+        atomic_store_explicit(&slot->next, drained, memory_order_relaxed);
+        drained = slot_index + 1;
+    }
+    while (drained) {
+        slot_index = drained - 1;
+        drained = atomic_load_explicit(&pool->slots[slot_index].next, memory_order_relaxed);
+        pool_push_free(pool, slot_index);
+    }
+}
+
+// ========================================================================
+// === POOL REGISTRY ======================================================
+// ========================================================================
+
+/**
+ * @brief Frees a pool and all objects it holds
+ *
+ * @param pool The pool to free; no objects may be checked out
+ */
+static void pool_free(IcuObjectPool* pool) {
+    if (pool->slots) {
+        uint32_t created = atomic_load(&pool->created);
+        for (uint32_t i = 0; i < created && i < pool->capacity; i++) {
+            ubrk_close(pool->slots[i].pBreakIterator);
+            utrans_close(pool->slots[i].pTransliterator);
+        }
+    }
+    ubrk_close(pool->pBreakIterator);
+    utrans_close(pool->pTransliterator);
+    sqlite3_mutex_free(pool->clone_mutex);
+    sqlite3_free(pool->slots);
+    sqlite3_free(pool->locale);
+    sqlite3_free(pool->rules);
+    sqlite3_free(pool);
+}
+
+/**
+ * @brief Creates a pool for a configuration
+ *
+ * @param pConfig The tokenizer configuration
+ * @param fingerprint Fingerprint of the configuration
+ * @param[out] ppPool Receives the new pool
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+static int pool_create(const IcuTokenizerConfig* pConfig, sqlite3_uint64 fingerprint,
+                       IcuObjectPool** ppPool) {
+    IcuObjectPool* pool = (IcuObjectPool*)sqlite3_malloc(sizeof(IcuObjectPool));
+    if (!pool)
+        return SQLITE_NOMEM;
+    memset(pool, 0, sizeof(IcuObjectPool));
+    pool->fingerprint = fingerprint;
+    pool->reference_count = 1;
+
+    int cpu_count = icu_online_cpu_count();
+    pool->capacity = (uint32_t)(cpu_count * ICU_POOL_SLOTS_PER_CPU);
+    if (pool->capacity < ICU_POOL_MIN_SLOTS)
+        pool->capacity = ICU_POOL_MIN_SLOTS;
+    atomic_init(&pool->created, 0);
+    atomic_init(&pool->free_head, 0);
+
+    int32_t rules_length = u_strlen(pConfig->rules);
+    pool->locale = sqlite3_mprintf("%s", pConfig->locale);
+    pool->rules = (UChar*)sqlite3_malloc((rules_length + 1) * (int)sizeof(UChar));
+    pool->slots = (IcuPoolSlot*)sqlite3_malloc((int)pool->capacity * (int)sizeof(IcuPoolSlot));
+    pool->clone_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_FAST);
+    if (!pool->locale || !pool->rules || !pool->slots ||
+        (!pool->clone_mutex && sqlite3_threadsafe())) {
+        pool_free(pool);
+        return SQLITE_NOMEM;
+    }
+    memset(pool->slots, 0, pool->capacity * sizeof(IcuPoolSlot));
+    u_strcpy(pool->rules, pConfig->rules);
+
+    IcuTokenizerConfig pool_config = *pConfig;
+    pool_config.locale = pool->locale;
+    pool_config.rules = pool->rules;
+    int rc = icu_open_objects(&pool_config, &pool->pBreakIterator, &pool->pTransliterator);
+    if (rc != SQLITE_OK) {
+        pool_free(pool);
+        return rc;
+    }
+
+    *ppPool = pool;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Finds or creates the pool for a configuration and takes a reference
+ *
+ * @param pConfig The tokenizer configuration
+ * @param[out] ppPool Receives the pool
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+int icu_pool_acquire(const IcuTokenizerConfig* pConfig, IcuObjectPool** ppPool) {
+    // Pools are keyed on what the ICU objects depend on, so configurations
+    // that differ only in how tokens are formed share a pool
+    IcuTokenizerConfig object_config;
+    memset(&object_config, 0, sizeof(IcuTokenizerConfig));
+    object_config.locale = pConfig->locale;
+    object_config.rules = pConfig->rules;
+    sqlite3_uint64 fingerprint = icu_config_fingerprint(&object_config);
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+    int rc = SQLITE_OK;
+
+    sqlite3_mutex_enter(registry_mutex);
+    IcuObjectPool* pool = pool_registry;
+    while (pool) {
+        if (pool->fingerprint == fingerprint && strcmp(pool->locale, pConfig->locale) == 0 &&
+            u_strcmp(pool->rules, pConfig->rules) == 0)
+            break;
+        pool = pool->next_pool;
+    }
+    if (pool) {
+        pool->reference_count++;
+    } else {
+        rc = pool_create(pConfig, fingerprint, &pool);
+        if (rc == SQLITE_OK) {
+            pool->next_pool = pool_registry;
+            pool_registry = pool;
+        }
+    }
+    sqlite3_mutex_leave(registry_mutex);
+
+    *ppPool = (rc == SQLITE_OK) ? pool : NULL;
+    return rc;
+}
+
+/**
+ * @brief Takes an additional reference to a pool
+ *
+ * @param pool The object pool
+ */
+void icu_pool_retain(IcuObjectPool* pool) {
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+    sqlite3_mutex_enter(registry_mutex);
+    pool->reference_count++;
+    sqlite3_mutex_leave(registry_mutex);
+}
+
+/**
+ * @brief Drops a reference to a pool, freeing it with the last reference
+ *
+ * @param pool The object pool
+ */
+void icu_pool_release(IcuObjectPool* pool) {
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+    sqlite3_mutex_enter(registry_mutex);
+    int last_reference = (--pool->reference_count == 0);
+    if (last_reference) {
+        IcuObjectPool** link = &pool_registry;
+        while (*link != pool) {
+            link = &(*link)->next_pool;
+        }
+        *link = pool->next_pool;
+    }
+    sqlite3_mutex_leave(registry_mutex);
+
+    if (last_reference)
+        pool_free(pool);
+}
+
+/**
+ * @brief Closes the pooled objects that are not checked out, in every pool
+ *
+ * Called when memory is released under pressure. The prototypes are kept, so
+ * the pools keep working and re-create their objects on demand.
+ */
+void icu_pool_release_idle(void) {
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP1);
+    sqlite3_mutex_enter(registry_mutex);
+    for (IcuObjectPool* pool = pool_registry; pool; pool = pool->next_pool) {
+        pool_close_idle_slots(pool);
+    }
+    sqlite3_mutex_leave(registry_mutex);
+}
+
+#else  // !FTS5_ICU_HAVE_POOL
+
+// Without C11 atomics the "pool" option is accepted but every tokenizer
+// instance keeps its own ICU objects.
+
+int icu_pool_acquire(const IcuTokenizerConfig* pConfig, IcuObjectPool** ppPool) {
+    UNUSED_PARAMETER(pConfig);
+    *ppPool = NULL;
+    return SQLITE_OK;
+}
+
+void icu_pool_retain(IcuObjectPool* pool) {
+    UNUSED_PARAMETER(pool);
+}
+
+void icu_pool_release(IcuObjectPool* pool) {
+    UNUSED_PARAMETER(pool);
+}
+
+int icu_pool_checkout(IcuObjectPool* pool, IcuPoolLease* lease) {
+    UNUSED_PARAMETER(pool);
+    UNUSED_PARAMETER(lease);
+    return SQLITE_ERROR;
+}
+
+void icu_pool_checkin(IcuObjectPool* pool, IcuPoolLease* lease) {
+    UNUSED_PARAMETER(pool);
+    UNUSED_PARAMETER(lease);
+}
+
+void icu_pool_release_idle(void) {
+}
+
+#endif  // FTS5_ICU_HAVE_POOL
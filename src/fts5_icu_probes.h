@@ -0,0 +1,50 @@
+/**
+ * @file fts5_icu_probes.h
+ * @brief Optional USDT probes in the tokenizer hot path
+ *
+ * Libraries built with -DFTS5_ICU_USDT=ON contain statically defined
+ * tracepoints in the "fts5_icu" provider, which bpftrace, SystemTap and perf
+ * can attach to in a running process (see scripts/bpftrace/). A probe that
+ * nothing is attached to is a single nop instruction. Its arguments are
+ * recorded in an ELF note and are only read by an attached tracer. Other builds
+ * compile the probes away entirely.
+ *
+ * Probes and their arguments:
+ *   create__start(name, nArg)           entry of icuCreate()
+ *   create__done(name, rc)              exit of icuCreate()
+ *   tokenize__start(locale, nText, flags)
+ *                                       entry of icuTokenize()
+ *   tokenize__done(locale, nText, tokens, rc)
+ *                                       exit of icuTokenize(); tokens counts
+ *                                       the tokens that are not colocated
+ *   token__start(units)                 entry of process_single_token(); the
+ *                                       token length in UTF-16 code units
+ *   token__done(units, bytes, rc)       exit of process_single_token(); bytes
+ *                                       is the UTF-8 token length, 0 if the
+ *                                       token was skipped
+ *   translit__start(units)              around utrans_transUChars(), with the
+ *   translit__done(units, out_units)    input and output lengths
+ *   break__start(position)              around ubrk_next(), with the position
+ *   break__done(position, boundary)     before and the boundary found after
+ */
+
+#ifndef FTS5_ICU_PROBES_H
+#define FTS5_ICU_PROBES_H
+
+#ifdef FTS5_ICU_USDT
+#include <sys/sdt.h>
+
+#define ICU_PROBE1(name, a) DTRACE_PROBE1(fts5_icu, name, a)
+#define ICU_PROBE2(name, a, b) DTRACE_PROBE2(fts5_icu, name, a, b)
+#define ICU_PROBE3(name, a, b, c) DTRACE_PROBE3(fts5_icu, name, a, b, c)
+#define ICU_PROBE4(name, a, b, c, d) DTRACE_PROBE4(fts5_icu, name, a, b, c, d)
+#else
+// Arguments are still evaluated, as they would be by the probes, so that
+// variables only passed to probes do not trigger unused warnings
+#define ICU_PROBE1(name, a) ((void)(a))
+#define ICU_PROBE2(name, a, b) ((void)(a), (void)(b))
+#define ICU_PROBE3(name, a, b, c) ((void)(a), (void)(b), (void)(c))
+#define ICU_PROBE4(name, a, b, c, d) ((void)(a), (void)(b), (void)(c), (void)(d))
+#endif
+
+#endif  // FTS5_ICU_PROBES_H
@@ -0,0 +1,580 @@
+/**
+ * @file fts5_icu_rebuild.c
+ * @brief Parallel FTS5 rebuild driver for the ICU tokenizer
+ *
+ * icu_parallel_rebuild(table [, threads]) runs the FTS5 'rebuild' command on
+ * the calling connection while a pool of worker threads tokenizes the source
+ * rows ahead of the writer. Each worker owns a clone of the table's tokenizer.
+ *
+ * The writer thread reads the source rows in rowid order into a bounded
+ * window of slots, which the workers fill with recorded token streams. When
+ * FTS5 asks the tokenizer for a document, the writer looks the text up in the
+ * window and replays the recorded tokens instead of running ICU. A document
+ * is only replayed if its text is byte-for-byte identical to the text the
+ * worker tokenized, so any mismatch simply falls back to live tokenization.
+ */
+
+#include "fts5_icu.h"
+
+SQLITE_EXTENSION_INIT3
+
+#ifdef FTS5_ICU_HAVE_PTHREADS
+
+#include <pthread.h>
+
+/** Upper bound for the number of worker threads */
+#define ICU_REBUILD_MAX_THREADS 64
+
+/** Number of window slots allocated per worker thread */
+#define ICU_REBUILD_SLOTS_PER_THREAD 16
+
+/** Lifecycle of a window slot */
+enum {
+    ICU_SLOT_EMPTY = 0, /**< Free for the reader */
+    ICU_SLOT_PENDING,   /**< Holds source text waiting for a worker */
+    ICU_SLOT_RUNNING,   /**< Being tokenized by a worker */
+    ICU_SLOT_DONE       /**< Token stream ready for replay */
+};
+
+/** One token recorded by a worker thread */
+typedef struct IcuRecordedToken {
+    int tflags;       /**< FTS5_TOKEN_* flags */
+    int iStart;       /**< Start byte offset in the source text */
+    int iEnd;         /**< End byte offset in the source text */
+    int token_offset; /**< Offset of the token bytes in the slot byte pool */
+    int token_length; /**< Length of the token in bytes */
+} IcuRecordedToken;
+
+/** A window slot holding one column value and its token stream */
+typedef struct IcuRebuildSlot {
+    int state;                  /**< One of the ICU_SLOT_* values */
+    int result;                 /**< Result of tokenizing the source text */
+    char* source_text;          /**< Copy of the column value */
+    int source_length;          /**< Length of source_text in bytes */
+    int source_capacity;        /**< Allocated size of source_text */
+    IcuRecordedToken* tokens;   /**< Recorded tokens */
+    int token_count;            /**< Number of recorded tokens */
+    int token_capacity;         /**< Allocated entries in tokens */
+    char* token_bytes;          /**< Byte pool holding the token text */
+    int token_bytes_used;       /**< Bytes used in token_bytes */
+    int token_bytes_capacity;   /**< Allocated size of token_bytes */
+} IcuRebuildSlot;
+
+/** State shared between the writer thread and the workers */
+typedef struct IcuRebuildSession {
+    sqlite3* db;                    /**< Connection running the rebuild */
+    sqlite3_stmt* scan_statement;   /**< Reads the source rows in rowid order */
+    int scan_done;                  /**< Set once scan_statement is exhausted */
+    int scan_column;                /**< Next column to read from the current row */
+    int scan_row_valid;             /**< Set while a row is being read */
+    int thread_count;               /**< Number of worker threads requested */
+    int threads_started;            /**< Number of worker threads running */
+    int disabled;                   /**< Set when the workers could not be started */
+    IcuTokenizerV2* prototype;      /**< Tokenizer instance that receives replays */
+    IcuTokenizerV2** worker_tokenizers; /**< One cloned tokenizer per worker */
+    pthread_t* threads;             /**< Worker thread handles */
+    pthread_mutex_t mutex;          /**< Protects the sequence counters and slot states */
+    pthread_cond_t work_ready;      /**< Signalled when slots become pending */
+    pthread_cond_t work_done;       /**< Signalled when a worker finishes a slot */
+    IcuRebuildSlot* slots;          /**< Ring buffer of window slots */
+    int slot_count;                 /**< Number of slots in the ring */
+    sqlite3_int64 head_seq;         /**< Oldest occupied slot */
+    sqlite3_int64 tail_seq;         /**< Next slot to be filled by the reader */
+    sqlite3_int64 next_work_seq;    /**< Next slot to be claimed by a worker */
+    int shutting_down;              /**< Tells the workers to exit */
+    sqlite3_int64 replayed_count;   /**< Documents served from the window */
+    sqlite3_int64 fallback_count;   /**< Documents tokenized live by the writer */
+} IcuRebuildSession;
+
+/** Session active on the calling thread while the rebuild statement runs */
+static _Thread_local IcuRebuildSession* current_rebuild_session = NULL;
+
+/** Arguments handed to each worker thread */
+typedef struct IcuRebuildWorker {
+    IcuRebuildSession* session;
+    IcuTokenizerV2* tokenizer;
+} IcuRebuildWorker;
+
+// ========================================================================
+// === TOKEN STREAM RECORDING =============================================
+// ========================================================================
+
+/**
+ * @brief xToken callback that appends a token to a window slot
+ *
+ * @param pCtx The IcuRebuildSlot being filled
+ * @param tflags FTS5_TOKEN_* flags
+ * @param pToken Token text
+ * @param nToken Length of the token text in bytes
+ * @param iStart Start byte offset in the source text
+ * @param iEnd End byte offset in the source text
+ * @return SQLITE_OK on success, SQLITE_NOMEM or SQLITE_ERROR on failure
+ */
+static int record_token(void* pCtx, int tflags, const char* pToken, int nToken, int iStart,
+                        int iEnd) {
+    IcuRebuildSlot* slot = (IcuRebuildSlot*)pCtx;
+
+    if (slot->token_count == slot->token_capacity) {
+        if (slot->token_capacity > INT_MAX / 2 / (int)sizeof(IcuRecordedToken)) {
+            return SQLITE_ERROR;  // Prevent integer overflow
+        }
+        int new_capacity = slot->token_capacity ? slot->token_capacity * 2 : 64;
+        IcuRecordedToken* new_tokens = (IcuRecordedToken*)icu_memory_realloc(
+          NULL, slot->tokens, new_capacity * (int)sizeof(IcuRecordedToken));
+        if (!new_tokens)
+            return SQLITE_NOMEM;
+        slot->tokens = new_tokens;
+        slot->token_capacity = new_capacity;
+    }
+
+    if (nToken > INT_MAX - slot->token_bytes_used) {
+        return SQLITE_ERROR;  // Prevent integer overflow
+    }
+    if (slot->token_bytes_used + nToken > slot->token_bytes_capacity) {
+        int64_t new_capacity = slot->token_bytes_capacity ? slot->token_bytes_capacity : 1024;
+        while (new_capacity < (int64_t)slot->token_bytes_used + nToken) {
+            new_capacity *= 2;
+        }
+        if (new_capacity > INT_MAX) {
+            return SQLITE_ERROR;
+        }
+        char* new_bytes = (char*)icu_memory_realloc(NULL, slot->token_bytes, new_capacity);
+        if (!new_bytes)
+            return SQLITE_NOMEM;
+        slot->token_bytes = new_bytes;
+        slot->token_bytes_capacity = (int)new_capacity;
+    }
+
+    IcuRecordedToken* token = &slot->tokens[slot->token_count++];
+    token->tflags = tflags;
+    token->iStart = iStart;
+    token->iEnd = iEnd;
+    token->token_offset = slot->token_bytes_used;
+    token->token_length = nToken;
+    memcpy(slot->token_bytes + slot->token_bytes_used, pToken, nToken);
+    slot->token_bytes_used += nToken;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Worker thread main loop
+ *
+ * Claims pending slots in sequence order and tokenizes them with the worker's
+ * own tokenizer clone until the session shuts down.
+ *
+ * @param pArg The IcuRebuildWorker describing this thread
+ * @return Always NULL
+ */
+static void* rebuild_worker_main(void* pArg) {
+    IcuRebuildWorker* worker = (IcuRebuildWorker*)pArg;
+    IcuRebuildSession* session = worker->session;
+
+    pthread_mutex_lock(&session->mutex);
+    for (;;) {
+        while (!session->shutting_down && session->next_work_seq == session->tail_seq) {
+            pthread_cond_wait(&session->work_ready, &session->mutex);
+        }
+        if (session->shutting_down)
+            break;
+
+        IcuRebuildSlot* slot = &session->slots[session->next_work_seq % session->slot_count];
+        session->next_work_seq++;
+        slot->state = ICU_SLOT_RUNNING;
+        pthread_mutex_unlock(&session->mutex);
+
+        slot->token_count = 0;
+        slot->token_bytes_used = 0;
+        slot->result = icuTokenize((Fts5Tokenizer*)worker->tokenizer, slot,
+                                   FTS5_TOKENIZE_DOCUMENT, slot->source_text,
+                                   slot->source_length, NULL, 0, record_token);
+
+        pthread_mutex_lock(&session->mutex);
+        slot->state = ICU_SLOT_DONE;
+        pthread_cond_broadcast(&session->work_done);
+    }
+    pthread_mutex_unlock(&session->mutex);
+
+    sqlite3_free(worker);
+    return NULL;
+}
+
+// ========================================================================
+// === SESSION MANAGEMENT =================================================
+// ========================================================================
+
+/**
+ * @brief Clones the prototype tokenizer for each worker and starts the threads
+ *
+ * @param session The rebuild session
+ * @param prototype The tokenizer instance of the table being rebuilt
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+static int start_rebuild_workers(IcuRebuildSession* session, IcuTokenizerV2* prototype) {
+    session->prototype = prototype;
+    session->worker_tokenizers = (IcuTokenizerV2**)sqlite3_malloc(
+      session->thread_count * (int)sizeof(IcuTokenizerV2*));
+    session->threads = (pthread_t*)sqlite3_malloc(session->thread_count * (int)sizeof(pthread_t));
+    if (!session->worker_tokenizers || !session->threads)
+        return SQLITE_NOMEM;
+    memset(session->worker_tokenizers, 0, session->thread_count * sizeof(IcuTokenizerV2*));
+
+    for (int i = 0; i < session->thread_count; i++) {
+        int rc = icu_tokenizer_clone(prototype, &session->worker_tokenizers[i]);
+        if (rc != SQLITE_OK)
+            return rc;
+    }
+
+    for (int i = 0; i < session->thread_count; i++) {
+        IcuRebuildWorker* worker = (IcuRebuildWorker*)sqlite3_malloc(sizeof(IcuRebuildWorker));
+        if (!worker)
+            return SQLITE_NOMEM;
+        worker->session = session;
+        worker->tokenizer = session->worker_tokenizers[i];
+        if (pthread_create(&session->threads[i], NULL, rebuild_worker_main, worker) != 0) {
+            sqlite3_free(worker);
+            return SQLITE_ERROR;
+        }
+        session->threads_started++;
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Stops the worker threads and releases all session resources
+ *
+ * @param session The rebuild session
+ */
+static void finish_rebuild_session(IcuRebuildSession* session) {
+    pthread_mutex_lock(&session->mutex);
+    session->shutting_down = 1;
+    pthread_cond_broadcast(&session->work_ready);
+    pthread_mutex_unlock(&session->mutex);
+
+    for (int i = 0; i < session->threads_started; i++) {
+        pthread_join(session->threads[i], NULL);
+    }
+
+    if (session->worker_tokenizers) {
+        for (int i = 0; i < session->thread_count; i++) {
+            icuDelete((Fts5Tokenizer*)session->worker_tokenizers[i]);
+        }
+    }
+    if (session->slots) {
+        for (int i = 0; i < session->slot_count; i++) {
+            icu_memory_free(NULL, session->slots[i].source_text);
+            icu_memory_free(NULL, session->slots[i].tokens);
+            icu_memory_free(NULL, session->slots[i].token_bytes);
+        }
+    }
+    sqlite3_free(session->worker_tokenizers);
+    sqlite3_free(session->threads);
+    sqlite3_free(session->slots);
+    sqlite3_finalize(session->scan_statement);
+    pthread_cond_destroy(&session->work_done);
+    pthread_cond_destroy(&session->work_ready);
+    pthread_mutex_destroy(&session->mutex);
+}
+
+/**
+ * @brief Copies a column value into an empty slot
+ *
+ * @param slot The slot to fill
+ * @param text The column value
+ * @param length Length of the column value in bytes
+ * @return SQLITE_OK on success, SQLITE_NOMEM on allocation failure
+ */
+static int fill_slot_text(IcuRebuildSlot* slot, const char* text, int length) {
+    if (length > slot->source_capacity) {
+        char* new_text = (char*)icu_memory_realloc(NULL, slot->source_text, length);
+        if (!new_text)
+            return SQLITE_NOMEM;
+        slot->source_text = new_text;
+        slot->source_capacity = length;
+    }
+    memcpy(slot->source_text, text, length);
+    slot->source_length = length;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Reads source rows into the window until it is full
+ *
+ * Runs on the writer thread. Every non-empty column value becomes one pending
+ * slot, in the order FTS5 will ask for them.
+ *
+ * @param session The rebuild session
+ */
+static void refill_rebuild_window(IcuRebuildSession* session) {
+    int queued = 0;
+
+    while (!session->scan_done && session->tail_seq - session->head_seq < session->slot_count) {
+        if (!session->scan_row_valid) {
+            if (sqlite3_step(session->scan_statement) != SQLITE_ROW) {
+                session->scan_done = 1;
+                break;
+            }
+            session->scan_row_valid = 1;
+            session->scan_column = 0;
+        }
+
+        int column_count = sqlite3_column_count(session->scan_statement);
+        if (session->scan_column >= column_count) {
+            session->scan_row_valid = 0;
+            continue;
+        }
+
+        int column = session->scan_column++;
+        const char* text = (const char*)sqlite3_column_text(session->scan_statement, column);
+        int length = sqlite3_column_bytes(session->scan_statement, column);
+        if (!text || length <= 0)
+            continue;  // FTS5 does not tokenize NULL or empty values
+
+        IcuRebuildSlot* slot = &session->slots[session->tail_seq % session->slot_count];
+        if (fill_slot_text(slot, text, length) != SQLITE_OK) {
+            session->scan_done = 1;  // Remaining rows are tokenized live
+            break;
+        }
+
+        pthread_mutex_lock(&session->mutex);
+        slot->state = ICU_SLOT_PENDING;
+        session->tail_seq++;
+        pthread_mutex_unlock(&session->mutex);
+        queued = 1;
+    }
+
+    if (queued) {
+        pthread_mutex_lock(&session->mutex);
+        pthread_cond_broadcast(&session->work_ready);
+        pthread_mutex_unlock(&session->mutex);
+    }
+}
+
+/**
+ * @brief Waits for a slot to be tokenized and returns it to the reader
+ *
+ * @param session The rebuild session
+ * @param slot The slot to release
+ */
+static void release_rebuild_slot(IcuRebuildSession* session, IcuRebuildSlot* slot) {
+    pthread_mutex_lock(&session->mutex);
+    while (slot->state != ICU_SLOT_DONE) {
+        pthread_cond_wait(&session->work_done, &session->mutex);
+    }
+    slot->state = ICU_SLOT_EMPTY;
+    session->head_seq++;
+    pthread_mutex_unlock(&session->mutex);
+}
+
+// ========================================================================
+// === REPLAY HOOK (called from xTokenize) ================================
+// ========================================================================
+
+/**
+ * @brief Serves an xTokenize call from the precomputed window if possible
+ *
+ * Only document tokenization on the thread running icu_parallel_rebuild() is
+ * considered. Any slots older than the matching one belong to columns FTS5
+ * skipped (for example UNINDEXED columns) and are discarded.
+ *
+ * @param pTokenizer The tokenizer instance FTS5 invoked
+ * @param flags FTS5_TOKENIZE_* flags
+ * @param pText Document text
+ * @param nText Length of the document text in bytes
+ * @param pLocale Locale passed by FTS5, if any
+ * @param nLocale Length of the locale
+ * @param pCtx Context for the callback function
+ * @param xToken Callback function to replay the tokens to
+ * @param[out] pRc Result of the replay when the call was handled
+ * @return Non-zero if the call was handled, zero to tokenize live
+ */
+int icu_rebuild_try_replay(IcuTokenizerV2* pTokenizer, int flags, const char* pText, int nText,
+                           const char* pLocale, int nLocale, void* pCtx, IcuTokenCallback xToken,
+                           int* pRc) {
+    IcuRebuildSession* session = current_rebuild_session;
+    if (!session || session->disabled)
+        return 0;
+    if (flags != FTS5_TOKENIZE_DOCUMENT || (pLocale && nLocale > 0))
+        return 0;
+
+    if (!session->prototype) {
+        if (start_rebuild_workers(session, pTokenizer) != SQLITE_OK) {
+            session->disabled = 1;
+            return 0;
+        }
+    } else if (pTokenizer != session->prototype) {
+        return 0;  // Some other table's tokenizer
+    }
+
+    refill_rebuild_window(session);
+
+    sqlite3_int64 match_seq = -1;
+    for (sqlite3_int64 seq = session->head_seq; seq < session->tail_seq; seq++) {
+        const IcuRebuildSlot* slot = &session->slots[seq % session->slot_count];
+        if (slot->source_length == nText && memcmp(slot->source_text, pText, nText) == 0) {
+            match_seq = seq;
+            break;
+        }
+    }
+    if (match_seq < 0) {
+        session->fallback_count++;
+        return 0;
+    }
+
+    while (session->head_seq < match_seq) {
+        release_rebuild_slot(session, &session->slots[session->head_seq % session->slot_count]);
+    }
+
+    IcuRebuildSlot* slot = &session->slots[match_seq % session->slot_count];
+    pthread_mutex_lock(&session->mutex);
+    while (slot->state != ICU_SLOT_DONE) {
+        pthread_cond_wait(&session->work_done, &session->mutex);
+    }
+    pthread_mutex_unlock(&session->mutex);
+
+    if (slot->result != SQLITE_OK) {
+        release_rebuild_slot(session, slot);
+        session->fallback_count++;
+        return 0;  // Let the writer report the error itself
+    }
+
+    int rc = SQLITE_OK;
+    for (int i = 0; i < slot->token_count && rc == SQLITE_OK; i++) {
+        const IcuRecordedToken* token = &slot->tokens[i];
+        rc = xToken(pCtx, token->tflags, slot->token_bytes + token->token_offset,
+                    token->token_length, token->iStart, token->iEnd);
+    }
+    release_rebuild_slot(session, slot);
+    session->replayed_count++;
+
+    refill_rebuild_window(session);
+
+    *pRc = rc;
+    return 1;
+}
+
+// ========================================================================
+// === SQL FUNCTION: icu_parallel_rebuild(table [, threads]) ==============
+// ========================================================================
+
+/**
+ * @brief Implementation of icu_parallel_rebuild()
+ *
+ * Returns the number of column values that were replayed from the worker
+ * threads. The rebuild itself is an ordinary FTS5 'rebuild' command, so the
+ * resulting index is identical to a serial rebuild.
+ *
+ * @param context SQL function context
+ * @param argc Number of arguments (1 or 2)
+ * @param argv Table name and optional worker thread count
+ */
+static void icu_parallel_rebuild_func(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    sqlite3* db = sqlite3_context_db_handle(context);
+    const char* table_name = (const char*)sqlite3_value_text(argv[0]);
+    if (!table_name) {
+        sqlite3_result_error(context, "icu_parallel_rebuild: table name required", -1);
+        return;
+    }
+
+    int thread_count;
+    if (argc > 1) {
+        thread_count = sqlite3_value_int(argv[1]);
+    } else {
+        thread_count = icu_online_cpu_count();
+    }
+    if (thread_count < 1 || thread_count > ICU_REBUILD_MAX_THREADS) {
+        thread_count = thread_count < 1 ? 1 : ICU_REBUILD_MAX_THREADS;
+    }
+    if (!sqlite3_threadsafe()) {
+        sqlite3_result_error(context, "icu_parallel_rebuild: SQLite is not thread-safe", -1);
+        return;
+    }
+    if (current_rebuild_session) {
+        sqlite3_result_error(context, "icu_parallel_rebuild: rebuild already in progress", -1);
+        return;
+    }
+
+    IcuRebuildSession session;
+    memset(&session, 0, sizeof(session));
+    session.db = db;
+    session.thread_count = thread_count;
+    session.slot_count = thread_count * ICU_REBUILD_SLOTS_PER_THREAD;
+    pthread_mutex_init(&session.mutex, NULL);
+    pthread_cond_init(&session.work_ready, NULL);
+    pthread_cond_init(&session.work_done, NULL);
+
+    session.slots = (IcuRebuildSlot*)sqlite3_malloc(session.slot_count *
+                                                    (int)sizeof(IcuRebuildSlot));
+    if (!session.slots) {
+        finish_rebuild_session(&session);
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    memset(session.slots, 0, session.slot_count * sizeof(IcuRebuildSlot));
+
+    char* scan_sql = sqlite3_mprintf("SELECT * FROM \"%w\" ORDER BY rowid", table_name);
+    char* rebuild_sql = sqlite3_mprintf("INSERT INTO \"%w\"(\"%w\") VALUES('rebuild')",
+                                        table_name, table_name);
+    int rc = (scan_sql && rebuild_sql) ? SQLITE_OK : SQLITE_NOMEM;
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_prepare_v2(db, scan_sql, -1, &session.scan_statement, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        current_rebuild_session = &session;
+        rc = sqlite3_exec(db, rebuild_sql, NULL, NULL, NULL);
+        current_rebuild_session = NULL;
+    }
+    sqlite3_free(scan_sql);
+    sqlite3_free(rebuild_sql);
+
+    if (rc == SQLITE_OK) {
+        sqlite3_result_int64(context, session.replayed_count);
+    } else if (rc == SQLITE_NOMEM) {
+        sqlite3_result_error_nomem(context);
+    } else {
+        char* message = sqlite3_mprintf("icu_parallel_rebuild: %s", sqlite3_errmsg(db));
+        sqlite3_result_error(context, message ? message : "icu_parallel_rebuild failed", -1);
+        sqlite3_free(message);
+    }
+    finish_rebuild_session(&session);
+}
+
+#else  // !FTS5_ICU_HAVE_PTHREADS
+
+int icu_rebuild_try_replay(IcuTokenizerV2* pTokenizer, int flags, const char* pText, int nText,
+                           const char* pLocale, int nLocale, void* pCtx, IcuTokenCallback xToken,
+                           int* pRc) {
+    UNUSED_PARAMETER(pTokenizer);
+    UNUSED_PARAMETER(flags);
+    UNUSED_PARAMETER(pText);
+    UNUSED_PARAMETER(nText);
+    UNUSED_PARAMETER(pLocale);
+    UNUSED_PARAMETER(nLocale);
+    UNUSED_PARAMETER(pCtx);
+    UNUSED_PARAMETER(xToken);
+    UNUSED_PARAMETER(pRc);
+    return 0;
+}
+
+static void icu_parallel_rebuild_func(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    UNUSED_PARAMETER(argc);
+    UNUSED_PARAMETER(argv);
+    sqlite3_result_error(context, "icu_parallel_rebuild: built without thread support", -1);
+}
+
+#endif  // FTS5_ICU_HAVE_PTHREADS
+
+/**
+ * @brief Registers icu_parallel_rebuild() on a database connection
+ *
+ * @param db The database connection
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+int icu_register_rebuild_function(sqlite3* db) {
+    int rc = sqlite3_create_function(db, "icu_parallel_rebuild", 1, SQLITE_UTF8, NULL,
+                                     icu_parallel_rebuild_func, NULL, NULL);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, "icu_parallel_rebuild", 2, SQLITE_UTF8, NULL,
+                                     icu_parallel_rebuild_func, NULL, NULL);
+    }
+    return rc;
+}
@@ -0,0 +1,204 @@
+/**
+ * @file fts5_icu_rules.c
+ * @brief Process-wide cache of transliterators compiled from custom rules
+ *
+ * The "rules" tokenizer option replaces the compiled-in transliterator rule
+ * chain, for example tokenize = "icu rules 'NFKD; Lower; NFKC'" (FTS5 only
+ * accepts single-quoted arguments in a tokenize directive). Compiling a rule
+ * chain takes milliseconds, and FTS5 creates a tokenizer instance every time
+ * a connection opens the table, so every distinct rule string is compiled
+ * once per process: the compiled transliterator is kept in a registry keyed
+ * by the rule string, and every instance clones it. Entries are reference
+ * counted; an entry that no configuration references stays compiled, so that
+ * dropping and recreating a table does not compile the rules again, until
+ * icu_memory_release() closes it.
+ *
+ * The registry is protected by the SQLITE_MUTEX_STATIC_APP2 mutex like the
+ * compiled-in prototypes, because object pools open their objects with the
+ * APP1 mutex held.
+ */
+
+#include "fts5_icu.h"
+
+SQLITE_EXTENSION_INIT3
+
+struct IcuRuleSet {
+    IcuRuleSet* next_rule_set;        /**< Next rule set in the registry */
+    int reference_count;              /**< Configurations using the rule set */
+    UChar* rules;                     /**< The rule string, NUL-terminated */
+    UTransliterator* pTransliterator; /**< Transliterator compiled from the rules */
+};
+
+/** All compiled rule sets; protected by the SQLITE_MUTEX_STATIC_APP2 mutex */
+static IcuRuleSet* rule_set_registry = NULL;
+
+/**
+ * @brief Converts a rule string from the table declaration to UTF-16
+ *
+ * @param rules The rule string in UTF-8
+ * @param[out] pResult Receives the rule string (free with sqlite3_free())
+ * @return SQLITE_OK on success, SQLITE_ERROR for an empty string or invalid
+ *         UTF-8, SQLITE_NOMEM
+ */
+static int rules_to_utf16(const char* rules, UChar** pResult) {
+    UErrorCode status = U_ZERO_ERROR;
+    int32_t length = 0;
+    u_strFromUTF8(NULL, 0, &length, rules, -1, &status);
+    if (status != U_BUFFER_OVERFLOW_ERROR || length == 0)
+        return SQLITE_ERROR;
+
+    UChar* result = (UChar*)sqlite3_malloc64((sqlite3_uint64)(length + 1) * sizeof(UChar));
+    if (!result)
+        return SQLITE_NOMEM;
+    status = U_ZERO_ERROR;
+    u_strFromUTF8(result, length + 1, NULL, rules, -1, &status);
+    if (U_FAILURE(status)) {
+        sqlite3_free(result);
+        return SQLITE_ERROR;
+    }
+    *pResult = result;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Compiles a rule set, or finds the one already compiled
+ *
+ * @param rules The rule string in UTF-8, in the form accepted by
+ *              utrans_openU() (a compound transliterator ID such as
+ *              "NFKD; Lower; NFKC")
+ * @param[out] ppRuleSet Receives the rule set
+ * @return SQLITE_OK on success, SQLITE_ERROR if ICU rejects the rules,
+ *         SQLITE_NOMEM
+ */
+int icu_rule_set_open(const char* rules, IcuRuleSet** ppRuleSet) {
+    *ppRuleSet = NULL;
+    UChar* key = NULL;
+    int rc = rules_to_utf16(rules, &key);
+    if (rc != SQLITE_OK)
+        return rc;
+
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP2);
+    sqlite3_mutex_enter(registry_mutex);
+    IcuRuleSet* rule_set = rule_set_registry;
+    while (rule_set && u_strcmp(rule_set->rules, key) != 0) {
+        rule_set = rule_set->next_rule_set;
+    }
+
+    if (rule_set) {
+        rule_set->reference_count++;
+        sqlite3_free(key);
+    } else {
+        UErrorCode status = U_ZERO_ERROR;
+        UTransliterator* pTransliterator =
+          utrans_openU(key, -1, UTRANS_FORWARD, NULL, 0, NULL, &status);
+        if (U_FAILURE(status)) {
+            sqlite3_free(key);
+            rc = SQLITE_ERROR;
+        } else {
+            rule_set = (IcuRuleSet*)sqlite3_malloc(sizeof(IcuRuleSet));
+            if (!rule_set) {
+                utrans_close(pTransliterator);
+                sqlite3_free(key);
+                rc = SQLITE_NOMEM;
+            } else {
+                rule_set->rules = key;
+                rule_set->pTransliterator = pTransliterator;
+                rule_set->reference_count = 1;
+                rule_set->next_rule_set = rule_set_registry;
+                rule_set_registry = rule_set;
+            }
+        }
+    }
+    sqlite3_mutex_leave(registry_mutex);
+
+    *ppRuleSet = rule_set;
+    return rc;
+}
+
+/**
+ * @brief Takes an additional reference to a rule set
+ *
+ * @param rule_set The rule set
+ */
+void icu_rule_set_retain(IcuRuleSet* rule_set) {
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP2);
+    sqlite3_mutex_enter(registry_mutex);
+    rule_set->reference_count++;
+    sqlite3_mutex_leave(registry_mutex);
+}
+
+/**
+ * @brief Drops a reference to a rule set
+ *
+ * The rule set stays in the registry after the last reference is dropped;
+ * icu_rule_set_release_idle() closes it.
+ *
+ * @param rule_set The rule set
+ */
+void icu_rule_set_release(IcuRuleSet* rule_set) {
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP2);
+    sqlite3_mutex_enter(registry_mutex);
+    rule_set->reference_count--;
+    sqlite3_mutex_leave(registry_mutex);
+}
+
+/**
+ * @brief Closes every rule set that no configuration references
+ */
+void icu_rule_set_release_idle(void) {
+    IcuRuleSet* idle = NULL;
+
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP2);
+    sqlite3_mutex_enter(registry_mutex);
+    IcuRuleSet** link = &rule_set_registry;
+    while (*link) {
+        IcuRuleSet* rule_set = *link;
+        if (rule_set->reference_count == 0) {
+            *link = rule_set->next_rule_set;
+            rule_set->next_rule_set = idle;
+            idle = rule_set;
+        } else {
+            link = &rule_set->next_rule_set;
+        }
+    }
+    sqlite3_mutex_leave(registry_mutex);
+
+    while (idle) {
+        IcuRuleSet* next = idle->next_rule_set;
+        utrans_close(idle->pTransliterator);
+        sqlite3_free(idle->rules);
+        sqlite3_free(idle);
+        idle = next;
+    }
+}
+
+/**
+ * @brief Returns the rule string of a rule set
+ *
+ * @param rule_set The rule set
+ * @return The NUL-terminated rule string, valid while the reference is held
+ */
+const UChar* icu_rule_set_rules(const IcuRuleSet* rule_set) {
+    return rule_set->rules;
+}
+
+/**
+ * @brief Clones the transliterator compiled for a rule set
+ *
+ * @param rule_set The rule set
+ * @param[out] ppTransliterator Receives the clone
+ * @return SQLITE_OK on success, SQLITE_ERROR on failure
+ */
+int icu_rule_set_clone(IcuRuleSet* rule_set, UTransliterator** ppTransliterator) {
+    UErrorCode status = U_ZERO_ERROR;
+    sqlite3_mutex* registry_mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP2);
+    sqlite3_mutex_enter(registry_mutex);
+    UTransliterator* pTransliterator = utrans_clone(rule_set->pTransliterator, &status);
+    sqlite3_mutex_leave(registry_mutex);
+    if (U_FAILURE(status)) {
+        utrans_close(pTransliterator);
+        return SQLITE_ERROR;
+    }
+    *ppTransliterator = pTransliterator;
+    return SQLITE_OK;
+}
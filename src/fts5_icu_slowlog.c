@@ -0,0 +1,494 @@
+/**
+ * @file fts5_icu_slowlog.c
+ * @brief Slow document log, the icu_slow_documents virtual table and
+ *        icu_budget_stats()
+ *
+ * Tables created with "slow_log N" time every icuTokenize() call. A call that
+ * takes N microseconds or longer is recorded in a process-wide ring buffer,
+ * together with what makes a document expensive:
+ *   - its size, token count and longest token
+ *   - the code points per script
+ *   - the time spent converting it, in the break iterator and in the
+ *     transliterator
+ *   - an FNV-1a hash that icu_document_hash() computes for any text, so that
+ *     the row can be found without copying documents into the log
+ *
+ * SELECT * FROM icu_slow_documents ORDER BY total_us DESC
+ *
+ * The ring buffer holds the last FTS5_ICU_SLOW_LOG_SIZE slow calls; rowids
+ * keep increasing, so that a poller can ask for rowid > last seen. Calls of
+ * tables without the option only test the option. With the option, each
+ * call reads the monotonic clock twice, and each ubrk_next() and
+ * utrans_transUChars() call twice more.
+ *
+ * Calls that exceed the "time_budget" or "work_budget" of their table finish
+ * on the degraded path; icu_budget_stats() counts them and the bytes they
+ * left to it.
+ */
+
+#include "fts5_icu.h"
+
+SQLITE_EXTENSION_INIT3
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/** Number of slow calls kept in the ring buffer */
+#ifndef FTS5_ICU_SLOW_LOG_SIZE
+#define FTS5_ICU_SLOW_LOG_SIZE 256
+#endif
+
+/** Number of scripts listed per document, most frequent first */
+#define ICU_SLOW_LOG_SCRIPTS 6
+
+/** Script codes counted per document; later codes are not listed */
+#define ICU_SLOW_LOG_SCRIPT_CODES 256
+
+/** Julian day number of 1970-01-01 in milliseconds */
+#define ICU_JULIAN_DAY_MS_AT_UNIX_EPOCH 210866760000000LL
+
+/** One slow call */
+typedef struct IcuSlowDocument {
+    sqlite3_int64 sequence;            /**< Number of the slow call since load, from 1 */
+    double time;                       /**< Unix time at which the call ended */
+    int flags;                         /**< FTS5_TOKENIZE_* flags of the call */
+    int bytes;                         /**< Size of the text in bytes */
+    int tokens;                        /**< Tokens that are not colocated */
+    int longest_token;                 /**< Longest normalized token in bytes */
+    int degraded_bytes;                /**< Bytes tokenized on the degraded path */
+    sqlite3_int64 total_ns;            /**< Wall time of the call */
+    IcuStageTimes stage_times;         /**< Wall time per stage */
+    sqlite3_uint64 hash;               /**< FNV-1a hash of the text */
+    char scripts[160];                 /**< Code points per script as a JSON object */
+} IcuSlowDocument;
+
+/** Ring buffer of slow calls; protected by the SQLITE_MUTEX_STATIC_APP3 mutex */
+static IcuSlowDocument slow_log[FTS5_ICU_SLOW_LOG_SIZE];
+
+/** Number of slow calls recorded since load */
+static sqlite3_int64 slow_log_count = 0;
+
+/** Calls that finished on the degraded path since load */
+static sqlite3_int64 degraded_calls = 0;
+
+/** Bytes tokenized on the degraded path since load */
+static sqlite3_int64 degraded_bytes = 0;
+
+// ========================================================================
+// === RECORDING ==========================================================
+// ========================================================================
+
+/**
+ * @brief Reads a monotonic clock
+ *
+ * @return A time in nanoseconds from an arbitrary origin
+ */
+sqlite3_int64 icu_slow_log_clock(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (sqlite3_int64)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (sqlite3_int64)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Computes the hash reported for a text
+ *
+ * @param text The text
+ * @param length Length of the text in bytes
+ * @return The 64-bit FNV-1a hash of the bytes
+ */
+static sqlite3_uint64 document_hash(const char* text, int length) {
+    sqlite3_uint64 hash = 14695981039346656037ULL;
+    for (int i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Describes the scripts of a text as a JSON object
+ *
+ * Lists the ICU_SLOW_LOG_SCRIPTS most frequent scripts with their code point
+ * counts, e.g. {"Latin":812,"Common":167,"Han":40}.
+ *
+ * @param text The UTF-16 text
+ * @param length Length of the text in code units
+ * @param[out] out Receives the JSON object
+ * @param size Size of out in bytes
+ */
+static void describe_scripts(const UChar* text, int32_t length, char* out, int size) {
+    int32_t counts[ICU_SLOW_LOG_SCRIPT_CODES] = {0};
+    for (int32_t i = 0; i < length;) {
+        UChar32 c;
+        U16_NEXT(text, i, length, c);
+        UErrorCode status = U_ZERO_ERROR;
+        UScriptCode script = uscript_getScript(c, &status);
+        if (U_SUCCESS(status) && script >= 0 && script < ICU_SLOW_LOG_SCRIPT_CODES)
+            counts[script]++;
+    }
+
+    out[0] = '{';
+    int used = 1;
+    for (int listed = 0; listed < ICU_SLOW_LOG_SCRIPTS; listed++) {
+        int best = -1;
+        for (int script = 0; script < ICU_SLOW_LOG_SCRIPT_CODES; script++) {
+            if (counts[script] > 0 && (best < 0 || counts[script] > counts[best]))
+                best = script;
+        }
+        if (best < 0)
+            break;
+
+        // Stop at the last entry that fits completely
+        char entry[64];
+        sqlite3_snprintf(sizeof(entry), entry, "%s\"%s\":%d", listed ? "," : "",
+                         uscript_getName((UScriptCode)best), counts[best]);
+        int entry_length = (int)strlen(entry);
+        if (used + entry_length + 2 > size)
+            break;
+        memcpy(out + used, entry, entry_length);
+        used += entry_length;
+        counts[best] = 0;
+    }
+    out[used++] = '}';
+    out[used] = 0;
+}
+
+/**
+ * @brief Records a slow call in the ring buffer
+ *
+ * Must be called before the stream is closed, since the script mix is
+ * computed from its UTF-16 text.
+ *
+ * @param stream The stream of the call
+ * @param flags FTS5_TOKENIZE_* flags of the call
+ * @param token_count Tokens that are not colocated
+ * @param longest_token Longest normalized token in bytes
+ * @param total_ns Wall time of the call in nanoseconds
+ * @param stage_times Wall time per stage
+ */
+void icu_slow_log_record(const IcuTokenStream* stream, int flags, int token_count,
+                         int longest_token, sqlite3_int64 total_ns,
+                         const IcuStageTimes* stage_times) {
+    IcuSlowDocument entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.flags = flags;
+    entry.bytes = stream->text_length;
+    entry.tokens = token_count;
+    entry.longest_token = longest_token;
+    if (stream->degraded) {
+        entry.degraded_bytes =
+          stream->text_length - stream->scratch.byte_offset_map[stream->degraded_start];
+    }
+    entry.total_ns = total_ns;
+    entry.stage_times = *stage_times;
+    entry.hash = document_hash(stream->text, stream->text_length);
+    describe_scripts(stream->scratch.utf16_text_buffer, stream->utf16_text_length, entry.scripts,
+                     sizeof(entry.scripts));
+
+    sqlite3_vfs* vfs = sqlite3_vfs_find(NULL);
+    sqlite3_int64 julian_ms = 0;
+    if (vfs && vfs->iVersion >= 2 && vfs->xCurrentTimeInt64 &&
+        vfs->xCurrentTimeInt64(vfs, &julian_ms) == SQLITE_OK) {
+        entry.time = (double)(julian_ms - ICU_JULIAN_DAY_MS_AT_UNIX_EPOCH) / 1000.0;
+    }
+
+    sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP3);
+    sqlite3_mutex_enter(mutex);
+    entry.sequence = ++slow_log_count;
+    slow_log[(entry.sequence - 1) % FTS5_ICU_SLOW_LOG_SIZE] = entry;
+    sqlite3_mutex_leave(mutex);
+}
+
+/**
+ * @brief Counts a call that finished on the degraded path
+ *
+ * @param bytes Bytes of the text left to the degraded path
+ */
+void icu_slow_log_note_degraded(int bytes) {
+    sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP3);
+    sqlite3_mutex_enter(mutex);
+    degraded_calls++;
+    degraded_bytes += bytes;
+    sqlite3_mutex_leave(mutex);
+}
+
+// ========================================================================
+// === VIRTUAL TABLE ======================================================
+// ========================================================================
+
+/** Column numbers of the icu_slow_documents virtual table */
+enum {
+    ICU_SLOW_COLUMN_TIME = 0,
+    ICU_SLOW_COLUMN_KIND,
+    ICU_SLOW_COLUMN_BYTES,
+    ICU_SLOW_COLUMN_TOKENS,
+    ICU_SLOW_COLUMN_LONGEST_TOKEN,
+    ICU_SLOW_COLUMN_DEGRADED_BYTES,
+    ICU_SLOW_COLUMN_TOTAL_US,
+    ICU_SLOW_COLUMN_CONVERT_US,
+    ICU_SLOW_COLUMN_BREAK_US,
+    ICU_SLOW_COLUMN_TRANSLITERATE_US,
+    ICU_SLOW_COLUMN_SCRIPTS,
+    ICU_SLOW_COLUMN_HASH
+};
+
+/** Cursor over a snapshot of the ring buffer, oldest call first */
+typedef struct IcuSlowCursor {
+    sqlite3_vtab_cursor base;  /**< Base class, must be first */
+    IcuSlowDocument* entries;  /**< Copy of the ring buffer */
+    int entry_count;           /**< Calls in entries */
+    int index;                 /**< Current call */
+} IcuSlowCursor;
+
+static int slowConnect(sqlite3* db, void* pAux, int argc, const char* const* argv,
+                       sqlite3_vtab** ppVtab, char** pzErr) {
+    UNUSED_PARAMETER(pAux);
+    UNUSED_PARAMETER(argc);
+    UNUSED_PARAMETER(argv);
+    UNUSED_PARAMETER(pzErr);
+
+    int rc = sqlite3_declare_vtab(db, "CREATE TABLE x(time, kind, bytes, tokens, longest_token, "
+                                      "degraded_bytes, total_us, convert_us, break_us, "
+                                      "transliterate_us, scripts, hash)");
+    if (rc != SQLITE_OK)
+        return rc;
+
+    sqlite3_vtab* vtab = (sqlite3_vtab*)sqlite3_malloc(sizeof(sqlite3_vtab));
+    if (!vtab)
+        return SQLITE_NOMEM;
+    memset(vtab, 0, sizeof(sqlite3_vtab));
+    sqlite3_vtab_config(db, SQLITE_VTAB_DIRECTONLY);
+
+    *ppVtab = vtab;
+    return SQLITE_OK;
+}
+
+static int slowDisconnect(sqlite3_vtab* pVtab) {
+    sqlite3_free(pVtab);
+    return SQLITE_OK;
+}
+
+static int slowBestIndex(sqlite3_vtab* pVtab, sqlite3_index_info* pInfo) {
+    UNUSED_PARAMETER(pVtab);
+    pInfo->estimatedCost = FTS5_ICU_SLOW_LOG_SIZE;
+    pInfo->estimatedRows = FTS5_ICU_SLOW_LOG_SIZE;
+    return SQLITE_OK;
+}
+
+static int slowOpen(sqlite3_vtab* pVtab, sqlite3_vtab_cursor** ppCursor) {
+    UNUSED_PARAMETER(pVtab);
+    IcuSlowCursor* cursor = (IcuSlowCursor*)sqlite3_malloc(sizeof(IcuSlowCursor));
+    if (!cursor)
+        return SQLITE_NOMEM;
+    memset(cursor, 0, sizeof(IcuSlowCursor));
+    *ppCursor = &cursor->base;
+    return SQLITE_OK;
+}
+
+static int slowClose(sqlite3_vtab_cursor* pCursor) {
+    IcuSlowCursor* cursor = (IcuSlowCursor*)pCursor;
+    sqlite3_free(cursor->entries);
+    sqlite3_free(cursor);
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Copies the ring buffer, so that calls logged during the scan do not
+ *        overwrite rows being read
+ */
+static int slowFilter(sqlite3_vtab_cursor* pCursor, int idxNum, const char* idxStr, int argc,
+                      sqlite3_value** argv) {
+    UNUSED_PARAMETER(idxNum);
+    UNUSED_PARAMETER(idxStr);
+    UNUSED_PARAMETER(argc);
+    UNUSED_PARAMETER(argv);
+    IcuSlowCursor* cursor = (IcuSlowCursor*)pCursor;
+
+    sqlite3_free(cursor->entries);
+    cursor->entries = (IcuSlowDocument*)sqlite3_malloc64(sizeof(slow_log));
+    cursor->entry_count = 0;
+    cursor->index = 0;
+    if (!cursor->entries)
+        return SQLITE_NOMEM;
+
+    sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP3);
+    sqlite3_mutex_enter(mutex);
+    sqlite3_int64 first = slow_log_count > FTS5_ICU_SLOW_LOG_SIZE
+                            ? slow_log_count - FTS5_ICU_SLOW_LOG_SIZE
+                            : 0;
+    for (sqlite3_int64 sequence = first; sequence < slow_log_count; sequence++) {
+        cursor->entries[cursor->entry_count++] = slow_log[sequence % FTS5_ICU_SLOW_LOG_SIZE];
+    }
+    sqlite3_mutex_leave(mutex);
+    return SQLITE_OK;
+}
+
+static int slowNext(sqlite3_vtab_cursor* pCursor) {
+    ((IcuSlowCursor*)pCursor)->index++;
+    return SQLITE_OK;
+}
+
+static int slowEof(sqlite3_vtab_cursor* pCursor) {
+    IcuSlowCursor* cursor = (IcuSlowCursor*)pCursor;
+    return cursor->index >= cursor->entry_count;
+}
+
+static int slowColumn(sqlite3_vtab_cursor* pCursor, sqlite3_context* context, int column) {
+    IcuSlowCursor* cursor = (IcuSlowCursor*)pCursor;
+    const IcuSlowDocument* entry = &cursor->entries[cursor->index];
+
+    switch (column) {
+        case ICU_SLOW_COLUMN_TIME:
+            sqlite3_result_double(context, entry->time);
+            break;
+        case ICU_SLOW_COLUMN_KIND:
+            if (entry->flags & FTS5_TOKENIZE_QUERY) {
+                sqlite3_result_text(context, "query", -1, SQLITE_STATIC);
+            } else if (entry->flags & FTS5_TOKENIZE_AUX) {
+                sqlite3_result_text(context, "aux", -1, SQLITE_STATIC);
+            } else {
+                sqlite3_result_text(context, "document", -1, SQLITE_STATIC);
+            }
+            break;
+        case ICU_SLOW_COLUMN_BYTES:
+            sqlite3_result_int(context, entry->bytes);
+            break;
+        case ICU_SLOW_COLUMN_TOKENS:
+            sqlite3_result_int(context, entry->tokens);
+            break;
+        case ICU_SLOW_COLUMN_LONGEST_TOKEN:
+            sqlite3_result_int(context, entry->longest_token);
+            break;
+        case ICU_SLOW_COLUMN_DEGRADED_BYTES:
+            sqlite3_result_int(context, entry->degraded_bytes);
+            break;
+        case ICU_SLOW_COLUMN_TOTAL_US:
+            sqlite3_result_int64(context, entry->total_ns / 1000);
+            break;
+        case ICU_SLOW_COLUMN_CONVERT_US:
+        case ICU_SLOW_COLUMN_BREAK_US:
+        case ICU_SLOW_COLUMN_TRANSLITERATE_US:
+            sqlite3_result_int64(
+              context,
+              entry->stage_times.stage_ns[column - ICU_SLOW_COLUMN_CONVERT_US + ICU_STAGE_CONVERT] /
+                1000);
+            break;
+        case ICU_SLOW_COLUMN_SCRIPTS:
+            sqlite3_result_text(context, entry->scripts, -1, SQLITE_TRANSIENT);
+            break;
+        case ICU_SLOW_COLUMN_HASH: {
+            char hash[17];
+            sqlite3_snprintf(sizeof(hash), hash, "%016llx", entry->hash);
+            sqlite3_result_text(context, hash, 16, SQLITE_TRANSIENT);
+            break;
+        }
+        default:
+            break;
+    }
+    return SQLITE_OK;
+}
+
+static int slowRowid(sqlite3_vtab_cursor* pCursor, sqlite3_int64* pRowid) {
+    IcuSlowCursor* cursor = (IcuSlowCursor*)pCursor;
+    *pRowid = cursor->entries[cursor->index].sequence;
+    return SQLITE_OK;
+}
+
+// ========================================================================
+// === REGISTRATION =======================================================
+// ========================================================================
+
+/**
+ * @brief SQL function icu_document_hash(text): the hash the log reports
+ *
+ * Finds logged documents, e.g.
+ *   SELECT rowid FROM docs WHERE icu_document_hash(body) = '<hash>'
+ */
+static void icu_document_hash_func(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    UNUSED_PARAMETER(argc);
+    if (sqlite3_value_type(argv[0]) == SQLITE_NULL)
+        return;
+
+    const char* text = (const char*)sqlite3_value_text(argv[0]);
+    int length = sqlite3_value_bytes(argv[0]);
+    if (!text) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    char hash[17];
+    sqlite3_snprintf(sizeof(hash), hash, "%016llx", document_hash(text, length));
+    sqlite3_result_text(context, hash, 16, SQLITE_TRANSIENT);
+}
+
+/**
+ * @brief SQL function icu_budget_stats(): calls that spent their budget
+ *
+ * Returns a JSON object with the number of calls that finished on the
+ * degraded path and the bytes they tokenized on it since load.
+ */
+static void icu_budget_stats_func(sqlite3_context* context, int argc, sqlite3_value** argv) {
+    UNUSED_PARAMETER(argc);
+    UNUSED_PARAMETER(argv);
+
+    sqlite3_mutex* mutex = sqlite3_mutex_alloc(SQLITE_MUTEX_STATIC_APP3);
+    sqlite3_mutex_enter(mutex);
+    sqlite3_int64 calls = degraded_calls;
+    sqlite3_int64 bytes = degraded_bytes;
+    sqlite3_mutex_leave(mutex);
+
+    char* json = sqlite3_mprintf("{\"degraded_calls\":%lld,\"degraded_bytes\":%lld}", calls,
+                                 bytes);
+    if (!json) {
+        sqlite3_result_error_nomem(context);
+        return;
+    }
+    sqlite3_result_text(context, json, -1, sqlite3_free);
+}
+
+static sqlite3_module icu_slow_documents_module = {
+  .iVersion = 0,
+  .xCreate = NULL,  // Eponymous-only
+  .xConnect = slowConnect,
+  .xBestIndex = slowBestIndex,
+  .xDisconnect = slowDisconnect,
+  .xDestroy = slowDisconnect,
+  .xOpen = slowOpen,
+  .xClose = slowClose,
+  .xFilter = slowFilter,
+  .xNext = slowNext,
+  .xEof = slowEof,
+  .xColumn = slowColumn,
+  .xRowid = slowRowid,
+};
+
+/**
+ * @brief Registers icu_slow_documents, icu_document_hash() and icu_budget_stats()
+ *
+ * @param db The database connection
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+int icu_register_slow_log_module(sqlite3* db) {
+    int rc = sqlite3_create_module(db, "icu_slow_documents", &icu_slow_documents_module, NULL);
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, "icu_document_hash", 1,
+                                     SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS, NULL,
+                                     icu_document_hash_func, NULL, NULL);
+    }
+    if (rc == SQLITE_OK) {
+        rc = sqlite3_create_function(db, "icu_budget_stats", 0, SQLITE_UTF8, NULL,
+                                     icu_budget_stats_func, NULL, NULL);
+    }
+    return rc;
+}
@@ -0,0 +1,339 @@
+/**
+ * @file fts5_icu_tokens.c
+ * @brief icu_tokens() table-valued function for inspecting tokenizer output
+ *
+ * SELECT token, start, "end", rule_status, raw_token FROM icu_tokens(text [, locale])
+ *
+ * Rows are produced one at a time by stepping the same IcuTokenStream that
+ * icuTokenize() uses, so the token list is never materialized and the output
+ * is exactly what FTS5 would index. The optional locale argument replaces the
+ * break iterator locale for that query, which makes it easy to compare the
+ * segmentation of different locales on the same text.
+ */
+
+#include "fts5_icu.h"
+
+SQLITE_EXTENSION_INIT3
+
+/** Column numbers of the icu_tokens virtual table */
+enum {
+    ICU_TOKENS_COLUMN_TOKEN = 0,
+    ICU_TOKENS_COLUMN_START,
+    ICU_TOKENS_COLUMN_END,
+    ICU_TOKENS_COLUMN_RULE_STATUS,
+    ICU_TOKENS_COLUMN_RAW_TOKEN,
+    ICU_TOKENS_COLUMN_TEXT,   /* HIDDEN: document argument */
+    ICU_TOKENS_COLUMN_LOCALE  /* HIDDEN: optional locale argument */
+};
+
+/** idxNum bits describing which arguments xFilter receives */
+#define ICU_TOKENS_HAS_TEXT 0x01
+#define ICU_TOKENS_HAS_LOCALE 0x02
+
+/** Virtual table instance; one per connection */
+typedef struct IcuTokensVtab {
+    sqlite3_vtab base;         /**< Base class, must be first */
+    IcuTokenizerV2* tokenizer; /**< Shared tokenizer, created on first use */
+    int tokenizer_in_use;      /**< Set while a cursor is using the shared tokenizer */
+} IcuTokensVtab;
+
+/** Cursor over the tokens of one document */
+typedef struct IcuTokensCursor {
+    sqlite3_vtab_cursor base;  /**< Base class, must be first */
+    IcuTokenizerV2* tokenizer; /**< Tokenizer used by this cursor */
+    int owns_tokenizer;        /**< Set if tokenizer is a private clone */
+    IcuTokenStream stream;     /**< Stream over the document */
+    char* text;                /**< Copy of the document argument */
+    int text_length;           /**< Length of the document in bytes */
+    char* locale;              /**< Copy of the locale argument, or NULL */
+    sqlite3_int64 rowid;       /**< Number of the current token */
+    int eof;                   /**< Set once the stream is exhausted */
+} IcuTokensCursor;
+
+// ========================================================================
+// === VIRTUAL TABLE METHODS ==============================================
+// ========================================================================
+
+static int tokensConnect(sqlite3* db, void* pAux, int argc, const char* const* argv,
+                         sqlite3_vtab** ppVtab, char** pzErr) {
+    UNUSED_PARAMETER(pAux);
+    UNUSED_PARAMETER(argc);
+    UNUSED_PARAMETER(argv);
+    UNUSED_PARAMETER(pzErr);
+
+    int rc = sqlite3_declare_vtab(db, "CREATE TABLE x(token, start, \"end\", rule_status, "
+                                      "raw_token, text HIDDEN, locale HIDDEN)");
+    if (rc != SQLITE_OK)
+        return rc;
+
+    IcuTokensVtab* vtab = (IcuTokensVtab*)sqlite3_malloc(sizeof(IcuTokensVtab));
+    if (!vtab)
+        return SQLITE_NOMEM;
+    memset(vtab, 0, sizeof(IcuTokensVtab));
+    sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+
+    *ppVtab = &vtab->base;
+    return SQLITE_OK;
+}
+
+static int tokensDisconnect(sqlite3_vtab* pVtab) {
+    IcuTokensVtab* vtab = (IcuTokensVtab*)pVtab;
+    if (vtab->tokenizer)
+        icuDelete((Fts5Tokenizer*)vtab->tokenizer);
+    sqlite3_free(vtab);
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Plans a query; the text argument is required, the locale optional
+ *
+ * Like json_each(), an unusable equality constraint on a hidden argument
+ * column makes this plan unusable so that SQLite picks a join order in which
+ * the argument is known.
+ */
+static int tokensBestIndex(sqlite3_vtab* pVtab, sqlite3_index_info* pInfo) {
+    UNUSED_PARAMETER(pVtab);
+
+    int argument_index[2] = {-1, -1};
+    int unusable = 0;
+    for (int i = 0; i < pInfo->nConstraint; i++) {
+        const struct sqlite3_index_constraint* constraint = &pInfo->aConstraint[i];
+        if (constraint->iColumn < ICU_TOKENS_COLUMN_TEXT ||
+            constraint->op != SQLITE_INDEX_CONSTRAINT_EQ) {
+            continue;
+        }
+        if (!constraint->usable) {
+            unusable = 1;
+            continue;
+        }
+        argument_index[constraint->iColumn - ICU_TOKENS_COLUMN_TEXT] = i;
+    }
+    if (unusable && argument_index[0] < 0)
+        return SQLITE_CONSTRAINT;
+
+    int argv_index = 1;
+    pInfo->idxNum = 0;
+    if (argument_index[0] >= 0) {
+        pInfo->aConstraintUsage[argument_index[0]].argvIndex = argv_index++;
+        pInfo->aConstraintUsage[argument_index[0]].omit = 1;
+        pInfo->idxNum |= ICU_TOKENS_HAS_TEXT;
+        if (argument_index[1] >= 0) {
+            pInfo->aConstraintUsage[argument_index[1]].argvIndex = argv_index++;
+            pInfo->aConstraintUsage[argument_index[1]].omit = 1;
+            pInfo->idxNum |= ICU_TOKENS_HAS_LOCALE;
+        }
+        pInfo->estimatedCost = 10.0;
+        pInfo->estimatedRows = 100;
+    } else {
+        pInfo->estimatedCost = 1e12;  // No document: empty result
+    }
+    return SQLITE_OK;
+}
+
+static int tokensOpen(sqlite3_vtab* pVtab, sqlite3_vtab_cursor** ppCursor) {
+    UNUSED_PARAMETER(pVtab);
+    IcuTokensCursor* cursor = (IcuTokensCursor*)sqlite3_malloc(sizeof(IcuTokensCursor));
+    if (!cursor)
+        return SQLITE_NOMEM;
+    memset(cursor, 0, sizeof(IcuTokensCursor));
+    cursor->eof = 1;
+    *ppCursor = &cursor->base;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Closes the stream and gives back the tokenizer of a cursor
+ *
+ * @param cursor The cursor to reset
+ */
+static void tokens_cursor_reset(IcuTokensCursor* cursor) {
+    IcuTokensVtab* vtab = (IcuTokensVtab*)cursor->base.pVtab;
+
+    icu_token_stream_close(&cursor->stream);
+    if (cursor->owns_tokenizer) {
+        icuDelete((Fts5Tokenizer*)cursor->tokenizer);
+    } else if (cursor->tokenizer) {
+        vtab->tokenizer_in_use = 0;
+    }
+    sqlite3_free(cursor->text);
+    sqlite3_free(cursor->locale);
+    cursor->tokenizer = NULL;
+    cursor->owns_tokenizer = 0;
+    cursor->text = NULL;
+    cursor->locale = NULL;
+    cursor->eof = 1;
+}
+
+static int tokensClose(sqlite3_vtab_cursor* pCursor) {
+    IcuTokensCursor* cursor = (IcuTokensCursor*)pCursor;
+    tokens_cursor_reset(cursor);
+    sqlite3_free(cursor);
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Selects the tokenizer a cursor will use
+ *
+ * The connection's shared tokenizer is used when it is free and no locale
+ * override was given; otherwise the cursor gets a private clone, with its
+ * break iterator reopened for the requested locale if necessary.
+ *
+ * @param cursor The cursor
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+static int tokens_cursor_acquire_tokenizer(IcuTokensCursor* cursor) {
+    IcuTokensVtab* vtab = (IcuTokensVtab*)cursor->base.pVtab;
+
+    if (!vtab->tokenizer) {
+        Fts5Tokenizer* tokenizer = NULL;
+        int rc = icuCreate(NULL, NULL, 0, &tokenizer);
+        if (rc != SQLITE_OK)
+            return rc;
+        vtab->tokenizer = (IcuTokenizerV2*)tokenizer;
+    }
+
+    int override_locale = cursor->locale && strcmp(cursor->locale, vtab->tokenizer->config.locale);
+    if (!override_locale && !vtab->tokenizer_in_use) {
+        cursor->tokenizer = vtab->tokenizer;
+        vtab->tokenizer_in_use = 1;
+        return SQLITE_OK;
+    }
+
+    int rc = icu_tokenizer_clone(vtab->tokenizer, &cursor->tokenizer);
+    if (rc != SQLITE_OK)
+        return rc;
+    cursor->owns_tokenizer = 1;
+
+    if (override_locale) {
+        UErrorCode status = U_ZERO_ERROR;
+        UBreakIterator* break_iterator = ubrk_open(UBRK_WORD, cursor->locale, NULL, 0, &status);
+        if (U_FAILURE(status)) {
+            ubrk_close(break_iterator);
+            return SQLITE_ERROR;
+        }
+        ubrk_close(cursor->tokenizer->pBreakIterator);
+        cursor->tokenizer->pBreakIterator = break_iterator;
+    }
+    return SQLITE_OK;
+}
+
+static int tokensNext(sqlite3_vtab_cursor* pCursor) {
+    IcuTokensCursor* cursor = (IcuTokensCursor*)pCursor;
+    int rc = icu_token_stream_next(&cursor->stream);
+    if (rc == SQLITE_ROW) {
+        cursor->rowid++;
+        return SQLITE_OK;
+    }
+    cursor->eof = 1;
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+static int tokensFilter(sqlite3_vtab_cursor* pCursor, int idxNum, const char* idxStr, int argc,
+                        sqlite3_value** argv) {
+    UNUSED_PARAMETER(idxStr);
+    UNUSED_PARAMETER(argc);
+    IcuTokensCursor* cursor = (IcuTokensCursor*)pCursor;
+
+    tokens_cursor_reset(cursor);
+    cursor->rowid = 0;
+    if (!(idxNum & ICU_TOKENS_HAS_TEXT) || sqlite3_value_type(argv[0]) == SQLITE_NULL)
+        return SQLITE_OK;
+
+    // The arguments only live for the duration of xFilter, so keep copies
+    cursor->text_length = sqlite3_value_bytes(argv[0]);
+    const unsigned char* text = sqlite3_value_text(argv[0]);
+    cursor->text = (char*)sqlite3_malloc(cursor->text_length + 1);
+    if (!text || !cursor->text)
+        return SQLITE_NOMEM;
+    memcpy(cursor->text, text, cursor->text_length + 1);
+    if ((idxNum & ICU_TOKENS_HAS_LOCALE) && sqlite3_value_type(argv[1]) != SQLITE_NULL) {
+        cursor->locale = sqlite3_mprintf("%s", sqlite3_value_text(argv[1]));
+        if (!cursor->locale)
+            return SQLITE_NOMEM;
+    }
+
+    int rc = tokens_cursor_acquire_tokenizer(cursor);
+    if (rc == SQLITE_OK) {
+        rc = icu_token_stream_open(&cursor->stream, cursor->tokenizer, cursor->text,
+                                   cursor->text_length);
+    }
+    if (rc != SQLITE_OK)
+        return rc;
+
+    cursor->eof = 0;
+    return tokensNext(pCursor);
+}
+
+static int tokensEof(sqlite3_vtab_cursor* pCursor) {
+    return ((IcuTokensCursor*)pCursor)->eof;
+}
+
+static int tokensColumn(sqlite3_vtab_cursor* pCursor, sqlite3_context* context, int column) {
+    IcuTokensCursor* cursor = (IcuTokensCursor*)pCursor;
+    const IcuTokenStream* stream = &cursor->stream;
+
+    switch (column) {
+        case ICU_TOKENS_COLUMN_TOKEN:
+            sqlite3_result_text(context, stream->token, stream->token_length, SQLITE_TRANSIENT);
+            break;
+        case ICU_TOKENS_COLUMN_START:
+            sqlite3_result_int(context, stream->token_start_byte);
+            break;
+        case ICU_TOKENS_COLUMN_END:
+            sqlite3_result_int(context, stream->token_end_byte);
+            break;
+        case ICU_TOKENS_COLUMN_RULE_STATUS:
+            sqlite3_result_int(context, stream->token_rule_status);
+            break;
+        case ICU_TOKENS_COLUMN_RAW_TOKEN:
+            sqlite3_result_text(context, cursor->text + stream->token_start_byte,
+                                stream->token_end_byte - stream->token_start_byte,
+                                SQLITE_TRANSIENT);
+            break;
+        case ICU_TOKENS_COLUMN_TEXT:
+            sqlite3_result_text(context, cursor->text, cursor->text_length, SQLITE_TRANSIENT);
+            break;
+        case ICU_TOKENS_COLUMN_LOCALE:
+            if (cursor->locale)
+                sqlite3_result_text(context, cursor->locale, -1, SQLITE_TRANSIENT);
+            break;
+        default:
+            break;
+    }
+    return SQLITE_OK;
+}
+
+static int tokensRowid(sqlite3_vtab_cursor* pCursor, sqlite3_int64* pRowid) {
+    *pRowid = ((IcuTokensCursor*)pCursor)->rowid;
+    return SQLITE_OK;
+}
+
+// ========================================================================
+// === REGISTRATION =======================================================
+// ========================================================================
+
+static sqlite3_module icu_tokens_module = {
+  .iVersion = 0,
+  .xCreate = NULL,  // Eponymous-only
+  .xConnect = tokensConnect,
+  .xBestIndex = tokensBestIndex,
+  .xDisconnect = tokensDisconnect,
+  .xDestroy = tokensDisconnect,
+  .xOpen = tokensOpen,
+  .xClose = tokensClose,
+  .xFilter = tokensFilter,
+  .xNext = tokensNext,
+  .xEof = tokensEof,
+  .xColumn = tokensColumn,
+  .xRowid = tokensRowid,
+};
+
+/**
+ * @brief Registers the icu_tokens eponymous virtual table
+ *
+ * @param db The database connection
+ * @return SQLITE_OK on success, appropriate error code on failure
+ */
+int icu_register_tokens_module(sqlite3* db) {
+    return sqlite3_create_module(db, "icu_tokens", &icu_tokens_module, NULL);
+}
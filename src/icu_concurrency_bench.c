@@ -0,0 +1,538 @@
+/**
+ * @file icu_concurrency_bench.c
+ * @brief Multi-connection scaling benchmark for the ICU tokenizer
+ *
+ * Usage: icu_concurrency_bench [options] <library>
+ *
+ *   -t 1,2,4,8    thread counts to measure (default 1,2,4,... up to the CPU count)
+ *   -c N          tables created and dropped per thread (default 50)
+ *   -d N          documents inserted per thread (default 5000)
+ *   -q N          MATCH queries per thread (default 2000)
+ *   -o OPTIONS    tokenizer arguments appended to the tokenizer name
+ *   -n NAME       tokenizer name (default derived from the library file name)
+ *   -p PHASE      run only "create", "insert" or "match" (the others are
+ *                 skipped or, for "match", run untimed to fill the table)
+ *   -r            print CSV instead of a table
+ *
+ * Every thread opens its own in-memory connection, loads the extension and
+ * works on its own FTS5 table, which is how applications with one connection
+ * per worker use the tokenizer. The threads run each phase together, started
+ * by a barrier, so throughput that stops growing with the thread count points
+ * at shared state: ICU's internal mutexes (the transliterator registry in
+ * utrans_openU(), lazily loaded break engines), the allocator, or locks in
+ * the extension itself.
+ *
+ * The phases are:
+ *   create  CREATE VIRTUAL TABLE/DROP TABLE pairs, i.e. tokenizer xCreate
+ *   insert  documents inserted in one transaction per thread
+ *   match   single-term queries, each timed for the latency percentiles
+ *
+ * Threads are named "icu-bench-<n>" and the program is built with frame
+ * pointers, so "perf record -g" attributes samples per thread with usable
+ * call stacks; scripts/profile_concurrency.sh wraps this.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sqlite3.h"
+
+/** Longest generated document in bytes */
+#define BENCH_DOCUMENT_SIZE 1024
+
+/** Words per generated document */
+#define BENCH_WORDS_PER_DOCUMENT 24
+
+/** Most thread counts accepted by -t */
+#define BENCH_MAX_RUNS 32
+
+/** Benchmark settings from the command line */
+typedef struct BenchOptions {
+    const char* library;          /**< Extension to load */
+    char tokenizer[256];          /**< Tokenizer name and arguments */
+    int thread_counts[BENCH_MAX_RUNS]; /**< Thread counts to measure */
+    int run_count;                /**< Entries in thread_counts */
+    int creates;                  /**< Tables created per thread */
+    int documents;                /**< Documents inserted per thread */
+    int queries;                  /**< Queries per thread */
+    const char* phase;            /**< Only phase to time, or NULL for all */
+    int csv;                      /**< Print CSV */
+} BenchOptions;
+
+/** Phases every thread runs in lockstep */
+typedef enum BenchPhase { PHASE_CREATE, PHASE_INSERT, PHASE_MATCH, PHASE_COUNT } BenchPhase;
+
+static const char* const phase_names[PHASE_COUNT] = {"create", "insert", "match"};
+
+/** Reusable barrier; pthread_barrier_t is not available everywhere */
+typedef struct BenchBarrier {
+    pthread_mutex_t mutex;
+    pthread_cond_t released;
+    int parties;    /**< Threads that meet at the barrier */
+    int waiting;    /**< Threads currently waiting */
+    int generation; /**< Incremented on every release */
+} BenchBarrier;
+
+/** State shared by the threads of one run */
+typedef struct BenchRun {
+    const BenchOptions* options;
+    int thread_count;
+    BenchBarrier barrier;
+    double phase_start[PHASE_COUNT]; /**< Wall clock when the phase started */
+    double phase_end[PHASE_COUNT];   /**< Wall clock when the last thread finished */
+    double* latencies;               /**< Query latencies of all threads in microseconds */
+    int failed;                      /**< Set by a thread that hit an error */
+} BenchRun;
+
+/** Arguments of one worker thread */
+typedef struct BenchThread {
+    BenchRun* run;
+    int index;
+    pthread_t handle;
+} BenchThread;
+
+// ========================================================================
+// === HELPERS ============================================================
+// ========================================================================
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void barrier_init(BenchBarrier* barrier, int parties) {
+    pthread_mutex_init(&barrier->mutex, NULL);
+    pthread_cond_init(&barrier->released, NULL);
+    barrier->parties = parties;
+    barrier->waiting = 0;
+    barrier->generation = 0;
+}
+
+static void barrier_destroy(BenchBarrier* barrier) {
+    pthread_cond_destroy(&barrier->released);
+    pthread_mutex_destroy(&barrier->mutex);
+}
+
+/**
+ * @brief Waits until every party has arrived
+ *
+ * @param barrier The barrier
+ * @return Non-zero in exactly one of the released threads
+ */
+static int barrier_wait(BenchBarrier* barrier) {
+    pthread_mutex_lock(&barrier->mutex);
+    int generation = barrier->generation;
+    int last = (++barrier->waiting == barrier->parties);
+    if (last) {
+        barrier->waiting = 0;
+        barrier->generation++;
+        pthread_cond_broadcast(&barrier->released);
+    } else {
+        while (generation == barrier->generation) {
+            pthread_cond_wait(&barrier->released, &barrier->mutex);
+        }
+    }
+    pthread_mutex_unlock(&barrier->mutex);
+    return last;
+}
+
+/**
+ * @brief Returns the next value of a per-thread pseudo-random generator
+ *
+ * @param state Generator state
+ * @return A 32-bit pseudo-random value
+ */
+static uint32_t next_random(uint64_t* state) {
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (uint32_t)(*state >> 33);
+}
+
+/**
+ * @brief Writes a pseudo-random mixed-script word
+ *
+ * @param state Generator state
+ * @param out Output buffer with room for 64 bytes
+ * @return Length of the word in bytes
+ */
+static int generate_word(uint64_t* state, char* out) {
+    static const char* const syllables[] = {
+      "ka", "lo", "mi", "ne", "ra", "su", "te", "vo", "bri", "dan", "fel", "gor", "hum", "jas",
+      "pel", "tor", "Кра", "Мо", "Пе", "Сви", "Ша", "Éco", "Über", "Ñan", "Στα", "Λο"};
+    static const int syllable_count = sizeof(syllables) / sizeof(syllables[0]);
+
+    // A Zipf-like skew keeps some words frequent, as in real text
+    uint32_t seed = next_random(state) % 4096;
+    seed = (seed * seed) / 4096;
+    int length = 0;
+    for (int i = 0; i < 3; i++) {
+        const char* syllable = syllables[seed % syllable_count];
+        seed /= syllable_count;
+        size_t n = strlen(syllable);
+        memcpy(out + length, syllable, n);
+        length += (int)n;
+    }
+    out[length] = 0;
+    return length;
+}
+
+/**
+ * @brief Writes a pseudo-random document
+ *
+ * @param state Generator state
+ * @param out Output buffer of BENCH_DOCUMENT_SIZE bytes
+ * @return Length of the document in bytes
+ */
+static int generate_document(uint64_t* state, char* out) {
+    int length = 0;
+    for (int i = 0; i < BENCH_WORDS_PER_DOCUMENT; i++) {
+        if (i > 0)
+            out[length++] = (i % 8 == 0) ? '.' : ' ';
+        length += generate_word(state, out + length);
+    }
+    out[length] = 0;
+    return length;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Executes SQL and reports errors on stderr
+ *
+ * @param db The connection
+ * @param sql The statements
+ * @return SQLITE_OK or the error code
+ */
+static int exec_sql(sqlite3* db, const char* sql) {
+    char* error = NULL;
+    int rc = sqlite3_exec(db, sql, NULL, NULL, &error);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", sql, error ? error : sqlite3_errstr(rc));
+        sqlite3_free(error);
+    }
+    return rc;
+}
+
+// ========================================================================
+// === PHASES =============================================================
+// ========================================================================
+
+static int run_create_phase(sqlite3* db, const BenchOptions* options) {
+    char* create = sqlite3_mprintf(
+      "CREATE VIRTUAL TABLE scratch USING fts5(body, tokenize=%Q)", options->tokenizer);
+    int rc = create ? SQLITE_OK : SQLITE_NOMEM;
+    for (int i = 0; i < options->creates && rc == SQLITE_OK; i++) {
+        rc = exec_sql(db, create);
+        if (rc == SQLITE_OK)
+            rc = exec_sql(db, "DROP TABLE scratch");
+    }
+    sqlite3_free(create);
+    return rc;
+}
+
+static int run_insert_phase(sqlite3* db, const BenchOptions* options, uint64_t* state) {
+    sqlite3_stmt* insert = NULL;
+    int rc = exec_sql(db, "BEGIN");
+    if (rc == SQLITE_OK)
+        rc = sqlite3_prepare_v2(db, "INSERT INTO documents(body) VALUES (?)", -1, &insert, NULL);
+
+    char document[BENCH_DOCUMENT_SIZE];
+    for (int i = 0; i < options->documents && rc == SQLITE_OK; i++) {
+        int length = generate_document(state, document);
+        sqlite3_bind_text(insert, 1, document, length, SQLITE_STATIC);
+        rc = sqlite3_step(insert) == SQLITE_DONE ? SQLITE_OK : SQLITE_ERROR;
+        sqlite3_reset(insert);
+    }
+    sqlite3_finalize(insert);
+    if (rc == SQLITE_OK)
+        rc = exec_sql(db, "COMMIT");
+    else
+        fprintf(stderr, "insert: %s\n", sqlite3_errmsg(db));
+    return rc;
+}
+
+static int run_match_phase(sqlite3* db, const BenchOptions* options, uint64_t* state,
+                           double* latencies) {
+    sqlite3_stmt* query = NULL;
+    int rc = sqlite3_prepare_v2(db, "SELECT count(*) FROM documents WHERE documents MATCH ?", -1,
+                                &query, NULL);
+    char word[64];
+    for (int i = 0; i < options->queries && rc == SQLITE_OK; i++) {
+        int length = generate_word(state, word);
+        double start = now_seconds();
+        sqlite3_bind_text(query, 1, word, length, SQLITE_STATIC);
+        while ((rc = sqlite3_step(query)) == SQLITE_ROW) {
+        }
+        rc = (rc == SQLITE_DONE) ? SQLITE_OK : rc;
+        sqlite3_reset(query);
+        latencies[i] = (now_seconds() - start) * 1e6;
+    }
+    if (rc != SQLITE_OK)
+        fprintf(stderr, "match: %s\n", sqlite3_errmsg(db));
+    sqlite3_finalize(query);
+    return rc;
+}
+
+/**
+ * @brief Checks whether a phase is timed in this invocation
+ *
+ * @param options Benchmark settings
+ * @param phase The phase
+ * @return Non-zero if the phase runs under the clock
+ */
+static int phase_selected(const BenchOptions* options, BenchPhase phase) {
+    return !options->phase || strcmp(options->phase, phase_names[phase]) == 0;
+}
+
+/**
+ * @brief Worker thread: runs every phase in lockstep with the other threads
+ */
+static void* bench_thread(void* argument) {
+    BenchThread* thread = (BenchThread*)argument;
+    BenchRun* run = thread->run;
+    const BenchOptions* options = run->options;
+    uint64_t state = 0x9E3779B97F4A7C15ULL * (uint64_t)(thread->index + 1);
+
+#ifdef __linux__
+    char name[16];
+    snprintf(name, sizeof(name), "icu-bench-%d", thread->index);
+    pthread_setname_np(pthread_self(), name);
+#endif
+
+    sqlite3* db = NULL;
+    char* error = NULL;
+    int rc = sqlite3_open(":memory:", &db);
+    if (rc == SQLITE_OK)
+        rc = sqlite3_enable_load_extension(db, 1);
+    if (rc == SQLITE_OK && sqlite3_load_extension(db, options->library, NULL, &error) != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", options->library, error ? error : "cannot load");
+        sqlite3_free(error);
+        rc = SQLITE_ERROR;
+    }
+    if (rc == SQLITE_OK) {
+        char* create = sqlite3_mprintf(
+          "CREATE VIRTUAL TABLE documents USING fts5(body, tokenize=%Q)", options->tokenizer);
+        rc = create ? exec_sql(db, create) : SQLITE_NOMEM;
+        sqlite3_free(create);
+    }
+    if (rc != SQLITE_OK)
+        run->failed = 1;
+
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        int timed = phase_selected(options, phase);
+        // The match phase always needs the documents
+        int needed = timed || (phase == PHASE_INSERT && phase_selected(options, PHASE_MATCH));
+
+        if (barrier_wait(&run->barrier))
+            run->phase_start[phase] = now_seconds();
+        barrier_wait(&run->barrier);
+
+        if (!run->failed && needed) {
+            if (phase == PHASE_CREATE)
+                rc = run_create_phase(db, options);
+            else if (phase == PHASE_INSERT)
+                rc = run_insert_phase(db, options, &state);
+            else
+                rc = run_match_phase(db, options, &state,
+                                     run->latencies + (size_t)thread->index * options->queries);
+            if (rc != SQLITE_OK)
+                run->failed = 1;
+        }
+
+        if (barrier_wait(&run->barrier))
+            run->phase_end[phase] = now_seconds();
+    }
+
+    sqlite3_close(db);
+    return NULL;
+}
+
+// ========================================================================
+// === DRIVER =============================================================
+// ========================================================================
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s [-t 1,2,4] [-c creates] [-d documents] [-q queries] [-o options]\n"
+            "          [-n name] [-p create|insert|match] [-r] <library>\n",
+            program);
+}
+
+/**
+ * @brief Parses a comma-separated list of thread counts
+ *
+ * @param list The list
+ * @param options Receives the thread counts
+ * @return Non-zero on success
+ */
+static int parse_thread_counts(const char* list, BenchOptions* options) {
+    options->run_count = 0;
+    while (*list) {
+        char* end;
+        long count = strtol(list, &end, 10);
+        if (end == list || count < 1 || count > 1024 || options->run_count == BENCH_MAX_RUNS)
+            return 0;
+        options->thread_counts[options->run_count++] = (int)count;
+        list = (*end == ',') ? end + 1 : end;
+        if (*end && *end != ',')
+            return 0;
+    }
+    return options->run_count > 0;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    memset(&options, 0, sizeof(options));
+    options.creates = 50;
+    options.documents = 5000;
+    options.queries = 2000;
+    const char* name = NULL;
+    const char* arguments = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:c:d:q:o:n:p:r")) != -1) {
+        switch (opt) {
+            case 't':
+                if (!parse_thread_counts(optarg, &options)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'c': options.creates = atoi(optarg); break;
+            case 'd': options.documents = atoi(optarg); break;
+            case 'q': options.queries = atoi(optarg); break;
+            case 'o': arguments = optarg; break;
+            case 'n': name = optarg; break;
+            case 'p': options.phase = optarg; break;
+            case 'r': options.csv = 1; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind != argc - 1 || options.creates < 0 || options.documents < 1 ||
+        options.queries < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (options.phase && strcmp(options.phase, "create") != 0 &&
+        strcmp(options.phase, "insert") != 0 && strcmp(options.phase, "match") != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    options.library = argv[optind];
+
+    // Tokenizer registered by the library: libfts5_icu_ru.so -> icu_ru
+    char derived[64] = "icu";
+    if (!name) {
+        const char* base = strrchr(options.library, '/');
+        base = base ? base + 1 : options.library;
+        const char* suffix = strstr(base, "libfts5_icu");
+        if (suffix) {
+            suffix += strlen("libfts5_icu");
+            size_t n = strcspn(suffix, ".");
+            if (n < sizeof(derived) - 4) {
+                memcpy(derived + 3, suffix, n);
+                derived[3 + n] = 0;
+            }
+        }
+        name = derived;
+    }
+    snprintf(options.tokenizer, sizeof(options.tokenizer), "%s%s%s", name,
+             arguments ? " " : "", arguments ? arguments : "");
+
+    if (options.run_count == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int count = 1; options.run_count < BENCH_MAX_RUNS; count *= 2) {
+            options.thread_counts[options.run_count++] = count;
+            if (count >= cpus)
+                break;
+        }
+    }
+
+    if (options.csv) {
+        printf("threads,creates_per_s,docs_per_s,docs_per_s_per_thread,efficiency,"
+               "queries_per_s,match_p50_us,match_p99_us\n");
+    } else {
+        printf("Library:   %s\nTokenizer: %s\n", options.library, options.tokenizer);
+        printf("Per thread: %d creates, %d documents, %d queries\n\n", options.creates,
+               options.documents, options.queries);
+        printf("%7s %12s %12s %14s %10s %12s %10s %10s\n", "threads", "creates/s", "docs/s",
+               "docs/s/thread", "scaling", "queries/s", "p50 us", "p99 us");
+    }
+
+    double baseline = 0;
+    for (int r = 0; r < options.run_count; r++) {
+        BenchRun run;
+        memset(&run, 0, sizeof(run));
+        run.options = &options;
+        run.thread_count = options.thread_counts[r];
+        run.latencies = (double*)calloc((size_t)run.thread_count * options.queries, sizeof(double));
+        BenchThread* threads = (BenchThread*)calloc(run.thread_count, sizeof(BenchThread));
+        if (!run.latencies || !threads) {
+            fprintf(stderr, "out of memory\n");
+            return 1;
+        }
+        barrier_init(&run.barrier, run.thread_count);
+        for (int i = 0; i < run.thread_count; i++) {
+            threads[i].run = &run;
+            threads[i].index = i;
+            if (pthread_create(&threads[i].handle, NULL, bench_thread, &threads[i]) != 0) {
+                fprintf(stderr, "cannot start thread %d\n", i);
+                return 1;
+            }
+        }
+        for (int i = 0; i < run.thread_count; i++) {
+            pthread_join(threads[i].handle, NULL);
+        }
+        barrier_destroy(&run.barrier);
+        free(threads);
+        if (run.failed) {
+            free(run.latencies);
+            return 1;
+        }
+
+        double seconds[PHASE_COUNT];
+        for (int phase = 0; phase < PHASE_COUNT; phase++) {
+            seconds[phase] = run.phase_end[phase] - run.phase_start[phase];
+        }
+        double creates = phase_selected(&options, PHASE_CREATE) && options.creates > 0
+                           ? (double)run.thread_count * options.creates / seconds[PHASE_CREATE]
+                           : 0;
+        double documents = phase_selected(&options, PHASE_INSERT)
+                             ? (double)run.thread_count * options.documents / seconds[PHASE_INSERT]
+                             : 0;
+        if (r == 0)
+            baseline = documents / run.thread_count;
+        double efficiency = baseline > 0 ? documents / run.thread_count / baseline : 0;
+
+        double queries = 0, p50 = 0, p99 = 0;
+        if (phase_selected(&options, PHASE_MATCH)) {
+            size_t n = (size_t)run.thread_count * options.queries;
+            qsort(run.latencies, n, sizeof(double), compare_doubles);
+            queries = n / seconds[PHASE_MATCH];
+            p50 = run.latencies[n / 2];
+            p99 = run.latencies[n * 99 / 100];
+        }
+        free(run.latencies);
+
+        if (options.csv) {
+            printf("%d,%.1f,%.1f,%.1f,%.3f,%.1f,%.1f,%.1f\n", run.thread_count, creates, documents,
+                   documents / run.thread_count, efficiency, queries, p50, p99);
+        } else {
+            printf("%7d %12.1f %12.0f %14.0f %9.0f%% %12.0f %10.1f %10.1f\n", run.thread_count,
+                   creates, documents, documents / run.thread_count, efficiency * 100, queries,
+                   p50, p99);
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,430 @@
+/**
+ * @file icu_dict_build.c
+ * @brief Builds a user dictionary file for the "dictionary" tokenizer option
+ *
+ * Usage: icu_dict_build <word list> <output file>
+ *
+ * The word list is UTF-8 text with one word per line. Leading and trailing
+ * whitespace is ignored, as are empty lines and lines starting with '#'.
+ * Words are matched against the document text exactly as written, so list
+ * every variant (for example Traditional and Simplified forms) that occurs
+ * in the indexed text.
+ *
+ * The output holds a forward and a backward double-array trie (see
+ * fts5_icu_dict_format.h) that the tokenizer maps read-only.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fts5_icu_dict_format.h"
+
+/** A dictionary word as UTF-8 bytes */
+typedef struct DictKey {
+    unsigned char* bytes; /**< UTF-8 bytes of the word */
+    int length;           /**< Number of bytes */
+} DictKey;
+
+/** Growable double array under construction */
+typedef struct DictBuilder {
+    IcuDictUnit* units; /**< Units; check == -1 marks a free unit */
+    int32_t capacity;   /**< Allocated units */
+    int32_t size;       /**< One past the highest used unit */
+    int32_t first_free; /**< Lowest unit that may still be free */
+} DictBuilder;
+
+// ========================================================================
+// === WORD LIST ==========================================================
+// ========================================================================
+
+/**
+ * @brief Returns the length of the UTF-8 sequence starting at a byte
+ *
+ * @param bytes The text
+ * @param length Bytes available
+ * @return Length of a valid sequence, or 0 if the sequence is malformed
+ */
+static int utf8_sequence_length(const unsigned char* bytes, int length) {
+    int expected;
+    if (bytes[0] < 0x80)
+        return 1;
+    else if (bytes[0] >= 0xC2 && bytes[0] <= 0xDF)
+        expected = 2;
+    else if (bytes[0] >= 0xE0 && bytes[0] <= 0xEF)
+        expected = 3;
+    else if (bytes[0] >= 0xF0 && bytes[0] <= 0xF4)
+        expected = 4;
+    else
+        return 0;
+
+    if (expected > length)
+        return 0;
+    for (int i = 1; i < expected; i++) {
+        if ((bytes[i] & 0xC0) != 0x80)
+            return 0;
+    }
+    return expected;
+}
+
+/**
+ * @brief Checks that a word is well-formed UTF-8
+ *
+ * @param key The word
+ * @return Non-zero if the word is valid
+ */
+static int is_valid_utf8(const DictKey* key) {
+    for (int i = 0; i < key->length;) {
+        int n = utf8_sequence_length(key->bytes + i, key->length - i);
+        if (n == 0)
+            return 0;
+        i += n;
+    }
+    return 1;
+}
+
+/**
+ * @brief Creates a copy of a word with its code points in reverse order
+ *
+ * @param key The word, which must be valid UTF-8
+ * @param[out] reversed Receives the reversed word
+ * @return 0 on success, -1 on allocation failure
+ */
+static int reverse_key(const DictKey* key, DictKey* reversed) {
+    reversed->bytes = (unsigned char*)malloc(key->length > 0 ? key->length : 1);
+    if (!reversed->bytes)
+        return -1;
+    reversed->length = key->length;
+
+    int out = key->length;
+    for (int i = 0; i < key->length;) {
+        int n = utf8_sequence_length(key->bytes + i, key->length - i);
+        out -= n;
+        memcpy(reversed->bytes + out, key->bytes + i, n);
+        i += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Orders words bytewise, with a prefix before its extensions
+ */
+static int compare_keys(const void* a, const void* b) {
+    const DictKey* left = (const DictKey*)a;
+    const DictKey* right = (const DictKey*)b;
+    int shorter = left->length < right->length ? left->length : right->length;
+    int cmp = memcmp(left->bytes, right->bytes, shorter);
+    if (cmp != 0)
+        return cmp;
+    return left->length - right->length;
+}
+
+/**
+ * @brief Sorts words and removes duplicates
+ *
+ * @param keys The words
+ * @param count Number of words
+ * @return Number of distinct words
+ */
+static int sort_unique(DictKey* keys, int count) {
+    if (count == 0)
+        return 0;
+    qsort(keys, count, sizeof(DictKey), compare_keys);
+    int unique = 1;
+    for (int i = 1; i < count; i++) {
+        if (compare_keys(&keys[unique - 1], &keys[i]) == 0) {
+            free(keys[i].bytes);
+        } else {
+            keys[unique++] = keys[i];
+        }
+    }
+    return unique;
+}
+
+/**
+ * @brief Reads a word list
+ *
+ * @param path Path of the word list
+ * @param[out] pKeys Receives the words
+ * @param[out] pCount Receives the number of words
+ * @return 0 on success, -1 on failure
+ */
+static int read_word_list(const char* path, DictKey** pKeys, int* pCount) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Error: cannot open %s\n", path);
+        return -1;
+    }
+
+    DictKey* keys = NULL;
+    int count = 0;
+    int capacity = 0;
+    int line_number = 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), file)) {
+        line_number++;
+        size_t length = strlen(line);
+        if (length == sizeof(line) - 1 && line[length - 1] != '\n') {
+            fprintf(stderr, "Error: line %d of %s is too long\n", line_number, path);
+            fclose(file);
+            return -1;
+        }
+
+        // Trim surrounding whitespace, including a Windows line ending
+        char* start = line;
+        while (*start == ' ' || *start == '\t')
+            start++;
+        char* end = line + length;
+        while (end > start &&
+               (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+            end--;
+        if (end == start || *start == '#')
+            continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            DictKey* grown = (DictKey*)realloc(keys, capacity * sizeof(DictKey));
+            if (!grown) {
+                fprintf(stderr, "Error: out of memory\n");
+                fclose(file);
+                return -1;
+            }
+            keys = grown;
+        }
+
+        DictKey* key = &keys[count];
+        key->length = (int)(end - start);
+        key->bytes = (unsigned char*)malloc(key->length);
+        if (!key->bytes) {
+            fprintf(stderr, "Error: out of memory\n");
+            fclose(file);
+            return -1;
+        }
+        memcpy(key->bytes, start, key->length);
+        if (!is_valid_utf8(key)) {
+            fprintf(stderr, "Warning: skipping line %d of %s (invalid UTF-8)\n", line_number,
+                    path);
+            free(key->bytes);
+            continue;
+        }
+        count++;
+    }
+    fclose(file);
+
+    *pKeys = keys;
+    *pCount = count;
+    return 0;
+}
+
+// ========================================================================
+// === DOUBLE-ARRAY CONSTRUCTION ==========================================
+// ========================================================================
+
+/**
+ * @brief Grows the double array to hold at least a given number of units
+ *
+ * @param builder The builder
+ * @param required Number of units needed
+ * @return 0 on success, -1 on allocation failure
+ */
+static int builder_reserve(DictBuilder* builder, int32_t required) {
+    if (required <= builder->capacity)
+        return 0;
+    int32_t capacity = builder->capacity ? builder->capacity : 1024;
+    while (capacity < required)
+        capacity *= 2;
+    IcuDictUnit* units = (IcuDictUnit*)realloc(builder->units, capacity * sizeof(IcuDictUnit));
+    if (!units)
+        return -1;
+    for (int32_t i = builder->capacity; i < capacity; i++) {
+        units[i].base = -1;
+        units[i].check = -1;
+    }
+    builder->units = units;
+    builder->capacity = capacity;
+    return 0;
+}
+
+/**
+ * @brief Returns the transition label of a word at a given depth
+ */
+static int key_label(const DictKey* key, int depth) {
+    return depth < key->length ? key->bytes[depth] + 1 : ICU_DICT_END_LABEL;
+}
+
+/**
+ * @brief Places the children of a state and recurses into them
+ *
+ * The words in keys[left, right) share their first depth bytes, which form
+ * the path to state. They are sorted, so their labels at depth ascend.
+ *
+ * @param builder The builder
+ * @param keys The sorted words
+ * @param left First word below the state
+ * @param right One past the last word below the state
+ * @param depth Length of the shared prefix
+ * @param state The state whose children are placed
+ * @return 0 on success, -1 on allocation failure
+ */
+static int build_state(DictBuilder* builder, const DictKey* keys, int left, int right, int depth,
+                       int32_t state) {
+    int labels[257];
+    int starts[258];
+    int child_count = 0;
+    for (int i = left; i < right; i++) {
+        int label = key_label(&keys[i], depth);
+        if (child_count == 0 || labels[child_count - 1] != label) {
+            labels[child_count] = label;
+            starts[child_count] = i;
+            child_count++;
+        }
+    }
+    starts[child_count] = right;
+
+    // Find the lowest base at which every child lands on a free unit
+    int32_t base = builder->first_free - labels[0];
+    if (base < 1)
+        base = 1;
+    for (;;) {
+        if (builder_reserve(builder, base + 257) != 0)
+            return -1;
+        int fits = 1;
+        for (int i = 0; i < child_count && fits; i++) {
+            fits = builder->units[base + labels[i]].check == -1;
+        }
+        if (fits)
+            break;
+        base++;
+    }
+
+    builder->units[state].base = base;
+    for (int i = 0; i < child_count; i++) {
+        int32_t child = base + labels[i];
+        builder->units[child].check = state;
+        if (child + 1 > builder->size)
+            builder->size = child + 1;
+    }
+    while (builder->units[builder->first_free].check != -1) {
+        builder->first_free++;
+        if (builder_reserve(builder, builder->first_free + 1) != 0)
+            return -1;
+    }
+
+    for (int i = 0; i < child_count; i++) {
+        if (labels[i] == ICU_DICT_END_LABEL)
+            continue;  // End-of-word units have no children
+        if (build_state(builder, keys, starts[i], starts[i + 1], depth + 1, base + labels[i]) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Builds the double array for a sorted list of distinct words
+ *
+ * @param builder The builder to fill
+ * @param keys The sorted words
+ * @param count Number of words
+ * @return 0 on success, -1 on allocation failure
+ */
+static int build_trie(DictBuilder* builder, const DictKey* keys, int count) {
+    memset(builder, 0, sizeof(DictBuilder));
+    if (builder_reserve(builder, 1024) != 0)
+        return -1;
+    builder->units[0].check = 0;  // The root is its own parent
+    builder->size = 1;
+    builder->first_free = 1;
+    if (count == 0)
+        return 0;
+    return build_state(builder, keys, 0, count, 0, 0);
+}
+
+// ========================================================================
+// === MAIN ===============================================================
+// ========================================================================
+
+/**
+ * @brief Computes the FNV-1a checksum of the sorted word list
+ */
+static uint64_t word_list_checksum(const DictKey* keys, int count) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < keys[i].length; j++) {
+            hash ^= keys[i].bytes[j];
+            hash *= 1099511628211ULL;
+        }
+        hash ^= '\n';
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <word list> <output file>\n", argv[0]);
+        return 1;
+    }
+
+    DictKey* keys = NULL;
+    int count = 0;
+    if (read_word_list(argv[1], &keys, &count) != 0)
+        return 1;
+    count = sort_unique(keys, count);
+
+    DictKey* reversed = (DictKey*)malloc((count > 0 ? count : 1) * sizeof(DictKey));
+    if (!reversed) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+    for (int i = 0; i < count; i++) {
+        if (reverse_key(&keys[i], &reversed[i]) != 0) {
+            fprintf(stderr, "Error: out of memory\n");
+            return 1;
+        }
+    }
+    qsort(reversed, count, sizeof(DictKey), compare_keys);
+
+    DictBuilder forward, backward;
+    if (build_trie(&forward, keys, count) != 0 || build_trie(&backward, reversed, count) != 0) {
+        fprintf(stderr, "Error: out of memory\n");
+        return 1;
+    }
+
+    IcuDictHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ICU_DICT_MAGIC, 4);
+    header.version = ICU_DICT_VERSION;
+    header.byte_order = ICU_DICT_BYTE_ORDER;
+    header.word_count = (uint32_t)count;
+    header.checksum = word_list_checksum(keys, count);
+    header.forward_units = (uint32_t)forward.size;
+    header.backward_units = (uint32_t)backward.size;
+
+    FILE* output = fopen(argv[2], "wb");
+    if (!output) {
+        fprintf(stderr, "Error: cannot create %s\n", argv[2]);
+        return 1;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, output) == 1 &&
+             fwrite(forward.units, sizeof(IcuDictUnit), forward.size, output) ==
+               (size_t)forward.size &&
+             fwrite(backward.units, sizeof(IcuDictUnit), backward.size, output) ==
+               (size_t)backward.size;
+    if (fclose(output) != 0 || !ok) {
+        fprintf(stderr, "Error: failed to write %s\n", argv[2]);
+        return 1;
+    }
+
+    printf("%d words, %d + %d units, %zu bytes\n", count, forward.size, backward.size,
+           sizeof(header) + (size_t)(forward.size + backward.size) * sizeof(IcuDictUnit));
+
+    for (int i = 0; i < count; i++) {
+        free(keys[i].bytes);
+        free(reversed[i].bytes);
+    }
+    free(keys);
+    free(reversed);
+    free(forward.units);
+    free(backward.units);
+    return 0;
+}
@@ -0,0 +1,784 @@
+/**
+ * @file icu_shard_build.c
+ * @brief Builds an FTS5 index split across several shard databases
+ *
+ * Usage: icu_shard_build [options] <library> <output prefix>
+ *
+ *   -j FILE       read documents from a JSONL file, one object per line
+ *   -d FILE       read documents from a table of this SQLite database ...
+ *   -t TABLE      ... named TABLE
+ *   -c COLUMN     field or column holding the text, and the column of the
+ *                 shard tables (default "content")
+ *   -i ID         integer field or column used as the rowid (default: the
+ *                 line number of a JSONL file, the rowid of a table)
+ *   -s N          number of shards (default: the number of online CPUs)
+ *   -T NAME       name of the FTS5 table in every shard (default "documents")
+ *   -o OPTIONS    tokenizer arguments appended to the tokenizer name
+ *   -n NAME       tokenizer name (default derived from the library file name)
+ *   -x            create contentless shards (content='')
+ *   -m FILE       manifest path (default "<output prefix>.manifest.json")
+ *
+ * A database has a single writer, so one index cannot be built faster than
+ * one thread tokenizes. This tool splits the index into N shards: shard k
+ * holds every document with ((rowid % N) + N) % N = k, the non-negative
+ * remainder, in its own database "<output prefix>-k.db". All shards are
+ * built at the same time, one thread per shard, each with its own connection
+ * and its own tokenizer instance. A JSONL file is read and parsed once, by
+ * the main thread, which hands the documents of each shard to its thread in
+ * batches through a bounded queue. With a source table, every thread selects
+ * the rows of its own shard. Each shard is built in one transaction, then
+ * optimized to a single segment and vacuumed. Existing shard files are
+ * replaced.
+ *
+ * The manifest is a JSON file naming the tokenizer, the table and the shard
+ * databases, so that an application can open one connection per shard and
+ * query the shards in parallel. Documents keep their rowids, so results from
+ * different shards can be merged by rowid, and the partition expression of
+ * the manifest finds the shard of a document that changes later.
+ *
+ * Build throughput is printed per shard and for the whole build.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sqlite3.h"
+
+/** Most shards accepted by -s */
+#define SHARD_LIMIT 256
+
+/** Longest shard or manifest path */
+#define SHARD_PATH_SIZE 4096
+
+/** Most documents and text bytes the reader collects for a shard before queuing them */
+#define SHARD_BATCH_DOCUMENTS 256
+#define SHARD_BATCH_BYTES (1024 * 1024)
+
+/** Most batches queued for a shard; the reader waits for the shard beyond that */
+#define SHARD_QUEUE_BATCHES 4
+
+/** Build settings from the command line */
+typedef struct ShardOptions {
+    const char* library;       /**< Extension to load */
+    char tokenizer[256];       /**< Tokenizer name and arguments */
+    const char* jsonl_path;    /**< JSONL input, or NULL */
+    const char* database_path; /**< Source database, or NULL */
+    const char* source_table;  /**< Source table */
+    const char* column;        /**< Text field or column */
+    const char* id;            /**< Rowid field or column, or NULL */
+    const char* table;         /**< FTS5 table in the shards */
+    const char* prefix;        /**< Shard path prefix */
+    char manifest_path[SHARD_PATH_SIZE]; /**< Manifest path */
+    int shard_count;           /**< Number of shards */
+    int contentless;           /**< Create contentless shards */
+} ShardOptions;
+
+/** Documents of one shard, passed from the JSONL reader to the shard thread */
+typedef struct DocumentBatch {
+    struct DocumentBatch* next;                  /**< Next batch in the queue */
+    int count;                                   /**< Documents in the batch */
+    sqlite3_int64 rowids[SHARD_BATCH_DOCUMENTS]; /**< Rowid of every document */
+    size_t starts[SHARD_BATCH_DOCUMENTS];        /**< Offset of every text in text */
+    int lengths[SHARD_BATCH_DOCUMENTS];          /**< Length of every text, -1 for NULL */
+    char* text;                                  /**< Texts, back to back */
+    size_t used;                                 /**< Bytes in text */
+    size_t capacity;                             /**< Allocated size of text */
+} DocumentBatch;
+
+/** One shard and the thread that builds it */
+typedef struct Shard {
+    const ShardOptions* options;
+    int index;                      /**< Shard number */
+    char path[SHARD_PATH_SIZE];     /**< Shard database */
+    pthread_t handle;               /**< Building thread */
+    sqlite3_stmt* insert;           /**< Inserts one document into the shard */
+    sqlite3_int64 documents;        /**< Documents indexed */
+    sqlite3_int64 text_bytes;       /**< Bytes of text indexed */
+    sqlite3_int64 min_rowid;        /**< Smallest rowid indexed */
+    sqlite3_int64 max_rowid;        /**< Largest rowid indexed */
+    sqlite3_int64 file_bytes;       /**< Size of the finished database */
+    double index_seconds;           /**< Time spent reading and inserting */
+    double optimize_seconds;        /**< Time spent optimizing and vacuuming */
+    int failed;                     /**< Set when the shard could not be built */
+    pthread_mutex_t queue_lock;     /**< Protects the queue fields below */
+    pthread_cond_t queue_changed;   /**< Signalled when a batch is queued or taken */
+    DocumentBatch* queue_head;      /**< Oldest queued batch */
+    DocumentBatch* queue_tail;      /**< Newest queued batch */
+    int queued;                     /**< Batches in the queue */
+    int input_done;                 /**< Set once the reader queued its last batch */
+    int input_failed;               /**< Set when the input could not be read */
+    DocumentBatch* pending;         /**< Batch the reader is filling; reader only */
+} Shard;
+
+// ========================================================================
+// === HELPERS ============================================================
+// ========================================================================
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Executes SQL and reports errors on stderr
+ *
+ * @param db The connection
+ * @param sql The statements
+ * @return SQLITE_OK or the error code
+ */
+static int exec_sql(sqlite3* db, const char* sql) {
+    char* error = NULL;
+    int rc = sqlite3_exec(db, sql, NULL, NULL, &error);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", sql, error ? error : sqlite3_errstr(rc));
+        sqlite3_free(error);
+    }
+    return rc;
+}
+
+/**
+ * @brief Maps a rowid to its shard
+ *
+ * @param rowid The rowid
+ * @param shard_count Number of shards
+ * @return The shard number, also for negative rowids
+ */
+static int shard_of(sqlite3_int64 rowid, int shard_count) {
+    return (int)(((rowid % shard_count) + shard_count) % shard_count);
+}
+
+/**
+ * @brief Removes a database file and its journals
+ *
+ * @param path The database file
+ */
+static void remove_database(const char* path) {
+    static const char* const suffixes[] = {"", "-journal", "-wal", "-shm"};
+    char file[SHARD_PATH_SIZE + 16];
+    for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+        snprintf(file, sizeof(file), "%s%s", path, suffixes[i]);
+        unlink(file);
+    }
+}
+
+/**
+ * @brief Writes a string as a JSON string literal
+ *
+ * @param out The output file
+ * @param text The string
+ */
+static void write_json_string(FILE* out, const char* text) {
+    fputc('"', out);
+    for (const unsigned char* p = (const unsigned char*)text; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            fprintf(out, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(out, "\\u%04x", *p);
+        else
+            fputc(*p, out);
+    }
+    fputc('"', out);
+}
+
+// ========================================================================
+// === SHARD BUILDERS =====================================================
+// ========================================================================
+
+/**
+ * @brief Inserts one document into a shard
+ *
+ * @param shard The shard
+ * @param rowid Rowid of the document
+ * @param text The text, or NULL
+ * @param text_bytes Length of the text in bytes
+ * @return SQLITE_OK or the error code
+ */
+static int insert_document(Shard* shard, sqlite3_int64 rowid, const char* text, int text_bytes) {
+    sqlite3_bind_int64(shard->insert, 1, rowid);
+    sqlite3_bind_text(shard->insert, 2, text, text_bytes, SQLITE_STATIC);
+    int rc = sqlite3_step(shard->insert);
+    sqlite3_reset(shard->insert);
+    if (rc != SQLITE_DONE)
+        return rc;
+
+    if (shard->documents == 0 || rowid < shard->min_rowid)
+        shard->min_rowid = rowid;
+    if (shard->documents == 0 || rowid > shard->max_rowid)
+        shard->max_rowid = rowid;
+    shard->documents++;
+    shard->text_bytes += text_bytes;
+    return SQLITE_OK;
+}
+
+// ========================================================================
+// === JSONL READER =======================================================
+// ========================================================================
+
+static void batch_free(DocumentBatch* batch) {
+    if (batch) {
+        free(batch->text);
+        free(batch);
+    }
+}
+
+/**
+ * @brief Queues a batch for a shard, waiting while its queue is full
+ *
+ * @param shard The shard
+ * @param batch The batch; the shard thread frees it
+ */
+static void queue_push(Shard* shard, DocumentBatch* batch) {
+    pthread_mutex_lock(&shard->queue_lock);
+    while (shard->queued >= SHARD_QUEUE_BATCHES)
+        pthread_cond_wait(&shard->queue_changed, &shard->queue_lock);
+    if (shard->queue_tail)
+        shard->queue_tail->next = batch;
+    else
+        shard->queue_head = batch;
+    shard->queue_tail = batch;
+    shard->queued++;
+    pthread_cond_broadcast(&shard->queue_changed);
+    pthread_mutex_unlock(&shard->queue_lock);
+}
+
+/**
+ * @brief Takes the oldest batch of a shard, waiting for the reader
+ *
+ * @param shard The shard
+ * @return The batch, or NULL once the reader is done and the queue is empty
+ */
+static DocumentBatch* queue_pop(Shard* shard) {
+    pthread_mutex_lock(&shard->queue_lock);
+    while (!shard->queue_head && !shard->input_done)
+        pthread_cond_wait(&shard->queue_changed, &shard->queue_lock);
+    DocumentBatch* batch = shard->queue_head;
+    if (batch) {
+        shard->queue_head = batch->next;
+        if (!shard->queue_head)
+            shard->queue_tail = NULL;
+        shard->queued--;
+        pthread_cond_broadcast(&shard->queue_changed);
+    }
+    pthread_mutex_unlock(&shard->queue_lock);
+    return batch;
+}
+
+/**
+ * @brief Queues the pending batch of a shard and tells it the input ended
+ *
+ * @param shard The shard
+ * @param failed Non-zero if the input could not be read completely
+ */
+static void queue_finish(Shard* shard, int failed) {
+    if (shard->pending) {
+        queue_push(shard, shard->pending);
+        shard->pending = NULL;
+    }
+    pthread_mutex_lock(&shard->queue_lock);
+    shard->input_done = 1;
+    shard->input_failed = failed;
+    pthread_cond_broadcast(&shard->queue_changed);
+    pthread_mutex_unlock(&shard->queue_lock);
+}
+
+/**
+ * @brief Adds a document to the pending batch of its shard
+ *
+ * A full batch is queued and a new one started.
+ *
+ * @param shard The shard of the document
+ * @param rowid Rowid of the document
+ * @param text The text, or NULL
+ * @param length Length of the text in bytes
+ * @return SQLITE_OK or SQLITE_NOMEM
+ */
+static int dispatch_document(Shard* shard, sqlite3_int64 rowid, const char* text, int length) {
+    DocumentBatch* batch = shard->pending;
+    if (!batch) {
+        batch = (DocumentBatch*)calloc(1, sizeof(DocumentBatch));
+        if (!batch)
+            return SQLITE_NOMEM;
+        shard->pending = batch;
+    }
+    if (text && batch->used + length > batch->capacity) {
+        size_t capacity = batch->capacity ? batch->capacity : 64 * 1024;
+        while (capacity < batch->used + length)
+            capacity *= 2;
+        char* grown = (char*)realloc(batch->text, capacity);
+        if (!grown)
+            return SQLITE_NOMEM;
+        batch->text = grown;
+        batch->capacity = capacity;
+    }
+
+    batch->rowids[batch->count] = rowid;
+    batch->starts[batch->count] = batch->used;
+    batch->lengths[batch->count] = text ? length : -1;
+    if (text) {
+        memcpy(batch->text + batch->used, text, length);
+        batch->used += length;
+    }
+    batch->count++;
+
+    if (batch->count == SHARD_BATCH_DOCUMENTS || batch->used >= SHARD_BATCH_BYTES) {
+        queue_push(shard, batch);
+        shard->pending = NULL;
+    }
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Reads a JSONL file once and hands every document to its shard
+ *
+ * Runs on the main thread while the shard threads index. Every line is
+ * parsed once, with json_extract() on a private in-memory connection. Empty
+ * lines are skipped, but counted, so that line numbers stay meaningful as
+ * rowids. Every shard is told that the input ended, also on failure, so
+ * that no shard thread waits forever.
+ *
+ * @param options Build settings
+ * @param shards The shards
+ * @return SQLITE_OK or the error code
+ */
+static int read_jsonl(const ShardOptions* options, Shard* shards) {
+    sqlite3* db = NULL;
+    sqlite3_stmt* extract = NULL;
+    char* text_path = sqlite3_mprintf("$.\"%w\"", options->column);
+    char* id_path = sqlite3_mprintf("$.\"%w\"", options->id ? options->id : "");
+    FILE* input = fopen(options->jsonl_path, "r");
+    int rc = (text_path && id_path) ? SQLITE_OK : SQLITE_NOMEM;
+    if (rc == SQLITE_OK && !input) {
+        fprintf(stderr, "%s: cannot open\n", options->jsonl_path);
+        rc = SQLITE_CANTOPEN;
+    }
+    if (rc == SQLITE_OK)
+        rc = sqlite3_open(":memory:", &db);
+    if (rc == SQLITE_OK) {
+        const char* sql = options->id ? "SELECT json_extract(?1, ?2), json_extract(?1, ?3)"
+                                      : "SELECT json_extract(?1, ?2)";
+        rc = sqlite3_prepare_v2(db, sql, -1, &extract, NULL);
+        if (rc != SQLITE_OK)
+            fprintf(stderr, "%s\n", sqlite3_errmsg(db));
+    }
+    if (rc == SQLITE_OK) {
+        sqlite3_bind_text(extract, 2, text_path, -1, SQLITE_STATIC);
+        if (options->id)
+            sqlite3_bind_text(extract, 3, id_path, -1, SQLITE_STATIC);
+    }
+
+    char* line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    sqlite3_int64 line_number = 0;
+    while (rc == SQLITE_OK && (length = getline(&line, &capacity, input)) != -1) {
+        line_number++;
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            length--;
+        if (length == 0)
+            continue;
+
+        sqlite3_bind_text(extract, 1, line, (int)length, SQLITE_STATIC);
+        rc = sqlite3_step(extract);
+        if (rc == SQLITE_ROW) {
+            sqlite3_int64 rowid = line_number;
+            rc = SQLITE_OK;
+            if (options->id) {
+                rowid = sqlite3_column_int64(extract, 1);
+                if (sqlite3_column_type(extract, 1) != SQLITE_INTEGER)
+                    rc = SQLITE_MISMATCH;
+            }
+            if (rc == SQLITE_OK) {
+                Shard* shard = &shards[shard_of(rowid, options->shard_count)];
+                rc = dispatch_document(shard, rowid, (const char*)sqlite3_column_text(extract, 0),
+                                       sqlite3_column_bytes(extract, 0));
+            }
+        }
+        if (rc == SQLITE_MISMATCH) {
+            fprintf(stderr, "%s:%lld: \"%s\" is not an integer\n", options->jsonl_path,
+                    line_number, options->id);
+        } else if (rc == SQLITE_NOMEM) {
+            fprintf(stderr, "%s:%lld: out of memory\n", options->jsonl_path, line_number);
+        } else if (rc != SQLITE_OK) {
+            fprintf(stderr, "%s:%lld: %s\n", options->jsonl_path, line_number,
+                    sqlite3_errmsg(db));
+        }
+        sqlite3_reset(extract);
+    }
+
+    for (int i = 0; i < options->shard_count; i++) {
+        queue_finish(&shards[i], rc != SQLITE_OK);
+    }
+    free(line);
+    if (input)
+        fclose(input);
+    sqlite3_finalize(extract);
+    sqlite3_close(db);
+    sqlite3_free(id_path);
+    sqlite3_free(text_path);
+    return rc;
+}
+
+/**
+ * @brief Indexes the documents the JSONL reader queues for a shard
+ *
+ * The queue is drained to the end even after a failure, so that the reader
+ * never waits for a shard that stopped.
+ *
+ * @param shard The shard
+ * @param rc SQLITE_OK, or the error that already stopped the shard
+ * @return SQLITE_OK, the first error, or SQLITE_ERROR if the input failed
+ */
+static int index_queue(Shard* shard, int rc) {
+    DocumentBatch* batch;
+    while ((batch = queue_pop(shard)) != NULL) {
+        for (int i = 0; rc == SQLITE_OK && i < batch->count; i++) {
+            const char* text = batch->lengths[i] < 0 ? NULL : batch->text + batch->starts[i];
+            rc = insert_document(shard, batch->rowids[i], text,
+                                 batch->lengths[i] < 0 ? 0 : batch->lengths[i]);
+            if (rc != SQLITE_OK)
+                fprintf(stderr, "%s: %s\n", shard->path, sqlite3_errstr(rc));
+        }
+        batch_free(batch);
+    }
+    if (rc == SQLITE_OK && shard->input_failed)
+        rc = SQLITE_ERROR;
+    return rc;
+}
+
+/**
+ * @brief Indexes the documents of a shard from a table of another database
+ *
+ * @param shard The shard
+ * @return SQLITE_OK or the error code
+ */
+static int index_table(Shard* shard) {
+    const ShardOptions* options = shard->options;
+    sqlite3* source = NULL;
+    int rc = sqlite3_open_v2(options->database_path, &source, SQLITE_OPEN_READONLY, NULL);
+    if (rc != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", options->database_path, sqlite3_errmsg(source));
+        sqlite3_close(source);
+        return rc;
+    }
+
+    // Each thread scans the table; the modulo keeps its own rows
+    char* sql = sqlite3_mprintf(
+      "SELECT \"%w\", \"%w\" FROM \"%w\" WHERE ((\"%w\" %% %d) + %d) %% %d = %d",
+      options->id ? options->id : "rowid", options->column, options->source_table,
+      options->id ? options->id : "rowid", options->shard_count, options->shard_count,
+      options->shard_count, shard->index);
+    sqlite3_stmt* select = NULL;
+    rc = sql ? sqlite3_prepare_v2(source, sql, -1, &select, NULL) : SQLITE_NOMEM;
+    if (rc != SQLITE_OK)
+        fprintf(stderr, "%s: %s\n", options->database_path, sqlite3_errmsg(source));
+
+    while (rc == SQLITE_OK && (rc = sqlite3_step(select)) == SQLITE_ROW) {
+        if (sqlite3_column_type(select, 0) != SQLITE_INTEGER) {
+            fprintf(stderr, "%s: \"%s\" is not an integer\n", options->database_path,
+                    options->id ? options->id : "rowid");
+            rc = SQLITE_MISMATCH;
+            break;
+        }
+        rc = insert_document(shard, sqlite3_column_int64(select, 0),
+                             (const char*)sqlite3_column_text(select, 1),
+                             sqlite3_column_bytes(select, 1));
+        if (rc != SQLITE_OK)
+            fprintf(stderr, "%s: %s\n", shard->path, sqlite3_errstr(rc));
+    }
+    if (rc == SQLITE_DONE)
+        rc = SQLITE_OK;
+
+    sqlite3_finalize(select);
+    sqlite3_free(sql);
+    sqlite3_close(source);
+    return rc;
+}
+
+/**
+ * @brief Opens a shard database, creates its table and loads the extension
+ *
+ * @param shard The shard
+ * @param[out] pDb Receives the connection; close it also on failure
+ * @return SQLITE_OK or the error code
+ */
+static int open_shard(Shard* shard, sqlite3** pDb) {
+    const ShardOptions* options = shard->options;
+    remove_database(shard->path);
+
+    char* error = NULL;
+    int rc = sqlite3_open(shard->path, pDb);
+    sqlite3* db = *pDb;
+    if (rc == SQLITE_OK)
+        rc = sqlite3_enable_load_extension(db, 1);
+    if (rc == SQLITE_OK && sqlite3_load_extension(db, options->library, NULL, &error) != SQLITE_OK) {
+        fprintf(stderr, "%s: %s\n", options->library, error ? error : "cannot load");
+        sqlite3_free(error);
+        return SQLITE_ERROR;
+    }
+
+    // A shard that fails is built again from scratch, so it needs no journal
+    if (rc == SQLITE_OK)
+        rc = exec_sql(db, "PRAGMA journal_mode=OFF; PRAGMA synchronous=OFF");
+    if (rc == SQLITE_OK) {
+        char* create = sqlite3_mprintf(
+          "CREATE VIRTUAL TABLE \"%w\" USING fts5(\"%w\", tokenize=%Q%s)", options->table,
+          options->column, options->tokenizer, options->contentless ? ", content=''" : "");
+        rc = create ? exec_sql(db, create) : SQLITE_NOMEM;
+        sqlite3_free(create);
+    }
+    if (rc == SQLITE_OK) {
+        char* insert = sqlite3_mprintf("INSERT INTO \"%w\"(rowid, \"%w\") VALUES (?, ?)",
+                                       options->table, options->column);
+        rc = insert ? sqlite3_prepare_v2(db, insert, -1, &shard->insert, NULL) : SQLITE_NOMEM;
+        sqlite3_free(insert);
+    }
+    if (rc != SQLITE_OK && rc != SQLITE_ERROR)
+        fprintf(stderr, "%s: %s\n", shard->path, sqlite3_errmsg(db));
+    return rc;
+}
+
+/**
+ * @brief Shard thread: builds, optimizes and vacuums one shard database
+ */
+static void* shard_thread(void* argument) {
+    Shard* shard = (Shard*)argument;
+    const ShardOptions* options = shard->options;
+
+#ifdef __linux__
+    char name[16];
+    snprintf(name, sizeof(name), "icu-shard-%d", shard->index);
+    pthread_setname_np(pthread_self(), name);
+#endif
+
+    double start = now_seconds();
+    sqlite3* db = NULL;
+    int rc = open_shard(shard, &db);
+    if (rc == SQLITE_OK)
+        rc = exec_sql(db, "BEGIN");
+    if (options->jsonl_path)
+        rc = index_queue(shard, rc);
+    else if (rc == SQLITE_OK)
+        rc = index_table(shard);
+    sqlite3_finalize(shard->insert);
+    shard->insert = NULL;
+    if (rc == SQLITE_OK)
+        rc = exec_sql(db, "COMMIT");
+    double indexed = now_seconds();
+    shard->index_seconds = indexed - start;
+
+    if (rc == SQLITE_OK) {
+        char* optimize = sqlite3_mprintf("INSERT INTO \"%w\"(\"%w\") VALUES ('optimize')",
+                                         options->table, options->table);
+        rc = optimize ? exec_sql(db, optimize) : SQLITE_NOMEM;
+        sqlite3_free(optimize);
+    }
+    if (rc == SQLITE_OK)
+        rc = exec_sql(db, "VACUUM");
+    shard->optimize_seconds = now_seconds() - indexed;
+    sqlite3_close(db);
+
+    struct stat info;
+    if (rc == SQLITE_OK && stat(shard->path, &info) == 0)
+        shard->file_bytes = info.st_size;
+    shard->failed = (rc != SQLITE_OK);
+    return NULL;
+}
+
+// ========================================================================
+// === MANIFEST ===========================================================
+// ========================================================================
+
+/**
+ * @brief Writes the manifest describing the shards
+ *
+ * Shard paths are written relative to the manifest when both are in the same
+ * directory, so that the files can be moved together.
+ *
+ * @param options Build settings
+ * @param shards The built shards
+ * @return Non-zero on success
+ */
+static int write_manifest(const ShardOptions* options, const Shard* shards) {
+    FILE* out = fopen(options->manifest_path, "w");
+    if (!out) {
+        fprintf(stderr, "%s: cannot create\n", options->manifest_path);
+        return 0;
+    }
+
+    const char* manifest_base = strrchr(options->manifest_path, '/');
+    size_t manifest_directory = manifest_base ? (size_t)(manifest_base - options->manifest_path) + 1 : 0;
+
+    fprintf(out, "{\n  \"version\": 1,\n  \"tokenizer\": ");
+    write_json_string(out, options->tokenizer);
+    fprintf(out, ",\n  \"table\": ");
+    write_json_string(out, options->table);
+    fprintf(out, ",\n  \"column\": ");
+    write_json_string(out, options->column);
+    fprintf(out, ",\n  \"contentless\": %s,\n", options->contentless ? "true" : "false");
+    fprintf(out, "  \"partition\": \"((rowid %% %d) + %d) %% %d\",\n  \"shards\": [\n",
+            options->shard_count, options->shard_count, options->shard_count);
+    for (int i = 0; i < options->shard_count; i++) {
+        const Shard* shard = &shards[i];
+        const char* path = shard->path;
+        if (strncmp(path, options->manifest_path, manifest_directory) == 0 &&
+            !strchr(path + manifest_directory, '/')) {
+            path += manifest_directory;
+        }
+        fprintf(out, "    {\"shard\": %d, \"path\": ", shard->index);
+        write_json_string(out, path);
+        fprintf(out, ", \"documents\": %lld, \"text_bytes\": %lld, \"file_bytes\": %lld",
+                shard->documents, shard->text_bytes, shard->file_bytes);
+        if (shard->documents > 0) {
+            fprintf(out, ", \"min_rowid\": %lld, \"max_rowid\": %lld", shard->min_rowid,
+                    shard->max_rowid);
+        }
+        fprintf(out, "}%s\n", i + 1 < options->shard_count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    return fclose(out) == 0;
+}
+
+// ========================================================================
+// === DRIVER =============================================================
+// ========================================================================
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "Usage: %s (-j file.jsonl | -d source.db -t table) [-c column] [-i id]\n"
+            "          [-s shards] [-T table] [-o options] [-n name] [-x] [-m manifest]\n"
+            "          <library> <output prefix>\n",
+            program);
+}
+
+int main(int argc, char** argv) {
+    ShardOptions options;
+    memset(&options, 0, sizeof(options));
+    options.column = "content";
+    options.table = "documents";
+    options.shard_count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char* name = NULL;
+    const char* arguments = NULL;
+    const char* manifest = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:d:t:c:i:s:T:o:n:xm:")) != -1) {
+        switch (opt) {
+            case 'j': options.jsonl_path = optarg; break;
+            case 'd': options.database_path = optarg; break;
+            case 't': options.source_table = optarg; break;
+            case 'c': options.column = optarg; break;
+            case 'i': options.id = optarg; break;
+            case 's': options.shard_count = atoi(optarg); break;
+            case 'T': options.table = optarg; break;
+            case 'o': arguments = optarg; break;
+            case 'n': name = optarg; break;
+            case 'x': options.contentless = 1; break;
+            case 'm': manifest = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind != argc - 2 || options.shard_count < 1 || options.shard_count > SHARD_LIMIT ||
+        !options.jsonl_path == !options.database_path ||
+        !options.database_path != !options.source_table) {
+        usage(argv[0]);
+        return 1;
+    }
+    options.library = argv[optind];
+    options.prefix = argv[optind + 1];
+    snprintf(options.manifest_path, sizeof(options.manifest_path), "%s%s",
+             manifest ? manifest : options.prefix, manifest ? "" : ".manifest.json");
+
+    if (!sqlite3_threadsafe()) {
+        fprintf(stderr, "SQLite was built without thread safety\n");
+        return 1;
+    }
+
+    // Tokenizer registered by the library: libfts5_icu_ru.so -> icu_ru
+    char derived[64] = "icu";
+    if (!name) {
+        const char* base = strrchr(options.library, '/');
+        base = base ? base + 1 : options.library;
+        const char* suffix = strstr(base, "libfts5_icu");
+        if (suffix) {
+            suffix += strlen("libfts5_icu");
+            size_t n = strcspn(suffix, ".");
+            if (n < sizeof(derived) - 4) {
+                memcpy(derived + 3, suffix, n);
+                derived[3 + n] = 0;
+            }
+        }
+        name = derived;
+    }
+    snprintf(options.tokenizer, sizeof(options.tokenizer), "%s%s%s", name,
+             arguments ? " " : "", arguments ? arguments : "");
+
+    Shard* shards = (Shard*)calloc(options.shard_count, sizeof(Shard));
+    if (!shards) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    printf("Library:   %s\nTokenizer: %s\nInput:     %s%s%s\nShards:    %d\n\n", options.library,
+           options.tokenizer, options.jsonl_path ? options.jsonl_path : options.database_path,
+           options.source_table ? " table " : "", options.source_table ? options.source_table : "",
+           options.shard_count);
+    fflush(stdout);
+
+    double start = now_seconds();
+    for (int i = 0; i < options.shard_count; i++) {
+        shards[i].options = &options;
+        shards[i].index = i;
+        snprintf(shards[i].path, sizeof(shards[i].path), "%s-%d.db", options.prefix, i);
+        pthread_mutex_init(&shards[i].queue_lock, NULL);
+        pthread_cond_init(&shards[i].queue_changed, NULL);
+        if (pthread_create(&shards[i].handle, NULL, shard_thread, &shards[i]) != 0) {
+            fprintf(stderr, "cannot start thread %d\n", i);
+            return 1;
+        }
+    }
+    int failed = 0;
+    if (options.jsonl_path)
+        failed = read_jsonl(&options, shards) != SQLITE_OK;
+    for (int i = 0; i < options.shard_count; i++) {
+        pthread_join(shards[i].handle, NULL);
+        pthread_cond_destroy(&shards[i].queue_changed);
+        pthread_mutex_destroy(&shards[i].queue_lock);
+        failed |= shards[i].failed;
+    }
+    double seconds = now_seconds() - start;
+    if (failed) {
+        free(shards);
+        return 1;
+    }
+
+    printf("%5s %10s %10s %10s %10s %12s %10s %10s\n", "shard", "documents", "text MB",
+           "index s", "optimize s", "docs/s", "MB/s", "file MB");
+    sqlite3_int64 documents = 0, text_bytes = 0, file_bytes = 0;
+    for (int i = 0; i < options.shard_count; i++) {
+        const Shard* shard = &shards[i];
+        double shard_seconds = shard->index_seconds + shard->optimize_seconds;
+        printf("%5d %10lld %10.1f %10.2f %10.2f %12.0f %10.2f %10.1f\n", shard->index,
+               shard->documents, shard->text_bytes / 1e6, shard->index_seconds,
+               shard->optimize_seconds, shard->documents / shard_seconds,
+               shard->text_bytes / 1e6 / shard_seconds, shard->file_bytes / 1e6);
+        documents += shard->documents;
+        text_bytes += shard->text_bytes;
+        file_bytes += shard->file_bytes;
+    }
+    printf("%5s %10lld %10.1f %21.2f %12.0f %10.2f %10.1f\n", "all", documents, text_bytes / 1e6,
+           seconds, documents / seconds, text_bytes / 1e6 / seconds, file_bytes / 1e6);
+
+    int written = write_manifest(&options, shards);
+    free(shards);
+    if (!written)
+        return 1;
+    printf("\nManifest:  %s\n", options.manifest_path);
+    return 0;
+}
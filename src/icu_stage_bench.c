@@ -0,0 +1,486 @@
+/**
+ * @file icu_stage_bench.c
+ * @brief Stage-level microbenchmarks of the xTokenize pipeline
+ *
+ * Usage: icu_stage_bench [-r repetitions] [-s bytes] [-i input] [-P]
+ *
+ *   -r N      timed repetitions per stage and input (default 30)
+ *   -s N      size of every input in bytes (default 65536)
+ *   -i NAME   run only the named input (see the table below)
+ *   -P        also read hardware counters with perf_event_open (Linux)
+ *
+ * The program is compiled from the tokenizer sources with SQLITE_CORE, so
+ * it calls the tokenizer internals directly and opens no database. For
+ * every fixed input it times the stages of icuTokenize() in isolation:
+ *
+ *   utf8_to_utf16   convert_utf8_to_utf16_with_mapping() over the document
+ *   break           ubrk_setText(), then ubrk_next() and ubrk_getRuleStatus()
+ *                   for every boundary
+ *   transliterate   utrans_transUChars() on a copy of every word
+ *   to_utf8         u_strToUTF8WithSub() on every transliterated word
+ *   tokenize        the whole of icuTokenize() with a counting callback, with
+ *                   every word going through the rule chain
+ *   specialized     the same with ASCII words of plain configurations folded
+ *                   without the rule chain, as FTS5 calls it (see
+ *                   fold_ascii_token())
+ *
+ * Whatever "tokenize" spends beyond the sum of the stages is reported as
+ * "overhead": the token stream bookkeeping and the callback. "speedup" is the
+ * time of "tokenize" divided by that of "specialized".
+ *
+ * Every stage reports the mean time per byte and per word token with the
+ * standard deviation over the repetitions. With -P it also reports cycles,
+ * cache misses and branch misses per KiB of input, which may need
+ * /proc/sys/kernel/perf_event_paranoid lowered.
+ */
+
+#include "fts5_icu.h"
+
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+/** A fixed benchmark input: one paragraph repeated to the requested size */
+typedef struct StageInput {
+    const char* name;
+    const char* paragraph;
+} StageInput;
+
+static const StageInput stage_inputs[] = {
+  {"latin",
+   "The quick brown fox jumps over the lazy dog. Les élèves étudient à l'université; "
+   "die Straße führt über den Fluß. ¿Dónde está la biblioteca? Ångström, naïve café. "},
+  {"cyrillic",
+   "Быстрая коричневая лиса прыгает через ленивую собаку. Съешь же ещё этих мягких "
+   "французских булок, да выпей чаю. Москва — столица России. "},
+  {"greek",
+   "Η γρήγορη καφέ αλεπού πηδά πάνω από το τεμπέλικο σκυλί. Ξεσκεπάζω την ψυχοφθόρα "
+   "βδελυγμία. Η Αθήνα είναι η πρωτεύουσα της Ελλάδας. "},
+  {"arabic",
+   "الثعلب البني السريع يقفز فوق الكلب الكسول. صِفْ خَلْقَ خَوْدٍ كَمِثْلِ الشَّمْسِ إِذْ بَزَغَتْ. "
+   "القاهرة هي عاصمة مصر. "},
+  {"hebrew",
+   "השועל החום המהיר קופץ מעל הכלב העצלן. דג סקרן שט בים מאוכזב ולפתע מצא חברה. "
+   "ירושלים היא בירת ישראל. "},
+  {"japanese",
+   "東京タワーの夜景はとても美しいです。全文検索システムは日本語の文章を単語に分割します。"
+   "カタカナとひらがなと漢字が混ざっています。"},
+  {"chinese",
+   "今天天气很好，我们去公园散步吧。全文检索系统需要高效的分词算法来处理中文文本。"
+   "數據庫索引的大小直接影響查詢性能。"},
+  {"korean",
+   "다람쥐 헌 쳇바퀴에 타고파. 전문 검색 시스템은 한국어 문장을 단어로 나눕니다. "
+   "서울은 대한민국의 수도입니다. "},
+  {"thai",
+   "สุนัขจิ้งจอกสีน้ำตาลกระโดดข้ามสุนัขขี้เกียจ ระบบค้นหาข้อความต้องตัดคำภาษาไทย "
+   "กรุงเทพมหานครเป็นเมืองหลวงของประเทศไทย "},
+};
+
+#define STAGE_INPUT_COUNT ((int)(sizeof(stage_inputs) / sizeof(stage_inputs[0])))
+
+/** Stages in the order they run inside icuTokenize() */
+typedef enum Stage {
+    STAGE_UTF8_TO_UTF16,
+    STAGE_BREAK,
+    STAGE_TRANSLITERATE,
+    STAGE_TO_UTF8,
+    STAGE_TOKENIZE,
+    STAGE_SPECIALIZED,
+    STAGE_COUNT
+} Stage;
+
+static const char* const stage_names[STAGE_COUNT] = {
+  "utf8_to_utf16", "break", "transliterate", "to_utf8", "tokenize", "specialized"};
+
+/** Hardware counters read around every repetition */
+typedef enum Counter { COUNTER_CYCLES, COUNTER_CACHE, COUNTER_BRANCH, COUNTER_COUNT } Counter;
+
+/** Document prepared for the individual stages */
+typedef struct StageDocument {
+    char* text;            /**< UTF-8 document */
+    int length;            /**< Bytes in text */
+    UChar* utf16;          /**< Converted document */
+    int32_t utf16_length;  /**< Code units in utf16 */
+    int32_t* map;          /**< Byte offset map filled by the conversion */
+    int32_t* word_bounds;  /**< Start and end of every word, in pairs */
+    int word_count;        /**< Words in the document */
+    UChar* words;          /**< Transliterated words, back to back */
+    int32_t* word_lengths; /**< Length of every transliterated word */
+    UChar* scratch;        /**< Transliteration buffer */
+    int32_t scratch_size;  /**< Code units in scratch */
+    char* utf8;            /**< UTF-8 output buffer */
+    int32_t utf8_size;     /**< Bytes in utf8 */
+} StageDocument;
+
+static int perf_fds[COUNTER_COUNT] = {-1, -1, -1};
+
+// ========================================================================
+// === HARDWARE COUNTERS ==================================================
+// ========================================================================
+
+/**
+ * @brief Opens the cycle, cache miss and branch miss counters of this thread
+ *
+ * @return Non-zero if all counters are available
+ */
+static int counters_open(void) {
+#ifdef __linux__
+    static const uint64_t configs[COUNTER_COUNT] = {
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        perf_fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (perf_fds[i] < 0) {
+            for (int j = 0; j < i; j++) {
+                close(perf_fds[j]);
+                perf_fds[j] = -1;
+            }
+            return 0;
+        }
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+static void counters_start(void) {
+#ifdef __linux__
+    for (int i = 0; i < COUNTER_COUNT && perf_fds[i] >= 0; i++) {
+        ioctl(perf_fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+static void counters_stop(double* totals) {
+#ifdef __linux__
+    for (int i = 0; i < COUNTER_COUNT && perf_fds[i] >= 0; i++) {
+        uint64_t value = 0;
+        ioctl(perf_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(perf_fds[i], &value, sizeof(value)) == sizeof(value))
+            totals[i] += (double)value;
+    }
+#else
+    UNUSED_PARAMETER(totals);
+#endif
+}
+
+// ========================================================================
+// === STAGES =============================================================
+// ========================================================================
+
+static double now_nanoseconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int count_token(void* pCtx, int tflags, const char* pToken, int nToken, int iStart,
+                       int iEnd) {
+    UNUSED_PARAMETER(tflags);
+    UNUSED_PARAMETER(pToken);
+    UNUSED_PARAMETER(nToken);
+    UNUSED_PARAMETER(iStart);
+    UNUSED_PARAMETER(iEnd);
+    (*(int*)pCtx)++;
+    return SQLITE_OK;
+}
+
+/**
+ * @brief Runs one stage over a document once
+ *
+ * @param stage The stage
+ * @param doc The prepared document
+ * @param tokenizer The tokenizer whose ICU objects are used
+ * @return Number of items produced, to keep the work observable
+ */
+static int run_stage(Stage stage, StageDocument* doc, IcuTokenizerV2* tokenizer) {
+    UErrorCode status = U_ZERO_ERROR;
+    int produced = 0;
+    switch (stage) {
+        case STAGE_UTF8_TO_UTF16:
+            produced = convert_utf8_to_utf16_with_mapping(doc->text, doc->length, doc->utf16,
+                                                          doc->length + 1, doc->map);
+            break;
+
+        case STAGE_BREAK: {
+            UBreakIterator* iterator = tokenizer->pBreakIterator;
+            ubrk_setText(iterator, doc->utf16, doc->utf16_length, &status);
+            for (int32_t end = ubrk_next(iterator); end != UBRK_DONE; end = ubrk_next(iterator)) {
+                produced += ubrk_getRuleStatus(iterator) >= UBRK_WORD_NONE_LIMIT;
+            }
+            break;
+        }
+
+        case STAGE_TRANSLITERATE:
+            for (int i = 0; i < doc->word_count; i++) {
+                int32_t length = doc->word_bounds[2 * i + 1] - doc->word_bounds[2 * i];
+                u_strncpy(doc->scratch, doc->utf16 + doc->word_bounds[2 * i], length);
+                int32_t limit = length;
+                status = U_ZERO_ERROR;
+                utrans_transUChars(tokenizer->pTransliterator, doc->scratch, &length,
+                                   doc->scratch_size, 0, &limit, &status);
+                produced += length;
+            }
+            break;
+
+        case STAGE_TO_UTF8: {
+            const UChar* word = doc->words;
+            for (int i = 0; i < doc->word_count; i++) {
+                int32_t length = 0;
+                status = U_ZERO_ERROR;
+                u_strToUTF8WithSub(doc->utf8, doc->utf8_size, &length, word,
+                                   doc->word_lengths[i], 0xFFFD, NULL, &status);
+                word += doc->word_lengths[i];
+                produced += length;
+            }
+            break;
+        }
+
+        case STAGE_TOKENIZE: {
+            int plain_words = tokenizer->plain_words;
+            tokenizer->plain_words = 0;
+            icuTokenize((Fts5Tokenizer*)tokenizer, &produced, FTS5_TOKENIZE_DOCUMENT, doc->text,
+                        doc->length, NULL, 0, count_token);
+            tokenizer->plain_words = plain_words;
+            break;
+        }
+
+        case STAGE_SPECIALIZED:
+            icuTokenize((Fts5Tokenizer*)tokenizer, &produced, FTS5_TOKENIZE_DOCUMENT, doc->text,
+                        doc->length, NULL, 0, count_token);
+            break;
+
+        case STAGE_COUNT:
+            break;
+    }
+    return produced;
+}
+
+/**
+ * @brief Builds a document from an input and precomputes the stage inputs
+ *
+ * @param input The fixed input
+ * @param size Document size in bytes
+ * @param tokenizer The tokenizer whose ICU objects are used
+ * @param doc Receives the document
+ * @return Non-zero on success
+ */
+static int prepare_document(const StageInput* input, int size, IcuTokenizerV2* tokenizer,
+                            StageDocument* doc) {
+    memset(doc, 0, sizeof(StageDocument));
+    int paragraph = (int)strlen(input->paragraph);
+    int copies = size / paragraph > 0 ? size / paragraph : 1;
+    doc->length = copies * paragraph;
+    doc->text = (char*)malloc(doc->length + 1);
+    doc->utf16 = (UChar*)malloc((doc->length + 1) * sizeof(UChar));
+    doc->map = (int32_t*)malloc((doc->length + 2) * sizeof(int32_t));
+    doc->word_bounds = (int32_t*)malloc((doc->length + 1) * 2 * sizeof(int32_t));
+    doc->word_lengths = (int32_t*)malloc((doc->length + 1) * sizeof(int32_t));
+    doc->scratch_size = 4096;
+    doc->scratch = (UChar*)malloc(doc->scratch_size * sizeof(UChar));
+    if (!doc->text || !doc->utf16 || !doc->map || !doc->word_bounds || !doc->word_lengths ||
+        !doc->scratch) {
+        return 0;
+    }
+    for (int i = 0; i < copies; i++) {
+        memcpy(doc->text + i * paragraph, input->paragraph, paragraph);
+    }
+    doc->text[doc->length] = 0;
+
+    doc->utf16_length = run_stage(STAGE_UTF8_TO_UTF16, doc, tokenizer);
+    if (doc->utf16_length <= 0)
+        return 0;
+
+    // Word boundaries as the tokenizer sees them
+    UErrorCode status = U_ZERO_ERROR;
+    UBreakIterator* iterator = tokenizer->pBreakIterator;
+    ubrk_setText(iterator, doc->utf16, doc->utf16_length, &status);
+    int32_t start = ubrk_first(iterator);
+    for (int32_t end = ubrk_next(iterator); end != UBRK_DONE; end = ubrk_next(iterator)) {
+        if (ubrk_getRuleStatus(iterator) >= UBRK_WORD_NONE_LIMIT && end - start < 1024) {
+            doc->word_bounds[2 * doc->word_count] = start;
+            doc->word_bounds[2 * doc->word_count + 1] = end;
+            doc->word_count++;
+        }
+        start = end;
+    }
+
+    // Transliterated words for the UTF-8 stage
+    int32_t total = 0;
+    int32_t capacity = 0;
+    for (int i = 0; i < doc->word_count; i++) {
+        int32_t length = doc->word_bounds[2 * i + 1] - doc->word_bounds[2 * i];
+        u_strncpy(doc->scratch, doc->utf16 + doc->word_bounds[2 * i], length);
+        int32_t limit = length;
+        status = U_ZERO_ERROR;
+        utrans_transUChars(tokenizer->pTransliterator, doc->scratch, &length, doc->scratch_size, 0,
+                           &limit, &status);
+        if (U_FAILURE(status))
+            return 0;
+        if (total + length > capacity) {
+            capacity = (total + length) * 2;
+            UChar* words = (UChar*)realloc(doc->words, capacity * sizeof(UChar));
+            if (!words)
+                return 0;
+            doc->words = words;
+        }
+        u_memcpy(doc->words + total, doc->scratch, length);
+        doc->word_lengths[i] = length;
+        total += length;
+    }
+    doc->utf8_size = doc->scratch_size * 4;
+    doc->utf8 = (char*)malloc(doc->utf8_size);
+    return doc->utf8 != NULL;
+}
+
+static void free_document(StageDocument* doc) {
+    free(doc->text);
+    free(doc->utf16);
+    free(doc->map);
+    free(doc->word_bounds);
+    free(doc->word_lengths);
+    free(doc->words);
+    free(doc->scratch);
+    free(doc->utf8);
+}
+
+/**
+ * @brief Computes the mean and standard deviation of a series
+ */
+static void mean_and_deviation(const double* values, int count, double* pMean,
+                               double* pDeviation) {
+    double sum = 0, squares = 0;
+    for (int i = 0; i < count; i++) {
+        sum += values[i];
+    }
+    double mean = sum / count;
+    for (int i = 0; i < count; i++) {
+        squares += (values[i] - mean) * (values[i] - mean);
+    }
+    *pMean = mean;
+    *pDeviation = count > 1 ? sqrt(squares / (count - 1)) : 0;
+}
+
+// ========================================================================
+// === DRIVER =============================================================
+// ========================================================================
+
+int main(int argc, char** argv) {
+    int repetitions = 30;
+    int size = 65536;
+    const char* only = NULL;
+    int use_counters = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:s:i:P")) != -1) {
+        switch (opt) {
+            case 'r': repetitions = atoi(optarg); break;
+            case 's': size = atoi(optarg); break;
+            case 'i': only = optarg; break;
+            case 'P': use_counters = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-r repetitions] [-s bytes] [-i input] [-P]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    if (repetitions < 2 || size < 1024 || size > 64 * 1024 * 1024) {
+        fprintf(stderr, "repetitions must be at least 2 and size 1024 bytes to 64 MiB\n");
+        return 1;
+    }
+    if (use_counters && !counters_open()) {
+        fprintf(stderr, "perf_event_open is not available; timing only\n");
+        use_counters = 0;
+    }
+
+    Fts5Tokenizer* pTok = NULL;
+    if (icuCreate(NULL, NULL, 0, &pTok) != SQLITE_OK) {
+        fprintf(stderr, "cannot create the %s tokenizer\n", TOKENIZER_NAME);
+        return 1;
+    }
+    IcuTokenizerV2* tokenizer = (IcuTokenizerV2*)pTok;
+
+    printf("Tokenizer: %s, %d repetitions of %d bytes per input\n\n", TOKENIZER_NAME,
+           repetitions, size);
+    printf("%-9s %-14s %10s %8s %11s", "input", "stage", "ns/byte", "+-%", "ns/token");
+    if (use_counters)
+        printf(" %12s %12s %12s", "cycles/KiB", "cmiss/KiB", "bmiss/KiB");
+    printf("\n");
+
+    double* samples = (double*)malloc(repetitions * sizeof(double));
+    if (!samples)
+        return 1;
+
+    for (int i = 0; i < STAGE_INPUT_COUNT; i++) {
+        const StageInput* input = &stage_inputs[i];
+        if (only && strcmp(only, input->name) != 0)
+            continue;
+
+        StageDocument doc;
+        if (!prepare_document(input, size, tokenizer, &doc) || doc.word_count == 0) {
+            fprintf(stderr, "%s: cannot prepare the input\n", input->name);
+            free_document(&doc);
+            continue;
+        }
+
+        double stage_mean[STAGE_COUNT];
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            double counters[COUNTER_COUNT] = {0, 0, 0};
+            run_stage(stage, &doc, tokenizer);  // Warm up caches and lazy ICU data
+            for (int r = 0; r < repetitions; r++) {
+                if (use_counters)
+                    counters_start();
+                double start = now_nanoseconds();
+                volatile int produced = run_stage(stage, &doc, tokenizer);
+                samples[r] = now_nanoseconds() - start;
+                (void)produced;
+                if (use_counters)
+                    counters_stop(counters);
+            }
+
+            double mean, deviation;
+            mean_and_deviation(samples, repetitions, &mean, &deviation);
+            stage_mean[stage] = mean;
+            printf("%-9s %-14s %10.2f %7.1f%% %11.1f", input->name, stage_names[stage],
+                   mean / doc.length, mean > 0 ? deviation * 100 / mean : 0,
+                   mean / doc.word_count);
+            if (use_counters) {
+                double kib = (double)doc.length * repetitions / 1024;
+                printf(" %12.0f %12.1f %12.1f", counters[COUNTER_CYCLES] / kib,
+                       counters[COUNTER_CACHE] / kib, counters[COUNTER_BRANCH] / kib);
+            }
+            printf("\n");
+        }
+
+        double stages = 0;
+        for (int stage = 0; stage < STAGE_TOKENIZE; stage++) {
+            stages += stage_mean[stage];
+        }
+        double overhead = stage_mean[STAGE_TOKENIZE] - stages;
+        printf("%-9s %-14s %10.2f %8s %11.1f\n", input->name, "overhead", overhead / doc.length,
+               "", overhead / doc.word_count);
+        printf("%-9s %-14s %9.2fx\n", input->name, "speedup",
+               stage_mean[STAGE_TOKENIZE] / stage_mean[STAGE_SPECIALIZED]);
+        printf("%-9s %d bytes, %d word tokens\n\n", input->name, doc.length, doc.word_count);
+        free_document(&doc);
+    }
+
+    free(samples);
+    icuDelete(pTok);
+    return 0;
+}
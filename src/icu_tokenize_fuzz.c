@@ -0,0 +1,343 @@
+/**
+ * @file icu_tokenize_fuzz.c
+ * @brief Fuzz target that treats slow and memory-hungry inputs as failures
+ *
+ * Usage: icu_tokenize_fuzz FILE|DIRECTORY...
+ *
+ * Built with -DFTS5_ICU_FUZZ=ON and clang, this is a libFuzzer target (which
+ * AFL++ can also drive through its libFuzzer compatibility driver). Built
+ * without it, the program replays the given inputs once each and exits with
+ * status 1 if any of them fails; scripts/test_all.sh replays the seed corpus
+ * and the regression inputs in tests/fuzz/ that way.
+ *
+ * Like icu_stage_bench, the program is compiled from the tokenizer sources
+ * with SQLITE_CORE and calls icuTokenize() directly. The first byte of an
+ * input selects the tokenizer and the flags, the rest is the text, which need
+ * not be valid UTF-8:
+ *
+ *   bits 0-2   tokenizer options, an index into fuzz_configs below
+ *   bit 3      FTS5_TOKENIZE_QUERY instead of FTS5_TOKENIZE_DOCUMENT
+ *   bit 6      also FTS5_TOKENIZE_PREFIX, when bit 3 is set
+ *
+ * so the seed files start with an ASCII digit: '0' to '7' tokenize a document
+ * with each configuration, '8' and '9' a query, and 'H' to 'O' a prefix
+ * query.
+ *
+ * Besides crashes, sanitizer reports, tokens with offsets outside the text
+ * and result codes other than SQLITE_OK, SQLITE_NOMEM and SQLITE_ERROR (which
+ * rejects invalid UTF-8), an input fails when one call
+ *   - takes longer than FUZZ_TIME_BASE_NS plus FUZZ_NS_PER_BYTE per byte, or
+ *   - raises the peak of tokenizer (sqlite3_malloc) and ICU heap memory by
+ *     more than FUZZ_MEMORY_BASE plus FUZZ_BYTES_PER_BYTE per byte.
+ * The per-byte limits can be changed with the environment variables
+ * FTS5_ICU_FUZZ_NS_PER_BYTE and FTS5_ICU_FUZZ_BYTES_PER_BYTE, e.g. to hunt
+ * for smaller regressions or to account for a slower sanitizer build.
+ */
+
+#include "fts5_icu.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unicode/uclean.h>
+
+/** Fixed cost allowed for every call: lazy ICU data, buffers, the callback */
+#define FUZZ_TIME_BASE_NS (20 * 1000 * 1000)
+#define FUZZ_MEMORY_BASE (1024 * 1024)
+
+/**
+ * Default per-byte limits. A single word as long as the whole input is the
+ * most expensive known case: about 2000 ns and 32 bytes of peak memory per
+ * byte in a release build. The time limit leaves room for sanitizers and
+ * noisy machines.
+ */
+#define FUZZ_NS_PER_BYTE 20000
+#define FUZZ_BYTES_PER_BYTE 64
+
+/** Tokenizer options selected by the first byte of an input */
+static const char* fuzz_configs[][6] = {
+  {NULL},
+  {"cjk", "bigram", NULL},
+  {"trigram", "1", NULL},
+  {"edge_ngram_max", "10", NULL},
+  {"fuzzy", "1", NULL},
+  {"pool", "1", NULL},
+  {"work_budget", "64", NULL},
+  {"cjk", "bigram", "fuzzy", "1", "edge_ngram_max", "6"},
+};
+
+#define FUZZ_CONFIG_COUNT ((int)(sizeof(fuzz_configs) / sizeof(fuzz_configs[0])))
+
+static Fts5Tokenizer* fuzz_tokenizers[FUZZ_CONFIG_COUNT];
+static sqlite3_int64 fuzz_ns_per_byte = FUZZ_NS_PER_BYTE;
+static sqlite3_int64 fuzz_bytes_per_byte = FUZZ_BYTES_PER_BYTE;
+
+/** Checked by the token callback */
+typedef struct FuzzCall {
+    int nText;       /**< Bytes in the text */
+    int tokens;      /**< Tokens received */
+    int bad_offset;  /**< Non-zero once a token had offsets outside the text */
+} FuzzCall;
+
+// ========================================================================
+// === ICU HEAP ACCOUNTING ================================================
+// ========================================================================
+
+// ICU allocations carry a header with their size, so that the live total and
+// its peak can be tracked. Builds with FTS5_ICU_ARENA install their own ICU
+// memory functions, so only the tokenizer's own heap is measured there.
+
+#define FUZZ_HEADER 16
+
+static size_t icu_live;
+static size_t icu_peak;
+
+#ifndef FTS5_ICU_ARENA
+
+static void* U_CALLCONV fuzz_icu_alloc(const void* context, size_t size) {
+    UNUSED_PARAMETER(context);
+    char* block = (char*)malloc(size + FUZZ_HEADER);
+    if (!block)
+        return NULL;
+    *(size_t*)block = size;
+    icu_live += size;
+    if (icu_live > icu_peak)
+        icu_peak = icu_live;
+    return block + FUZZ_HEADER;
+}
+
+static void U_CALLCONV fuzz_icu_free(const void* context, void* mem) {
+    UNUSED_PARAMETER(context);
+    if (!mem)
+        return;
+    char* block = (char*)mem - FUZZ_HEADER;
+    icu_live -= *(size_t*)block;
+    free(block);
+}
+
+static void* U_CALLCONV fuzz_icu_realloc(const void* context, void* mem, size_t size) {
+    if (!mem)
+        return fuzz_icu_alloc(context, size);
+    char* block = (char*)mem - FUZZ_HEADER;
+    size_t old_size = *(size_t*)block;
+    block = (char*)realloc(block, size + FUZZ_HEADER);
+    if (!block)
+        return NULL;
+    *(size_t*)block = size;
+    icu_live += size - old_size;
+    if (icu_live > icu_peak)
+        icu_peak = icu_live;
+    return block + FUZZ_HEADER;
+}
+
+#endif
+
+// ========================================================================
+// === TARGET =============================================================
+// ========================================================================
+
+static int fuzz_token(void* pCtx, int tflags, const char* pToken, int nToken, int iStart,
+                      int iEnd) {
+    UNUSED_PARAMETER(tflags);
+    FuzzCall* call = (FuzzCall*)pCtx;
+    if (iStart < 0 || iEnd < iStart || iEnd > call->nText || nToken < 0 ||
+        (nToken > 0 && !pToken)) {
+        call->bad_offset = 1;
+    }
+    call->tokens++;
+    return SQLITE_OK;
+}
+
+static sqlite3_int64 limit_from_env(const char* name, sqlite3_int64 fallback) {
+    const char* value = getenv(name);
+    return value && atoll(value) > 0 ? atoll(value) : fallback;
+}
+
+/**
+ * @brief Installs the ICU memory functions and creates the tokenizers
+ *
+ * Must run before anything else uses ICU. Every tokenizer tokenizes a short
+ * multilingual text once, so that ICU loads its break rules, dictionaries and
+ * transliterator data here and not in the first measured call.
+ *
+ * @return Non-zero on success
+ */
+static int fuzz_initialize(void) {
+#ifndef FTS5_ICU_ARENA
+    UErrorCode status = U_ZERO_ERROR;
+    u_setMemoryFunctions(NULL, fuzz_icu_alloc, fuzz_icu_realloc, fuzz_icu_free, &status);
+    if (U_FAILURE(status)) {
+        fprintf(stderr, "u_setMemoryFunctions: %s\n", u_errorName(status));
+        return 0;
+    }
+#endif
+    fuzz_ns_per_byte = limit_from_env("FTS5_ICU_FUZZ_NS_PER_BYTE", FUZZ_NS_PER_BYTE);
+    fuzz_bytes_per_byte = limit_from_env("FTS5_ICU_FUZZ_BYTES_PER_BYTE", FUZZ_BYTES_PER_BYTE);
+
+    static const char warm_up[] = "Warm up: Straße, Москва, Ελλάδα, القاهرة, ירושלים, "
+                                  "東京タワー, 全文检索, 서울, กรุงเทพมหานคร 2024";
+    for (int i = 0; i < FUZZ_CONFIG_COUNT; i++) {
+        int nArg = 0;
+        while (nArg < 6 && fuzz_configs[i][nArg]) {
+            nArg++;
+        }
+        if (icuCreate(NULL, fuzz_configs[i], nArg, &fuzz_tokenizers[i]) != SQLITE_OK) {
+            fprintf(stderr, "cannot create the %s tokenizer with configuration %d\n",
+                    TOKENIZER_NAME, i);
+            return 0;
+        }
+        FuzzCall call = {(int)sizeof(warm_up) - 1, 0, 0};
+        icuTokenize(fuzz_tokenizers[i], &call, FTS5_TOKENIZE_DOCUMENT, warm_up, call.nText, NULL,
+                    0, fuzz_token);
+        call.tokens = 0;
+        icuTokenize(fuzz_tokenizers[i], &call, FTS5_TOKENIZE_QUERY, warm_up, call.nText, NULL, 0,
+                    fuzz_token);
+    }
+    return 1;
+}
+
+/**
+ * @brief Tokenizes one input and checks its time and memory
+ *
+ * @param data The input: selector byte, then text
+ * @param size Bytes in data
+ * @param message Receives a description of the failure
+ * @param message_size Size of message
+ * @return Non-zero if the input failed
+ */
+static int fuzz_one(const uint8_t* data, size_t size, char* message, size_t message_size) {
+    if (size == 0 || size > 64 * 1024 * 1024)
+        return 0;
+    int selector = data[0];
+    Fts5Tokenizer* pTok = fuzz_tokenizers[selector % FUZZ_CONFIG_COUNT];
+    int flags = FTS5_TOKENIZE_DOCUMENT;
+    if (selector & 0x08)
+        flags = FTS5_TOKENIZE_QUERY | ((selector & 0x40) ? FTS5_TOKENIZE_PREFIX : 0);
+    const char* pText = (const char*)data + 1;
+    int nText = (int)size - 1;
+
+    // Peaks are measured from what is live before the call
+    sqlite3_int64 sqlite_current = 0, sqlite_peak = 0;
+    sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &sqlite_current, &sqlite_peak, 1);
+    size_t icu_before = icu_live;
+    icu_peak = icu_live;
+
+    FuzzCall call = {nText, 0, 0};
+    sqlite3_int64 start = icu_slow_log_clock();
+    int rc = icuTokenize(pTok, &call, flags, pText, nText, NULL, 0, fuzz_token);
+    sqlite3_int64 elapsed = icu_slow_log_clock() - start;
+
+    sqlite3_int64 peak_before = sqlite_current;
+    sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &sqlite_current, &sqlite_peak, 0);
+    sqlite3_int64 memory = (sqlite_peak - peak_before) + (sqlite3_int64)(icu_peak - icu_before);
+
+    sqlite3_int64 time_limit = FUZZ_TIME_BASE_NS + fuzz_ns_per_byte * nText;
+    sqlite3_int64 memory_limit = FUZZ_MEMORY_BASE + fuzz_bytes_per_byte * nText;
+    if (call.bad_offset) {
+        snprintf(message, message_size, "token offsets outside the %d byte text", nText);
+    } else if (rc != SQLITE_OK && rc != SQLITE_ERROR && rc != SQLITE_NOMEM) {
+        snprintf(message, message_size, "icuTokenize() returned %d", rc);
+    } else if (elapsed > time_limit) {
+        snprintf(message, message_size, "%lld ns for %d bytes (%lld ns/byte, limit %lld ns)",
+                 (long long)elapsed, nText, (long long)(elapsed / (nText ? nText : 1)),
+                 (long long)time_limit);
+    } else if (memory > memory_limit) {
+        snprintf(message, message_size, "peak %lld bytes for %d bytes (limit %lld bytes)",
+                 (long long)memory, nText, (long long)memory_limit);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+#ifdef FTS5_ICU_LIBFUZZER
+
+int LLVMFuzzerInitialize(int* argc, char*** argv) {
+    UNUSED_PARAMETER(argc);
+    UNUSED_PARAMETER(argv);
+    if (!fuzz_initialize())
+        abort();
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    char message[256];
+    if (fuzz_one(data, size, message, sizeof(message))) {
+        // abort() makes libFuzzer save the input as a crash
+        fprintf(stderr, "==%s== %s\n", TOKENIZER_NAME, message);
+        abort();
+    }
+    return 0;
+}
+
+#else
+
+// ========================================================================
+// === REPLAY =============================================================
+// ========================================================================
+
+/**
+ * @brief Replays one input file
+ *
+ * @return Non-zero if the input failed or could not be read
+ */
+static int replay_file(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "%s: cannot open\n", path);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t* data = (uint8_t*)malloc(size > 0 ? size : 1);
+    if (!data || fread(data, 1, size, file) != (size_t)size) {
+        fprintf(stderr, "%s: cannot read\n", path);
+        free(data);
+        fclose(file);
+        return 1;
+    }
+    fclose(file);
+
+    char message[256];
+    int failed = fuzz_one(data, (size_t)size, message, sizeof(message));
+    if (failed)
+        fprintf(stderr, "%s: FAILED: %s\n", path, message);
+    free(data);
+    return failed;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s FILE|DIRECTORY...\n", argv[0]);
+        return 1;
+    }
+    if (!fuzz_initialize())
+        return 1;
+
+    int inputs = 0, failures = 0;
+    for (int i = 1; i < argc; i++) {
+        struct stat info;
+        if (stat(argv[i], &info) == 0 && S_ISDIR(info.st_mode)) {
+            DIR* dir = opendir(argv[i]);
+            struct dirent* entry;
+            while (dir && (entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] == '.')
+                    continue;
+                char path[4096];
+                snprintf(path, sizeof(path), "%s/%s", argv[i], entry->d_name);
+                failures += replay_file(path);
+                inputs++;
+            }
+            if (dir)
+                closedir(dir);
+        } else {
+            failures += replay_file(argv[i]);
+            inputs++;
+        }
+    }
+
+    printf("%s: %d inputs, %d failed\n", TOKENIZER_NAME, inputs, failures);
+    return failures ? 1 : 0;
+}
+
+#endif  // FTS5_ICU_LIBFUZZER
@@ -0,0 +1,63 @@
+-- Test script for the LOCALE=all library, which registers every tokenizer
+
+-- Load the combined library (from the build directory)
+.load ./build/libfts5_icu_all.so
+
+-- One table per registered tokenizer
+CREATE VIRTUAL TABLE test_icu USING fts5(content, tokenize = 'icu');
+CREATE VIRTUAL TABLE test_ja USING fts5(content, tokenize = 'icu_ja');
+CREATE VIRTUAL TABLE test_zh USING fts5(content, tokenize = 'icu_zh');
+CREATE VIRTUAL TABLE test_th USING fts5(content, tokenize = 'icu_th');
+CREATE VIRTUAL TABLE test_ko USING fts5(content, tokenize = 'icu_ko');
+CREATE VIRTUAL TABLE test_ar USING fts5(content, tokenize = 'icu_ar');
+CREATE VIRTUAL TABLE test_ru USING fts5(content, tokenize = 'icu_ru');
+CREATE VIRTUAL TABLE test_he USING fts5(content, tokenize = 'icu_he');
+CREATE VIRTUAL TABLE test_el USING fts5(content, tokenize = 'icu_el');
+
+INSERT INTO test_icu(content) VALUES ('Français, русский и 中文测试!');
+INSERT INTO test_ja(content) VALUES ('カタカナとひらがな');
+INSERT INTO test_zh(content) VALUES ('數據庫索引');
+INSERT INTO test_th(content) VALUES ('การทดสอบภาษาไทย');
+INSERT INTO test_ko(content) VALUES ('서울은 대한민국의 수도입니다');
+INSERT INTO test_ar(content) VALUES ('القاهرة');
+INSERT INTO test_ru(content) VALUES ('Москва');
+INSERT INTO test_he(content) VALUES ('ירושלים');
+INSERT INTO test_el(content) VALUES ('Ελλάδα');
+
+-- Each tokenizer applies its own rule chain
+SELECT 'icu', count(*) FROM test_icu WHERE test_icu MATCH 'francais';
+SELECT 'icu_ja', count(*) FROM test_ja WHERE test_ja MATCH 'カタカナ';
+SELECT 'icu_zh', count(*) FROM test_zh WHERE test_zh MATCH '数据库';
+SELECT 'icu_th', count(*) FROM test_th WHERE test_th MATCH 'ทดสอบ';
+SELECT 'icu_ko', count(*) FROM test_ko WHERE test_ko MATCH '서울은';
+SELECT 'icu_ar', count(*) FROM test_ar WHERE test_ar MATCH 'القاهرة';
+SELECT 'icu_ru', count(*) FROM test_ru WHERE test_ru MATCH 'moskva';
+SELECT 'icu_he', count(*) FROM test_he WHERE test_he MATCH 'ירושלים';
+SELECT 'icu_el', count(*) FROM test_el WHERE test_el MATCH 'Ελλάδα';
+
+-- The same tokens as the locale libraries produce
+CREATE VIRTUAL TABLE vocab_ja USING fts5vocab(test_ja, 'row');
+CREATE VIRTUAL TABLE vocab_el USING fts5vocab(test_el, 'row');
+SELECT 'icu_ja terms', group_concat(term, ' ') FROM vocab_ja;
+SELECT 'icu_el terms', group_concat(term, ' ') FROM vocab_el;
+
+-- Further tables clone the prototypes of their tokenizer
+CREATE VIRTUAL TABLE test_ja2 USING fts5(content, tokenize = 'icu_ja');
+CREATE VIRTUAL TABLE test_ja_pooled USING fts5(content, tokenize = 'icu_ja pool 1');
+INSERT INTO test_ja2(content) VALUES ('カタカナ');
+INSERT INTO test_ja_pooled(content) VALUES ('カタカナ');
+SELECT 'icu_ja clones', (SELECT count(*) FROM test_ja2 WHERE test_ja2 MATCH 'カタカナ') +
+                        (SELECT count(*) FROM test_ja_pooled WHERE test_ja_pooled MATCH 'カタカナ');
+
+-- Every tokenizer has its replay tokenizer, fed by icu_tokenize_blob() with
+-- the tokenizer named; without a name the blob comes from "icu"
+CREATE VIRTUAL TABLE replay_th USING fts5(tokens, tokenize = 'icu_th_replay', content = '');
+INSERT INTO replay_th(rowid, tokens) VALUES (1, icu_tokenize_blob('การทดสอบภาษาไทย', 'icu_th'));
+SELECT 'icu_th_replay', rowid FROM replay_th WHERE replay_th MATCH 'ทดสอบ';
+CREATE VIRTUAL TABLE replay_el USING fts5(tokens, tokenize = 'icu_el_replay', content = '');
+INSERT INTO replay_el(rowid, tokens) VALUES (1, icu_tokenize_blob('Ελλάδα', 'icu_el'));
+SELECT 'icu_el_replay', rowid FROM replay_el WHERE replay_el MATCH 'Ελλάδα';
+CREATE VIRTUAL TABLE replay_icu USING fts5(tokens, tokenize = 'icu_replay', content = '');
+INSERT INTO replay_icu(rowid, tokens) VALUES (1, icu_tokenize_blob('Français'));
+SELECT 'icu_replay', rowid FROM replay_icu WHERE replay_icu MATCH 'francais';
+SELECT 'icu_tokens', group_concat(token, ' ') FROM icu_tokens('Москва Ελλάδα');
@@ -0,0 +1,32 @@
+-- Test script for canonical number tokens ("numbers canonical")
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+CREATE VIRTUAL TABLE prices USING fts5(content, tokenize = 'icu numbers canonical');
+INSERT INTO prices(content) VALUES ('Total 1,234.50 EUR');
+INSERT INTO prices(content) VALUES ('Summe 1.234,5 EUR und 0042 Stück');
+INSERT INTO prices(content) VALUES ('المجموع ١٬٢٣٤٫٥ و ٤٢');
+INSERT INTO prices(content) VALUES ('合計 １２３４．５０ 円');
+INSERT INTO prices(content) VALUES ('Version 1.2.3 on 10.0.0.1');
+
+-- Every spelling of the same value is one term
+CREATE VIRTUAL TABLE vocab USING fts5vocab(prices, 'row');
+SELECT 'numbers', group_concat(term || ':' || doc, ' ')
+  FROM (SELECT term, doc FROM vocab WHERE term GLOB '[0-9]*' ORDER BY term);
+
+-- Queries are rewritten in the same way
+SELECT 'grouped query', group_concat(rowid) FROM prices WHERE prices MATCH '"1,234.5"';
+SELECT 'plain query', group_concat(rowid) FROM prices WHERE prices MATCH '1234';
+SELECT 'zero query', group_concat(rowid) FROM prices WHERE prices MATCH '42';
+SELECT 'version query', group_concat(rowid) FROM prices WHERE prices MATCH '"1.2.3"';
+
+-- Highlighting uses the offsets of the original text
+SELECT 'highlight', highlight(prices, 0, '[', ']') FROM prices
+ WHERE prices MATCH '"1234.5"' AND rowid = 3;
+
+-- Without the option, numbers go through the rule chain
+CREATE VIRTUAL TABLE raw USING fts5(content, tokenize = 'icu');
+INSERT INTO raw(content) VALUES ('Total 1,234.50 EUR');
+CREATE VIRTUAL TABLE raw_vocab USING fts5vocab(raw, 'row');
+SELECT 'default', group_concat(term, ' ') FROM raw_vocab WHERE term GLOB '[0-9]*';
@@ -0,0 +1,38 @@
+-- Test script for the CJK overlapping-bigram segmentation mode ("cjk bigram")
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+CREATE VIRTUAL TABLE bigram USING fts5(content, tokenize='icu cjk bigram');
+CREATE VIRTUAL TABLE dictionary USING fts5(content, tokenize='icu cjk dictionary');
+
+INSERT INTO bigram(content) VALUES
+  ('iPhone15は東京で発売。'),
+  ('新しいスマートフォン'),
+  ('中文分词测试 中'),
+  ('한국어 테스트 Hello');
+INSERT INTO dictionary(content) SELECT content FROM bigram;
+
+-- Han, Kana and Hangul runs become overlapping bigrams; other scripts use
+-- ICU word breaking and all tokens are normalized by the rule chain
+CREATE VIRTUAL TABLE bigram_vocab USING fts5vocab(bigram, 'instance');
+SELECT doc, "offset", term FROM bigram_vocab ORDER BY doc, "offset";
+
+-- Multi-character queries match as phrases of bigrams
+SELECT 'tokyo', rowid FROM bigram WHERE bigram MATCH '東京';
+SELECT 'smartphone', rowid FROM bigram WHERE bigram MATCH 'スマートフォン';
+SELECT 'segmentation', rowid FROM bigram WHERE bigram MATCH '分词';
+SELECT 'korean', rowid FROM bigram WHERE bigram MATCH '한국어';
+SELECT 'latin', rowid FROM bigram WHERE bigram MATCH 'iphone15 AND hello';
+
+-- A single-character run is indexed as a unigram
+SELECT 'unigram', rowid FROM bigram WHERE bigram MATCH '中';
+
+-- Bigram mode finds words the dictionary splits differently
+SELECT 'bigram substring', count(*) FROM bigram WHERE bigram MATCH '文分';
+SELECT 'dictionary substring', count(*) FROM dictionary WHERE dictionary MATCH '文分';
+
+-- Offsets point into the original text
+SELECT 'highlight', highlight(bigram, 0, '[', ']') FROM bigram WHERE bigram MATCH '東京';
+
+INSERT INTO bigram(bigram) VALUES ('integrity-check');
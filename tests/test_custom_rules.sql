@@ -0,0 +1,41 @@
+-- Test script for custom transliterator rules given as a tokenizer argument
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+-- The compiled-in rules fold accents and script, custom rules only what they name
+CREATE VIRTUAL TABLE folded USING fts5(content, tokenize = 'icu');
+CREATE VIRTUAL TABLE lowered USING fts5(content, tokenize = "icu rules 'NFKD; Lower; NFKC'");
+INSERT INTO folded(content) VALUES ('Café Москва 數據');
+INSERT INTO lowered(content) VALUES ('Café Москва 數據');
+CREATE VIRTUAL TABLE vocab_folded USING fts5vocab(folded, 'row');
+CREATE VIRTUAL TABLE vocab_lowered USING fts5vocab(lowered, 'row');
+SELECT 'default terms', group_concat(term, ' ') FROM vocab_folded;
+SELECT 'custom terms', group_concat(term, ' ') FROM vocab_lowered;
+SELECT 'custom match', count(*) FROM lowered WHERE lowered MATCH 'café';
+SELECT 'custom no fold', count(*) FROM lowered WHERE lowered MATCH 'cafe';
+
+-- Tables with the same rules share one compiled transliterator
+CREATE VIRTUAL TABLE lowered2 USING fts5(content, tokenize = "icu rules 'NFKD; Lower; NFKC'");
+CREATE VIRTUAL TABLE lowered_pooled USING fts5(content, tokenize = "icu rules 'NFKD; Lower; NFKC' pool 1");
+INSERT INTO lowered2(content) VALUES ('ÉCOLE');
+INSERT INTO lowered_pooled(content) VALUES ('ÉCOLE');
+SELECT 'shared rules', (SELECT count(*) FROM lowered2 WHERE lowered2 MATCH 'école') +
+                       (SELECT count(*) FROM lowered_pooled WHERE lowered_pooled MATCH 'école');
+
+-- Dropping every table that uses the rules and creating another recompiles them
+DROP TABLE lowered2;
+DROP TABLE lowered_pooled;
+CREATE VIRTUAL TABLE lowered3 USING fts5(content, tokenize = "icu rules 'Latin-ASCII; Lower'");
+INSERT INTO lowered3(content) VALUES ('Ærøskøbing');
+CREATE VIRTUAL TABLE vocab_lowered3 USING fts5vocab(lowered3, 'row');
+SELECT 'other rules', group_concat(term, ' ') FROM vocab_lowered3;
+SELECT 'other rules match', count(*) FROM lowered3 WHERE lowered3 MATCH 'aeroskobing';
+
+
+-- Rule sets no table uses are closed by icu_release_memory() and recompiled on demand
+DROP TABLE lowered3;
+SELECT 'release', icu_release_memory() >= 0;
+CREATE VIRTUAL TABLE lowered4 USING fts5(content, tokenize = "icu rules 'Latin-ASCII; Lower'");
+INSERT INTO lowered4(content) VALUES ('Ærøskøbing');
+SELECT 'recompiled match', count(*) FROM lowered4 WHERE lowered4 MATCH 'aeroskobing';
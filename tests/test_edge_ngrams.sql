@@ -0,0 +1,35 @@
+-- Test script for edge n-grams ("edge_ngram_min" / "edge_ngram_max")
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+CREATE VIRTUAL TABLE edge USING fts5(content,
+    tokenize='icu edge_ngram_min 2 edge_ngram_max 4');
+
+INSERT INTO edge(content) VALUES
+  ('Привет Straße'),
+  ('Printer ink'),
+  ('Crème brûlée');
+
+-- Every document token is followed by its normalized 2 to 4 code point
+-- prefixes as colocated tokens at the same position
+CREATE VIRTUAL TABLE edge_vocab USING fts5vocab(edge, 'instance');
+SELECT doc, "offset", term FROM edge_vocab ORDER BY doc, "offset", length(term);
+
+-- Queries are not expanded, so a keystroke is an exact term lookup that
+-- matches every word it is a prefix of
+SELECT 'pr', rowid FROM edge WHERE edge MATCH 'pr' ORDER BY rowid;
+SELECT 'priv', rowid FROM edge WHERE edge MATCH 'priv';
+SELECT 'accents', rowid FROM edge WHERE edge MATCH 'BRU';
+SELECT 'cyrillic query', rowid FROM edge WHERE edge MATCH 'При';
+
+-- Prefixes longer than the maximum still need a prefix query
+SELECT 'beyond max', count(*) FROM edge WHERE edge MATCH 'print';
+SELECT 'prefix query', rowid FROM edge WHERE edge MATCH 'print*';
+
+-- Colocated prefixes do not shift positions, so phrases still work and
+-- highlights cover the whole word
+SELECT 'phrase', rowid FROM edge WHERE edge MATCH '"printer ink"';
+SELECT 'highlight', highlight(edge, 0, '[', ']') FROM edge WHERE edge MATCH 'stra';
+
+INSERT INTO edge(edge) VALUES ('integrity-check');
@@ -0,0 +1,42 @@
+-- Test script for deletion-variant fuzzy matching ("fuzzy 1")
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+CREATE VIRTUAL TABLE fuzzy USING fts5(content, tokenize='icu fuzzy 1');
+CREATE VIRTUAL TABLE capped USING fts5(content,
+    tokenize='icu fuzzy 1 fuzzy_min 5 fuzzy_max 8 fuzzy_max_variants 3');
+
+INSERT INTO fuzzy(content) VALUES
+  ('hello world'),
+  ('Straße'),
+  ('help'),
+  ('cat');
+INSERT INTO capped(content) SELECT content FROM fuzzy;
+
+-- Every token of four or more code points is followed by its variants with
+-- one code point deleted; a run of equal code points gives one variant
+CREATE VIRTUAL TABLE fuzzy_vocab USING fts5vocab(fuzzy, 'instance');
+SELECT doc, "offset", group_concat(term, ' ') FROM
+  (SELECT * FROM fuzzy_vocab ORDER BY doc, "offset", term) GROUP BY doc, "offset";
+
+-- Queries carry their variants too, so one edit in either direction matches
+SELECT 'deletion', rowid FROM fuzzy WHERE fuzzy MATCH 'helo' ORDER BY rowid;
+SELECT 'insertion', rowid FROM fuzzy WHERE fuzzy MATCH 'helllo';
+SELECT 'substitution', rowid FROM fuzzy WHERE fuzzy MATCH 'hallo';
+SELECT 'transposition', rowid FROM fuzzy WHERE fuzzy MATCH 'ehllo';
+SELECT 'normalized', rowid FROM fuzzy WHERE fuzzy MATCH 'STRASE';
+SELECT 'phrase', rowid FROM fuzzy WHERE fuzzy MATCH '"helo wrld"';
+SELECT 'too short', count(*) FROM fuzzy WHERE fuzzy MATCH 'cta';
+
+-- Prefix queries are not expanded
+SELECT 'prefix', rowid FROM fuzzy WHERE fuzzy MATCH 'hel*' ORDER BY rowid;
+
+-- Length limits and the variant cap bound the index growth
+CREATE VIRTUAL TABLE capped_vocab USING fts5vocab(capped, 'instance');
+SELECT 'fuzzy instances', count(*) FROM fuzzy_vocab;
+SELECT 'capped instances', count(*) FROM capped_vocab;
+SELECT 'capped variants', group_concat(term, ' ') FROM
+  (SELECT term FROM capped_vocab WHERE doc = 1 AND "offset" = 0 ORDER BY term);
+
+INSERT INTO fuzzy(fuzzy) VALUES ('integrity-check');
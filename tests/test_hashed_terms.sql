@@ -0,0 +1,28 @@
+-- Test script for hashed long terms ("hash_terms N")
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+CREATE VIRTUAL TABLE documents USING fts5(content, tokenize = 'icu hash_terms 24');
+INSERT INTO documents(content) VALUES ('Donaudampfschifffahrtsgesellschaftskapitän on the river');
+INSERT INTO documents(content) VALUES ('ηλεκτροεγκεφαλογραφήματα και Κωνσταντινούπολη');
+
+-- Terms longer than 24 bytes keep their leading bytes and end in a digest
+-- behind a control character (shown as ~); shorter terms are unchanged
+CREATE VIRTUAL TABLE vocab USING fts5vocab(documents, 'row');
+SELECT 'terms', group_concat(replace(term, char(31), '~') || ':' ||
+                             length(CAST(term AS BLOB)), ' ')
+  FROM (SELECT term FROM vocab ORDER BY term);
+
+-- Queries are hashed in the same way
+SELECT 'long query', group_concat(rowid) FROM documents
+ WHERE documents MATCH 'donaudampfschifffahrtsgesellschaftskapitan';
+SELECT 'native query', group_concat(rowid) FROM documents
+ WHERE documents MATCH 'Ηλεκτροεγκεφαλογραφήματα';
+SELECT 'short query', group_concat(rowid) FROM documents WHERE documents MATCH 'konstantinoupole';
+SELECT 'highlight', highlight(documents, 0, '[', ']') FROM documents
+ WHERE documents MATCH 'elektroenkephalographemata';
+
+-- Prefix queries find the words that were not hashed
+SELECT 'prefix query', group_concat(rowid) FROM documents WHERE documents MATCH 'konstan*';
+SELECT 'hashed prefix', count(*) FROM documents WHERE documents MATCH 'donaudampf*';
@@ -0,0 +1,18 @@
+-- Test script for the icu_tokens() table-valued function
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+-- Inspect the tokens of a mixed-script document
+SELECT token, start, "end", rule_status, raw_token
+  FROM icu_tokens('Français, русский и 中文测试!');
+
+-- Override the break iterator locale for one query
+SELECT count(*) FROM icu_tokens('การทดสอบภาษาไทย', 'th');
+
+-- Vocabulary analysis over a sample of documents
+CREATE TABLE sample(body TEXT);
+INSERT INTO sample(body) VALUES ('the quick brown fox'), ('The Quick Fox'), ('ÉLAN élan');
+SELECT token, count(*) AS n
+  FROM sample, icu_tokens(sample.body)
+ GROUP BY token ORDER BY n DESC, token;
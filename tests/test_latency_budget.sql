@@ -0,0 +1,46 @@
+-- Test script for the per-call latency budget ("time_budget N", "work_budget N")
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+-- Words that end within the first 19 bytes take the full path; from the
+-- first word that ends past them, the document is split by code point class
+-- and case folded instead of transliterated: accents and scripts are kept
+-- and Han characters become single tokens
+CREATE VIRTUAL TABLE budget USING fts5(content, tokenize='icu work_budget 19');
+INSERT INTO budget(content) VALUES ('Hello World Straße Москва ÉCOLE x2 東京 Tail');
+CREATE VIRTUAL TABLE budget_vocab USING fts5vocab(budget, 'instance');
+SELECT 'token', offset, term FROM budget_vocab ORDER BY offset;
+SELECT 'stats', icu_budget_stats();
+
+-- Byte offsets of degraded tokens stay correct
+SELECT 'highlight', highlight(budget, 0, '[', ']') FROM budget WHERE budget MATCH 'tail';
+SELECT 'highlight', highlight(budget, 0, '[', ']') FROM budget WHERE budget MATCH 'strasse';
+
+-- A budget of 1 microsecond is spent by the first token of a large document
+CREATE VIRTUAL TABLE timed USING fts5(content, tokenize='icu time_budget 1');
+INSERT INTO timed(content) SELECT group_concat('Ärger', ' ') FROM generate_series(1, 20000);
+CREATE VIRTUAL TABLE timed_vocab USING fts5vocab(timed, 'row');
+SELECT 'timed', term, cnt FROM timed_vocab ORDER BY term;
+SELECT 'stats', icu_budget_stats() ->> 'degraded_calls';
+
+-- One oversized word is not broken or transliterated past the budget: it
+-- takes the degraded path from its start, cut after 64 code points
+CREATE VIRTUAL TABLE oversized USING fts5(content, tokenize='icu work_budget 100');
+INSERT INTO oversized(content)
+  SELECT 'Head ' || replace(printf('%.*c', 100000, 'x'), 'x', 'Ж') || ' Tail';
+CREATE VIRTUAL TABLE oversized_vocab USING fts5vocab(oversized, 'row');
+SELECT 'oversized', term, cnt FROM oversized_vocab WHERE length(term) < 64 ORDER BY term;
+SELECT 'oversized pieces', count(*), sum(cnt) FROM oversized_vocab WHERE length(term) = 64;
+SELECT 'stats', icu_budget_stats();
+
+-- Without a budget the full path cuts words after 256 code points
+CREATE VIRTUAL TABLE long_word USING fts5(content, tokenize='icu work_budget 100000000');
+INSERT INTO long_word(content) SELECT replace(printf('%.*c', 1000, 'x'), 'x', 'Ä');
+CREATE VIRTUAL TABLE long_word_vocab USING fts5vocab(long_word, 'row');
+SELECT 'long word', length(term), cnt FROM long_word_vocab ORDER BY length(term);
+
+-- A call whose last word ends exactly at the budget degrades no bytes and is
+-- not counted
+INSERT INTO budget(content) VALUES ('Hello World Straße');
+SELECT 'stats', icu_budget_stats();
@@ -0,0 +1,49 @@
+-- Test script for tokenizer memory accounting, budget and release
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+CREATE VIRTUAL TABLE documents USING fts5(content, tokenize='icu');
+INSERT INTO documents(content) VALUES ('Français, русский и 中文测试!'), ('The Quick Brown Fox');
+
+-- Scratch buffers are retained between calls and show up in the totals
+SELECT 'used after insert', icu_memory_used() > 0;
+SELECT 'highwater >= used', icu_memory_highwater() >= icu_memory_used();
+
+-- Releasing frees the retained buffers
+SELECT 'released', icu_release_memory() > 0;
+SELECT 'used after release', icu_memory_used();
+SELECT 'highwater reset', icu_memory_highwater(1) > 0, icu_memory_highwater() = icu_memory_used();
+
+-- Usage stays within the budget
+SELECT 'old budget', icu_memory_budget(65536);
+INSERT INTO documents(content) VALUES ('budgeted document');
+SELECT 'used under budget', icu_memory_used() <= 65536;
+SELECT 'budgeted match', rowid FROM documents WHERE documents MATCH 'budgeted';
+
+-- Removing the budget restores retention
+SELECT 'restored budget', icu_memory_budget(0) = 65536;
+SELECT 'query budget', icu_memory_budget();
+INSERT INTO documents(content) VALUES ('retained again');
+SELECT 'used after restore', icu_memory_used() > 0;
+
+-- Exceeding SQLite's soft heap limit releases instead of retaining
+SELECT 'release before soft limit', icu_release_memory() >= 0;
+PRAGMA soft_heap_limit = 1;
+INSERT INTO documents(content) VALUES ('soft limit document');
+SELECT 'used under soft limit', icu_memory_used();
+PRAGMA soft_heap_limit = 0;
+
+-- Idle pooled objects are released and re-created on demand
+CREATE VIRTUAL TABLE pooled USING fts5(content, tokenize='icu pool 1');
+INSERT INTO pooled(content) VALUES ('pooled document');
+SELECT 'pool release', icu_release_memory() >= 0;
+INSERT INTO pooled(content) VALUES ('another pooled document');
+SELECT 'pooled match', count(*) FROM pooled WHERE pooled MATCH 'pooled';
+
+-- Results are unchanged throughout
+SELECT 'matches', count(*) FROM documents WHERE documents MATCH 'francais OR fox OR retained';
+INSERT INTO documents(documents) VALUES ('integrity-check');
+
+-- ICU allocation counters; NULL unless built with FTS5_ICU_ARENA
+SELECT 'arena stats', coalesce(icu_arena_stats() ->> 'heap_allocations' >= 0, 'default build');
@@ -0,0 +1,29 @@
+-- Test script for colocated native-script and transliterated tokens ("native 1")
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+CREATE VIRTUAL TABLE documents USING fts5(content, tokenize = 'icu native 1');
+INSERT INTO documents(content) VALUES ('Москва Ελλάδα Paris 數據');
+INSERT INTO documents(content) VALUES ('Moskva travel guide');
+
+-- Every word is indexed in its own script, the transliteration is colocated
+-- only where it differs
+CREATE VIRTUAL TABLE vocab USING fts5vocab(documents, 'instance');
+SELECT 'first document', group_concat(term || '@' || offset, ' ')
+  FROM (SELECT term, offset FROM vocab WHERE doc = 1 ORDER BY offset, term);
+
+-- Native queries match the script they are written in
+SELECT 'native query', group_concat(rowid) FROM documents WHERE documents MATCH 'москва';
+SELECT 'greek query', group_concat(rowid) FROM documents WHERE documents MATCH 'Ελλάδα';
+
+-- Latin queries match the transliterations as before
+SELECT 'latin query', group_concat(rowid) FROM documents WHERE documents MATCH 'moskva';
+SELECT 'mixed phrase', group_concat(rowid) FROM documents WHERE documents MATCH '"москва ellada"';
+SELECT 'highlight', highlight(documents, 0, '[', ']') FROM documents
+ WHERE documents MATCH 'ellada';
+
+-- Pooled tables produce the same forms
+CREATE VIRTUAL TABLE pooled USING fts5(content, tokenize = 'icu native 1 pool 1');
+INSERT INTO pooled(content) VALUES ('Москва');
+SELECT 'pooled', count(*) FROM pooled WHERE pooled MATCH 'москва';
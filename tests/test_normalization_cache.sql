@@ -0,0 +1,40 @@
+-- Test script for the persistent normalization cache ("cache <path>")
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+CREATE TABLE corpus(id INTEGER PRIMARY KEY, content TEXT);
+INSERT INTO corpus(content) VALUES
+  ('Hello World'),
+  ('Straße STRASSE Ærøskøbing'),
+  ('Москва МОСКВА Ελληνικά'),
+  ('東京タワー 서울 กรุงเทพ'),
+  ('Hello again, world!');
+
+-- The first table fills the cache, the second is served from it; both must
+-- produce the tokens of a table without a cache
+CREATE VIRTUAL TABLE plain USING fts5(content, tokenize='icu');
+CREATE VIRTUAL TABLE cold USING fts5(content,
+    tokenize="icu cache './build/test_normalization.cache' cache_size 1");
+CREATE VIRTUAL TABLE warm USING fts5(content,
+    tokenize="icu cache './build/test_normalization.cache'");
+INSERT INTO plain(content) SELECT content FROM corpus;
+INSERT INTO cold(content) SELECT content FROM corpus;
+INSERT INTO warm(content) SELECT content FROM corpus;
+
+CREATE VIRTUAL TABLE plain_vocab USING fts5vocab(plain, 'instance');
+CREATE VIRTUAL TABLE cold_vocab USING fts5vocab(cold, 'instance');
+CREATE VIRTUAL TABLE warm_vocab USING fts5vocab(warm, 'instance');
+SELECT 'tokens', count(*) FROM plain_vocab;
+SELECT 'cold differences', count(*) FROM
+  (SELECT * FROM plain_vocab EXCEPT SELECT * FROM cold_vocab);
+SELECT 'warm differences', count(*) FROM
+  (SELECT * FROM plain_vocab EXCEPT SELECT * FROM warm_vocab);
+
+-- Queries go through the cache too
+SELECT 'query', rowid FROM warm WHERE warm MATCH 'strasse' ORDER BY rowid;
+SELECT 'query', rowid FROM warm WHERE warm MATCH 'МОСКВА' ORDER BY rowid;
+
+-- The file starts with its magic bytes and keeps its size
+SELECT 'file', substr(readfile('./build/test_normalization.cache'), 1, 4),
+       length(readfile('./build/test_normalization.cache'));
@@ -0,0 +1,29 @@
+-- Test script for the process-wide ICU object pool ("pool 1")
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+-- Tables with the same configuration share one pool
+CREATE VIRTUAL TABLE pooled_a USING fts5(content, tokenize='icu pool 1');
+CREATE VIRTUAL TABLE pooled_b USING fts5(content, tokenize='icu pool 1');
+CREATE VIRTUAL TABLE private_c USING fts5(content, tokenize='icu pool 0');
+
+INSERT INTO pooled_a(content) VALUES ('Français, русский и 中文测试!'), ('The Quick Brown Fox');
+INSERT INTO pooled_b(content) VALUES ('Ελληνικά κείμενα'), ('the quick fox');
+INSERT INTO private_c(content) VALUES ('the quick fox');
+
+SELECT 'pooled_a', rowid FROM pooled_a WHERE pooled_a MATCH 'francais';
+SELECT 'pooled_b', rowid FROM pooled_b WHERE pooled_b MATCH 'ellenika';
+SELECT 'pooled/private agree',
+       (SELECT count(*) FROM pooled_b WHERE pooled_b MATCH 'quick') =
+       (SELECT count(*) FROM private_c WHERE private_c MATCH 'quick');
+
+-- Parallel rebuild clones from a pooled table
+INSERT INTO pooled_a(content) SELECT 'document number ' || value FROM generate_series(1, 200);
+SELECT 'replayed', icu_parallel_rebuild('pooled_a', 2) >= 0;
+SELECT 'after rebuild', count(*) FROM pooled_a WHERE pooled_a MATCH 'document';
+INSERT INTO pooled_a(pooled_a) VALUES ('integrity-check');
+
+-- Dropping one table leaves the pool to the other
+DROP TABLE pooled_a;
+SELECT 'pooled_b after drop', count(*) FROM pooled_b WHERE pooled_b MATCH 'quick';
@@ -0,0 +1,30 @@
+-- Test script for icu_parallel_rebuild() using the universal tokenizer
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+-- Create a test table with an UNINDEXED column so some values are skipped
+CREATE VIRTUAL TABLE test_rebuild USING fts5(
+    title,
+    body,
+    note UNINDEXED,
+    tokenize = 'icu'
+);
+
+-- Insert text in different languages, including a NULL and a repeated value
+INSERT INTO test_rebuild(title, body, note) VALUES ('中文测试', 'Français', 'skip');
+INSERT INTO test_rebuild(title, body, note) VALUES ('русский', NULL, 'skip');
+INSERT INTO test_rebuild(title, body, note) VALUES ('العربية', 'Français', 'skip');
+INSERT INTO test_rebuild(title, body, note)
+  SELECT 'row ' || value, 'Ελληνικά κείμενο ' || value, 'x' FROM generate_series(1, 500);
+
+-- Rebuild the index with four worker threads and verify it
+SELECT icu_parallel_rebuild('test_rebuild', 4) > 0;
+INSERT INTO test_rebuild(test_rebuild) VALUES ('integrity-check');
+
+-- Query the table
+SELECT title FROM test_rebuild WHERE test_rebuild MATCH '测试';
+SELECT count(*) FROM test_rebuild WHERE test_rebuild MATCH 'francais';
+SELECT count(*) FROM test_rebuild WHERE test_rebuild MATCH 'keimeno';
+SELECT title FROM test_rebuild WHERE test_rebuild MATCH 'row AND 250';
+
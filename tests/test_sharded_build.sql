@@ -0,0 +1,40 @@
+-- Test script for the shards built by icu_shard_build from shard_corpus.jsonl
+-- (scripts/test_all.sh builds build/test_shards-{0,1,2}.db before running it)
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+ATTACH './build/test_shards-0.db' AS shard0;
+ATTACH './build/test_shards-1.db' AS shard1;
+ATTACH './build/test_shards-2.db' AS shard2;
+
+-- The manifest describes the shards
+SELECT 'manifest', json_extract(manifest, '$.tokenizer'), json_extract(manifest, '$.partition'),
+       json_array_length(manifest, '$.shards')
+  FROM (SELECT readfile('./build/test_shards.manifest.json') AS manifest);
+SELECT 'manifest shards', group_concat(json_extract(value, '$.path') || ':' ||
+                                       json_extract(value, '$.documents'), ' ')
+  FROM json_each(readfile('./build/test_shards.manifest.json'), '$.shards');
+
+-- Every document is in the shard the manifest's partition expression gives,
+-- negative rowids included, with its own rowid
+SELECT 'shard 0', group_concat(rowid) FROM shard0.documents;
+SELECT 'shard 1', group_concat(rowid) FROM shard1.documents;
+SELECT 'shard 2', group_concat(rowid) FROM shard2.documents;
+SELECT 'misplaced', count(*) FROM (
+    SELECT rowid, 0 AS shard FROM shard0.documents
+    UNION ALL SELECT rowid, 1 FROM shard1.documents
+    UNION ALL SELECT rowid, 2 FROM shard2.documents)
+ WHERE ((rowid % 3) + 3) % 3 <> shard;
+
+-- A query runs on every shard and the results are merged by rowid
+SELECT 'moskva', group_concat(rowid) FROM (
+    SELECT rowid FROM shard0.documents WHERE documents MATCH 'moskva'
+    UNION ALL SELECT rowid FROM shard1.documents WHERE documents MATCH 'moskva'
+    UNION ALL SELECT rowid FROM shard2.documents WHERE documents MATCH 'moskva'
+    ORDER BY rowid);
+SELECT 'capital', group_concat(rowid) FROM (
+    SELECT rowid FROM shard0.documents WHERE documents MATCH 'capital'
+    UNION ALL SELECT rowid FROM shard1.documents WHERE documents MATCH 'capital'
+    UNION ALL SELECT rowid FROM shard2.documents WHERE documents MATCH 'capital'
+    ORDER BY rowid);
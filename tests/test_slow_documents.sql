@@ -0,0 +1,33 @@
+-- Test script for the slow document log ("slow_log N" and icu_slow_documents)
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+-- Tables without the option are never logged
+CREATE VIRTUAL TABLE quiet USING fts5(content, tokenize='icu');
+INSERT INTO quiet(content) VALUES ('Hello World');
+SELECT 'before', count(*) FROM icu_slow_documents;
+
+-- A 1 microsecond threshold logs every call of these documents
+CREATE TABLE corpus(id INTEGER PRIMARY KEY, content TEXT);
+INSERT INTO corpus(content)
+  SELECT group_concat('Straße Москва 東京タワー', ' ') FROM generate_series(1, 200);
+INSERT INTO corpus(content)
+  SELECT group_concat('Ελληνικά', ' ') FROM generate_series(1, 300);
+
+CREATE VIRTUAL TABLE logged USING fts5(content, tokenize='icu slow_log 1');
+INSERT INTO logged(content) SELECT content FROM corpus ORDER BY id;
+SELECT 'documents', kind, bytes, tokens, longest_token, scripts
+  FROM icu_slow_documents ORDER BY rowid;
+
+-- The hash finds the document; stage times are part of the total
+SELECT 'found', corpus.id FROM icu_slow_documents
+  JOIN corpus ON icu_document_hash(corpus.content) = icu_slow_documents.hash
+  ORDER BY icu_slow_documents.rowid;
+SELECT 'stages', count(*) FROM icu_slow_documents
+  WHERE convert_us + break_us + transliterate_us <= total_us AND break_us > 0
+    AND transliterate_us > 0 AND time > 1600000000;
+
+-- Queries are logged too
+SELECT 'query', count(*) FROM logged WHERE logged MATCH 'москва';
+SELECT 'kinds', kind, count(*) FROM icu_slow_documents GROUP BY kind ORDER BY kind;
@@ -0,0 +1,41 @@
+-- Test script for the ASCII word shortcut of plain configurations
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+-- "icu" folds ASCII words itself; a work budget no document reaches keeps
+-- the tokens but sends every word through the rule chain; the pool changes
+-- neither
+CREATE VIRTUAL TABLE plain USING fts5(content, tokenize = 'icu');
+CREATE VIRTUAL TABLE generic USING fts5(content, tokenize = 'icu work_budget 100000000');
+CREATE VIRTUAL TABLE pooled USING fts5(content, tokenize = 'icu pool 1');
+
+CREATE TABLE documents(content);
+INSERT INTO documents(content) VALUES ('The QUICK brown Fox, x86_64 and __init__');
+INSERT INTO documents(content) VALUES ('Don''t stop: 3.14 1,000 HTTP/2 e-mail');
+INSERT INTO documents(content) VALUES ('Café naïve ÅNGSTRÖM Straße');
+INSERT INTO documents(content) VALUES ('Москва Ελλάδα ירושלים القاهرة 東京タワー');
+INSERT INTO documents(content) VALUES ('ＦＵＬＬ width ＡＢＣ and ﬁnance Ⅻ');
+INSERT INTO documents(content) VALUES ('mixedКириллица abcαβγ ABC123def');
+INSERT INTO plain(content) SELECT content FROM documents;
+INSERT INTO generic(content) SELECT content FROM documents;
+INSERT INTO pooled(content) SELECT content FROM documents;
+
+-- Every path produces the same terms at the same positions
+CREATE VIRTUAL TABLE plain_vocab USING fts5vocab(plain, 'instance');
+CREATE VIRTUAL TABLE generic_vocab USING fts5vocab(generic, 'instance');
+CREATE VIRTUAL TABLE pooled_vocab USING fts5vocab(pooled, 'instance');
+SELECT 'instances', (SELECT count(*) FROM plain_vocab),
+       (SELECT count(*) FROM (SELECT * FROM plain_vocab EXCEPT SELECT * FROM generic_vocab)),
+       (SELECT count(*) FROM (SELECT * FROM generic_vocab EXCEPT SELECT * FROM plain_vocab)),
+       (SELECT count(*) FROM (SELECT * FROM pooled_vocab EXCEPT SELECT * FROM plain_vocab));
+SELECT 'ascii terms', group_concat(term, ' ')
+  FROM (SELECT DISTINCT term FROM plain_vocab WHERE doc = 1 ORDER BY term);
+
+-- Queries and prefix queries go through the same path
+SELECT 'query', group_concat(rowid) FROM plain WHERE plain MATCH 'QUICK OR moskva';
+SELECT 'prefix', group_concat(rowid) FROM plain WHERE plain MATCH 'ABC*';
+
+-- Offsets of the folded words point into the original text
+SELECT 'highlight', highlight(plain, 0, '[', ']') FROM plain
+ WHERE plain MATCH 'fox OR x86_64 OR angstrom' ORDER BY rowid;
@@ -0,0 +1,56 @@
+-- Test script for icu_tokenize_blob() and the icu_replay tokenizer
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+-- Pre-tokenize documents into token-stream blobs
+CREATE TABLE staged(id INTEGER PRIMARY KEY, tokens BLOB);
+INSERT INTO staged(tokens) VALUES (icu_tokenize_blob('中文测试'));
+INSERT INTO staged(tokens) VALUES (icu_tokenize_blob('Français'));
+INSERT INTO staged(tokens) VALUES (icu_tokenize_blob('русский'));
+INSERT INTO staged(tokens) VALUES (icu_tokenize_blob('العربية', 'icu'));
+
+-- Ingest the blobs with the replay tokenizer (no ICU work for documents)
+CREATE VIRTUAL TABLE test_replay USING fts5(
+    tokens,
+    tokenize = 'icu_replay',
+    content = ''
+);
+INSERT INTO test_replay(rowid, tokens) SELECT id, tokens FROM staged;
+
+-- Queries are tokenized with the ICU rules, so they match the replayed tokens
+SELECT rowid FROM test_replay WHERE test_replay MATCH '测试';
+SELECT rowid FROM test_replay WHERE test_replay MATCH 'francais';
+SELECT rowid FROM test_replay WHERE test_replay MATCH 'العربية';
+
+-- The replayed index is identical to one built with the live tokenizer
+CREATE VIRTUAL TABLE test_live USING fts5(content, tokenize = 'icu', content = '');
+INSERT INTO test_live(rowid, content) VALUES (1, '中文测试'), (2, 'Français'), (3, 'русский'),
+                                             (4, 'العربية');
+CREATE VIRTUAL TABLE vocab_replay USING fts5vocab(test_replay, 'instance');
+CREATE VIRTUAL TABLE vocab_live USING fts5vocab(test_live, 'instance');
+SELECT count(*) FROM (SELECT term, doc, offset FROM vocab_replay
+                      EXCEPT SELECT term, doc, offset FROM vocab_live);
+SELECT count(*) FROM (SELECT term, doc, offset FROM vocab_live
+                      EXCEPT SELECT term, doc, offset FROM vocab_replay);
+
+
+-- Blobs for a table with options come from a tokenizer with the same options
+CREATE VIRTUAL TABLE test_replay_bigram USING fts5(
+    tokens,
+    tokenize = 'icu_replay cjk bigram',
+    content = ''
+);
+INSERT INTO test_replay_bigram(rowid, tokens)
+    VALUES (1, icu_tokenize_blob('全文检索系统', 'icu cjk bigram'));
+SELECT 'bigram replay', rowid FROM test_replay_bigram WHERE test_replay_bigram MATCH '检索';
+
+-- Quoted arguments are read as in a tokenize directive
+CREATE VIRTUAL TABLE test_replay_rules USING fts5(
+    tokens,
+    tokenize = 'icu_replay rules ''NFKD; Lower; NFKC''',
+    content = ''
+);
+INSERT INTO test_replay_rules(rowid, tokens)
+    VALUES (1, icu_tokenize_blob('Ünïcode Straße', 'icu rules "NFKD; Lower; NFKC"'));
+SELECT 'rules replay', rowid FROM test_replay_rules WHERE test_replay_rules MATCH 'straße';
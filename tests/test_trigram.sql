@@ -0,0 +1,36 @@
+-- Test script for the normalized trigram mode ("trigram 1")
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+CREATE VIRTUAL TABLE trigram USING fts5(content, tokenize='icu trigram 1');
+
+INSERT INTO trigram(content) VALUES
+  ('Order #A-1042: Crème Brûlée'),
+  ('Привет, мир!'),
+  ('東京タワーの営業時間'),
+  ('Hello World ab');
+
+-- Letter, mark and digit runs are normalized by the rule chain and split
+-- into overlapping code point trigrams; separators produce no tokens
+CREATE VIRTUAL TABLE trigram_vocab USING fts5vocab(trigram, 'instance');
+SELECT doc, "offset", term FROM trigram_vocab ORDER BY doc, "offset";
+
+-- Infix queries match inside words, independent of case, accents and script
+SELECT 'infix', rowid FROM trigram WHERE trigram MATCH '"RULE"';
+SELECT 'digits', rowid FROM trigram WHERE trigram MATCH '"104"';
+SELECT 'transliterated', rowid FROM trigram WHERE trigram MATCH '"rivet"';
+SELECT 'cyrillic query', rowid FROM trigram WHERE trigram MATCH '"ивет"';
+SELECT 'kana', rowid FROM trigram WHERE trigram MATCH '"たわー"';
+SELECT 'across words', rowid FROM trigram WHERE trigram MATCH '"llo wor"';
+
+-- Runs shorter than three code points are single tokens; prefix queries
+-- find two-character substrings
+SELECT 'short run', rowid FROM trigram WHERE trigram MATCH 'ab';
+SELECT 'prefix', rowid FROM trigram WHERE trigram MATCH 'or*' ORDER BY rowid;
+
+-- Offsets point into the original text
+SELECT 'highlight', highlight(trigram, 0, '[', ']') FROM trigram WHERE trigram MATCH '"業時間"';
+SELECT 'highlight', highlight(trigram, 0, '[', ']') FROM trigram WHERE trigram MATCH '"brul"';
+
+INSERT INTO trigram(trigram) VALUES ('integrity-check');
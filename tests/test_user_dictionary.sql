@@ -0,0 +1,44 @@
+-- Test script for user dictionaries ("dictionary <path>")
+--
+-- ./build/test_user_dictionary.dict is compiled from tests/user_dictionary.txt
+-- by scripts/test_all.sh with icu_dict_build
+
+-- Load the universal tokenizer (from the build directory)
+.load ./build/libfts5_icu.so
+
+CREATE VIRTUAL TABLE custom USING fts5(content,
+    tokenize="icu dictionary './build/test_user_dictionary.dict'");
+CREATE VIRTUAL TABLE plain USING fts5(content, tokenize='icu');
+
+INSERT INTO custom(content) VALUES
+  ('全文检索分词器'),
+  ('云原生数据库 Cloud Native'),
+  ('東京スカイツリーで形態素解析'),
+  ('人工智能ปัญญาประดิษฐ์และภาษาไทย');
+INSERT INTO plain(content) SELECT content FROM custom;
+
+-- Dictionary words stay whole; unmatched stretches and other scripts are
+-- broken by ICU
+CREATE VIRTUAL TABLE custom_vocab USING fts5vocab(custom, 'instance');
+SELECT doc, "offset", term FROM custom_vocab ORDER BY doc, "offset";
+
+-- Maximum matching prefers the longest words: 全文检索 is one token
+SELECT 'longest match', rowid FROM custom WHERE custom MATCH '全文检索';
+SELECT 'shorter word', count(*) FROM custom WHERE custom MATCH '全文';
+
+-- Terms ICU would split are found as single tokens
+SELECT 'custom', rowid FROM custom WHERE custom MATCH '分词器 OR 云原生';
+SELECT 'japanese', rowid FROM custom WHERE custom MATCH '東京スカイツリー';
+SELECT 'thai', rowid FROM custom WHERE custom MATCH 'ปัญญาประดิษฐ์';
+SELECT 'latin', rowid FROM custom WHERE custom MATCH 'cloud';
+
+-- Offsets point into the original text
+SELECT 'highlight', highlight(custom, 0, '[', ']') FROM custom WHERE custom MATCH '分词器';
+
+-- A second table maps the same file; both see the same dictionary
+CREATE VIRTUAL TABLE custom2 USING fts5(content,
+    tokenize="icu dictionary './build/test_user_dictionary.dict'");
+INSERT INTO custom2(content) VALUES ('东京和形態素解析');
+SELECT 'shared', rowid FROM custom2 WHERE custom2 MATCH '形態素解析';
+
+INSERT INTO custom(custom) VALUES ('integrity-check');